@@ -16,6 +16,7 @@
  *
  */
 #include "cptrie_ip6.h"
+#include "parallel_build.h"
 #include <assert.h>
 
 //Size of each level. They may need to be increased to accomodate larger routing table
@@ -38,58 +39,77 @@
 #define N_CNT 9000000
 
 //forward declation
-static int _cptrie_insert(__uint128_t key, int prefix_len, int nexthop, int level);
+static int _cptrie_insert(struct cptrie *t, __uint128_t key, int prefix_len, int nexthop, int level);
 
 struct cptrie cptrie;
 
-int cptrie_init () {
+//Bitmaps of a level under the entries of length len, see fragment_size()
+#define LEVEL_SIZE(longer, len, size) (fragment_size(longer, len, (size) / ELEMS_PER_STRIDE) * ELEMS_PER_STRIDE)
+
+//A fragment of a parallel build sizes its levels from longer, see
+//fragment_longer(). It's NULL for a full size CP-Trie.
+static int _cptrie_init (struct cptrie *t, const uint32_t *longer) {
   int err = 0;
+  uint64_t leaves = 0;
 
-  memset(&cptrie, 0, sizeof(cptrie));
-  leaf_init (&cptrie.leaf, N_CNT);
-  err = cptrie_level_init (&cptrie.level16, 16, SIZE16, NULL);
-  err = cptrie_level_init (&cptrie.level24, 24, SIZE24, &cptrie.level16);
-  err = cptrie_level_init (&cptrie.level32, 32, SIZE32, &cptrie.level24);
-  err = cptrie_level_init (&cptrie.level40, 40, SIZE40, &cptrie.level32);
-  err = cptrie_level_init (&cptrie.level48, 48, SIZE48, &cptrie.level40);
-  err = cptrie_level_init (&cptrie.level56, 56, SIZE56, &cptrie.level48);
-  err = cptrie_level_init (&cptrie.level64, 64, SIZE64, &cptrie.level56);
-  err = cptrie_level_init (&cptrie.level72, 72, SIZE72, &cptrie.level64);
-  err = cptrie_level_init (&cptrie.level80, 80, SIZE80, &cptrie.level72);
-  err = cptrie_level_init (&cptrie.level88, 88, SIZE88, &cptrie.level80);
-  err = cptrie_level_init (&cptrie.level96, 96, SIZE96, &cptrie.level88);
-  err = cptrie_level_init (&cptrie.level104, 104, SIZE104, &cptrie.level96);
-  err = cptrie_level_init (&cptrie.level112, 112, SIZE112, &cptrie.level104);
-  err = cptrie_level_init (&cptrie.level120, 120, SIZE120, &cptrie.level112);
-  err = cptrie_level_init (&cptrie.level128, 128, SIZE128, &cptrie.level120);
+  memset(t, 0, sizeof(*t));
+  err = cptrie_level_init (&t->level16, 16, SIZE16, NULL);
+  err = cptrie_level_init (&t->level24, 24, LEVEL_SIZE(longer, 16, SIZE24), &t->level16);
+  err = cptrie_level_init (&t->level32, 32, LEVEL_SIZE(longer, 24, SIZE32), &t->level24);
+  err = cptrie_level_init (&t->level40, 40, LEVEL_SIZE(longer, 32, SIZE40), &t->level32);
+  err = cptrie_level_init (&t->level48, 48, LEVEL_SIZE(longer, 40, SIZE48), &t->level40);
+  err = cptrie_level_init (&t->level56, 56, LEVEL_SIZE(longer, 48, SIZE56), &t->level48);
+  err = cptrie_level_init (&t->level64, 64, LEVEL_SIZE(longer, 56, SIZE64), &t->level56);
+  err = cptrie_level_init (&t->level72, 72, LEVEL_SIZE(longer, 64, SIZE72), &t->level64);
+  err = cptrie_level_init (&t->level80, 80, LEVEL_SIZE(longer, 72, SIZE80), &t->level72);
+  err = cptrie_level_init (&t->level88, 88, LEVEL_SIZE(longer, 80, SIZE88), &t->level80);
+  err = cptrie_level_init (&t->level96, 96, LEVEL_SIZE(longer, 88, SIZE96), &t->level88);
+  err = cptrie_level_init (&t->level104, 104, LEVEL_SIZE(longer, 96, SIZE104), &t->level96);
+  err = cptrie_level_init (&t->level112, 112, LEVEL_SIZE(longer, 104, SIZE112), &t->level104);
+  err = cptrie_level_init (&t->level120, 120, LEVEL_SIZE(longer, 112, SIZE120), &t->level112);
+  err = cptrie_level_init (&t->level128, 128, LEVEL_SIZE(longer, 120, SIZE128), &t->level120);
   //The count of level 16 is preset. It's not changed
-  cptrie.level16.count = SIZE16/4;
+  t->level16.count = SIZE16/4;
+  //A chunk has at most 256 leaves. One more chunk is left for the leaves
+  //inserted before they are pushed to the next level.
+  for (struct cptrie_level *l = &t->level16; l; l = l->chield)
+    leaves += l->size;
+  leaves = (leaves + 1) * 256;
+  leaf_init (&t->leaf, longer && leaves < N_CNT ? leaves : N_CNT);
   return err;
 }
 
-int cptrie_cleanup() {
+static int _cptrie_cleanup (struct cptrie *t) {
   int err = 0;
 
-  leaf_cleanup(&cptrie.leaf);
-  cptrie_level_cleanup(&cptrie.level16);
-  cptrie_level_cleanup(&cptrie.level24);
-  cptrie_level_cleanup(&cptrie.level32);
-  cptrie_level_cleanup(&cptrie.level40);
-  cptrie_level_cleanup(&cptrie.level48);
-  cptrie_level_cleanup(&cptrie.level56);
-  cptrie_level_cleanup(&cptrie.level64);
-  cptrie_level_cleanup(&cptrie.level72);
-  cptrie_level_cleanup(&cptrie.level80);
-  cptrie_level_cleanup(&cptrie.level88);
-  cptrie_level_cleanup(&cptrie.level96);
-  cptrie_level_cleanup(&cptrie.level104);
-  cptrie_level_cleanup(&cptrie.level112);
-  cptrie_level_cleanup(&cptrie.level120);
-  cptrie_level_cleanup(&cptrie.level128);
-  memset(&cptrie, 0, sizeof(cptrie));
+  leaf_cleanup(&t->leaf);
+  cptrie_level_cleanup(&t->level16);
+  cptrie_level_cleanup(&t->level24);
+  cptrie_level_cleanup(&t->level32);
+  cptrie_level_cleanup(&t->level40);
+  cptrie_level_cleanup(&t->level48);
+  cptrie_level_cleanup(&t->level56);
+  cptrie_level_cleanup(&t->level64);
+  cptrie_level_cleanup(&t->level72);
+  cptrie_level_cleanup(&t->level80);
+  cptrie_level_cleanup(&t->level88);
+  cptrie_level_cleanup(&t->level96);
+  cptrie_level_cleanup(&t->level104);
+  cptrie_level_cleanup(&t->level112);
+  cptrie_level_cleanup(&t->level120);
+  cptrie_level_cleanup(&t->level128);
+  memset(t, 0, sizeof(*t));
   return err;
 }
 
+int cptrie_init () {
+  return _cptrie_init (&cptrie, NULL);
+}
+
+int cptrie_cleanup() {
+  return _cptrie_cleanup (&cptrie);
+}
+
 //Calculate memory in MB
 double calc_cptrie_mem() {
   return (mem_size(&cptrie.level16) + mem_size(&cptrie.level24) + mem_size(&cptrie.level32) + mem_size(&cptrie.level40) +
@@ -157,7 +177,7 @@ static uint32_t calc_n_idx(struct cptrie_level *l, uint32_t idx, uint32_t bit_sp
 //There can be at most 256 leaves.
 #define ARR_SIZE 256
 
-static int insert_leaf(struct cptrie_level *l, uint32_t start_idx, uint32_t start_bit_spot, int level, struct leaf *leaf,
+static int insert_leaf(struct cptrie *t, struct cptrie_level *l, uint32_t start_idx, uint32_t start_bit_spot, int level, struct leaf *leaf,
                 __uint128_t key, int prefix_len, int nexthop) {
   register uint32_t new_prefixes = 0;
   register int i, j, k;
@@ -181,7 +201,7 @@ static int insert_leaf(struct cptrie_level *l, uint32_t start_idx, uint32_t star
   //TODO: increase the array dynamically when needed.
   if (leaf->count + num_leafs >= leaf->size) {
     puts ("Leaf array is full. Please increase the size.");
-    exit (1);
+    return -1;
   }
 
   for (i = 0; i < num_leafs; i++) {
@@ -264,15 +284,16 @@ static int insert_leaf(struct cptrie_level *l, uint32_t start_idx, uint32_t star
     for (i = 0; i < leaf_pushing_prefixes_count; i++) {
       matching_prefix1 = ((leaf_pushing_prefixes[i] >> (128 - l->chield->level_num)) + (0 << 7)) << (128 - l->chield->level_num);
       matching_prefix2 = ((leaf_pushing_prefixes[i] >> (128 - l->chield->level_num)) + (1 << 7)) << (128 - l->chield->level_num);
-      _cptrie_insert (matching_prefix1, prefix_len , nexthop, l->level_num + 1);
-      _cptrie_insert (matching_prefix2, prefix_len , nexthop, l->level_num + 1);
+      if (_cptrie_insert (t, matching_prefix1, prefix_len , nexthop, l->level_num + 1) ||
+          _cptrie_insert (t, matching_prefix2, prefix_len , nexthop, l->level_num + 1))
+        return -1;
     }
   }
   return 0;
 }
 
 //Checks if there a leaf in the level; if yes, it then move the leafs to the next level
-static int leaf_pushing(struct cptrie_level *l, uint32_t idx, uint32_t bit_spot, struct leaf *leafs,
+static int leaf_pushing(struct cptrie *t, struct cptrie_level *l, uint32_t idx, uint32_t bit_spot, struct leaf *leafs,
                 __uint128_t key) {
   register long long i;
   register uint32_t n_idx;
@@ -317,8 +338,9 @@ static int leaf_pushing(struct cptrie_level *l, uint32_t idx, uint32_t bit_spot,
     //Key to which the match was found and add 8 bits to the right
     matching_key = (key >> (128 - l->level_num)) << 8;
     //Previously inserted prefix is being pushed to a higher level.
-    _cptrie_insert ((matching_key + (0 << 7)) << (120 - l->level_num), prefix_len, next_hop, l->level_num + 1);
-    _cptrie_insert ((matching_key + (1 << 7)) << (120 - l->level_num), prefix_len, next_hop, l->level_num + 1);
+    if (_cptrie_insert (t, (matching_key + (0 << 7)) << (120 - l->level_num), prefix_len, next_hop, l->level_num + 1) ||
+        _cptrie_insert (t, (matching_key + (1 << 7)) << (120 - l->level_num), prefix_len, next_hop, l->level_num + 1))
+      return -1;
   }
   return 0;
 }
@@ -330,20 +352,21 @@ int cptrie_insert(__uint128_t key, int prefix_len, int nexthop) {
     exit (1);
   }
   //Level is same as prefix length
-  return _cptrie_insert(key, prefix_len, nexthop, prefix_len);
+  return _cptrie_insert(&cptrie, key, prefix_len, nexthop, prefix_len);
 }
 
 //This function will be called by cptrie_insert() and by itself recursively for
 //leaf pushing. When called by cptrie_insert(), level and prefix length should
 //be same. When called recursively, level will be higher than the prefix length.
-static int _cptrie_insert(__uint128_t key, int prefix_len, int nexthop, int level) {
+static int _cptrie_insert(struct cptrie *t, __uint128_t key, int prefix_len, int nexthop, int level) {
   register uint32_t bit_spot;
   //Index to array at each level
   register uint32_t idx;
   register uint32_t stride;
+  register uint32_t chunk_idx;
 
   if (prefix_len == 0) {
-    cptrie.def_nh = nexthop;
+    t->def_nh = nexthop;
     goto finish;
   }
 
@@ -352,142 +375,386 @@ static int _cptrie_insert(__uint128_t key, int prefix_len, int nexthop, int leve
   idx = stride / 64;
   bit_spot = stride % 64;
   if (level <= 16) {
-    insert_leaf(&cptrie.level16, idx, bit_spot, level, &cptrie.leaf, key, prefix_len, nexthop);
+    if (insert_leaf(t, &t->level16, idx, bit_spot, level, &t->leaf, key, prefix_len, nexthop))
+      goto error;
     goto finish;
   }
-  leaf_pushing (&cptrie.level16, idx, bit_spot, &cptrie.leaf, key);
+  if (leaf_pushing (t, &t->level16, idx, bit_spot, &t->leaf, key))
+    goto error;
 
   stride = ((key >> 104) & 0XFF);
-  idx = get_chunk_idx_frm_parent (&cptrie.level16, idx, bit_spot) * ELEMS_PER_STRIDE + stride / 64;
+  chunk_idx = get_chunk_idx_frm_parent (&t->level16, idx, bit_spot);
+  if (chunk_idx == (uint32_t)-1)
+    return -1;
+  idx = chunk_idx * ELEMS_PER_STRIDE + stride / 64;
   bit_spot = stride % 64;
   if (level <= 24) {
-    insert_leaf(&cptrie.level24, idx, bit_spot, level, &cptrie.leaf, key, prefix_len, nexthop);
+    if (insert_leaf(t, &t->level24, idx, bit_spot, level, &t->leaf, key, prefix_len, nexthop))
+      goto error;
     goto finish;
   }
-  leaf_pushing (&cptrie.level24, idx, bit_spot, &cptrie.leaf, key);
+  if (leaf_pushing (t, &t->level24, idx, bit_spot, &t->leaf, key))
+    goto error;
 
   stride = ((key >> 96) & 0XFF);
-  idx = get_chunk_idx_frm_parent (&cptrie.level24, idx, bit_spot) * ELEMS_PER_STRIDE + stride / 64;
+  chunk_idx = get_chunk_idx_frm_parent (&t->level24, idx, bit_spot);
+  if (chunk_idx == (uint32_t)-1)
+    return -1;
+  idx = chunk_idx * ELEMS_PER_STRIDE + stride / 64;
   bit_spot = stride % 64;
   if (level <= 32) {
-    insert_leaf(&cptrie.level32, idx, bit_spot, level, &cptrie.leaf, key, prefix_len, nexthop);
+    if (insert_leaf(t, &t->level32, idx, bit_spot, level, &t->leaf, key, prefix_len, nexthop))
+      goto error;
     goto finish;
   }
-  leaf_pushing (&cptrie.level32, idx, bit_spot, &cptrie.leaf, key);
+  if (leaf_pushing (t, &t->level32, idx, bit_spot, &t->leaf, key))
+    goto error;
 
   stride = ((key >> 88) & 0XFF);
-  idx = get_chunk_idx_frm_parent (&cptrie.level32, idx, bit_spot) * ELEMS_PER_STRIDE + stride / 64;
+  chunk_idx = get_chunk_idx_frm_parent (&t->level32, idx, bit_spot);
+  if (chunk_idx == (uint32_t)-1)
+    return -1;
+  idx = chunk_idx * ELEMS_PER_STRIDE + stride / 64;
   bit_spot = stride % 64;
   if (level <= 40) {
-    insert_leaf(&cptrie.level40, idx, bit_spot, level, &cptrie.leaf, key, prefix_len, nexthop);
+    if (insert_leaf(t, &t->level40, idx, bit_spot, level, &t->leaf, key, prefix_len, nexthop))
+      goto error;
     goto finish;
   }
-  leaf_pushing (&cptrie.level40, idx, bit_spot, &cptrie.leaf, key);
+  if (leaf_pushing (t, &t->level40, idx, bit_spot, &t->leaf, key))
+    goto error;
 
   stride = ((key >> 80) & 0XFF);
-  idx = get_chunk_idx_frm_parent (&cptrie.level40, idx, bit_spot) * ELEMS_PER_STRIDE + stride / 64;
+  chunk_idx = get_chunk_idx_frm_parent (&t->level40, idx, bit_spot);
+  if (chunk_idx == (uint32_t)-1)
+    return -1;
+  idx = chunk_idx * ELEMS_PER_STRIDE + stride / 64;
   bit_spot = stride % 64;
   if (level <= 48) {
-    insert_leaf(&cptrie.level48, idx, bit_spot, level, &cptrie.leaf, key, prefix_len, nexthop);
+    if (insert_leaf(t, &t->level48, idx, bit_spot, level, &t->leaf, key, prefix_len, nexthop))
+      goto error;
     goto finish;
   }
-  leaf_pushing (&cptrie.level48, idx, bit_spot, &cptrie.leaf, key);
+  if (leaf_pushing (t, &t->level48, idx, bit_spot, &t->leaf, key))
+    goto error;
 
   stride = ((key >> 72) & 0XFF);
-  idx = get_chunk_idx_frm_parent (&cptrie.level48, idx, bit_spot) * ELEMS_PER_STRIDE + stride / 64;
+  chunk_idx = get_chunk_idx_frm_parent (&t->level48, idx, bit_spot);
+  if (chunk_idx == (uint32_t)-1)
+    return -1;
+  idx = chunk_idx * ELEMS_PER_STRIDE + stride / 64;
   bit_spot = stride % 64;
   if (level <= 56) {
-    insert_leaf(&cptrie.level56, idx, bit_spot, level, &cptrie.leaf, key, prefix_len, nexthop);
+    if (insert_leaf(t, &t->level56, idx, bit_spot, level, &t->leaf, key, prefix_len, nexthop))
+      goto error;
     goto finish;
   }
-  leaf_pushing (&cptrie.level56, idx, bit_spot, &cptrie.leaf, key);
+  if (leaf_pushing (t, &t->level56, idx, bit_spot, &t->leaf, key))
+    goto error;
 
   stride = ((key >> 64) & 0XFF);
-  idx = get_chunk_idx_frm_parent (&cptrie.level56, idx, bit_spot) * ELEMS_PER_STRIDE + stride / 64;
+  chunk_idx = get_chunk_idx_frm_parent (&t->level56, idx, bit_spot);
+  if (chunk_idx == (uint32_t)-1)
+    return -1;
+  idx = chunk_idx * ELEMS_PER_STRIDE + stride / 64;
   bit_spot = stride % 64;
   if (level <= 64) {
-    insert_leaf(&cptrie.level64, idx, bit_spot, level, &cptrie.leaf, key, prefix_len, nexthop);
+    if (insert_leaf(t, &t->level64, idx, bit_spot, level, &t->leaf, key, prefix_len, nexthop))
+      goto error;
     goto finish;
   }
-  leaf_pushing (&cptrie.level64, idx, bit_spot, &cptrie.leaf, key);
+  if (leaf_pushing (t, &t->level64, idx, bit_spot, &t->leaf, key))
+    goto error;
 
   stride = ((key >> 56) & 0XFF);
-  idx = get_chunk_idx_frm_parent (&cptrie.level64, idx, bit_spot) * ELEMS_PER_STRIDE + stride / 64;
+  chunk_idx = get_chunk_idx_frm_parent (&t->level64, idx, bit_spot);
+  if (chunk_idx == (uint32_t)-1)
+    return -1;
+  idx = chunk_idx * ELEMS_PER_STRIDE + stride / 64;
   bit_spot = stride % 64;
   if (level <= 72) {
-    insert_leaf(&cptrie.level72, idx, bit_spot, level, &cptrie.leaf, key, prefix_len, nexthop);
+    if (insert_leaf(t, &t->level72, idx, bit_spot, level, &t->leaf, key, prefix_len, nexthop))
+      goto error;
     goto finish;
   }
-  leaf_pushing (&cptrie.level72, idx, bit_spot, &cptrie.leaf, key);
+  if (leaf_pushing (t, &t->level72, idx, bit_spot, &t->leaf, key))
+    goto error;
 
   stride = ((key >> 48) & 0XFF);
-  idx = get_chunk_idx_frm_parent (&cptrie.level72, idx, bit_spot) * ELEMS_PER_STRIDE + stride / 64;
+  chunk_idx = get_chunk_idx_frm_parent (&t->level72, idx, bit_spot);
+  if (chunk_idx == (uint32_t)-1)
+    return -1;
+  idx = chunk_idx * ELEMS_PER_STRIDE + stride / 64;
   bit_spot = stride % 64;
   if (level <= 80) {
-    insert_leaf(&cptrie.level80, idx, bit_spot, level, &cptrie.leaf, key, prefix_len, nexthop);
+    if (insert_leaf(t, &t->level80, idx, bit_spot, level, &t->leaf, key, prefix_len, nexthop))
+      goto error;
     goto finish;
   }
-  leaf_pushing (&cptrie.level80, idx, bit_spot, &cptrie.leaf, key);
+  if (leaf_pushing (t, &t->level80, idx, bit_spot, &t->leaf, key))
+    goto error;
 
   stride = ((key >> 40) & 0XFF);
-  idx = get_chunk_idx_frm_parent (&cptrie.level80, idx, bit_spot) * ELEMS_PER_STRIDE + stride / 64;
+  chunk_idx = get_chunk_idx_frm_parent (&t->level80, idx, bit_spot);
+  if (chunk_idx == (uint32_t)-1)
+    return -1;
+  idx = chunk_idx * ELEMS_PER_STRIDE + stride / 64;
   bit_spot = stride % 64;
   if (level <= 88) {
-    insert_leaf(&cptrie.level88, idx, bit_spot, level, &cptrie.leaf, key, prefix_len, nexthop);
+    if (insert_leaf(t, &t->level88, idx, bit_spot, level, &t->leaf, key, prefix_len, nexthop))
+      goto error;
     goto finish;
   }
-  leaf_pushing (&cptrie.level88, idx, bit_spot, &cptrie.leaf, key);
+  if (leaf_pushing (t, &t->level88, idx, bit_spot, &t->leaf, key))
+    goto error;
 
   stride = ((key >> 32) & 0XFF);
-  idx = get_chunk_idx_frm_parent (&cptrie.level88, idx, bit_spot) * ELEMS_PER_STRIDE + stride / 64;
+  chunk_idx = get_chunk_idx_frm_parent (&t->level88, idx, bit_spot);
+  if (chunk_idx == (uint32_t)-1)
+    return -1;
+  idx = chunk_idx * ELEMS_PER_STRIDE + stride / 64;
   bit_spot = stride % 64;
   if (level <= 96) {
-    insert_leaf(&cptrie.level96, idx, bit_spot, level, &cptrie.leaf, key, prefix_len, nexthop);
+    if (insert_leaf(t, &t->level96, idx, bit_spot, level, &t->leaf, key, prefix_len, nexthop))
+      goto error;
     goto finish;
   }
-  leaf_pushing (&cptrie.level96, idx, bit_spot, &cptrie.leaf, key);
+  if (leaf_pushing (t, &t->level96, idx, bit_spot, &t->leaf, key))
+    goto error;
 
   stride = ((key >> 24) & 0XFF);
-  idx = get_chunk_idx_frm_parent (&cptrie.level96, idx, bit_spot) * ELEMS_PER_STRIDE + stride / 64;
+  chunk_idx = get_chunk_idx_frm_parent (&t->level96, idx, bit_spot);
+  if (chunk_idx == (uint32_t)-1)
+    return -1;
+  idx = chunk_idx * ELEMS_PER_STRIDE + stride / 64;
   bit_spot = stride % 64;
   if (level <= 104) {
-    insert_leaf(&cptrie.level104, idx, bit_spot, level, &cptrie.leaf, key, prefix_len, nexthop);
+    if (insert_leaf(t, &t->level104, idx, bit_spot, level, &t->leaf, key, prefix_len, nexthop))
+      goto error;
     goto finish;
   }
-  leaf_pushing (&cptrie.level104, idx, bit_spot, &cptrie.leaf, key);
+  if (leaf_pushing (t, &t->level104, idx, bit_spot, &t->leaf, key))
+    goto error;
 
   stride = ((key >> 16) & 0XFF);
-  idx = get_chunk_idx_frm_parent (&cptrie.level104, idx, bit_spot) * ELEMS_PER_STRIDE + stride / 64;
+  chunk_idx = get_chunk_idx_frm_parent (&t->level104, idx, bit_spot);
+  if (chunk_idx == (uint32_t)-1)
+    return -1;
+  idx = chunk_idx * ELEMS_PER_STRIDE + stride / 64;
   bit_spot = stride % 64;
   if (level <= 112) {
-    insert_leaf(&cptrie.level112, idx, bit_spot, level, &cptrie.leaf, key, prefix_len, nexthop);
+    if (insert_leaf(t, &t->level112, idx, bit_spot, level, &t->leaf, key, prefix_len, nexthop))
+      goto error;
     goto finish;
   }
-  leaf_pushing (&cptrie.level112, idx, bit_spot, &cptrie.leaf, key);
+  if (leaf_pushing (t, &t->level112, idx, bit_spot, &t->leaf, key))
+    goto error;
 
   stride = ((key >> 8) & 0XFF);
-  idx = get_chunk_idx_frm_parent (&cptrie.level112, idx, bit_spot) * ELEMS_PER_STRIDE + stride / 64;
+  chunk_idx = get_chunk_idx_frm_parent (&t->level112, idx, bit_spot);
+  if (chunk_idx == (uint32_t)-1)
+    return -1;
+  idx = chunk_idx * ELEMS_PER_STRIDE + stride / 64;
   bit_spot = stride % 64;
   if (level <= 120) {
-    insert_leaf(&cptrie.level120, idx, bit_spot, level, &cptrie.leaf, key, prefix_len, nexthop);
+    if (insert_leaf(t, &t->level120, idx, bit_spot, level, &t->leaf, key, prefix_len, nexthop))
+      goto error;
     goto finish;
   }
-  leaf_pushing (&cptrie.level120, idx, bit_spot, &cptrie.leaf, key);
+  if (leaf_pushing (t, &t->level120, idx, bit_spot, &t->leaf, key))
+    goto error;
 
   stride = key & 0XFF;
-  idx = get_chunk_idx_frm_parent (&cptrie.level120, idx, bit_spot) * ELEMS_PER_STRIDE + stride / 64;
+  chunk_idx = get_chunk_idx_frm_parent (&t->level120, idx, bit_spot);
+  if (chunk_idx == (uint32_t)-1)
+    return -1;
+  idx = chunk_idx * ELEMS_PER_STRIDE + stride / 64;
   bit_spot = stride % 64;
   if (level <= 128) {
-    insert_leaf(&cptrie.level128, idx, bit_spot, level, &cptrie.leaf, key, prefix_len, nexthop);
+    if (insert_leaf(t, &t->level128, idx, bit_spot, level, &t->leaf, key, prefix_len, nexthop))
+      goto error;
     goto finish;
   }
 error:
   puts("Something went wrong in route insertion");
   return -1;
 finish:
-//  leaf_print(&cptrie.leaf);
-//  cptrie_level_print(&cptrie.level32);
+//  leaf_print(&t->leaf);
+//  cptrie_level_print(&t->level32);
+  return 0;
+}
+
+//Number of levels (16, 24, ..., 128)
+#define NUM_LEVELS 15
+
+struct cptrie_build {
+  __uint128_t *prefixes;
+  uint8_t *pre_lens;
+  uint8_t *pre_nhs;
+  struct fragment frags[MAX_FRAGS];
+  //Each fragment is built as a separate CP-Trie
+  struct cptrie tries[MAX_FRAGS];
+  //Number of chunks and leaves in each level of each fragment
+  uint32_t chunks[MAX_FRAGS][NUM_LEVELS];
+  uint32_t leaves[MAX_FRAGS][NUM_LEVELS];
+  //Where the chunks and the leaves of a fragment go in the merged CP-Trie
+  uint32_t chunk_off[MAX_FRAGS][NUM_LEVELS + 1];
+  uint32_t leaf_off[MAX_FRAGS][NUM_LEVELS];
+  //Where the leaves of a level start in the fragment's own leaf array
+  uint32_t leaf_start[MAX_FRAGS][NUM_LEVELS];
+  int err;
+};
+
+static int frag_insert(void *trie, __uint128_t key, int prefix_len, int nexthop, int level)
+{
+  return _cptrie_insert((struct cptrie *)trie, key, prefix_len, nexthop, level);
+}
+
+static void build_fragment(int f, void *arg)
+{
+  struct cptrie_build *b = (struct cptrie_build *) arg;
+  struct cptrie *t = &b->tries[f];
+  struct cptrie_level *l;
+  uint32_t i, leaves;
+  uint32_t longer[NUM_LENS];
+  int k;
+
+  fragment_longer(&b->frags[f], b->pre_lens, longer);
+  if (_cptrie_init(t, longer) ||
+      insert_fragment(&b->frags[f], b->prefixes, b->pre_lens, b->pre_nhs, frag_insert, t)) {
+    b->err = -1;
+    return;
+  }
+
+  for (l = &t->level16, k = 0; l; l = l->chield, k++) {
+    leaves = 0;
+    for (i = 0; i < l->count * ELEMS_PER_STRIDE; i++)
+      leaves += POPCNT(l->B[i].bitmap);
+    b->chunks[f][k] = l->count;
+    b->leaves[f][k] = leaves;
+  }
+}
+
+//Copies a fragment to the global CP-Trie and shifts its cumu_popcnt
+static void merge_fragment(int f, void *arg)
+{
+  struct cptrie_build *b = (struct cptrie_build *) arg;
+  struct cptrie *t = &b->tries[f];
+  struct cptrie_level *src, *dst;
+  uint32_t from, to, dst_idx, b_shift, c_shift;
+  int k;
+
+  for (src = &t->level16, dst = &cptrie.level16, k = 0; src; src = src->chield, dst = dst->chield, k++) {
+    b_shift = b->leaf_off[f][k] - b->leaf_start[f][k];
+    c_shift = b->chunk_off[f][k + 1];
+    if (k == 0) {
+      //Level 16 is shared by all the fragments. Copy only the roots of this fragment.
+      from = b->frags[f].root_lo / 64;
+      to = b->frags[f].root_hi / 64;
+      dst_idx = from;
+    } else {
+      from = 0;
+      to = src->count * ELEMS_PER_STRIDE;
+      dst_idx = b->chunk_off[f][k] * ELEMS_PER_STRIDE;
+    }
+    for (uint32_t i = from; i < to; i++, dst_idx++) {
+      dst->B[dst_idx].bitmap = src->B[i].bitmap;
+      dst->B[dst_idx].cumu_popcnt = src->B[i].cumu_popcnt + b_shift;
+      dst->C[dst_idx].bitmap = src->C[i].bitmap;
+      dst->C[dst_idx].cumu_popcnt = src->C[i].cumu_popcnt + c_shift;
+    }
+
+    memcpy(&cptrie.leaf.N[b->leaf_off[f][k]], &t->leaf.N[b->leaf_start[f][k]], b->leaves[f][k]);
+    memcpy(&cptrie.leaf.P[b->leaf_off[f][k]], &t->leaf.P[b->leaf_start[f][k]], b->leaves[f][k]);
+  }
+  _cptrie_cleanup(t);
+}
+
+static void cleanup_fragment(int f, void *arg)
+{
+  struct cptrie_build *b = (struct cptrie_build *) arg;
+
+  _cptrie_cleanup(&b->tries[f]);
+}
+
+//Builds the CP-Trie from scratch using nthreads threads. The FIB is split into
+//fragments by the 16 MSBs, each fragment is built independently and then they
+//are concatenated level by level. This replaces cptrie_init(); the CP-Trie
+//needs to be cleaned up with cptrie_cleanup() as usual.
+int cptrie_build(__uint128_t *prefixes, uint8_t *pre_lens, uint8_t *pre_nhs, uint64_t cnt, int nthreads)
+{
+  struct cptrie_build *b;
+  struct cptrie_level *l;
+  uint32_t chunks, leaves;
+  int num_frags, f, k;
+  int err = 0;
+
+  b = (struct cptrie_build *) calloc (1, sizeof(struct cptrie_build));
+  if (!b)
+    return -1;
+  b->prefixes = prefixes;
+  b->pre_lens = pre_lens;
+  b->pre_nhs = pre_nhs;
+
+  num_frags = partition_fib(prefixes, pre_lens, cnt, num_fragments(nthreads), b->frags);
+  if (num_frags < 0) {
+    free(b);
+    return -1;
+  }
+
+  run_tasks(nthreads, num_frags, build_fragment, b);
+  if (b->err) {
+    puts("Failed to build CP-Trie fragments");
+    err = -1;
+    goto cleanup_frags;
+  }
+
+  //Prefix sum of the chunk and leaf counts of the fragments. The leaves are
+  //stored level by level, and within a level in the order of fragments.
+  leaves = 0;
+  for (k = 0; k < NUM_LEVELS; k++) {
+    chunks = 0;
+    for (f = 0; f < num_frags; f++) {
+      b->chunk_off[f][k] = chunks;
+      chunks += b->chunks[f][k];
+      b->leaf_start[f][k] = (k == 0) ? 0 : b->leaf_start[f][k - 1] + b->leaves[f][k - 1];
+      b->leaf_off[f][k] = leaves;
+      leaves += b->leaves[f][k];
+    }
+  }
+
+  err = _cptrie_init(&cptrie, NULL);
+  if (err)
+    goto cleanup_frags;
+  cptrie.def_nh = find_default_route(pre_lens, pre_nhs, cnt);
+
+  for (l = cptrie.level16.chield, k = 1; l; l = l->chield, k++) {
+    l->count = b->chunk_off[num_frags - 1][k] + b->chunks[num_frags - 1][k];
+    if (l->count > l->size) {
+      printf("Cannot insert chunk in level %d . Please increase the level size\n", l->level_num);
+      err = -1;
+    }
+  }
+  cptrie.leaf.count = leaves;
+  if (leaves >= cptrie.leaf.size) {
+    puts ("Leaf array is full. Please increase the size.");
+    err = -1;
+  }
+  if (err) {
+    _cptrie_cleanup(&cptrie);
+    goto cleanup_frags;
+  }
+
+  run_tasks(nthreads, num_frags, merge_fragment, b);
+  free_partition(b->frags, num_frags);
+  free(b);
   return 0;
+
+cleanup_frags:
+  run_tasks(nthreads, num_frags, cleanup_fragment, b);
+  free_partition(b->frags, num_frags);
+  free(b);
+  return err;
 }
 
 /*Calculating index to the next level*/
@@ -615,6 +882,256 @@ uint8_t cptrie_lookup(__uint128_t key) {
   return n_idx == N_CNT ?  cptrie.def_nh : cptrie.leaf.N[n_idx];
 }
 
+//Same as cptrie_lookup() except that the key is the IPv6 address in network
+//byte order, e.g. the destination address in a packet header. As the stride
+//is 8 bits, each level reads just one byte of the address.
+uint8_t cptrie_lookup_addr(const uint8_t *addr) {
+  //Making them register improves the lookup performance
+  register uint32_t bit_spot;
+  register uint32_t idx, stride;
+  register uint64_t mask;
+  register uint64_t n_idx = N_CNT;
+
+  stride = (addr[0] << 8) | addr[1];
+  //Changing arithmetic operators to bitwise operators doesn't increase
+  //throughput. Probably compiler is changing it anyway. So we are using
+  //arithmetic operators as it is
+  idx = stride / 64;
+  bit_spot = stride % 64;
+  mask = MSK >> bit_spot;
+  if (cptrie.level16.C[idx].bitmap & mask) {
+    stride = addr[2];
+    idx = IDX_NXT (cptrie.level16.C, idx, bit_spot, stride);
+    bit_spot = stride % 64;
+    mask = MSK >> bit_spot;
+    if (cptrie.level24.C[idx].bitmap & mask) {
+      stride = addr[3];
+      idx = IDX_NXT (cptrie.level24.C, idx, bit_spot, stride);
+      bit_spot = stride % 64;
+      mask = MSK >> bit_spot;
+      if (cptrie.level32.C[idx].bitmap & mask) {
+        stride = addr[4];
+        idx = IDX_NXT (cptrie.level32.C, idx, bit_spot, stride);
+        bit_spot = stride % 64;
+        mask = MSK >> bit_spot;
+        if (cptrie.level40.C[idx].bitmap & mask) {
+          stride = addr[5];
+          idx = IDX_NXT (cptrie.level40.C, idx, bit_spot, stride);
+          bit_spot = stride % 64;
+          mask = MSK >> bit_spot;
+          if (cptrie.level48.C[idx].bitmap & mask) {
+            stride = addr[6];
+            idx = IDX_NXT (cptrie.level48.C, idx, bit_spot, stride);
+            bit_spot = stride % 64;
+            mask = MSK >> bit_spot;
+            if (cptrie.level56.C[idx].bitmap & mask) {
+              stride = addr[7];
+              idx = IDX_NXT (cptrie.level56.C, idx, bit_spot, stride);
+              bit_spot = stride % 64;
+              mask = MSK >> bit_spot;
+              if (cptrie.level64.C[idx].bitmap & mask) {
+                stride = addr[8];
+                idx = IDX_NXT (cptrie.level64.C, idx, bit_spot, stride);
+                bit_spot = stride % 64;
+                mask = MSK >> bit_spot;
+                if (cptrie.level72.C[idx].bitmap & mask) {
+                  stride = addr[9];
+                  idx = IDX_NXT (cptrie.level72.C, idx, bit_spot, stride);
+                  bit_spot = stride % 64;
+                  mask = MSK >> bit_spot;
+                  if (cptrie.level80.C[idx].bitmap & mask) {
+                    stride = addr[10];
+                    idx = IDX_NXT (cptrie.level80.C, idx, bit_spot, stride);
+                    bit_spot = stride % 64;
+                    mask = MSK >> bit_spot;
+                    if (cptrie.level88.C[idx].bitmap & mask) {
+                      stride = addr[11];
+                      idx = IDX_NXT (cptrie.level88.C, idx, bit_spot, stride);
+                      bit_spot = stride % 64;
+                      mask = MSK >> bit_spot;
+                      if (cptrie.level96.C[idx].bitmap & mask) {
+                        stride = addr[12];
+                        idx = IDX_NXT (cptrie.level96.C, idx, bit_spot, stride);
+                        bit_spot = stride % 64;
+                        mask = MSK >> bit_spot;
+                        if (cptrie.level104.C[idx].bitmap & mask) {
+                          stride = addr[13];
+                          idx = IDX_NXT (cptrie.level104.C, idx, bit_spot, stride);
+                          bit_spot = stride % 64;
+                          mask = MSK >> bit_spot;
+                          if (cptrie.level112.C[idx].bitmap & mask) {
+                            stride = addr[14];
+                            idx = IDX_NXT (cptrie.level112.C, idx, bit_spot, stride);
+                            bit_spot = stride % 64;
+                            mask = MSK >> bit_spot;
+                            if (cptrie.level120.C[idx].bitmap & mask) {
+                              stride = addr[15];
+                              idx = IDX_NXT (cptrie.level120.C, idx, bit_spot, stride);
+                              bit_spot = stride % 64;
+                              mask = MSK >> bit_spot;
+                              if (cptrie.level128.B[idx].bitmap & mask)
+                                n_idx = N_IDX(cptrie.level128.B, idx, bit_spot);
+                            } else if (cptrie.level120.B[idx].bitmap & mask)
+                              n_idx = N_IDX(cptrie.level120.B, idx, bit_spot);
+                          } else if (cptrie.level112.B[idx].bitmap & mask)
+                            n_idx = N_IDX(cptrie.level112.B, idx, bit_spot);
+                        } else if (cptrie.level104.B[idx].bitmap & mask)
+                          n_idx = N_IDX(cptrie.level104.B, idx, bit_spot);
+                      } else if (cptrie.level96.B[idx].bitmap & mask)
+                        n_idx = N_IDX(cptrie.level96.B, idx, bit_spot);
+                    } else if (cptrie.level88.B[idx].bitmap & mask)
+                      n_idx = N_IDX(cptrie.level88.B, idx, bit_spot);
+                  } else if (cptrie.level80.B[idx].bitmap & mask)
+                    n_idx = N_IDX(cptrie.level80.B, idx, bit_spot);
+                } else if (cptrie.level72.B[idx].bitmap & mask)
+                  n_idx = N_IDX(cptrie.level72.B, idx, bit_spot);
+              } else if (cptrie.level64.B[idx].bitmap & mask)
+                n_idx = N_IDX(cptrie.level64.B, idx, bit_spot);
+            } else if (cptrie.level56.B[idx].bitmap & mask)
+              n_idx = N_IDX(cptrie.level56.B, idx, bit_spot);
+          } else if (cptrie.level48.B[idx].bitmap & mask)
+            n_idx = N_IDX(cptrie.level48.B, idx, bit_spot);
+        } else if (cptrie.level40.B[idx].bitmap & mask)
+          n_idx = N_IDX(cptrie.level40.B, idx, bit_spot);
+      } else if (cptrie.level32.B[idx].bitmap & mask)
+        n_idx = N_IDX(cptrie.level32.B, idx, bit_spot);
+    } else if (cptrie.level24.B[idx].bitmap & mask)
+      n_idx = N_IDX(cptrie.level24.B, idx, bit_spot);
+  } else if (cptrie.level16.B[idx].bitmap & mask)
+    n_idx = N_IDX(cptrie.level16.B, idx, bit_spot);
+  return n_idx == N_CNT ?  cptrie.def_nh : cptrie.leaf.N[n_idx];
+}
+
+//Continues the lookup from level 64 using the lower 64 bits of the key. This
+//is called only when level 64 says that the match is longer than 64 bits.
+static uint64_t lookup_lo(register uint32_t idx, register uint32_t bit_spot, uint64_t key_lo)
+{
+  register uint32_t stride;
+  register uint64_t mask;
+  register uint64_t n_idx = N_CNT;
+
+  stride = (key_lo >> 56) & 0XFF;
+  idx = IDX_NXT (cptrie.level64.C, idx, bit_spot, stride);
+  bit_spot = stride % 64;
+  mask = MSK >> bit_spot;
+  if (cptrie.level72.C[idx].bitmap & mask) {
+    stride = (key_lo >> 48) & 0XFF;
+    idx = IDX_NXT (cptrie.level72.C, idx, bit_spot, stride);
+    bit_spot = stride % 64;
+    mask = MSK >> bit_spot;
+    if (cptrie.level80.C[idx].bitmap & mask) {
+      stride = (key_lo >> 40) & 0XFF;
+      idx = IDX_NXT (cptrie.level80.C, idx, bit_spot, stride);
+      bit_spot = stride % 64;
+      mask = MSK >> bit_spot;
+      if (cptrie.level88.C[idx].bitmap & mask) {
+        stride = (key_lo >> 32) & 0XFF;
+        idx = IDX_NXT (cptrie.level88.C, idx, bit_spot, stride);
+        bit_spot = stride % 64;
+        mask = MSK >> bit_spot;
+        if (cptrie.level96.C[idx].bitmap & mask) {
+          stride = (key_lo >> 24) & 0XFF;
+          idx = IDX_NXT (cptrie.level96.C, idx, bit_spot, stride);
+          bit_spot = stride % 64;
+          mask = MSK >> bit_spot;
+          if (cptrie.level104.C[idx].bitmap & mask) {
+            stride = (key_lo >> 16) & 0XFF;
+            idx = IDX_NXT (cptrie.level104.C, idx, bit_spot, stride);
+            bit_spot = stride % 64;
+            mask = MSK >> bit_spot;
+            if (cptrie.level112.C[idx].bitmap & mask) {
+              stride = (key_lo >> 8) & 0XFF;
+              idx = IDX_NXT (cptrie.level112.C, idx, bit_spot, stride);
+              bit_spot = stride % 64;
+              mask = MSK >> bit_spot;
+              if (cptrie.level120.C[idx].bitmap & mask) {
+                stride = key_lo & 0XFF;
+                idx = IDX_NXT (cptrie.level120.C, idx, bit_spot, stride);
+                bit_spot = stride % 64;
+                mask = MSK >> bit_spot;
+                if (cptrie.level128.B[idx].bitmap & mask)
+                  n_idx = N_IDX(cptrie.level128.B, idx, bit_spot);
+              } else if (cptrie.level120.B[idx].bitmap & mask)
+                n_idx = N_IDX(cptrie.level120.B, idx, bit_spot);
+            } else if (cptrie.level112.B[idx].bitmap & mask)
+              n_idx = N_IDX(cptrie.level112.B, idx, bit_spot);
+          } else if (cptrie.level104.B[idx].bitmap & mask)
+            n_idx = N_IDX(cptrie.level104.B, idx, bit_spot);
+        } else if (cptrie.level96.B[idx].bitmap & mask)
+          n_idx = N_IDX(cptrie.level96.B, idx, bit_spot);
+      } else if (cptrie.level88.B[idx].bitmap & mask)
+        n_idx = N_IDX(cptrie.level88.B, idx, bit_spot);
+    } else if (cptrie.level80.B[idx].bitmap & mask)
+      n_idx = N_IDX(cptrie.level80.B, idx, bit_spot);
+  } else if (cptrie.level72.B[idx].bitmap & mask)
+    n_idx = N_IDX(cptrie.level72.B, idx, bit_spot);
+  return n_idx;
+}
+
+//Same as cptrie_lookup() except that the key is given as two 64-bit halves.
+//Most of the prefixes are not longer than 64, so levels 16 to 64 are looked up
+//with 64-bit arithmetic on the upper half only. The lower half is used only if
+//the match is longer than 64 bits.
+uint8_t cptrie_lookup64(uint64_t key_hi, uint64_t key_lo) {
+  register uint32_t bit_spot;
+  register uint32_t idx, stride;
+  register uint64_t mask;
+  register uint64_t n_idx = N_CNT;
+
+  stride = key_hi >> 48;
+  idx = stride / 64;
+  bit_spot = stride % 64;
+  mask = MSK >> bit_spot;
+  if (cptrie.level16.C[idx].bitmap & mask) {
+    stride = (key_hi >> 40) & 0XFF;
+    idx = IDX_NXT (cptrie.level16.C, idx, bit_spot, stride);
+    bit_spot = stride % 64;
+    mask = MSK >> bit_spot;
+    if (cptrie.level24.C[idx].bitmap & mask) {
+      stride = (key_hi >> 32) & 0XFF;
+      idx = IDX_NXT (cptrie.level24.C, idx, bit_spot, stride);
+      bit_spot = stride % 64;
+      mask = MSK >> bit_spot;
+      if (cptrie.level32.C[idx].bitmap & mask) {
+        stride = (key_hi >> 24) & 0XFF;
+        idx = IDX_NXT (cptrie.level32.C, idx, bit_spot, stride);
+        bit_spot = stride % 64;
+        mask = MSK >> bit_spot;
+        if (cptrie.level40.C[idx].bitmap & mask) {
+          stride = (key_hi >> 16) & 0XFF;
+          idx = IDX_NXT (cptrie.level40.C, idx, bit_spot, stride);
+          bit_spot = stride % 64;
+          mask = MSK >> bit_spot;
+          if (cptrie.level48.C[idx].bitmap & mask) {
+            stride = (key_hi >> 8) & 0XFF;
+            idx = IDX_NXT (cptrie.level48.C, idx, bit_spot, stride);
+            bit_spot = stride % 64;
+            mask = MSK >> bit_spot;
+            if (cptrie.level56.C[idx].bitmap & mask) {
+              stride = key_hi & 0XFF;
+              idx = IDX_NXT (cptrie.level56.C, idx, bit_spot, stride);
+              bit_spot = stride % 64;
+              mask = MSK >> bit_spot;
+              if (cptrie.level64.C[idx].bitmap & mask) {
+                //The match is longer than 64 bits
+                n_idx = lookup_lo(idx, bit_spot, key_lo);
+              } else if (cptrie.level64.B[idx].bitmap & mask)
+                n_idx = N_IDX(cptrie.level64.B, idx, bit_spot);
+            } else if (cptrie.level56.B[idx].bitmap & mask)
+              n_idx = N_IDX(cptrie.level56.B, idx, bit_spot);
+          } else if (cptrie.level48.B[idx].bitmap & mask)
+            n_idx = N_IDX(cptrie.level48.B, idx, bit_spot);
+        } else if (cptrie.level40.B[idx].bitmap & mask)
+          n_idx = N_IDX(cptrie.level40.B, idx, bit_spot);
+      } else if (cptrie.level32.B[idx].bitmap & mask)
+        n_idx = N_IDX(cptrie.level32.B, idx, bit_spot);
+    } else if (cptrie.level24.B[idx].bitmap & mask)
+      n_idx = N_IDX(cptrie.level24.B, idx, bit_spot);
+  } else if (cptrie.level16.B[idx].bitmap & mask)
+    n_idx = N_IDX(cptrie.level16.B, idx, bit_spot);
+  return n_idx == N_CNT ?  cptrie.def_nh : cptrie.leaf.N[n_idx];
+}
+
 //This is same as FIB lookup, except it returns matched prefix length instead
 //of next-hop index
 uint8_t cptrie_matched_prefix_len(__uint128_t key) {
@@ -37,7 +37,10 @@ int cptrie_init();
 int cptrie_cleanup();
 double calc_cptrie_mem();
 int cptrie_insert(__uint128_t ip, int prefix_len, int nexthop);
+int cptrie_build(__uint128_t *prefixes, uint8_t *pre_lens, uint8_t *pre_nhs, uint64_t cnt, int nthreads);
 uint8_t cptrie_lookup(__uint128_t key);
+uint8_t cptrie_lookup_addr(const uint8_t *addr);
+uint8_t cptrie_lookup64(uint64_t key_hi, uint64_t key_lo);
 uint8_t cptrie_matched_prefix_len(__uint128_t key);
 
 #endif /* CPTRIE_IP6_H_ */
@@ -18,13 +18,15 @@
 #include "dir.h"
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
 
 int dir_init (struct dir *d, uint32_t size) {
-  d->c = (uint16_t *) calloc (size, sizeof(uint16_t));
+  d->c = (ckid_t *) calloc (size, sizeof(ckid_t));
   d->size = size;
   d->count = 0;
+  d->deferred = 0;
 
-  if (!d->c)
+  if (!d->c || rank_init(&d->r, size))
     return -1;
   else
     return 0;
@@ -35,6 +37,7 @@ int dir_cleanup (struct dir *d) {
   int err = 0;
 
   free(d->c);
+  rank_cleanup(&d->r);
   d->size = 0;
   d->count = 0;
   return err;
@@ -48,27 +51,18 @@ int dir_print (struct dir *d) {
 }
 
 double mem_size(struct dir *d) {
-  //each element is 2 bytes
-  return d->size * 2;
+  return d->size * sizeof(ckid_t);
 }
 
 /*Calculate the chunk ID*/
 uint32_t calc_ckid(struct dir *d, uint32_t idx) {
-  long long i;
-
   if (idx >= d->size) {
     puts("Index needs to be smaller than arr_size");
     return 0;
   }
 
-  /*Find the first chunk ID to the left and increment that by 1*/
-  for (i = (long long)idx - 1; i >= 0; i--) {
-    if (d->c[i] > 0)
-      return d->c[i] + 1;
-  }
-
-  /*If there is no chunk to the left, then this is the first chunk*/
-  return 1;
+  /*The chunks are in the order of their entries*/
+  return rank_count(&d->r, idx) + 1;
 }
 
 /*Update C16 based on the newly inserted chunk*/
@@ -81,6 +75,10 @@ int update_ckid(struct dir *d, uint32_t idx, uint32_t chunk_id)
     return -1;
   }
 
+  rank_set(&d->r, idx);
+  if (d->deferred)
+    return 0;
+
   d->c[idx] = chunk_id;
 
   /* Increment chunk ID to the right */
@@ -92,3 +90,66 @@ int update_ckid(struct dir *d, uint32_t idx, uint32_t chunk_id)
   return 0;
 }
 
+/*Remove the chunk at idx, i.e. the reverse of update_ckid()*/
+int remove_ckid(struct dir *d, uint32_t idx)
+{
+  long long i;
+  ckid_t chunk_id;
+
+  if (idx >= d->size || !rank_test(&d->r, idx)) {
+    puts("Invalid index");
+    return -1;
+  }
+
+  rank_clear(&d->r, idx);
+  if (d->deferred)
+    return 0;
+
+  chunk_id = d->c[idx];
+  d->c[idx] = 0;
+
+  /* Decrement chunk ID to the right */
+  for (i = idx + 1; i < d->size; i++) {
+    if (d->c[i] > chunk_id)
+      d->c[i]--;
+  }
+
+  return 0;
+}
+
+/*Chunk ID of an entry, 0 if it has none. Unlike c, it's valid while the
+ *direct pointing is deferred.*/
+uint32_t dir_ckid(struct dir *d, uint32_t idx)
+{
+  if (!d->deferred)
+    return d->c[idx];
+  return rank_test(&d->r, idx) ? rank_count(&d->r, idx) + 1 : 0;
+}
+
+/*Stop maintaining c on each update. It's rebuilt by dir_commit().*/
+void dir_defer(struct dir *d)
+{
+  d->deferred = 1;
+}
+
+/*Rebuild c from the rank in a single pass*/
+void dir_commit(struct dir *d)
+{
+  uint32_t chunk_id = 0;
+
+  for (uint64_t i = 0; i < d->size; i++)
+    d->c[i] = rank_test(&d->r, i) ? ++chunk_id : 0;
+  d->deferred = 0;
+}
+
+/*Rebuild the rank after c was written directly, e.g. by a parallel build*/
+void dir_sync(struct dir *d)
+{
+  memset(d->r.bits, 0, d->r.blocks * RANK_WORDS * sizeof(uint64_t));
+  for (uint64_t i = 0; i < d->size; i++) {
+    if (d->c[i])
+      d->r.bits[i / 64] |= 1ULL << (i % 64);
+  }
+  rank_build(&d->r);
+  d->deferred = 0;
+}
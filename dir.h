@@ -19,11 +19,31 @@
 #define DIR_H_
 
 #include <stdint.h>
+#include "rank.h"
+
+//Bits of the key resolved by Poptrie's direct pointing (s in the Poptrie
+//paper). It's set at build time, e.g. make POPTRIE_S=18.
+#ifndef POPTRIE_S
+#define POPTRIE_S 16
+#endif
+
+//Chunk IDs are 16 bits like the original implementation as long as the
+//direct pointing has no more than 2^16 entries. A wider direct pointing may
+//point to more chunks.
+#if POPTRIE_S > 16
+typedef uint32_t ckid_t;
+#else
+typedef uint16_t ckid_t;
+#endif
 
 struct dir {
-  uint16_t *c;
+  ckid_t *c;
   uint64_t size;
   uint64_t count;
+  //Entries that have a chunk. The chunk ID of an entry is its rank + 1.
+  struct rank r;
+  //c is stale until dir_commit(). The chunk IDs are derived from r instead.
+  int deferred;
 };
 
 int dir_init (struct dir *l, uint32_t size);
@@ -32,5 +52,10 @@ int dir_print (struct dir *l);
 double mem_size(struct dir *l);
 uint32_t calc_ckid(struct dir *d, uint32_t idx);
 int update_ckid(struct dir *d, uint32_t idx, uint32_t chunk_id);
+int remove_ckid(struct dir *d, uint32_t idx);
+uint32_t dir_ckid(struct dir *d, uint32_t idx);
+void dir_defer(struct dir *d);
+void dir_commit(struct dir *d);
+void dir_sync(struct dir *d);
 
 #endif /* DIR_H_ */
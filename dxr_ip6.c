@@ -0,0 +1,710 @@
+/*
+ *   Copyright (c) 2019-2021 MD Iftakharul Islam (Tamim) <tamim@csebuet.org>
+ *
+ *   This program is free software; you can redistribute it and/or modify
+ *   it under the terms of the GNU General Public License as published by
+ *   the Free Software Foundation; either version 3 of the License, or
+ *   (at your option) any later version.
+ *
+ *   This program is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *   GNU General Public License for more details.
+ *
+ *   You should have received a copy of the GNU General Public License
+ *   along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+#include "dxr_ip6.h"
+#include "parallel_build.h"
+
+//Bits of a key below the direct table
+#define CNK_BITS (128 - DXR_K)
+//Bits of a short range start that are dropped
+#define SHORT_SHIFT (CNK_BITS - 32)
+//Initial number of prefixes, the array grows as needed
+#define P_SIZE 65536
+//Room for the ranges of the updates after a rebuild, on top of as many
+//ranges as the rebuild made. The garbage reaches about the same size by the
+//time the room runs out.
+#define RANGE_SLACK 4096
+
+struct dxr dxr;
+
+//A range made by sweep(), before it's stored in a chunk
+struct sweep_range {
+  __uint128_t start;
+  uint8_t nh;
+};
+
+static __inline__ __uint128_t pre_mask(int len)
+{
+  return len ? ~(__uint128_t)0 << (128 - len) : 0;
+}
+
+static __inline__ __uint128_t pre_addr(const struct dxr_prefix *p)
+{
+  return ((__uint128_t)p->hi << 64) | p->lo;
+}
+
+//Last address covered by a prefix
+static __inline__ __uint128_t pre_end(const struct dxr_prefix *p)
+{
+  return pre_addr(p) | ~pre_mask(p->len);
+}
+
+//The prefixes are sorted by address and then by length, so a prefix comes
+//before the longer prefixes it covers
+static __inline__ int pre_before(const struct dxr_prefix *p, __uint128_t addr, int len)
+{
+  __uint128_t a = pre_addr(p);
+
+  return a < addr || (a == addr && p->len < len);
+}
+
+static int prefix_order(const void *x, const void *y)
+{
+  const struct dxr_prefix *a = (const struct dxr_prefix *) x;
+  const struct dxr_prefix *b = (const struct dxr_prefix *) y;
+
+  if (a->hi != b->hi)
+    return a->hi < b->hi ? -1 : 1;
+  if (a->lo != b->lo)
+    return a->lo < b->lo ? -1 : 1;
+  if (a->len != b->len)
+    return a->len < b->len ? -1 : 1;
+  return a->seq < b->seq ? -1 : a->seq > b->seq;
+}
+
+//Index of the first prefix that isn't before (addr, len)
+static uint64_t lower_bound(__uint128_t addr, int len)
+{
+  uint64_t lo = 0, hi = dxr.p_cnt, mid;
+
+  while (lo < hi) {
+    mid = (lo + hi) / 2;
+    if (pre_before(&dxr.P[mid], addr, len))
+      lo = mid + 1;
+    else
+      hi = mid;
+  }
+  return lo;
+}
+
+//Index of the first prefix starting after addr
+static uint64_t upper_bound(__uint128_t addr)
+{
+  uint64_t lo = 0, hi = dxr.p_cnt, mid;
+
+  while (lo < hi) {
+    mid = (lo + hi) / 2;
+    if (pre_addr(&dxr.P[mid]) <= addr)
+      lo = mid + 1;
+    else
+      hi = mid;
+  }
+  return lo;
+}
+
+//Index of a prefix or -1 if it doesn't exist
+static int64_t find_prefix(__uint128_t addr, int len)
+{
+  uint64_t i = lower_bound(addr, len);
+
+  if (i < dxr.p_cnt && pre_addr(&dxr.P[i]) == addr && dxr.P[i].len == len)
+    return i;
+  return -1;
+}
+
+static int reserve_prefixes(uint64_t cnt)
+{
+  struct dxr_prefix *p;
+  uint64_t size;
+
+  if (dxr.p_cnt + cnt <= dxr.p_size)
+    return 0;
+  size = dxr.p_size * 2 > dxr.p_cnt + cnt ? dxr.p_size * 2 : dxr.p_cnt + cnt;
+  p = (struct dxr_prefix *) realloc (dxr.P, size * sizeof(struct dxr_prefix));
+  if (!p) {
+    puts("Failed to allocate memory for DXR prefixes");
+    return -1;
+  }
+  dxr.P = p;
+  dxr.p_size = size;
+  return 0;
+}
+
+//Sorts the prefixes of a loaded FIB and drops the duplicates. The last one
+//inserted wins like in the other algorithms.
+static void sort_prefixes()
+{
+  uint64_t i, n = 0;
+
+  qsort(dxr.P, dxr.p_cnt, sizeof(struct dxr_prefix), prefix_order);
+  memset(dxr.len_cnt, 0, sizeof(dxr.len_cnt));
+  for (i = 0; i < dxr.p_cnt; i++) {
+    if (i + 1 < dxr.p_cnt && dxr.P[i + 1].hi == dxr.P[i].hi && dxr.P[i + 1].lo == dxr.P[i].lo &&
+        dxr.P[i + 1].len == dxr.P[i].len)
+      continue;
+    dxr.P[n++] = dxr.P[i];
+    dxr.len_cnt[dxr.P[i].len]++;
+  }
+  dxr.p_cnt = n;
+}
+
+//Makes room for s short and l long ranges
+static int reserve_ranges(struct dxr_ranges *r, uint32_t s, uint32_t l)
+{
+  uint64_t size;
+  void *p;
+
+  if ((uint64_t)r->s_cnt + s > DXR_BASE || (uint64_t)r->l_cnt + l > DXR_BASE) {
+    puts("Too many ranges for DXR");
+    return -1;
+  }
+  if (r->s_cnt + s > r->s_size) {
+    size = (uint64_t)r->s_size * 2 > r->s_cnt + s ? (uint64_t)r->s_size * 2 : r->s_cnt + s + RANGE_SLACK;
+    if (size > DXR_BASE + 1ULL)
+      size = DXR_BASE + 1ULL;
+    if (!(p = realloc(r->S, size * sizeof(uint32_t))))
+      goto fail;
+    r->S = (uint32_t *) p;
+    if (!(p = realloc(r->SN, size)))
+      goto fail;
+    r->SN = (uint8_t *) p;
+    r->s_size = size;
+  }
+  if (r->l_cnt + l > r->l_size) {
+    size = (uint64_t)r->l_size * 2 > r->l_cnt + l ? (uint64_t)r->l_size * 2 : r->l_cnt + l + RANGE_SLACK;
+    if (size > DXR_BASE + 1ULL)
+      size = DXR_BASE + 1ULL;
+    if (!(p = realloc(r->L, size * sizeof(struct dxr_range))))
+      goto fail;
+    r->L = (struct dxr_range *) p;
+    if (!(p = realloc(r->LN, size)))
+      goto fail;
+    r->LN = (uint8_t *) p;
+    r->l_size = size;
+  }
+  return 0;
+
+fail:
+  puts("Failed to allocate memory for DXR ranges");
+  return -1;
+}
+
+static void free_ranges(struct dxr_ranges *r)
+{
+  free(r->S);
+  free(r->SN);
+  free(r->L);
+  free(r->LN);
+  memset(r, 0, sizeof(*r));
+}
+
+static void free_table(struct dxr_table *t)
+{
+  if (!t)
+    return;
+  free(t->D);
+  free_ranges(&t->R);
+  free(t);
+}
+
+//Makes t the table of the lookups. A lookup that loaded the table it
+//replaces may still be reading it, so that one is kept until the next
+//publish and the one retired before is freed.
+static void publish(struct dxr_table *t)
+{
+  struct dxr_table *old = dxr.T;
+
+  __atomic_store_n(&dxr.T, t, __ATOMIC_RELEASE);
+  free_table(dxr.retired);
+  dxr.retired = old;
+}
+
+//Appends a range unless it's merged with the last one. A range starting
+//where the last one starts replaces it.
+static __inline__ void emit(struct sweep_range *out, uint64_t *n, __uint128_t start, uint8_t nh)
+{
+  if (*n && out[*n - 1].start == start) {
+    out[*n - 1].nh = nh;
+    if (*n > 1 && out[*n - 2].nh == nh)
+      (*n)--;
+    return;
+  }
+  if (*n && out[*n - 1].nh == nh)
+    return;
+  out[*n].start = start;
+  out[*n].nh = nh;
+  (*n)++;
+}
+
+//Cuts [lo, hi] into the ranges of the prefixes [i, end) starting in it and
+//the prefixes covering lo, and merges the adjacent ranges with the same
+//next-hop. The prefixes are nested or disjoint, so the ones covering the
+//current address form a stack. out needs room for 2 * (end - i) + 1 ranges.
+//Returns the number of ranges.
+static uint64_t sweep(__uint128_t lo, __uint128_t hi, uint64_t i, uint64_t end, struct sweep_range *out)
+{
+  struct {
+    __uint128_t end;
+    uint8_t nh;
+  } stack[129];
+  __uint128_t a;
+  uint64_t n = 0;
+  int64_t j;
+  int sp = 0;
+
+  //The prefixes starting before lo and covering it, from the shortest
+  for (int len = 0; len <= 128; len++) {
+    if (!dxr.len_cnt[len])
+      continue;
+    a = lo & pre_mask(len);
+    if (a == lo)
+      break;
+    if ((j = find_prefix(a, len)) >= 0) {
+      stack[sp].end = pre_end(&dxr.P[j]);
+      stack[sp++].nh = dxr.P[j].nh;
+    }
+  }
+  emit(out, &n, lo, sp ? stack[sp - 1].nh : 0);
+
+  for (; i < end; i++) {
+    a = pre_addr(&dxr.P[i]);
+    while (sp && stack[sp - 1].end < a) {
+      sp--;
+      emit(out, &n, stack[sp].end + 1, sp ? stack[sp - 1].nh : 0);
+    }
+    stack[sp].end = pre_end(&dxr.P[i]);
+    stack[sp++].nh = dxr.P[i].nh;
+    emit(out, &n, a, dxr.P[i].nh);
+  }
+
+  //The ends grow as the stack unwinds, so the ranges stay in order
+  while (sp) {
+    sp--;
+    if (stack[sp].end >= hi)
+      break;
+    emit(out, &n, stack[sp].end + 1, sp ? stack[sp - 1].nh : 0);
+  }
+  return n;
+}
+
+//Makes the ranges of the chunks [c_lo, c_hi], appends them to r and points
+//the entries of D to them. D[0] is the entry of chunk c_lo.
+static int build_chunks(uint32_t c_lo, uint32_t c_hi, struct dxr_ranges *r, uint32_t *D)
+{
+  __uint128_t lo = (__uint128_t)c_lo << CNK_BITS;
+  __uint128_t hi = ((__uint128_t)c_hi << CNK_BITS) | (~(__uint128_t)0 >> DXR_K);
+  uint64_t i = lower_bound(lo, 0), end = upper_bound(hi);
+  uint64_t n, j = 0, k, m, cnt;
+  struct sweep_range *out;
+  uint32_t base, c;
+  int is_short;
+
+  out = (struct sweep_range *) malloc ((2 * (end - i) + 1) * sizeof(struct sweep_range));
+  if (!out) {
+    puts("Failed to allocate memory for DXR ranges");
+    return -1;
+  }
+  n = sweep(lo, hi, i, end, out);
+
+  for (c = c_lo; ; c++) {
+    //out[j] is the range where the chunk starts
+    while (j + 1 < n && out[j + 1].start <= (__uint128_t)c << CNK_BITS)
+      j++;
+    is_short = 1;
+    for (k = j + 1; k < n && (uint32_t)(out[k].start >> CNK_BITS) == c; k++) {
+      if (out[k].start & ~pre_mask(DXR_K + 32))
+        is_short = 0;
+    }
+    cnt = k - j;
+
+    if (cnt == 1) {
+      D[c - c_lo] = DXR_NH | out[j].nh;
+    } else if (is_short) {
+      if (reserve_ranges(r, cnt + 1, 0))
+        goto fail;
+      base = r->s_cnt;
+      r->S[base] = cnt;
+      r->SN[base] = 0;
+      r->S[base + 1] = 0;
+      r->SN[base + 1] = out[j].nh;
+      for (m = 1; m < cnt; m++) {
+        r->S[base + 1 + m] = out[j + m].start >> SHORT_SHIFT;
+        r->SN[base + 1 + m] = out[j + m].nh;
+      }
+      r->s_cnt += cnt + 1;
+      D[c - c_lo] = base;
+    } else {
+      if (reserve_ranges(r, 0, cnt + 1))
+        goto fail;
+      base = r->l_cnt;
+      r->L[base].hi = 0;
+      r->L[base].lo = cnt;
+      r->LN[base] = 0;
+      r->L[base + 1].hi = (uint64_t)c << (64 - DXR_K);
+      r->L[base + 1].lo = 0;
+      r->LN[base + 1] = out[j].nh;
+      for (m = 1; m < cnt; m++) {
+        r->L[base + 1 + m].hi = out[j + m].start >> 64;
+        r->L[base + 1 + m].lo = out[j + m].start;
+        r->LN[base + 1 + m] = out[j + m].nh;
+      }
+      r->l_cnt += cnt + 1;
+      D[c - c_lo] = DXR_LONG | base;
+    }
+    //The last range of the chunk may go on in the next one
+    j = k - 1;
+    if (c == c_hi)
+      break;
+  }
+  free(out);
+  return 0;
+
+fail:
+  free(out);
+  return -1;
+}
+
+struct dxr_build {
+  int ntasks;
+  //Task t makes the chunks [c_lo[t], c_lo[t + 1])
+  uint32_t c_lo[MAX_FRAGS + 1];
+  struct dxr_ranges r[MAX_FRAGS];
+  //Where the ranges of a task go in the merged ranges
+  uint32_t s_off[MAX_FRAGS];
+  uint32_t l_off[MAX_FRAGS];
+  uint32_t *D;
+  struct dxr_ranges merged;
+  int err;
+};
+
+static void build_task(int t, void *arg)
+{
+  struct dxr_build *b = (struct dxr_build *) arg;
+
+  if (build_chunks(b->c_lo[t], b->c_lo[t + 1] - 1, &b->r[t], b->D + b->c_lo[t]))
+    b->err = -1;
+}
+
+//Copies the ranges of a task to their place and shifts the indexes of its
+//chunks
+static void merge_task(int t, void *arg)
+{
+  struct dxr_build *b = (struct dxr_build *) arg;
+  struct dxr_ranges *r = &b->r[t];
+
+  memcpy(&b->merged.S[b->s_off[t]], r->S, r->s_cnt * sizeof(uint32_t));
+  memcpy(&b->merged.SN[b->s_off[t]], r->SN, r->s_cnt);
+  memcpy(&b->merged.L[b->l_off[t]], r->L, r->l_cnt * sizeof(struct dxr_range));
+  memcpy(&b->merged.LN[b->l_off[t]], r->LN, r->l_cnt);
+  for (uint32_t c = b->c_lo[t]; c < b->c_lo[t + 1]; c++) {
+    if (b->D[c] & DXR_NH)
+      continue;
+    b->D[c] += (b->D[c] & DXR_LONG) ? b->l_off[t] : b->s_off[t];
+  }
+}
+
+//Makes the ranges of all the chunks from the sorted prefixes with nthreads
+//threads. The chunks are split into tasks with about the same number of
+//prefixes, and the ranges of the tasks are concatenated. The new table
+//replaces the current one, which drops the garbage.
+static int rebuild(int nthreads)
+{
+  struct dxr_build *b;
+  struct dxr_table *tbl;
+  uint32_t s = 0, l = 0, c;
+  int t, n, err = 0;
+
+  b = (struct dxr_build *) calloc (1, sizeof(struct dxr_build));
+  if (!b)
+    return -1;
+  b->D = (uint32_t *) malloc (DXR_SIZE * sizeof(uint32_t));
+  if (!b->D) {
+    free(b);
+    return -1;
+  }
+
+  n = num_fragments(nthreads);
+  b->c_lo[0] = 0;
+  b->ntasks = 1;
+  for (t = 1; t < n && dxr.p_cnt; t++) {
+    c = dxr.P[dxr.p_cnt * t / n].hi >> (64 - DXR_K);
+    if (c > b->c_lo[b->ntasks - 1])
+      b->c_lo[b->ntasks++] = c;
+  }
+  b->c_lo[b->ntasks] = DXR_SIZE;
+
+  run_tasks(nthreads, b->ntasks, build_task, b);
+  if (b->err) {
+    puts("Failed to build DXR chunks");
+    err = -1;
+    goto cleanup;
+  }
+
+  for (t = 0; t < b->ntasks; t++) {
+    b->s_off[t] = s;
+    b->l_off[t] = l;
+    s += b->r[t].s_cnt;
+    l += b->r[t].l_cnt;
+  }
+  if (reserve_ranges(&b->merged, 2 * s + RANGE_SLACK, 2 * l + RANGE_SLACK)) {
+    free_ranges(&b->merged);
+    err = -1;
+    goto cleanup;
+  }
+  run_tasks(nthreads, b->ntasks, merge_task, b);
+  b->merged.s_cnt = s;
+  b->merged.l_cnt = l;
+
+  tbl = (struct dxr_table *) malloc (sizeof(struct dxr_table));
+  if (!tbl) {
+    free_ranges(&b->merged);
+    err = -1;
+    goto cleanup;
+  }
+  tbl->D = b->D;
+  tbl->R = b->merged;
+  b->D = NULL;
+  publish(tbl);
+  dxr.garbage = 0;
+
+cleanup:
+  for (t = 0; t < b->ntasks; t++)
+    free_ranges(&b->r[t]);
+  free(b->D);
+  free(b);
+  return err;
+}
+
+//Remakes the chunks overlapping a prefix after an update. Their new ranges
+//are made on the side and copied past the ranges in use, where no lookup
+//reads, before the entries of D are pointed to them. The old ranges become
+//garbage. Once the garbage outgrows the ranges in use, or the new ranges
+//don't fit in the arrays, everything is rebuilt.
+static int update_chunks(__uint128_t addr, int len)
+{
+  struct dxr_table *t = dxr.T;
+  struct dxr_ranges *R = &t->R, r;
+  uint32_t c_lo = addr >> CNK_BITS;
+  uint32_t c_hi = len >= DXR_K ? c_lo : c_lo + (uint32_t)((1ULL << (DXR_K - len)) - 1);
+  uint32_t base, d, *D;
+  int err = 0;
+
+  for (uint32_t c = c_lo; ; c++) {
+    d = t->D[c];
+    base = d & DXR_BASE;
+    if (!(d & DXR_NH))
+      dxr.garbage += (d & DXR_LONG) ? R->L[base].lo + 1 : R->S[base] + 1;
+    if (c == c_hi)
+      break;
+  }
+
+  memset(&r, 0, sizeof(r));
+  D = (uint32_t *) malloc (((uint64_t)c_hi - c_lo + 1) * sizeof(uint32_t));
+  if (!D || build_chunks(c_lo, c_hi, &r, D)) {
+    err = -1;
+    goto cleanup;
+  }
+  if ((uint64_t)R->s_cnt + r.s_cnt > R->s_size || (uint64_t)R->l_cnt + r.l_cnt > R->l_size ||
+      dxr.garbage * 2 > (uint64_t)R->s_cnt + r.s_cnt + R->l_cnt + r.l_cnt) {
+    err = rebuild(1);
+    goto cleanup;
+  }
+
+  memcpy(&R->S[R->s_cnt], r.S, r.s_cnt * sizeof(uint32_t));
+  memcpy(&R->SN[R->s_cnt], r.SN, r.s_cnt);
+  memcpy(&R->L[R->l_cnt], r.L, r.l_cnt * sizeof(struct dxr_range));
+  memcpy(&R->LN[R->l_cnt], r.LN, r.l_cnt);
+  //The ranges are written before a lookup can find them through D
+  for (uint32_t c = c_lo; ; c++) {
+    d = D[c - c_lo];
+    if (!(d & DXR_NH))
+      d += (d & DXR_LONG) ? R->l_cnt : R->s_cnt;
+    __atomic_store_n(&t->D[c], d, __ATOMIC_RELEASE);
+    if (c == c_hi)
+      break;
+  }
+  R->s_cnt += r.s_cnt;
+  R->l_cnt += r.l_cnt;
+
+cleanup:
+  free(D);
+  free_ranges(&r);
+  return err;
+}
+
+int dxr_init()
+{
+  memset(&dxr, 0, sizeof(dxr));
+  dxr.T = (struct dxr_table *) calloc (1, sizeof(struct dxr_table));
+  dxr.P = (struct dxr_prefix *) malloc (P_SIZE * sizeof(struct dxr_prefix));
+  if (dxr.T)
+    dxr.T->D = (uint32_t *) malloc (DXR_SIZE * sizeof(uint32_t));
+  if (!dxr.T || !dxr.T->D || !dxr.P) {
+    puts("Failed to allocate memory for DXR");
+    return -1;
+  }
+  dxr.p_size = P_SIZE;
+  //No route until the FIB is committed
+  for (uint32_t c = 0; c < DXR_SIZE; c++)
+    dxr.T->D[c] = DXR_NH;
+  return 0;
+}
+
+int dxr_cleanup()
+{
+  free_table(dxr.T);
+  free_table(dxr.retired);
+  free(dxr.P);
+  memset(&dxr, 0, sizeof(dxr));
+  return 0;
+}
+
+//Builds the ranges of the prefixes inserted so far. Later updates remake
+//only the chunks they overlap.
+void dxr_commit()
+{
+  sort_prefixes();
+  if (rebuild(1))
+    puts("Failed to commit DXR");
+  dxr.committed = 1;
+}
+
+//Memory read by the lookups in MB
+double calc_dxr_mem()
+{
+  double mem = DXR_SIZE * sizeof(uint32_t);
+
+  mem += dxr.T->R.s_cnt * (sizeof(uint32_t) + 1);
+  mem += dxr.T->R.l_cnt * (sizeof(struct dxr_range) + 1);
+  return mem / (1024 * 1024);
+}
+
+//Same as calc_dxr_mem(). The sorted prefixes are only read by the updates.
+double calc_dxr_resident(double *ctrl)
+{
+  *ctrl = dxr.p_cnt * sizeof(struct dxr_prefix) / (1024.0 * 1024);
+  return calc_dxr_mem();
+}
+
+int dxr_insert(__uint128_t ip, int prefix_len, int nexthop)
+{
+  struct dxr_prefix *p;
+  int64_t i;
+
+  ip &= pre_mask(prefix_len);
+  if (!dxr.committed) {
+    if (reserve_prefixes(1))
+      return -1;
+    p = &dxr.P[dxr.p_cnt];
+    p->hi = ip >> 64;
+    p->lo = ip;
+    p->len = prefix_len;
+    p->nh = nexthop;
+    p->seq = dxr.p_cnt++;
+    return 0;
+  }
+
+  if ((i = find_prefix(ip, prefix_len)) >= 0) {
+    if (dxr.P[i].nh == nexthop)
+      return 0;
+    dxr.P[i].nh = nexthop;
+  } else {
+    if (reserve_prefixes(1))
+      return -1;
+    i = lower_bound(ip, prefix_len);
+    memmove(&dxr.P[i + 1], &dxr.P[i], (dxr.p_cnt - i) * sizeof(struct dxr_prefix));
+    p = &dxr.P[i];
+    p->hi = ip >> 64;
+    p->lo = ip;
+    p->len = prefix_len;
+    p->nh = nexthop;
+    p->seq = 0;
+    dxr.p_cnt++;
+    dxr.len_cnt[prefix_len]++;
+  }
+  return update_chunks(ip, prefix_len);
+}
+
+//Withdraws a route of a committed FIB. The ranges of the prefix go back to
+//the prefix covering it. Returns -1 if the route doesn't exist.
+int dxr_delete(__uint128_t ip, int prefix_len)
+{
+  int64_t i;
+
+  ip &= pre_mask(prefix_len);
+  if (!dxr.committed || (i = find_prefix(ip, prefix_len)) < 0)
+    return -1;
+  memmove(&dxr.P[i], &dxr.P[i + 1], (dxr.p_cnt - i - 1) * sizeof(struct dxr_prefix));
+  dxr.p_cnt--;
+  dxr.len_cnt[prefix_len]--;
+  return update_chunks(ip, prefix_len);
+}
+
+//Builds DXR from scratch using nthreads threads. This replaces dxr_init();
+//DXR needs to be cleaned up with dxr_cleanup() as usual.
+int dxr_build(__uint128_t *prefixes, uint8_t *pre_lens, uint8_t *pre_nhs, uint64_t cnt, int nthreads)
+{
+  if (dxr_init() < 0 || reserve_prefixes(cnt))
+    return -1;
+  for (uint64_t i = 0; i < cnt; i++)
+    dxr_insert(prefixes[i], pre_lens[i], pre_nhs[i]);
+  sort_prefixes();
+  dxr.committed = 1;
+  return rebuild(nthreads);
+}
+
+//Finds the last range of a chunk starting at or before the key. The number
+//of ranges left halves at each step whatever the comparison is, so the
+//search has no branch to mispredict. The table is loaded once per lookup, so
+//a rebuild that publishes a new one is seen by the next lookup.
+static __inline__ uint8_t _dxr_lookup(uint64_t key_hi, uint64_t key_lo)
+{
+  register const struct dxr_table *t = __atomic_load_n(&dxr.T, __ATOMIC_ACQUIRE);
+  register uint32_t d = t->D[key_hi >> (64 - DXR_K)];
+  register uint32_t base, n, i, half;
+
+  if (d & DXR_NH)
+    return d;
+  base = d & DXR_BASE;
+  i = base + 1;
+  if (!(d & DXR_LONG)) {
+    register const uint32_t *s = t->R.S;
+    register uint32_t key = key_hi >> (32 - DXR_K);
+
+    n = s[base];
+    while (n > 1) {
+      half = n / 2;
+      i = s[i + half] <= key ? i + half : i;
+      n -= half;
+    }
+    return t->R.SN[i];
+  }
+
+  register const struct dxr_range *l = t->R.L;
+
+  n = l[base].lo;
+  while (n > 1) {
+    half = n / 2;
+    i = (l[i + half].hi < key_hi || (l[i + half].hi == key_hi && l[i + half].lo <= key_lo)) ? i + half : i;
+    n -= half;
+  }
+  return t->R.LN[i];
+}
+
+uint8_t dxr_lookup(__uint128_t key) {
+  return _dxr_lookup(key >> 64, key);
+}
+
+//Same as dxr_lookup() on the destination address of a packet, in network
+//byte order
+uint8_t dxr_lookup_addr(const uint8_t *addr) {
+  uint64_t hi, lo;
+
+  memcpy(&hi, addr, 8);
+  memcpy(&lo, addr + 8, 8);
+  return _dxr_lookup(__builtin_bswap64(hi), __builtin_bswap64(lo));
+}
@@ -0,0 +1,123 @@
+/*
+ *   Copyright (c) 2019-2021 MD Iftakharul Islam (Tamim) <tamim@csebuet.org>
+ *
+ *   This program is free software; you can redistribute it and/or modify
+ *   it under the terms of the GNU General Public License as published by
+ *   the Free Software Foundation; either version 3 of the License, or
+ *   (at your option) any later version.
+ *
+ *   This program is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *   GNU General Public License for more details.
+ *
+ *   You should have received a copy of the GNU General Public License
+ *   along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+#ifndef DXR_IP6_H_
+#define DXR_IP6_H_
+
+#include <math.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <time.h>
+#include <stdint.h>
+#include <string.h>
+
+/*
+ *DXR [Zec, Rizzo, Mikuc, "DXR: towards a billion routing lookups per second
+ *in software", SIGCOMM CCR 2012] turns the FIB into address ranges. The
+ *prefixes cut the address space into ranges with a single next-hop, and
+ *adjacent ranges with the same next-hop are merged. The direct table is
+ *indexed by the DXR_K MSBs of the key. A chunk of the direct table covered
+ *by a single range holds its next-hop, and any other chunk points to the
+ *sorted starts of its ranges, which are binary searched.
+ */
+#define DXR_K 16
+#define DXR_SIZE (1U << DXR_K)
+//The short ranges keep the 32 bits of the start after the DXR_K MSBs
+#if DXR_K < 8 || DXR_K > 32
+#error "DXR_K must be between 8 and 32"
+#endif
+
+//An entry of the direct table holds either a next-hop in the 8 LSBs or the
+//index of the ranges of its chunk in S, or in L if DXR_LONG is set
+#define DXR_NH 0x80000000U
+#define DXR_LONG 0x40000000U
+#define DXR_BASE 0x3FFFFFFFU
+
+//Start of a long range. The first one of a chunk holds the number of ranges
+//in lo instead.
+struct dxr_range {
+  uint64_t hi;
+  uint64_t lo;
+};
+
+/*
+ *The ranges of a chunk are short if all of them start on a boundary of
+ *DXR_K + 32 bits, i.e. the chunk has no prefix longer than that, and long
+ *otherwise. S[i] and L[i] hold the number of ranges of the chunk at i, and
+ *the starts of the ranges follow. The next-hop of the range at j is SN[j] or
+ *LN[j]. A chunk changed by an update is appended, and its old ranges are
+ *left as garbage until the next rebuild. The arrays of a table the lookups
+ *read are never reallocated. An update that doesn't fit in them rebuilds the
+ *table instead.
+ */
+struct dxr_ranges {
+  uint32_t *S;
+  uint8_t *SN;
+  uint32_t s_cnt, s_size;
+  struct dxr_range *L;
+  uint8_t *LN;
+  uint32_t l_cnt, l_size;
+};
+
+//A prefix of the FIB. seq orders the duplicates while a FIB is loaded.
+struct dxr_prefix {
+  uint64_t hi;
+  uint64_t lo;
+  uint32_t seq;
+  uint8_t len;
+  uint8_t nh;
+};
+
+//What the lookups read. An update writes its ranges past the ones in use and
+//then repoints the entries of D. A rebuild makes a new table on the side and
+//publishes it with a single pointer store.
+struct dxr_table {
+  //Direct table indexed by the DXR_K MSBs
+  uint32_t *D;
+  struct dxr_ranges R;
+};
+
+struct dxr {
+  struct dxr_table *T;
+  //Table replaced by the last rebuild. A lookup that started before the
+  //rebuild may still read it, so it's only freed by the next rebuild.
+  struct dxr_table *retired;
+  //Entries of T->R no longer pointed to by T->D
+  uint64_t garbage;
+  //The prefixes sorted by address and length. Only the updates and the
+  //rebuilds read them.
+  struct dxr_prefix *P;
+  uint64_t p_cnt, p_size;
+  //Number of prefixes of each length
+  uint32_t len_cnt[129];
+  //The ranges are built by dxr_commit(). Until then the prefixes are only
+  //collected.
+  int committed;
+};
+
+int dxr_init();
+int dxr_cleanup();
+void dxr_commit();
+double calc_dxr_mem();
+double calc_dxr_resident(double *ctrl);
+int dxr_insert(__uint128_t ip, int prefix_len, int nexthop);
+int dxr_delete(__uint128_t ip, int prefix_len);
+int dxr_build(__uint128_t *prefixes, uint8_t *pre_lens, uint8_t *pre_nhs, uint64_t cnt, int nthreads);
+uint8_t dxr_lookup(__uint128_t key);
+uint8_t dxr_lookup_addr(const uint8_t *addr);
+
+#endif /* DXR_IP6_H_ */
@@ -0,0 +1,270 @@
+/*
+ *   Copyright (c) 2019-2021 MD Iftakharul Islam (Tamim) <tamim@csebuet.org>
+ *
+ *   This program is free software; you can redistribute it and/or modify
+ *   it under the terms of the GNU General Public License as published by
+ *   the Free Software Foundation; either version 3 of the License, or
+ *   (at your option) any later version.
+ *
+ *   This program is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *   GNU General Public License for more details.
+ *
+ *   You should have received a copy of the GNU General Public License
+ *   along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+#include "engine.h"
+#include "sail_u_ip6.h"
+#include "sail_l_ip6.h"
+#include "sail_b_ip6.h"
+#include "sail_m_ip6.h"
+#include "cptrie_ip6.h"
+#include "poptrie_ip6.h"
+#include "dxr_ip6.h"
+#include <string.h>
+
+#define STR(X) #X
+#define XSTR(X) STR(X)
+
+static void sail_u_mem(struct engine_mem *m)
+{
+  m->total = calc_sail_u_mem();
+  m->lookup = calc_sail_u_resident(&m->update);
+}
+
+static const struct engine sail_u_engine = {
+  .name = "sail_u",
+  .title = "SAIL-U",
+  .init = sail_u_init,
+  .cleanup = sail_u_cleanup,
+  .commit = sail_u_commit,
+  .insert = sail_u_insert,
+  .remove = sail_u_delete,
+  .build = sail_u_build,
+  .lookup = sail_u_lookup,
+  .lookup_addr = sail_u_lookup_addr,
+  .matched_prefix_len = sail_u_matched_prefix_len,
+  .mem = sail_u_mem,
+  .layout = "packed",
+  .pack = sail_u_pack,
+  .lookup_packed = sail_u_lookup_packed,
+  .packed_mem = calc_sail_u_packed_mem,
+  .save = sail_u_save,
+  .load = sail_u_load,
+  .lookup_loop = lookup_loop<sail_u_lookup>,
+  .pkt_loop = pkt_loop<sail_u_lookup>,
+  .addr_loop = addr_loop<sail_u_lookup_addr>,
+  .packed_loop = lookup_loop<sail_u_lookup_packed>,
+  .cached_loop = cached_loop<sail_u_lookup>,
+  .burst_loop = burst_loop<sail_u_lookup>,
+  .latency_loop = latency_loop<sail_u_lookup>,
+};
+
+static void sail_l_mem(struct engine_mem *m)
+{
+  m->total = calc_sail_l_mem();
+  m->lookup = calc_sail_l_resident(&m->update);
+}
+
+static const struct engine sail_l_engine = {
+  .name = "sail_l",
+  .title = "SAIL-L",
+  .init = sail_l_init,
+  .cleanup = sail_l_cleanup,
+  .commit = sail_l_commit,
+  .insert = sail_l_insert,
+  .remove = sail_l_delete,
+  .build = sail_l_build,
+  .lookup = sail_l_lookup,
+  .lookup_addr = sail_l_lookup_addr,
+  .lookup_batch = sail_l_lookup_batch,
+  .max_batch = 8 * SAIL_L_MAX_VECS,
+  .matched_prefix_len = sail_l_matched_prefix_len,
+  .mem = sail_l_mem,
+  .layout = "packed",
+  .pack = sail_l_pack,
+  .lookup_packed = sail_l_lookup_packed,
+  .packed_mem = calc_sail_l_packed_mem,
+  .save = sail_l_save,
+  .load = sail_l_load,
+  .lookup_loop = lookup_loop<sail_l_lookup>,
+  .pkt_loop = pkt_loop<sail_l_lookup>,
+  .addr_loop = addr_loop<sail_l_lookup_addr>,
+  .packed_loop = lookup_loop<sail_l_lookup_packed>,
+  .cached_loop = cached_loop<sail_l_lookup>,
+  .burst_loop = burst_loop<sail_l_lookup>,
+  .latency_loop = latency_loop<sail_l_lookup>,
+};
+
+static void poptrie_mem(struct engine_mem *m)
+{
+  m->total = calc_poptrie_mem();
+}
+
+static const struct engine poptrie_engine = {
+  .name = "poptrie",
+  .title = "Poptrie",
+  .config = "s = " XSTR(POPTRIE_S),
+  .init = poptrie_init,
+  .cleanup = poptrie_cleanup,
+  .commit = poptrie_commit,
+  .insert = poptrie_insert,
+  .remove = poptrie_delete,
+  .build = poptrie_build,
+  .lookup = poptrie_lookup,
+  .lookup64 = poptrie_lookup64,
+  .lookup_batch = poptrie_lookup_batch,
+  .max_batch = POPTRIE_MAX_BATCH,
+  .matched_prefix_len = poptrie_matched_prefix_len,
+  .mem = poptrie_mem,
+  .layout = "compact",
+  .pack = poptrie_compact,
+  .lookup_packed = poptrie_lookup_compact,
+  .packed_mem = calc_poptrie_compact_mem,
+  .lookup_loop = lookup_loop<poptrie_lookup>,
+  .pkt_loop = pkt_loop<poptrie_lookup>,
+  .lookup64_loop = lookup64_loop<poptrie_lookup64>,
+  .packed_loop = lookup_loop<poptrie_lookup_compact>,
+  .cached_loop = cached_loop<poptrie_lookup>,
+  .burst_loop = burst_loop<poptrie_lookup>,
+  .latency_loop = latency_loop<poptrie_lookup>,
+};
+
+static void cptrie_mem(struct engine_mem *m)
+{
+  m->total = calc_cptrie_mem();
+}
+
+static const struct engine cptrie_engine = {
+  .name = "cptrie",
+  .title = "CP-Trie",
+  .init = cptrie_init,
+  .cleanup = cptrie_cleanup,
+  .insert = cptrie_insert,
+  .build = cptrie_build,
+  .lookup = cptrie_lookup,
+  .lookup_addr = cptrie_lookup_addr,
+  .lookup64 = cptrie_lookup64,
+  .matched_prefix_len = cptrie_matched_prefix_len,
+  .mem = cptrie_mem,
+  .lookup_loop = lookup_loop<cptrie_lookup>,
+  .pkt_loop = pkt_loop<cptrie_lookup>,
+  .addr_loop = addr_loop<cptrie_lookup_addr>,
+  .lookup64_loop = lookup64_loop<cptrie_lookup64>,
+  .cached_loop = cached_loop<cptrie_lookup>,
+  .burst_loop = burst_loop<cptrie_lookup>,
+  .latency_loop = latency_loop<cptrie_lookup>,
+};
+
+static void sail_b_mem(struct engine_mem *m)
+{
+  m->total = calc_sail_b_mem();
+  m->onchip = calc_sail_b_onchip_mem();
+}
+
+static const struct engine sail_b_engine = {
+  .name = "sail_b",
+  .title = "SAIL-B",
+  .init = sail_b_init,
+  .cleanup = sail_b_cleanup,
+  .insert = sail_b_insert,
+  .lookup = sail_b_lookup,
+  .mem = sail_b_mem,
+  .lookup_loop = lookup_loop<sail_b_lookup>,
+  .pkt_loop = pkt_loop<sail_b_lookup>,
+  .cached_loop = cached_loop<sail_b_lookup>,
+  .burst_loop = burst_loop<sail_b_lookup>,
+  .latency_loop = latency_loop<sail_b_lookup>,
+};
+
+//The operations of a single FIB go to FIB 0 of SAIL-M
+static int sail_m_init0()
+{
+  return sail_m_init(1);
+}
+
+static int sail_m_insert0(__uint128_t ip, int prefix_len, int nexthop)
+{
+  return sail_m_insert(0, ip, prefix_len, nexthop);
+}
+
+static uint8_t sail_m_lookup0(__uint128_t key)
+{
+  return sail_m_lookup(0, key);
+}
+
+static void sail_m_mem(struct engine_mem *m)
+{
+  m->total = calc_sail_m_mem();
+}
+
+static const struct engine sail_m_engine = {
+  .name = "sail_m",
+  .title = "SAIL-M",
+  .init = sail_m_init0,
+  .cleanup = sail_m_cleanup,
+  .commit = sail_m_commit,
+  .insert = sail_m_insert0,
+  .lookup = sail_m_lookup0,
+  .mem = sail_m_mem,
+  .max_fibs = SAIL_M_MAX_FIBS,
+  .init_fibs = sail_m_init,
+  .insert_fib = sail_m_insert,
+  .lookup_fib = sail_m_lookup,
+  .lookup_loop = lookup_loop<sail_m_lookup0>,
+  .pkt_loop = pkt_loop<sail_m_lookup0>,
+  .fib_loop = fib_loop<sail_m_lookup>,
+  .cached_loop = cached_loop<sail_m_lookup0>,
+  .burst_loop = burst_loop<sail_m_lookup0>,
+  .latency_loop = latency_loop<sail_m_lookup0>,
+};
+
+static void dxr_mem(struct engine_mem *m)
+{
+  m->total = calc_dxr_mem();
+  m->lookup = calc_dxr_resident(&m->update);
+}
+
+static const struct engine dxr_engine = {
+  .name = "dxr",
+  .title = "DXR",
+  .config = "k = " XSTR(DXR_K),
+  .init = dxr_init,
+  .cleanup = dxr_cleanup,
+  .commit = dxr_commit,
+  .insert = dxr_insert,
+  .remove = dxr_delete,
+  .build = dxr_build,
+  .lookup = dxr_lookup,
+  .lookup_addr = dxr_lookup_addr,
+  .mem = dxr_mem,
+  .lookup_loop = lookup_loop<dxr_lookup>,
+  .pkt_loop = pkt_loop<dxr_lookup>,
+  .addr_loop = addr_loop<dxr_lookup_addr>,
+  .cached_loop = cached_loop<dxr_lookup>,
+  .burst_loop = burst_loop<dxr_lookup>,
+  .latency_loop = latency_loop<dxr_lookup>,
+};
+
+//Every algorithm measured by the benchmark, in the order of the results
+const struct engine *engines[] = {
+  &sail_u_engine,
+  &sail_l_engine,
+  &poptrie_engine,
+  &cptrie_engine,
+  &sail_b_engine,
+  &sail_m_engine,
+  &dxr_engine,
+};
+const int num_engines = sizeof(engines) / sizeof(engines[0]);
+
+const struct engine *engine_find(const char *name)
+{
+  for (int e = 0; e < num_engines; e++) {
+    if (!strcmp(engines[e]->name, name))
+      return engines[e];
+  }
+  return NULL;
+}
@@ -0,0 +1,228 @@
+/*
+ *   Copyright (c) 2019-2021 MD Iftakharul Islam (Tamim) <tamim@csebuet.org>
+ *
+ *   This program is free software; you can redistribute it and/or modify
+ *   it under the terms of the GNU General Public License as published by
+ *   the Free Software Foundation; either version 3 of the License, or
+ *   (at your option) any later version.
+ *
+ *   This program is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *   GNU General Public License for more details.
+ *
+ *   You should have received a copy of the GNU General Public License
+ *   along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+#ifndef ENGINE_H_
+#define ENGINE_H_
+
+#include <stdint.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include "flow_cache.h"
+#include "stopwatch.h"
+
+//Memory consumption in MB. The parts an algorithm doesn't tell apart are 0.
+struct engine_mem {
+  double total;
+  //Resident memory read by the lookups and the memory only the updates touch
+  double lookup;
+  double update;
+  //Memory that would be on chip in a hardware implementation
+  double onchip;
+};
+
+/*
+ *Operations of a lookup algorithm. The benchmark runs every algorithm in
+ *engines[] through them, so a new algorithm only needs an entry there. The
+ *optional operations are NULL if the algorithm doesn't have them.
+ *
+ *The timed loops are instantiated from the templates below with the lookup
+ *as a template argument. So they call the lookup directly rather than
+ *through a function pointer, and inline it when its body is visible.
+ */
+struct engine {
+  //Name for -e and in the results, and the name printed
+  const char *name;
+  const char *title;
+  //Build time configuration printed along with the memory, optional
+  const char *config;
+
+  int (*init)();
+  int (*cleanup)();
+  //Rebuilds the lookup arrays once the FIB is loaded, optional
+  void (*commit)();
+  int (*insert)(__uint128_t ip, int prefix_len, int nexthop);
+  //Route withdrawal, optional
+  int (*remove)(__uint128_t ip, int prefix_len);
+  //Builds the whole FIB from scratch with nthreads threads, optional
+  int (*build)(__uint128_t *prefixes, uint8_t *pre_lens, uint8_t *pre_nhs, uint64_t cnt, int nthreads);
+
+  uint8_t (*lookup)(__uint128_t key);
+  //Lookup straight from the destination address of a packet, optional
+  uint8_t (*lookup_addr)(const uint8_t *addr);
+  //64-bit fast-path lookup, optional
+  uint8_t (*lookup64)(uint64_t key_hi, uint64_t key_lo);
+  //Looks up cnt keys with up to width lookups in flight, optional
+  void (*lookup_batch)(const __uint128_t *keys, uint8_t *nhs, uint64_t cnt, int width);
+  int max_batch;
+  //Length of the matched prefix, optional
+  uint8_t (*matched_prefix_len)(__uint128_t key);
+  void (*mem)(struct engine_mem *m);
+
+  //Read-only copy of the FIB in another layout, optional. pack() fails if
+  //the FIB doesn't fit in it, and any update drops it.
+  const char *layout;
+  int (*pack)();
+  uint8_t (*lookup_packed)(__uint128_t key);
+  double (*packed_mem)();
+  //Serialization of the packed layout. load() reads a file written by save()
+  //in place of the current one. Optional.
+  int (*save)(FILE *fp);
+  int (*load)(FILE *fp);
+
+  //Several FIBs in one structure, e.g. one for each virtual router. The
+  //operations above work on FIB 0. Optional, max_fibs is 0 without them.
+  int max_fibs;
+  int (*init_fibs)(int fibs);
+  int (*insert_fib)(int fib, __uint128_t ip, int prefix_len, int nexthop);
+  uint8_t (*lookup_fib)(int fib, __uint128_t key);
+
+  //Timed loops instantiated from the templates below. The optional ones go
+  //with the optional lookups.
+  uint8_t (*lookup_loop)(const __uint128_t *keys, uint64_t cnt, int repeat);
+  uint8_t (*pkt_loop)(const uint8_t *pkts, uint64_t cnt, uint32_t size, uint32_t off);
+  uint8_t (*addr_loop)(const uint8_t *pkts, uint64_t cnt, uint32_t size, uint32_t off);
+  uint8_t (*lookup64_loop)(const __uint128_t *keys, uint64_t cnt, int repeat);
+  uint8_t (*packed_loop)(const __uint128_t *keys, uint64_t cnt, int repeat);
+  uint8_t (*fib_loop)(const __uint128_t *keys, uint64_t cnt, int fibs);
+  uint8_t (*cached_loop)(struct flow_cache *fc, const __uint128_t *keys, uint64_t cnt, int repeat);
+  uint8_t (*burst_loop)(const __uint128_t *keys, uint8_t *nhs, uint64_t cnt);
+  uint8_t (*latency_loop)(const __uint128_t *keys, uint64_t cnt, uint64_t *cycles);
+};
+
+extern const struct engine *engines[];
+extern const int num_engines;
+
+const struct engine *engine_find(const char *name);
+
+//Converts the destination address of a packet, in network byte order
+static __inline__ __uint128_t addr_to_key(const uint8_t *addr)
+{
+  __uint128_t a = 0;
+
+  for (int i = 0; i < 16; i++)
+    a = (a << 8) | addr[i];
+  return a;
+}
+
+//Looks up each key repeat times. It returns the last next-hop, so the
+//lookups can't be dropped.
+template <uint8_t (*lookup)(__uint128_t)>
+uint8_t lookup_loop(const __uint128_t *keys, uint64_t cnt, int repeat)
+{
+  register uint64_t i;
+  register int j;
+  register uint8_t nh = 0;
+
+  for (i = 0; i < cnt; i++) {
+    for (j = 0; j < repeat; j++)
+      nh = lookup(keys[i]);
+  }
+  return nh;
+}
+
+//Looks up the destination of cnt packets of size bytes, at off bytes of each
+template <uint8_t (*lookup)(__uint128_t)>
+uint8_t pkt_loop(const uint8_t *pkts, uint64_t cnt, uint32_t size, uint32_t off)
+{
+  register uint64_t i;
+  register uint8_t nh = 0;
+
+  for (i = 0; i < cnt; i++)
+    nh = lookup(addr_to_key(pkts + i * size + off));
+  return nh;
+}
+
+template <uint8_t (*lookup_addr)(const uint8_t *)>
+uint8_t addr_loop(const uint8_t *pkts, uint64_t cnt, uint32_t size, uint32_t off)
+{
+  register uint64_t i;
+  register uint8_t nh = 0;
+
+  for (i = 0; i < cnt; i++)
+    nh = lookup_addr(pkts + i * size + off);
+  return nh;
+}
+
+template <uint8_t (*lookup64)(uint64_t, uint64_t)>
+uint8_t lookup64_loop(const __uint128_t *keys, uint64_t cnt, int repeat)
+{
+  register uint64_t i;
+  register int j;
+  register uint8_t nh = 0;
+
+  for (i = 0; i < cnt; i++) {
+    for (j = 0; j < repeat; j++)
+      nh = lookup64(keys[i] >> 64, keys[i]);
+  }
+  return nh;
+}
+
+//Looks up each key in the next FIB
+template <uint8_t (*lookup_fib)(int, __uint128_t)>
+uint8_t fib_loop(const __uint128_t *keys, uint64_t cnt, int fibs)
+{
+  register uint64_t i;
+  register uint8_t nh = 0;
+
+  for (i = 0; i < cnt; i++)
+    nh = lookup_fib(i % fibs, keys[i]);
+  return nh;
+}
+
+//Looks up each key repeat times through a flow cache
+template <uint8_t (*lookup)(__uint128_t)>
+uint8_t cached_loop(struct flow_cache *fc, const __uint128_t *keys, uint64_t cnt, int repeat)
+{
+  register uint64_t i;
+  register int j;
+  register uint8_t nh = 0;
+
+  for (i = 0; i < cnt; i++) {
+    for (j = 0; j < repeat; j++)
+      nh = flow_cache_lookup<lookup>(fc, keys[i]);
+  }
+  return nh;
+}
+
+//Looks up the destinations of a burst of packets and keeps their next-hops
+template <uint8_t (*lookup)(__uint128_t)>
+uint8_t burst_loop(const __uint128_t *keys, uint8_t *nhs, uint64_t cnt)
+{
+  register uint64_t i;
+
+  for (i = 0; i < cnt; i++)
+    nhs[i] = lookup(keys[i]);
+  return cnt ? nhs[cnt - 1] : 0;
+}
+
+//Times the lookups one by one and keeps the TSC cycles of each
+template <uint8_t (*lookup)(__uint128_t)>
+uint8_t latency_loop(const __uint128_t *keys, uint64_t cnt, uint64_t *cycles)
+{
+  register uint64_t i, t0, t1;
+  register uint8_t nh = 0;
+
+  for (i = 0; i < cnt; i++) {
+    t0 = tsc_begin();
+    nh ^= lookup(keys[i]);
+    t1 = tsc_end();
+    cycles[i] = t1 - t0;
+  }
+  return nh;
+}
+
+#endif /* ENGINE_H_ */
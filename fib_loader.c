@@ -0,0 +1,300 @@
+/*
+ *   Copyright (c) 2019-2021 MD Iftakharul Islam (Tamim) <tamim@csebuet.org>
+ *
+ *   This program is free software; you can redistribute it and/or modify
+ *   it under the terms of the GNU General Public License as published by
+ *   the Free Software Foundation; either version 3 of the License, or
+ *   (at your option) any later version.
+ *
+ *   This program is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *   GNU General Public License for more details.
+ *
+ *   You should have received a copy of the GNU General Public License
+ *   along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+#include "fib_loader.h"
+#include "parallel_build.h"
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <arpa/inet.h>
+
+//Each thread parses a few chunks so that a slow chunk doesn't hold the others
+#define CHUNKS_PER_THREAD 4
+#define MAX_CHUNKS 256
+
+struct chunk {
+  const char *begin;
+  const char *end;
+  struct fib fib;
+  int err;
+};
+
+struct load_arg {
+  struct chunk *chunks;
+};
+
+static int fib_grow(struct fib *fib)
+{
+  uint64_t size = fib->size ? fib->size * 2 : 4096;
+  __uint128_t *prefixes;
+  uint8_t *pre_lens, *pre_nhs;
+
+  prefixes = (__uint128_t *) realloc (fib->prefixes, size * sizeof(__uint128_t));
+  if (!prefixes)
+    return -1;
+  fib->prefixes = prefixes;
+  pre_lens = (uint8_t *) realloc (fib->pre_lens, size);
+  if (!pre_lens)
+    return -1;
+  fib->pre_lens = pre_lens;
+  pre_nhs = (uint8_t *) realloc (fib->pre_nhs, size);
+  if (!pre_nhs)
+    return -1;
+  fib->pre_nhs = pre_nhs;
+  fib->size = size;
+  return 0;
+}
+
+static int hex_val(char c)
+{
+  if (c >= '0' && c <= '9')
+    return c - '0';
+  if (c >= 'a' && c <= 'f')
+    return c - 'a' + 10;
+  if (c >= 'A' && c <= 'F')
+    return c - 'A' + 10;
+  return -1;
+}
+
+//Parses an IPv6 address in [p, end) into host byte order. Returns -2 for an
+//address with an embedded IPv4 suffix. It is rare in FIBs and is left to
+//inet_pton.
+static int parse_ipv6(const char *p, const char *end, __uint128_t *addr)
+{
+  uint16_t groups[8];
+  int n = 0, gap = -1, digits, v, d, i;
+
+  if (end - p >= 2 && p[0] == ':' && p[1] == ':') {
+    gap = 0;
+    p += 2;
+  }
+  while (p < end) {
+    v = 0;
+    for (digits = 0; p < end && (d = hex_val(*p)) >= 0; p++, digits++)
+      v = (v << 4) | d;
+    if (p < end && *p == '.')
+      return -2;
+    if (!digits || digits > 4 || n == 8)
+      return -1;
+    groups[n++] = v;
+    if (p == end)
+      break;
+    if (*p++ != ':')
+      return -1;
+    if (p < end && *p == ':') {
+      if (gap >= 0)
+        return -1;
+      gap = n;
+      p++;
+    } else if (p == end) {
+      return -1;
+    }
+  }
+  if ((gap < 0 && n != 8) || (gap >= 0 && n == 8))
+    return -1;
+
+  *addr = 0;
+  for (i = 0; i < n; i++) {
+    if (i == gap)
+      *addr <<= 16 * (8 - n);
+    *addr = (*addr << 16) | groups[i];
+  }
+  //Shifting a __uint128_t by 128 is undefined, and "::" is 0 anyway
+  if (gap == n && n)
+    *addr <<= 16 * (8 - n);
+  return 0;
+}
+
+//Parses a decimal number
+static const char *parse_num(const char *p, const char *end, int *num)
+{
+  const char *start = p;
+
+  *num = 0;
+  for (; p < end && *p >= '0' && *p <= '9' && p - start < 4; p++)
+    *num = *num * 10 + (*p - '0');
+  return p == start ? NULL : p;
+}
+
+//Parses "prefix/length<TAB>nexthop" in [p, end). The next-hop is optional.
+static int parse_route(const char *p, const char *end, __uint128_t *prefix, int *len, int *nh)
+{
+  const char *slash = (const char *) memchr(p, '/', end - p);
+  struct in6_addr v6addr;
+  char buff[64];
+  int ret;
+
+  if (!slash)
+    return -1;
+  ret = parse_ipv6(p, slash, prefix);
+  if (ret == -2) {
+    if (slash - p >= (long)sizeof(buff))
+      return -1;
+    memcpy(buff, p, slash - p);
+    buff[slash - p] = 0;
+    if (inet_pton(AF_INET6, buff, &v6addr) != 1)
+      return -1;
+    *prefix = 0;
+    for (int i = 0; i < 16; i++)
+      *prefix = (*prefix << 8) | v6addr.s6_addr[i];
+  } else if (ret) {
+    return -1;
+  }
+
+  p = parse_num(slash + 1, end, len);
+  if (!p || *len > 128)
+    return -1;
+  *nh = 0;
+  while (p < end && (*p == '\t' || *p == ' '))
+    p++;
+  if (p < end) {
+    p = parse_num(p, end, nh);
+    if (!p || *nh > 255)
+      return -1;
+  }
+  while (p < end && (*p == '\t' || *p == ' ' || *p == '\r'))
+    p++;
+  return p == end ? 0 : -1;
+}
+
+static void parse_chunk(int task, void *arg)
+{
+  struct chunk *c = &((struct load_arg *) arg)->chunks[task];
+  const char *p = c->begin, *eol;
+  __uint128_t prefix;
+  int len, nh;
+
+  while (p < c->end) {
+    eol = (const char *) memchr(p, '\n', c->end - p);
+    if (!eol)
+      eol = c->end;
+    //Skip empty lines
+    if (eol == p || (eol == p + 1 && *p == '\r')) {
+      p = eol + 1;
+      continue;
+    }
+    if (parse_route(p, eol, &prefix, &len, &nh)) {
+      printf ("Invalid route %.*s\n", (int)(eol - p), p);
+      c->err = -1;
+      return;
+    }
+    if (c->fib.cnt == c->fib.size && fib_grow(&c->fib)) {
+      puts("Failed to allocate memory for the FIB");
+      c->err = -1;
+      return;
+    }
+    c->fib.prefixes[c->fib.cnt] = prefix;
+    c->fib.pre_lens[c->fib.cnt] = len;
+    c->fib.pre_nhs[c->fib.cnt] = nh;
+    c->fib.cnt++;
+    p = eol + 1;
+  }
+}
+
+int fib_load(const char *file, struct fib *fib, int nthreads)
+{
+  struct chunk chunks[MAX_CHUNKS];
+  struct load_arg arg;
+  const char *data, *p, *end;
+  struct stat st;
+  uint64_t cnt = 0;
+  int fd, num_chunks, i, ret = 0;
+
+  memset(fib, 0, sizeof(*fib));
+  if ((fd = open(file, O_RDONLY)) < 0) {
+    puts("File not exists");
+    return -1;
+  }
+  if (fstat(fd, &st)) {
+    close(fd);
+    return -1;
+  }
+  if (!st.st_size) {
+    close(fd);
+    return 0;
+  }
+  data = (const char *) mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE | MAP_POPULATE, fd, 0);
+  close(fd);
+  if (data == MAP_FAILED) {
+    puts("Failed to map the FIB file");
+    return -1;
+  }
+  end = data + st.st_size;
+
+  //Split the file into chunks that end right after a newline
+  num_chunks = nthreads * CHUNKS_PER_THREAD;
+  if (num_chunks < 1)
+    num_chunks = 1;
+  if (num_chunks > MAX_CHUNKS)
+    num_chunks = MAX_CHUNKS;
+  memset(chunks, 0, sizeof(chunks));
+  p = data;
+  for (i = 0; i < num_chunks && p < end; i++) {
+    chunks[i].begin = p;
+    p = data + (uint64_t)st.st_size * (i + 1) / num_chunks;
+    if (p < chunks[i].begin)
+      p = chunks[i].begin;
+    p = (const char *) memchr(p, '\n', end - p);
+    p = p ? p + 1 : end;
+    chunks[i].end = p;
+  }
+  num_chunks = i;
+
+  arg.chunks = chunks;
+  if (run_tasks(nthreads, num_chunks, parse_chunk, &arg))
+    ret = -1;
+
+  //Concatenate the chunks in file order
+  for (i = 0; i < num_chunks; i++) {
+    if (chunks[i].err)
+      ret = -1;
+    cnt += chunks[i].fib.cnt;
+  }
+  if (!ret && cnt) {
+    fib->prefixes = (__uint128_t *) malloc (cnt * sizeof(__uint128_t));
+    fib->pre_lens = (uint8_t *) malloc (cnt);
+    fib->pre_nhs = (uint8_t *) malloc (cnt);
+    if (!fib->prefixes || !fib->pre_lens || !fib->pre_nhs) {
+      puts("Failed to allocate memory for the FIB");
+      ret = -1;
+    }
+  }
+  for (i = 0; i < num_chunks; i++) {
+    if (!ret) {
+      memcpy(fib->prefixes + fib->cnt, chunks[i].fib.prefixes, chunks[i].fib.cnt * sizeof(__uint128_t));
+      memcpy(fib->pre_lens + fib->cnt, chunks[i].fib.pre_lens, chunks[i].fib.cnt);
+      memcpy(fib->pre_nhs + fib->cnt, chunks[i].fib.pre_nhs, chunks[i].fib.cnt);
+      fib->cnt += chunks[i].fib.cnt;
+    }
+    fib_free(&chunks[i].fib);
+  }
+  fib->size = fib->cnt;
+  munmap((void *)data, st.st_size);
+  if (ret)
+    fib_free(fib);
+  return ret;
+}
+
+void fib_free(struct fib *fib)
+{
+  free(fib->prefixes);
+  free(fib->pre_lens);
+  free(fib->pre_nhs);
+  memset(fib, 0, sizeof(*fib));
+}
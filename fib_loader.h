@@ -0,0 +1,46 @@
+/*
+ *   Copyright (c) 2019-2021 MD Iftakharul Islam (Tamim) <tamim@csebuet.org>
+ *
+ *   This program is free software; you can redistribute it and/or modify
+ *   it under the terms of the GNU General Public License as published by
+ *   the Free Software Foundation; either version 3 of the License, or
+ *   (at your option) any later version.
+ *
+ *   This program is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *   GNU General Public License for more details.
+ *
+ *   You should have received a copy of the GNU General Public License
+ *   along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+#ifndef FIB_LOADER_H_
+#define FIB_LOADER_H_
+
+#include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+
+//Prefixes of a FIB in file order
+struct fib {
+  __uint128_t *prefixes;
+  //Prefix lengths
+  uint8_t *pre_lens;
+  //Next-hops for the prefixes
+  uint8_t *pre_nhs;
+  uint64_t cnt;
+  //Allocated entries
+  uint64_t size;
+};
+
+/*
+ *Loads a FIB file with one "prefix/length<TAB>nexthop" route per line. The
+ *file is mapped and split into line-aligned chunks which are parsed by
+ *nthreads threads. The routes stay in file order, so a later duplicate still
+ *overrides an earlier one on insertion.
+ */
+int fib_load(const char *file, struct fib *fib, int nthreads);
+void fib_free(struct fib *fib);
+
+#endif /* FIB_LOADER_H_ */
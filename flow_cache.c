@@ -0,0 +1,77 @@
+/*
+ *   Copyright (c) 2019-2021 MD Iftakharul Islam (Tamim) <tamim@csebuet.org>
+ *
+ *   This program is free software; you can redistribute it and/or modify
+ *   it under the terms of the GNU General Public License as published by
+ *   the Free Software Foundation; either version 3 of the License, or
+ *   (at your option) any later version.
+ *
+ *   This program is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *   GNU General Public License for more details.
+ *
+ *   You should have received a copy of the GNU General Public License
+ *   along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+#include "flow_cache.h"
+#include <string.h>
+
+volatile uint32_t flow_cache_gen = 1;
+
+//The cache has at least the given number of entries, rounded up to a power
+//of two number of sets
+int flow_cache_init(struct flow_cache *fc, uint64_t entries, bool key64, uint8_t (*lookup)(__uint128_t))
+{
+  uint64_t num_sets = 1;
+  void *sets;
+
+  memset(fc, 0, sizeof(*fc));
+  while (num_sets * FLOW_CACHE_WAYS < entries)
+    num_sets <<= 1;
+  if (posix_memalign(&sets, 64, num_sets * sizeof(struct flow_cache_set))) {
+    puts("Failed to allocate memory for flow cache");
+    return -1;
+  }
+  //Generation 0 is never current, so every set starts empty
+  memset(sets, 0, num_sets * sizeof(struct flow_cache_set));
+  fc->sets = (struct flow_cache_set *) sets;
+  fc->mask = num_sets - 1;
+  fc->key64 = key64;
+  fc->lookup = lookup;
+  return 0;
+}
+
+void flow_cache_free(struct flow_cache *fc)
+{
+  free(fc->sets);
+  memset(fc, 0, sizeof(*fc));
+}
+
+//Fills a way of the set with the next-hop of a missed key. A set from an
+//older generation is emptied first.
+uint8_t flow_cache_fill(struct flow_cache *fc, struct flow_cache_set *s, uint32_t gen, __uint128_t key, uint8_t nh)
+{
+  register int w;
+
+  fc->misses++;
+  if (s->gen != gen) {
+    s->gen = gen;
+    s->valid = 0;
+    s->next = 0;
+  }
+  w = s->next;
+  s->next = (w + 1) % FLOW_CACHE_WAYS;
+  s->hi[w] = key >> 64;
+  s->lo[w] = fc->key64 ? 0 : (uint64_t)key;
+  s->nh[w] = nh;
+  s->valid |= 1U << w;
+  return nh;
+}
+
+//Looks up the algorithm for a missed key and caches the next-hop
+uint8_t flow_cache_miss(struct flow_cache *fc, struct flow_cache_set *s, uint32_t gen, __uint128_t key)
+{
+  return flow_cache_fill(fc, s, gen, key, fc->lookup(key));
+}
@@ -0,0 +1,130 @@
+/*
+ *   Copyright (c) 2019-2021 MD Iftakharul Islam (Tamim) <tamim@csebuet.org>
+ *
+ *   This program is free software; you can redistribute it and/or modify
+ *   it under the terms of the GNU General Public License as published by
+ *   the Free Software Foundation; either version 3 of the License, or
+ *   (at your option) any later version.
+ *
+ *   This program is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *   GNU General Public License for more details.
+ *
+ *   You should have received a copy of the GNU General Public License
+ *   along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+#ifndef FLOW_CACHE_H_
+#define FLOW_CACHE_H_
+
+#include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+
+/*
+ *Set-associative cache of lookup results in front of an algorithm. Each
+ *thread has its own cache, so neither lookups nor fills need any locking.
+ *The key is the destination address or, when the FIB has no prefix longer
+ *than 64, just its upper 64 bits, which lets all the hosts of a /64 share an
+ *entry.
+ *
+ *A set holds FLOW_CACHE_WAYS entries in two cache lines. The upper halves of
+ *the keys, the next-hops and the metadata are in the first line, so a /64
+ *keyed cache touches only one line per lookup.
+ *
+ *Invalidation is by generation. A FIB change bumps flow_cache_gen, and a set
+ *stamped with an older generation is treated as empty. So invalidating the
+ *caches of all the threads is a single store.
+ */
+#define FLOW_CACHE_WAYS 4
+
+struct flow_cache_set {
+  uint64_t hi[FLOW_CACHE_WAYS];
+  uint32_t gen;
+  uint8_t nh[FLOW_CACHE_WAYS];
+  //Bitmap of valid ways
+  uint8_t valid;
+  //Next way to be replaced (round robin)
+  uint8_t next;
+  uint64_t lo[FLOW_CACHE_WAYS] __attribute__((aligned(64)));
+} __attribute__((aligned(64)));
+
+struct flow_cache {
+  struct flow_cache_set *sets;
+  uint64_t mask;
+  //Keyed by the upper 64 bits of the destination only
+  bool key64;
+  uint8_t (*lookup)(__uint128_t);
+  uint64_t hits;
+  uint64_t misses;
+};
+
+//Generation of the FIB. It starts at 1 so that a zeroed set is stale.
+extern volatile uint32_t flow_cache_gen;
+
+int flow_cache_init(struct flow_cache *fc, uint64_t entries, bool key64, uint8_t (*lookup)(__uint128_t));
+void flow_cache_free(struct flow_cache *fc);
+uint8_t flow_cache_fill(struct flow_cache *fc, struct flow_cache_set *s, uint32_t gen, __uint128_t key, uint8_t nh);
+uint8_t flow_cache_miss(struct flow_cache *fc, struct flow_cache_set *s, uint32_t gen, __uint128_t key);
+
+//Must be called whenever the FIB changes
+static __inline__ void flow_cache_invalidate()
+{
+  __sync_fetch_and_add(&flow_cache_gen, 1);
+}
+
+static __inline__ uint64_t flow_cache_hash(uint64_t hi, uint64_t lo)
+{
+  //Multiplicative hashing. The upper bits of the product are the best mixed.
+  return ((hi ^ (lo * 0x9E3779B97F4A7C15ULL)) * 0xC2B2AE3D27D4EB4FULL) >> 20;
+}
+
+static __inline__ struct flow_cache_set *flow_cache_set_of(struct flow_cache *fc, __uint128_t key)
+{
+  return &fc->sets[flow_cache_hash(key >> 64, fc->key64 ? 0 : (uint64_t)key) & fc->mask];
+}
+
+//Returns the way of the set holding the key, or -1 if it isn't cached
+static __inline__ int flow_cache_find(struct flow_cache *fc, struct flow_cache_set *s, uint32_t gen, __uint128_t key)
+{
+  register uint64_t hi = key >> 64, lo = fc->key64 ? 0 : (uint64_t)key;
+  register int w;
+
+  if (s->gen == gen) {
+    for (w = 0; w < FLOW_CACHE_WAYS; w++) {
+      if ((s->valid & (1U << w)) && s->hi[w] == hi && (fc->key64 || s->lo[w] == lo)) {
+        fc->hits++;
+        return w;
+      }
+    }
+  }
+  return -1;
+}
+
+static __inline__ uint8_t flow_cache_lookup(struct flow_cache *fc, __uint128_t key)
+{
+  register struct flow_cache_set *s = flow_cache_set_of(fc, key);
+  register uint32_t gen = flow_cache_gen;
+  register int w = flow_cache_find(fc, s, gen, key);
+
+  if (w >= 0)
+    return s->nh[w];
+  return flow_cache_miss(fc, s, gen, key);
+}
+
+//Same as above with the algorithm as a template argument, so a miss calls
+//it directly rather than through fc->lookup
+template <uint8_t (*lookup)(__uint128_t)>
+static __inline__ uint8_t flow_cache_lookup(struct flow_cache *fc, __uint128_t key)
+{
+  register struct flow_cache_set *s = flow_cache_set_of(fc, key);
+  register uint32_t gen = flow_cache_gen;
+  register int w = flow_cache_find(fc, s, gen, key);
+
+  if (w >= 0)
+    return s->nh[w];
+  return flow_cache_fill(fc, s, gen, key, lookup(key));
+}
+
+#endif /* FLOW_CACHE_H_ */
@@ -0,0 +1,80 @@
+/*
+ *   Copyright (c) 2019-2021 MD Iftakharul Islam (Tamim) <tamim@csebuet.org>
+ *
+ *   This program is free software; you can redistribute it and/or modify
+ *   it under the terms of the GNU General Public License as published by
+ *   the Free Software Foundation; either version 3 of the License, or
+ *   (at your option) any later version.
+ *
+ *   This program is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *   GNU General Public License for more details.
+ *
+ *   You should have received a copy of the GNU General Public License
+ *   along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+#include "histogram.h"
+#include <string.h>
+
+static uint32_t bucket_idx (uint64_t val)
+{
+  uint32_t msb, shift;
+
+  if (val < (1ULL << HIST_SUB_BITS))
+    return val;
+  msb = 63 - __builtin_clzll(val);
+  //val >> shift has HIST_SUB_BITS bits, i.e. in [HIST_HALF, 2 * HIST_HALF)
+  shift = msb - HIST_SUB_BITS + 1;
+  return shift * HIST_HALF + (val >> shift);
+}
+
+//Largest value that falls in the bucket
+static uint64_t bucket_max (uint32_t idx)
+{
+  uint32_t shift;
+
+  if (idx < (1U << HIST_SUB_BITS))
+    return idx;
+  shift = idx / HIST_HALF - 1;
+  return (((uint64_t)(idx - shift * HIST_HALF) + 1) << shift) - 1;
+}
+
+void hist_reset (struct histogram *h)
+{
+  memset(h, 0, sizeof(*h));
+  h->min = UINT64_MAX;
+}
+
+void hist_record (struct histogram *h, uint64_t val)
+{
+  h->counts[bucket_idx(val)]++;
+  h->total++;
+  if (val < h->min)
+    h->min = val;
+  if (val > h->max)
+    h->max = val;
+}
+
+//Returns the value at the given percentile (e.g. 99.9). Like HdrHistogram,
+//it reports the largest value equivalent to the bucket, capped by the max.
+uint64_t hist_percentile (struct histogram *h, double percentile)
+{
+  uint64_t target, cnt = 0;
+  uint64_t val;
+
+  if (!h->total)
+    return 0;
+  target = (uint64_t)(percentile * h->total / 100 + 0.5);
+  if (target < 1)
+    target = 1;
+  for (uint32_t i = 0; i < HIST_BUCKETS; i++) {
+    cnt += h->counts[i];
+    if (cnt >= target) {
+      val = bucket_max(i);
+      return val > h->max ? h->max : val;
+    }
+  }
+  return h->max;
+}
@@ -0,0 +1,44 @@
+/*
+ *   Copyright (c) 2019-2021 MD Iftakharul Islam (Tamim) <tamim@csebuet.org>
+ *
+ *   This program is free software; you can redistribute it and/or modify
+ *   it under the terms of the GNU General Public License as published by
+ *   the Free Software Foundation; either version 3 of the License, or
+ *   (at your option) any later version.
+ *
+ *   This program is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *   GNU General Public License for more details.
+ *
+ *   You should have received a copy of the GNU General Public License
+ *   along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+#ifndef HISTOGRAM_H_
+#define HISTOGRAM_H_
+
+#include <stdio.h>
+#include <stdint.h>
+
+/*
+ *Log-linear histogram like HdrHistogram. Values below 2^HIST_SUB_BITS get
+ *their own bucket. Above that, every power of two is split into
+ *2^(HIST_SUB_BITS - 1) linear buckets. So a recorded value is off by less than
+ *1/32 of itself while the whole 64-bit range fits in less than 2K buckets.
+ */
+#define HIST_SUB_BITS 6
+#define HIST_HALF (1U << (HIST_SUB_BITS - 1))
+#define HIST_BUCKETS ((64 - HIST_SUB_BITS + 2) * HIST_HALF)
+
+struct histogram {
+  uint64_t counts[HIST_BUCKETS];
+  uint64_t total;
+  uint64_t min, max;
+};
+
+void hist_reset (struct histogram *h);
+void hist_record (struct histogram *h, uint64_t val);
+uint64_t hist_percentile (struct histogram *h, double percentile);
+
+#endif /* HISTOGRAM_H_ */
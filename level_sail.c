@@ -18,17 +18,31 @@
 #include "level_sail.h"
 #include <stdio.h>
 #include <stdlib.h>
+#include <unistd.h>
+#include <sys/mman.h>
 
 int sail_level_init (struct sail_level *c, uint8_t level_num, uint32_t tot_num_chunks, uint32_t cnk_size, struct sail_level *parent) {
+  return sail_level_init_multi (c, level_num, tot_num_chunks, cnk_size, parent, 1);
+}
+
+//Same as sail_level_init() with width next-hops per entry, e.g. one for each
+//FIB of SAIL-M. Entry i has N[i * width] to N[i * width + width - 1].
+int sail_level_init_multi (struct sail_level *c, uint8_t level_num, uint32_t tot_num_chunks, uint32_t cnk_size,
+                           struct sail_level *parent, uint32_t width) {
   uint32_t arr_size = tot_num_chunks * cnk_size;
-  c->N = (uint8_t *) calloc (arr_size, sizeof (uint8_t));
-  c->P = (uint8_t *) calloc (arr_size, sizeof (uint8_t));
+  //N is padded so that a 32-bit gather can read its last entry
+  c->N = (uint8_t *) calloc ((uint64_t)arr_size * width + 3, sizeof (uint8_t));
+  c->P = (uint8_t *) calloc ((uint64_t)arr_size * width, sizeof (uint8_t));
   c->C = (uint32_t *) calloc (arr_size, sizeof (uint32_t));
-  if (!c->N || !c->P || !c->C)
+  c->O = (uint32_t *) calloc (tot_num_chunks, sizeof (uint32_t));
+  if (!c->N || !c->P || !c->C || !c->O || rank_init(&c->r, arr_size))
     return -1;
+  //Levels are loaded in bulk, see sail_level_commit()
+  c->deferred = 1;
   c->level_num = level_num;
   c->size = arr_size;
   c->cnk_size = cnk_size;
+  c->width = width;
   c->parent = parent;
   if (parent != NULL)
     parent->chield = c;
@@ -41,6 +55,8 @@ int sail_level_cleanup (struct sail_level *c) {
   free(c->N);
   free(c->P);
   free(c->C);
+  free(c->O);
+  rank_cleanup(&c->r);
   c->size = 0;
   c->count = 0;
   c->parent = NULL;
@@ -57,7 +73,7 @@ int sail_level_print (struct sail_level *c) {
 
 double mem_size (struct sail_level *c) {
   //For lookup, we need N and C array where each element is 1 and 4 bytes respectively
-  return c->count * c->cnk_size * (1 + 4);
+  return c->count * c->cnk_size * (c->width + 4);
 }
 
 static int chunk_insert(struct sail_level *c, uint32_t chunk_id)
@@ -75,92 +91,411 @@ static int chunk_insert(struct sail_level *c, uint32_t chunk_id)
     return -1;
   }
 
-  /*shift each element one step right to make space for the new one */      
-  memmove(&c->N[chunk_id * c->cnk_size], &c->N[(chunk_id - 1) * c->cnk_size], 
-          (c->count - chunk_id + 1) * c->cnk_size);
-  memmove(&c->P[chunk_id * c->cnk_size], &c->P[(chunk_id - 1) * c->cnk_size], 
-          (c->count - chunk_id + 1) * c->cnk_size);
+  /*shift each element one step right to make space for the new one. Once the
+   * parent is committed, new chunks are appended, so nothing is shifted. */
+  memmove(&c->N[(uint64_t)chunk_id * c->cnk_size * c->width], &c->N[(uint64_t)(chunk_id - 1) * c->cnk_size * c->width], 
+          (uint64_t)(c->count - chunk_id + 1) * c->cnk_size * c->width);
+  memmove(&c->P[(uint64_t)chunk_id * c->cnk_size * c->width], &c->P[(uint64_t)(chunk_id - 1) * c->cnk_size * c->width], 
+          (uint64_t)(c->count - chunk_id + 1) * c->cnk_size * c->width);
 
-  memmove(&c->C[chunk_id * c->cnk_size], &c->C[(chunk_id - 1) * c->cnk_size], 
+  if (c->deferred && rank_insert(&c->r, (chunk_id - 1) * c->cnk_size, c->cnk_size, c->count * c->cnk_size))
+    return -1;
+  //C is rebuilt from the rank on commit
+  if (!c->deferred)
+    memmove(&c->C[chunk_id * c->cnk_size], &c->C[(chunk_id - 1) * c->cnk_size], 
             (c->count - chunk_id + 1) * c->cnk_size * sizeof(c->C[0]));        
 
   /*Reset the newly created empty chunk*/
+  memset(&c->N[(uint64_t)(chunk_id - 1) * c->cnk_size * c->width], 0, c->cnk_size * c->width);
+  memset(&c->P[(uint64_t)(chunk_id - 1) * c->cnk_size * c->width], 0, c->cnk_size * c->width);
   m = (chunk_id - 1) * c->cnk_size;
-  for (; m < chunk_id * c->cnk_size; m++) {
-    c->N[m] = 0;
-    c->P[m] = 0;
+  for (; !c->deferred && m < chunk_id * c->cnk_size; m++)
     c->C[m] = 0;
-  }
 
 finish:
   c->count++;
   return 0;
 }
 
+/*Deletes a chunk of a committed level. The last chunk is moved to its place,
+ *so only the entries pointing to the moved chunk and to its chunks change.*/
+static int chunk_delete_last(struct sail_level *c, uint32_t chunk_id)
+{
+  register uint64_t first, last;
+  register uint32_t i;
+
+  first = (uint64_t)(chunk_id - 1) * c->cnk_size;
+  last = (uint64_t)(c->count - 1) * c->cnk_size;
+  for (i = 0; i < c->cnk_size; i++) {
+    if (c->C[first + i]) {
+      puts("Cannot delete a chunk that has chunks below it");
+      return -1;
+    }
+  }
+
+  if (first != last) {
+    memcpy(&c->N[first * c->width], &c->N[last * c->width], c->cnk_size * c->width);
+    memcpy(&c->P[first * c->width], &c->P[last * c->width], c->cnk_size * c->width);
+    memcpy(&c->C[first], &c->C[last], c->cnk_size * sizeof(c->C[0]));
+    c->O[chunk_id - 1] = c->O[c->count - 1];
+    c->parent->C[c->O[chunk_id - 1]] = chunk_id;
+    for (i = 0; i < c->cnk_size; i++) {
+      if (c->C[first + i])
+        c->chield->O[c->C[first + i] - 1] = first + i;
+    }
+  }
+
+  /*Reset the chunk freed at the end*/
+  c->count--;
+  memset(&c->N[last * c->width], 0, c->cnk_size * c->width);
+  memset(&c->P[last * c->width], 0, c->cnk_size * c->width);
+  memset(&c->C[last], 0, c->cnk_size * sizeof(c->C[0]));
+  return 0;
+}
+
+/*Inverse of chunk_insert(). Shifts each chunk after chunk_id one step left*/
+static int chunk_delete(struct sail_level *c, uint32_t chunk_id)
+{
+  register uint64_t first, next;
+
+  if (chunk_id > c->count || chunk_id < 1) {
+    puts("Invalid chunk_id");
+    return -1;
+  }
+  if (!c->parent->deferred)
+    return chunk_delete_last(c, chunk_id);
+
+  first = (uint64_t)(chunk_id - 1) * c->cnk_size;
+  next = (uint64_t)chunk_id * c->cnk_size;
+  if (rank_count(&c->r, next) != rank_count(&c->r, first)) {
+    puts("Cannot delete a chunk that has chunks below it");
+    return -1;
+  }
+
+  memmove(&c->N[first * c->width], &c->N[next * c->width], (uint64_t)(c->count - chunk_id) * c->cnk_size * c->width);
+  memmove(&c->P[first * c->width], &c->P[next * c->width], (uint64_t)(c->count - chunk_id) * c->cnk_size * c->width);
+
+  if (rank_remove(&c->r, first, c->cnk_size, c->count * c->cnk_size))
+    return -1;
+  if (!c->deferred)
+    memmove(&c->C[first], &c->C[next], (c->count - chunk_id) * c->cnk_size * sizeof(c->C[0]));
+
+  /*Reset the chunk freed at the end*/
+  c->count--;
+  memset(&c->N[(uint64_t)c->count * c->cnk_size * c->width], 0, c->cnk_size * c->width);
+  memset(&c->P[(uint64_t)c->count * c->cnk_size * c->width], 0, c->cnk_size * c->width);
+  if (!c->deferred)
+    memset(&c->C[c->count * c->cnk_size], 0, c->cnk_size * sizeof(c->C[0]));
+  return 0;
+}
+
 /*Calculate the chunk ID*/
 static uint32_t calc_ckid(struct sail_level *c, uint32_t idx)
 {
-  register long long i;
-
   //TODO: increase the array dynamically when needed.
   if (idx >= c->size) {
     printf("Array index out of bound in SAIL level %d. Please increase the array size.\n", c->level_num);
     return 0;
   }
 
-  /*Find the first chunk ID to the left and increment that by 1*/
-  for (i = (long long)idx - 1; i >= 0; i--) {
-    if (c->C[i] > 0)
-      return c->C[i] + 1;
-  }
-
-  /*If there is no chunk to the left, then this is the first chunk*/
-  return 1;
+  /*The chunks are in the order of the entries pointing to them until the
+   *level is committed. Then new chunks are appended.*/
+  if (!c->deferred)
+    return c->chield->count + 1;
+  return rank_count(&c->r, idx) + 1;
 }
 
 /*Update C16 based on the newly inserted chunk*/
 static int update_c(struct sail_level *c, uint32_t idx, uint32_t chunk_id)
 {
-  register long long i;
-
   if (idx >= c->size) {
     puts("Invalid index");
     return -1;
   }
 
+  if (c->deferred) {
+    rank_set(&c->r, idx);
+    return 0;
+  }
+
+  /* The chunk was appended, so no other chunk ID changes */
+  c->chield->O[chunk_id - 1] = idx;
   c->C[idx] = chunk_id;
+  return 0;
+}
+
+/*Inverse of update_c()*/
+static void clear_c(struct sail_level *c, uint32_t idx)
+{
+  if (c->deferred)
+    rank_clear(&c->r, idx);
+  else
+    c->C[idx] = 0;
+}
+
+//Chunk ID of an entry, 0 if it has none. Unlike C, it's valid while the level
+//is deferred.
+uint32_t sail_level_ckid (struct sail_level *c, uint32_t idx)
+{
+  if (!c->deferred)
+    return c->C[idx];
+  return rank_test(&c->r, idx) ? rank_count(&c->r, idx) + 1 : 0;
+}
 
-  /* Increment chunk ID to the right */
-  for (i = idx + 1; i < c->size; i++) {
-    if (c->C[i] > 0)
-      c->C[i]++;
+//Records the entry pointing to each chunk of the child level
+static void link_chunks (struct sail_level *c)
+{
+  if (!c->chield)
+    return;
+  for (uint32_t i = 0; i < c->count * c->cnk_size; i++) {
+    if (c->C[i])
+      c->chield->O[c->C[i] - 1] = i;
   }
+}
 
-  return 0;
+//Rebuilds C from the rank in a single pass. From then on, C is kept instead of
+//the rank: a new chunk is appended to the child level and a deleted one is
+//replaced by the last chunk, so an update writes O(cnk_size) entries.
+void sail_level_commit (struct sail_level *c)
+{
+  uint32_t chunk_id = 0;
+
+  for (uint32_t i = 0; i < c->count * c->cnk_size; i++)
+    c->C[i] = rank_test(&c->r, i) ? ++chunk_id : 0;
+  c->deferred = 0;
+  link_chunks(c);
 }
 
-//Get chunk ID based on parent. This function inserts chunk if needed
+//Commits a level after C was written directly by sail_level_merge()
+void sail_level_sync (struct sail_level *c)
+{
+  c->deferred = 0;
+  link_chunks(c);
+}
+
+//Get chunk ID based on parent. This function inserts chunk if needed.
+//Returns 0 (which is never a valid chunk ID) if the chunk cannot be inserted,
+//e.g. when the child level is full. Chunks created on the upper levels are
+//left in place; they only hold pushed leaves, so lookups are unaffected.
 uint32_t get_chunk_id_frm_parent (struct sail_level *parent, uint32_t idx) {
   register uint32_t chunk_id;
   register int err;
 
   assert (parent->chield != NULL);
-  if (parent->C[idx] == 0) {
+  chunk_id = sail_level_ckid(parent, idx);
+  if (chunk_id == 0) {
     /*Step 1*/
     chunk_id = calc_ckid(parent, idx);
     if (!chunk_id)
-      exit(0);
+      return 0;
     /*Step 2*/
     err = chunk_insert(parent->chield, chunk_id);
     if (err) {
       puts("Could not insert chunk to level in SAIL");
-      exit(0);
+      return 0;
     }
     /*Step 3*/
     err = update_c(parent, idx, chunk_id);
     if (err)
-      exit(0);
+      return 0;
   }
 
-  return parent->C[idx];
+  return chunk_id;
+}
+
+//Removes the chunk of an entry, the inverse of get_chunk_id_frm_parent(). The
+//chunks after it get the next lower chunk ID, or the last chunk takes its
+//place if the level is committed. The caller restores the entry
+//and makes sure the chunk has no chunks below it.
+int release_chunk_frm_parent (struct sail_level *parent, uint32_t idx) {
+  register uint32_t chunk_id;
+
+  assert (parent->chield != NULL);
+  chunk_id = sail_level_ckid(parent, idx);
+  if (chunk_id == 0)
+    return 0;
+  if (chunk_delete(parent->chield, chunk_id))
+    return -1;
+  clear_c(parent, idx);
+  return 0;
+}
+
+//Copies the levels of a fragment (built as a separate SAIL) into dst. Level 16
+//is shared by all the fragments, so only the roots [root_lo, root_hi) are
+//copied. The chunks of level k are appended at chunk_off[k], so the chunk IDs
+//pointing to level k are shifted by chunk_off[k].
+void sail_level_merge (struct sail_level *dst, struct sail_level *src, uint32_t root_lo, uint32_t root_hi, uint32_t *chunk_off)
+{
+  uint32_t from, to, dst_idx, shift;
+  int k;
+
+  for (k = 0; src && dst; src = src->chield, dst = dst->chield, k++) {
+    shift = src->chield ? chunk_off[k + 1] : 0;
+    if (k == 0) {
+      from = root_lo;
+      to = root_hi;
+      dst_idx = root_lo;
+    } else {
+      from = 0;
+      to = src->count * src->cnk_size;
+      dst_idx = chunk_off[k] * src->cnk_size;
+    }
+    memcpy(&dst->N[dst_idx], &src->N[from], to - from);
+    memcpy(&dst->P[dst_idx], &src->P[from], to - from);
+    for (uint32_t i = from; i < to; i++, dst_idx++)
+      dst->C[dst_idx] = src->C[i] ? src->C[i] + shift : 0;
+  }
+}
+
+//Bytes of [addr, addr + len) that are in memory
+static double resident (void *addr, uint64_t len)
+{
+  long page = sysconf(_SC_PAGESIZE);
+  uintptr_t start = (uintptr_t)addr & ~(uintptr_t)(page - 1);
+  uint64_t pages = ((uintptr_t)addr + len - start + page - 1) / page;
+  unsigned char *vec;
+  double bytes = 0;
+
+  vec = (unsigned char *) malloc (pages);
+  if (!vec || mincore((void *)start, pages * page, vec)) {
+    free(vec);
+    return 0;
+  }
+  for (uint64_t i = 0; i < pages; i++)
+    bytes += (vec[i] & 1) * page;
+  free(vec);
+  return bytes;
+}
+
+//Resident bytes of the lookup arrays (N and C) of a level. The resident bytes
+//of P, which only the updates need, are added to ctrl.
+double sail_level_resident (struct sail_level *c, double *ctrl)
+{
+  *ctrl += resident(c->P, (uint64_t)c->size * c->width) + resident(c->O, c->size / c->cnk_size * sizeof(c->O[0]));
+  return resident(c->N, (uint64_t)c->size * c->width) + resident(c->C, c->size * sizeof(c->C[0]));
+}
+
+//Cache line alignment of each level of the packed image
+#define PACK_ALIGN 64
+#define PACK_ROUND(X) (((X) + PACK_ALIGN - 1) & ~(uint64_t)(PACK_ALIGN - 1))
+
+//Packs the lookup arrays of the levels below level16 into p. The chunk IDs
+//have to fit in 24 bits for SAIL-U (leaf_pushed = 0) and 31 bits for SAIL-L.
+int sail_pack (struct sail_packed *p, struct sail_level *level16, uint8_t def_nh, int leaf_pushed)
+{
+  struct sail_level *l;
+  uint64_t off = 0;
+  uint32_t i, n, e;
+  int k;
+
+  memset(p, 0, sizeof(*p));
+  for (l = level16, k = 0; l; l = l->chield, k++) {
+    if (l->deferred || l->width != 1) {
+      puts("Only a committed SAIL with one next-hop per entry can be packed");
+      return -1;
+    }
+    if (l->count >= (leaf_pushed ? SAIL_PACKED_NH : 1U << 24)) {
+      printf("Too many chunks in level %d for the packed layout\n", l->level_num);
+      return -1;
+    }
+    n = l->count * l->cnk_size;
+    off += PACK_ROUND(l->chield ? n * sizeof(uint32_t) : n);
+  }
+  if (k != SAIL_LEVELS || posix_memalign(&p->mem, PACK_ALIGN, off))
+    return -1;
+  p->size = off;
+  p->def_nh = def_nh;
+
+  off = 0;
+  for (l = level16, k = 0; l; l = l->chield, k++) {
+    n = l->count * l->cnk_size;
+    if (!l->chield) {
+      p->N = (uint8_t *)p->mem + off;
+      memcpy(p->N, l->N, n);
+      break;
+    }
+    p->E[k] = (uint32_t *)((uint8_t *)p->mem + off);
+    for (i = 0; i < n; i++) {
+      if (leaf_pushed)
+        e = l->C[i] ? l->C[i] : (l->N[i] ? SAIL_PACKED_NH | l->N[i] : 0);
+      else
+        e = ((uint32_t)l->N[i] << 24) | l->C[i];
+      p->E[k][i] = e;
+    }
+    off += PACK_ROUND(n * sizeof(uint32_t));
+  }
+  return 0;
+}
+
+void sail_unpack (struct sail_packed *p)
+{
+  free(p->mem);
+  memset(p, 0, sizeof(*p));
+}
+
+//Header of a packed SAIL written by sail_packed_save(). The image follows it
+//as it is in memory, with the levels at these offsets.
+#define PACK_MAGIC "SAILPACK"
+struct sail_packed_hdr {
+  char magic[8];
+  uint32_t leaf_pushed;
+  uint32_t def_nh;
+  uint64_t size;
+  uint64_t off[SAIL_LEVELS];
+};
+
+int sail_packed_save (struct sail_packed *p, int leaf_pushed, FILE *fp)
+{
+  struct sail_packed_hdr h;
+  int k;
+
+  if (!p->mem)
+    return -1;
+  memset(&h, 0, sizeof(h));
+  memcpy(h.magic, PACK_MAGIC, sizeof(h.magic));
+  h.leaf_pushed = leaf_pushed;
+  h.def_nh = p->def_nh;
+  h.size = p->size;
+  for (k = 0; k < SAIL_LEVELS - 1; k++)
+    h.off[k] = (uint8_t *)p->E[k] - (uint8_t *)p->mem;
+  h.off[k] = p->N - (uint8_t *)p->mem;
+  if (fwrite(&h, sizeof(h), 1, fp) != 1 || fwrite(p->mem, p->size, 1, fp) != 1)
+    return -1;
+  return 0;
+}
+
+//Reads a packed SAIL written by sail_packed_save() in place of p. The image
+//must have been made with the same leaf pushing.
+int sail_packed_load (struct sail_packed *p, int leaf_pushed, FILE *fp)
+{
+  struct sail_packed_hdr h;
+  void *mem;
+  int k;
+
+  if (fread(&h, sizeof(h), 1, fp) != 1 || memcmp(h.magic, PACK_MAGIC, sizeof(h.magic)) ||
+      h.leaf_pushed != (uint32_t)leaf_pushed) {
+    puts("Not a packed SAIL of this kind");
+    return -1;
+  }
+  for (k = 0; k < SAIL_LEVELS; k++) {
+    //A level without chunks is empty at the end of the image
+    if (h.off[k] > h.size || h.off[k] % PACK_ALIGN) {
+      puts("Corrupt packed SAIL");
+      return -1;
+    }
+  }
+  if (posix_memalign(&mem, PACK_ALIGN, h.size))
+    return -1;
+  if (fread(mem, h.size, 1, fp) != 1) {
+    free(mem);
+    return -1;
+  }
+  sail_unpack(p);
+  p->mem = mem;
+  p->size = h.size;
+  p->def_nh = h.def_nh;
+  for (k = 0; k < SAIL_LEVELS - 1; k++)
+    p->E[k] = (uint32_t *)((uint8_t *)mem + h.off[k]);
+  p->N = (uint8_t *)mem + h.off[k];
+  return 0;
 }
@@ -26,6 +26,7 @@
 #include <stdint.h>
 #include <string.h>
 #include <assert.h>
+#include "rank.h"
 
 
 struct sail_level {
@@ -39,14 +40,57 @@ struct sail_level {
   //Number of elements in each chunk. We made it so that each level can have
   //chunk of differenet size (unlike the originbal SAIL)
   uint32_t cnk_size;
+  //Number of next-hops (and prefix lengths) per entry
+  uint32_t width;
   struct sail_level *parent, *chield;
+  //Entries that point to a chunk in the child level. While the level is
+  //deferred, the chunk ID of an entry is its rank + 1.
+  struct rank r;
+  //C is stale until sail_level_commit(). The chunk IDs are derived from r.
+  int deferred;
+  //Entry of the parent level pointing to each chunk. Only kept once the
+  //parent is committed, when the chunks are no longer in the order of the
+  //entries pointing to them.
+  uint32_t *O;
+};
+
+//Levels 16, 24, ..., 128
+#define SAIL_LEVELS 15
+//Flags a next-hop in an entry of a packed SAIL-L, see struct sail_packed
+#define SAIL_PACKED_NH 0x80000000U
+
+//Read-only lookup image of a SAIL made by sail_pack(). The levels are in a
+//single cache-aligned allocation and each entry is one 32-bit word, so a level
+//costs one memory access. In SAIL-U the next-hop is in the 8 MSBs and the
+//chunk ID in the rest. In SAIL-L an entry is either a chunk ID or a next-hop
+//flagged by SAIL_PACKED_NH, so the N of the internal levels is not needed.
+//The prefix lengths stay in the levels, which become the control plane.
+struct sail_packed {
+  void *mem;
+  uint64_t size;
+  uint32_t *E[SAIL_LEVELS - 1];
+  //Next-hops of the last level
+  uint8_t *N;
+  uint8_t def_nh;
 };
 
 int sail_level_init (struct sail_level *c, uint8_t level_num, uint32_t size, uint32_t cnk_size, struct sail_level *parent);
+int sail_level_init_multi (struct sail_level *c, uint8_t level_num, uint32_t tot_num_chunks, uint32_t cnk_size,
+                           struct sail_level *parent, uint32_t width);
 int sail_level_cleanup (struct sail_level *c);
 int sail_level_print (struct sail_level *c);
 double mem_size (struct sail_level *c);
 bool isNULL (struct sail_level *c);
 uint32_t get_chunk_id_frm_parent (struct sail_level *parent, uint32_t idx);
+int release_chunk_frm_parent (struct sail_level *parent, uint32_t idx);
+uint32_t sail_level_ckid (struct sail_level *c, uint32_t idx);
+void sail_level_commit (struct sail_level *c);
+void sail_level_sync (struct sail_level *c);
+double sail_level_resident (struct sail_level *c, double *ctrl);
+int sail_pack (struct sail_packed *p, struct sail_level *level16, uint8_t def_nh, int leaf_pushed);
+void sail_unpack (struct sail_packed *p);
+int sail_packed_save (struct sail_packed *p, int leaf_pushed, FILE *fp);
+int sail_packed_load (struct sail_packed *p, int leaf_pushed, FILE *fp);
+void sail_level_merge (struct sail_level *dst, struct sail_level *src, uint32_t root_lo, uint32_t root_hi, uint32_t *chunk_off);
 
 #endif /* LEVEL_SAIL_H_ */
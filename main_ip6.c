@@ -15,117 +15,396 @@
  *   along with this program.  If not, see <http://www.gnu.org/licenses/>.
  *
  */
-#include "sail_u_ip6.h"
-#include "sail_l_ip6.h"
-#include "cptrie_ip6.h"
-#include "poptrie_ip6.h"
+#include "engine.h"
 #include "prefix_distribution.h"
 #include "stopwatch.h"
+#include "histogram.h"
+#include "traffic_gen.h"
+#include "traffic_file.h"
+#include "fib_loader.h"
+#include "pcap_trace.h"
+#include "flow_cache.h"
+#include "rib.h"
 #include <arpa/inet.h>
 #include <sys/socket.h>
 #include <netinet/in.h>
 #include <inttypes.h>//Needed for "PRIx64" format specifier
 
-//This option checks if our FIB insertion and FIB lookup are working properly.
-//In order to verify FIB lookup, it stores results from SAIL-U and matches
-//that with results from other lookup algorithms.
-//This option should be disabled for actual performance measurement.
-//#define TEST
+#include <pthread.h>
+#include <sched.h>
+#include <unistd.h>
+#include <getopt.h>
+#include <stddef.h>
+#include <ctype.h>
 
-//This option calculates average matched prefix length of each 
-//algorithm for each traffic
-//This option should be disabled for actual performance measurement.
-//#define CALC_MATCHED_PREFIX_LEN
+//Set by the Makefile to be recorded with the results
+#ifndef GIT_REV
+#define GIT_REV "unknown"
+#endif
+#ifndef BUILD_FLAGS
+#define BUILD_FLAGS "unknown"
+#endif
 
-//This option writes traffics to files.
-//#define RECORD_TRAFFIC
+//Lookup algorithms are the ones in engines[] (see engine.h). They are
+//selected by a bitmap, so there can be at most MAX_ENGINE of them.
+#define MAX_ENGINE 32
+const char *engine_names[MAX_ENGINE];
+
+//Traffic patterns
+enum traffic {TR_REAL = 1 << 0, TR_RND = 1 << 1, TR_SEQ = 1 << 2, TR_PRE = 1 << 3, TR_REP = 1 << 4, TR_PKT = 1 << 5,
+              TR_ZIPF = 1 << 6};
+#define TR_ALL (TR_REAL | TR_RND | TR_SEQ | TR_PRE | TR_REP | TR_PKT | TR_ZIPF)
+#define NUM_TRAFFIC 7
+const char *traffic_names[NUM_TRAFFIC] = {"real", "rnd", "seq", "pre", "rep", "pkt", "zipf"};
+
+//Maximum number of skews in a Zipf traffic sweep
+#define MAX_SKEWS 16
+
+//Run time options. They used to be compile time switches.
+struct options {
+  //Bitmaps of engines[] and enum traffic to be measured
+  uint32_t engines;
+  uint32_t traffic;
+  //Number of IPs in random and repeated traffic
+  uint64_t rnd_cnt;
+  uint64_t rep_cnt;
+  //# of times a lookup is repeated in repeated traffic
+  int repeat;
+  //Zipf traffic is generated and measured for each of these skews
+  double skews[MAX_SKEWS];
+  int num_skews;
+  //Number of flows and mean packet train length of Zipf traffic
+  uint64_t working_set;
+  double burst;
+  //Number of threads for parallel build and multi-threaded lookup
+  int threads;
+  //Checks if FIB insertion and FIB lookup are working properly. The
+  //next-hops of the first algorithm are matched with the other algorithms
+  //outside the timed loops.
+  bool verify;
+  //Calculates average matched prefix length of each algorithm for each
+  //traffic instead of measuring performance
+  bool matched_len;
+  //Writes the generated traffics to files
+  bool record_traffic;
+  //Reports instructions, cache misses, dTLB misses and branch misses per
+  //operation for each phase. It falls back to TSC if the hardware counters
+  //are not available.
+  bool perf;
+  //Times individual lookups and reports latency percentiles
+  bool latency;
+  //Runs the lookups with 1, 2, 4, ... up to opt.threads threads. Each thread
+  //is pinned to a core and looks up its own slice of the traffic in the
+  //shared FIB.
+  bool multi_thread;
+  //Rebuilds each FIB with the parallel builder after the serial insertion
+  //and runs the lookups on the rebuilt FIB
+  bool parallel_build;
+  //Applies a route update after every update_ratio lookups of repeated
+  //traffic. 0 disables the mixed workload.
+  uint64_t update_ratio;
+  //Percentage of the updates that insert a new prefix and of those that
+  //withdraw one of the inserted prefixes. The rest change the next-hop of an
+  //existing prefix.
+  int inserts;
+  int withdraws;
+  //Applies the updates from a dedicated thread
+  bool update_thread;
+  //Number of packets forwarded together in pcap replay
+  int pkt_burst;
+  //Entries of the flow cache. The lookups of real, repeated and Zipf
+  //traffic and of the mixed workload are measured once more through the
+  //cache. 0 disables the cache.
+  uint64_t cache_entries;
+  //Keys the cache by the upper 64 bits of the destination
+  bool cache_key64;
+  //Number of routes withdrawn and announced again by the algorithms that
+  //support deletion. 0 disables the withdrawals.
+  uint64_t withdrawals;
+  //Lookups in flight in the batched lookups. 0 disables them.
+  int batch_width;
+  //FIBs of the run. An algorithm with several FIBs in one structure overlays
+  //as many of them as it can hold.
+  const char **fibs;
+  int num_fibs;
+};
 
-//Maximum number of prefixes in a FIB.
-#define PRE_CNT 110000
+struct options opt;
 
-//IPs and next-hop results in sequential traffic. Please don't change this, 
+//IPs in sequential traffic. Please don't change this, 
 //because currently we use only 8 bit long sequential pattern 
 #define SEQ_CNT (1ULL << 8)
 __uint128_t seq_ips[SEQ_CNT];
-#ifdef TEST
-  uint8_t seq_res[SEQ_CNT];
-#endif
 
-//IPs and next-hop results in random traffic
+//Default number of IPs in random traffic
 #define RND_CNT (1ULL << 24)
-__uint128_t rnd_ips[RND_CNT];
-#ifdef TEST
-  uint8_t rnd_res[RND_CNT];
-#endif
+__uint128_t *rnd_ips;
 
-//IPs in real traffic
-#define REAL_CNT  (1ULL << 24)
-__uint128_t real_ips[REAL_CNT];
-//Actual number of IPs in real traffic
+//IPs in real traffic. They are either mapped from a binary traffic file or
+//parsed from a text one.
+struct traffic_file real_traffic;
+__uint128_t *real_ips;
 uint64_t real_ip_cnt = 0;
-#ifdef TEST
-  //Next-hop results for real traffic
-  uint8_t real_res[REAL_CNT];
-#endif
 
-//# of times a lookup is repeated
+//IPs in Zipf traffic. It has as many IPs as random traffic.
+__uint128_t *zipf_ips;
+//Default skews, working set and mean packet train length of Zipf traffic
+#define ZIPF_SKEWS "0,0.5,0.8,1,1.2"
+#define WORKING_SET (1ULL << 16)
+#define BURST 1
+
+//A route update of the mixed workload
+struct update {
+  __uint128_t prefix;
+  uint8_t len;
+  uint8_t nh;
+  bool withdraw;
+};
+//Updates are reused round robin beyond this
+#define UPD_CNT (1ULL << 20)
+struct update *updates;
+//Default percentage of inserts and withdrawals among the updates
+#define INSERTS 50
+#define WITHDRAWS 20
+
+//Default # of times a lookup is repeated
 #define REPEAT 10
-//IPs in Repeated traffic
+//Default number of IPs in Repeated traffic
 #define REP_CNT  (1ULL << 24)
-__uint128_t rep_ips[REP_CNT];
-#ifdef TEST
-  //Next-hop results for repeated traffic
-  uint8_t rep_res[REP_CNT];
-#endif
+__uint128_t *rep_ips;
+
+//Next-hops of the first algorithm that looked up each traffic. They are
+//only used for verification.
+uint8_t *ref_res[NUM_TRAFFIC];
+bool ref_valid[NUM_TRAFFIC];
+const char *ref_name[NUM_TRAFFIC];
+
+//Packet-like buffers holding an Ethernet and an IPv6 header. The destination
+//address is in network byte order as it would be in the dataplane. They are
+//filled with the real traffic.
+#define PKT_CNT (1ULL << 20)
+#define PKT_SIZE 64
+//Offset of the destination address: Ethernet header (14) + 24
+#define DST_OFF 38
+uint8_t pkts[PKT_CNT][PKT_SIZE];
+
+//Packets of the capture given with -P. They are forwarded through each
+//algorithm in bursts.
+struct pcap_trace pcap;
+const char *pcap_file;
+//Default and maximum burst size of pcap replay
+#define PKT_BURST 32
+#define MAX_PKT_BURST 256
+//Hop limits of the captured packets. Forwarding decrements them, so they are
+//restored before each replay pass.
+uint8_t *pcap_hlim;
+//MAC address of each next-hop and of the outgoing port
+uint8_t nh_mac[256][6];
+uint8_t port_mac[6] = {0x02, 0, 0, 0, 0, 0};
+
+//Default number of lookups in flight in the batched lookups
+#define BATCH_WIDTH 8
+
+//A /64 keyed cache is only correct if no prefix is longer than 64. It is
+//decided for each FIB.
+bool cache_key64;
+
+//Number of lookups timed individually for each traffic
+#define LAT_CNT (1ULL << 20)
+enum lat_traffic {LAT_REAL = 0, LAT_RND, LAT_PRE, LAT_REP, NUM_LAT_TRAFFIC};
+const char *lat_traffic_name[NUM_LAT_TRAFFIC] = {"Real", "Random", "Prefix", "Repeated"};
+struct histogram lat_hist;
+
+//Thread counts are powers of two and the number of cores
+#define MAX_SCALING_RUNS 32
+enum mt_traffic {MT_REAL = 0, MT_RND, MT_REP, NUM_MT_TRAFFIC};
+const char *mt_traffic_name[NUM_MT_TRAFFIC] = {"Real", "Random", "Repeated"};
+
+//Lookup throughput of Zipf traffic for each skew
+struct zipf_result {
+  int runs;
+  double skew[MAX_SKEWS];
+  //Throughput in Mlps
+  double throughput[MAX_SKEWS];
+};
+
+//Lookup latency percentiles in ns
+struct latency_result {
+  double p50;
+  double p99;
+  double p999;
+};
+
+//Lookups through a flow cache
+enum cache_traffic {CT_REAL = 0, CT_REP, NUM_CACHE_TRAFFIC};
+const char *cache_traffic_name[NUM_CACHE_TRAFFIC] = {"Real", "Repeated"};
+struct cache_result {
+  //Throughput in Mlps and the fraction of lookups served by the cache
+  double throughput[NUM_CACHE_TRAFFIC];
+  double hit_rate[NUM_CACHE_TRAFFIC];
+  //For each skew of Zipf traffic
+  int zipf_runs;
+  double zipf_throughput[MAX_SKEWS];
+  double zipf_hit_rate[MAX_SKEWS];
+};
+
+//Lookups interleaved with route updates
+struct mixed_result {
+  //Lookup throughput in Mlps
+  double lookup_throughput;
+  //Successful updates per second in thousands, over the time spent in them
+  double update_rate;
+  uint64_t updates;
+  //Updates that the algorithm failed to apply
+  uint64_t failed;
+  struct latency_result latency;
+  //Single-thread workload through a flow cache invalidated at every update
+  double cached_throughput;
+  double cached_hit_rate;
+};
+
+//pcap replay through the forwarding pipeline
+struct replay_result {
+  //Packets per second in millions, end to end
+  double throughput;
+  //Packets of the capture that were forwarded in each pass. The rest had no
+  //route or an expired hop limit.
+  uint64_t forwarded;
+  uint64_t dropped;
+};
+
+struct scaling_result {
+  int runs;
+  int threads[MAX_SCALING_RUNS];
+  //Aggregate throughput in Mlps
+  double throughput[MAX_SCALING_RUNS];
+  //Aggregate throughput / (threads * single thread throughput)
+  double efficiency[MAX_SCALING_RUNS];
+};
+
+//Results of an algorithm on a FIB. The measurements an algorithm doesn't
+//support are left 0.
+struct engine_result {
+  double insert_time;
+  //Parallel build time of the whole FIB in millisec
+  double build_time;
+  double lookup_time;
+  double lookup_throughput_real_traffic;
+  double lookup_throughput_rnd_traffic;
+  double lookup_throughput_seq_traffic;
+  double lookup_throughput_pre_traffic;
+  double lookup_throughput_rep_traffic;
+  //Packet traffic through __uint128_t conversion and straight from the header
+  double lookup_throughput_pkt_traffic;
+  double lookup_addr_throughput_pkt_traffic;
+  //64-bit fast-path lookup
+  double lookup64_throughput_real_traffic;
+  double lookup64_throughput_rnd_traffic;
+  //Batched lookup with opt.batch_width lookups in flight
+  double batch_throughput_real_traffic;
+  double batch_throughput_rnd_traffic;
+  //Memory in MB, see struct engine_mem
+  double mem_consumption;
+  double lookup_mem_consumption;
+  double update_mem_consumption;
+  double onchip_mem_consumption;
+  //Lookup on the packed layout, 0 if the FIB doesn't fit in it
+  double packed_throughput_real_traffic;
+  double packed_throughput_rnd_traffic;
+  double packed_throughput_pre_traffic;
+  double packed_mem_consumption;
+  //Time to save the packed layout to a file and to load it back in millisec
+  double save_time;
+  double load_time;
+  double lookup_cpucycle;
+  //Time of a route withdrawal and of announcing it again in microsec
+  double withdraw_time;
+  double announce_time;
+  //Number of FIBs sharing the structure. The FIB under test is FIB 0.
+  double fibs;
+  //Random traffic looked up in each of the FIBs in turn
+  double lookup_throughput_multi_traffic;
+  struct scaling_result scaling[NUM_MT_TRAFFIC];
+  struct latency_result latency[NUM_LAT_TRAFFIC];
+  struct zipf_result zipf;
+  struct mixed_result mixed;
+  struct replay_result replay;
+  struct cache_result cache;
+};
 
 struct result {
+  //FIB file
+  const char *fib;
   //Number of prefixes with length 49-64
   uint64_t prefixes_49_64;
   //Number of prefixes with length 65-128
   uint64_t prefixes_65_128;
   //Total number of prefixes
   uint64_t total_prefixes;
-  //Results for SAIL_U
-  double sail_u_insert_time;
-  double sail_u_lookup_time;
-  double sail_u_lookup_throughput_real_traffic;
-  double sail_u_lookup_throughput_rnd_traffic;
-  double sail_u_lookup_throughput_seq_traffic;
-  double sail_u_lookup_throughput_pre_traffic;
-  double sail_u_lookup_throughput_rep_traffic;
-  double sail_u_mem_consumption;
-  double sail_u_lookup_cpucycle;
-  //Results for SAIL_L
-  double sail_l_insert_time;
-  double sail_l_lookup_time;
-  double sail_l_lookup_throughput_real_traffic;
-  double sail_l_lookup_throughput_rnd_traffic;
-  double sail_l_lookup_throughput_seq_traffic;
-  double sail_l_lookup_throughput_pre_traffic;
-  double sail_l_lookup_throughput_rep_traffic;
-  double sail_l_mem_consumption;
-  double sail_l_lookup_cpucycle;
-  //Results for Poptrie
-  double poptrie_insert_time;
-  double poptrie_lookup_time;
-  double poptrie_lookup_throughput_real_traffic;
-  double poptrie_lookup_throughput_rnd_traffic;
-  double poptrie_lookup_throughput_seq_traffic;
-  double poptrie_lookup_throughput_pre_traffic;
-  double poptrie_lookup_throughput_rep_traffic;
-  double poptrie_mem_consumption;
-  double poptrie_lookup_cpucycle;
-  //Results for CP-Trie
-  double cptrie_insert_time;
-  double cptrie_lookup_time;
-  double cptrie_lookup_throughput_real_traffic;
-  double cptrie_lookup_throughput_rnd_traffic;
-  double cptrie_lookup_throughput_seq_traffic;
-  double cptrie_lookup_throughput_pre_traffic;
-  double cptrie_lookup_throughput_rep_traffic;
-  double cptrie_mem_consumption;
-  double cptrie_lookup_cpucycle;
+  //Results of each algorithm in the order of engines[]
+  struct engine_result *eng;
+};
+
+//Scalar results written to the JSON and CSV files as <algorithm>_<field>.
+//Every double field of struct engine_result must be listed here.
+struct result_field {
+  const char *name;
+  size_t offset;
+};
+
+#define RESULT_FIELD(f) {#f, offsetof(struct engine_result, f)}
+struct result_field result_fields[] = {
+  RESULT_FIELD(insert_time),
+  RESULT_FIELD(build_time),
+  RESULT_FIELD(lookup_time),
+  RESULT_FIELD(lookup_throughput_real_traffic),
+  RESULT_FIELD(lookup_throughput_rnd_traffic),
+  RESULT_FIELD(lookup_throughput_seq_traffic),
+  RESULT_FIELD(lookup_throughput_pre_traffic),
+  RESULT_FIELD(lookup_throughput_rep_traffic),
+  RESULT_FIELD(lookup_throughput_pkt_traffic),
+  RESULT_FIELD(lookup_addr_throughput_pkt_traffic),
+  RESULT_FIELD(lookup64_throughput_real_traffic),
+  RESULT_FIELD(lookup64_throughput_rnd_traffic),
+  RESULT_FIELD(batch_throughput_real_traffic),
+  RESULT_FIELD(batch_throughput_rnd_traffic),
+  RESULT_FIELD(mem_consumption),
+  RESULT_FIELD(lookup_mem_consumption),
+  RESULT_FIELD(update_mem_consumption),
+  RESULT_FIELD(onchip_mem_consumption),
+  RESULT_FIELD(packed_throughput_real_traffic),
+  RESULT_FIELD(packed_throughput_rnd_traffic),
+  RESULT_FIELD(packed_throughput_pre_traffic),
+  RESULT_FIELD(packed_mem_consumption),
+  RESULT_FIELD(save_time),
+  RESULT_FIELD(load_time),
+  RESULT_FIELD(lookup_cpucycle),
+  RESULT_FIELD(withdraw_time),
+  RESULT_FIELD(announce_time),
+  RESULT_FIELD(fibs),
+  RESULT_FIELD(lookup_throughput_multi_traffic),
 };
+#define NUM_RESULT_FIELD (sizeof(result_fields) / sizeof(result_fields[0]))
+
+//Prints per-operation hardware counters of the last measured phase. It does
+//nothing unless the stopwatch is initialized with PERF.
+static void report_perf(const char *phase, uint64_t ops)
+{
+  struct perf_counters pc;
+
+  if (stopwatch_read_perf(&pc) || !ops)
+    return;
+  printf ("%s per op: ", phase);
+  if (pc.instructions >= 0)
+    printf ("%.2f instructions ", (double)pc.instructions / ops);
+  if (pc.cache_misses >= 0)
+    printf ("%.4f cache misses ", (double)pc.cache_misses / ops);
+  if (pc.dtlb_misses >= 0)
+    printf ("%.4f dTLB misses ", (double)pc.dtlb_misses / ops);
+  if (pc.branch_misses >= 0)
+    printf ("%.4f branch misses ", (double)pc.branch_misses / ops);
+  printf ("\n");
+}
 
 struct xorshift32_state {
   uint32_t a;
@@ -193,856 +472,1477 @@ static __inline__ __uint128_t in6_addr_to_uint128(struct in6_addr *in6)
   return a;
 }
 
-int test(char *file, struct result *res){
-  //As this variable is used during FIB lookup, make it register
-  //It improves lookup performance siginificantly
-  register long long i = 0, j = 0;
-  register uint8_t nh;
-  //Number of IPs in PRE traffic
-  register uint64_t prefix_cnt = 0;
-  double delay = 0, cpu_cycles = 0;
-  //Prefixes in the FIB
-  __uint128_t prefixes[PRE_CNT];
-  //Prefix lengths
-   uint8_t pre_lens[PRE_CNT];
-  //Next-hops for the prefixes
-   uint8_t pre_nhs[PRE_CNT];
-#ifdef TEST
-  //Next-hop results for prefix traffic
-  uint8_t pre_res[PRE_CNT];
-#endif
-  FILE *fp;
-  //Must have set to 0. Otherwise it's preallocated with garbage value
-  char v6str[256] = {0};
-  char buff[4096];
-  int prefixlen;
-  int nexthop;
-  int ret;
-  char prefixStr[256];
-  struct in6_addr v6addr;
+static uint8_t null_lookup(__uint128_t key) {
+  return 0;
+}
 
-  if ((fp = fopen(file, "r")) == NULL) {
-    puts("File not exists");
-    return -1;
-  }
+//Lookups timed by a latency loop between two updates of the histogram
+#define LAT_CHUNK 1024
 
-  printf("Reading FIB from file %s ....... \n", file);
-  
-  while ( !feof(fp) ) {
-    if ( !fgets(buff, sizeof(buff), fp) )
-      continue;
-    prefixlen = 0;
-    nexthop = 0;
-    ret = sscanf(buff, "%255[^'/']/%d\t%d", v6str, &prefixlen, &nexthop);
-    if ( ret < 0 ) {
-      puts ("The input file is not formatted properly");
-      return -1;
-    }
-//    printf ("%s/%d %d\n", v6str, prefixlen, nexthop);
+//Times n lookups one by one with a latency loop and adds them to lat_hist.
+//overhead is subtracted from each.
+static void record_latency(uint8_t (*loop)(const __uint128_t *, uint64_t, uint64_t *), const __uint128_t *ips,
+                           uint64_t n, uint64_t overhead)
+{
+  uint64_t cycles[LAT_CHUNK];
+  uint64_t i, j, k;
 
-    ret = inet_pton(AF_INET6, v6str, &v6addr);
-    if ( ret != 1 ) {
-      puts ("Invalid IPv6 prefix");
-      return -1;
-    }
+  for (i = 0; i < n; i += k) {
+    k = n - i < LAT_CHUNK ? n - i : LAT_CHUNK;
+    loop(ips + i, k, cycles);
+    for (j = 0; j < k; j++)
+      hist_record(&lat_hist, cycles[j] > overhead ? cycles[j] - overhead : 0);
+  }
+}
 
-    //TODO: Make it dynamic
-    if (prefix_cnt >= PRE_CNT) {
-      puts ("The PRE traffic array is full. Please increase the array size");
-      return -1;
-    }
+//Times n lookups one by one. The timing overhead is measured with the
+//latency loop of an empty lookup and subtracted.
+static void sample_lookups(uint8_t (*loop)(const __uint128_t *, uint64_t, uint64_t *), __uint128_t *ips,
+                           uint64_t n, uint64_t overhead, struct latency_result *lat)
+{
+  double ghz = stopwatch_tsc_ghz();
+
+  if (n > LAT_CNT)
+    n = LAT_CNT;
+  hist_reset(&lat_hist);
+  record_latency(loop, ips, n, overhead);
+  lat->p50 = hist_percentile(&lat_hist, 50) / ghz;
+  lat->p99 = hist_percentile(&lat_hist, 99) / ghz;
+  lat->p999 = hist_percentile(&lat_hist, 99.9) / ghz;
+}
 
-    //Store prefix info
-    prefixes[prefix_cnt] = in6_addr_to_uint128(&v6addr);
-    pre_lens[prefix_cnt] = prefixlen;
-    pre_nhs[prefix_cnt] = nexthop;
-    prefix_cnt++;
+static void sample_latency(const struct engine *e, __uint128_t *prefixes, uint64_t prefix_cnt,
+                           struct latency_result *lat)
+{
+  const char *name = e->title;
+  struct latency_result ovh;
+  uint64_t overhead;
+
+  //The median of the empty lookup is the overhead
+  sample_lookups(latency_loop<null_lookup>, rnd_ips, opt.rnd_cnt, 0, &ovh);
+  overhead = hist_percentile(&lat_hist, 50);
+
+  sample_lookups(e->latency_loop, real_ips, real_ip_cnt, overhead, &lat[LAT_REAL]);
+  sample_lookups(e->latency_loop, rnd_ips, opt.rnd_cnt, overhead, &lat[LAT_RND]);
+  sample_lookups(e->latency_loop, prefixes, prefix_cnt, overhead, &lat[LAT_PRE]);
+  sample_lookups(e->latency_loop, rep_ips, opt.rep_cnt, overhead, &lat[LAT_REP]);
+  for (int t = 0; t < NUM_LAT_TRAFFIC; t++)
+    printf ("%s latency for %s traffic: p50 = %.1f ns, p99 = %.1f ns, p99.9 = %.1f ns\n",
+            name, lat_traffic_name[t], lat[t].p50, lat[t].p99, lat[t].p999);
+}
 
-   //Record the prefix counts in results
-    res->total_prefixes++;
-    if (prefixlen >= 49 && prefixlen <= 64)
-      res->prefixes_49_64++;
-    else if (prefixlen >= 65 && prefixlen <= 128)
-      res->prefixes_65_128++;
-    
-    //record prefix distribution across all the FIBs
-    record_prefix_len (prefixlen);
-  }
-  
-  printf("-----------------Generating repeated traffic-------------- \n");
-  struct xorshift32_state rnd_idx = {1};
-  xorshift128_state rnd_ip = {1, 1, 1, 1};
-  
-  for (i = 0; i < REP_CNT; i++) {
-    //generate a 32-bit random number
-    xorshift32(&rnd_idx);
-    //generate a 128-bit random number
-    xorshift128(&rnd_ip);
-    //select an IP from prefix traffic
-    uint32_t ix = rnd_idx.a % prefix_cnt;
-    //Add the new random number to the right of the prefix to generate the IP
-    rep_ips[i] = prefixes[ix] | (xorshift_to_ipv6(&rnd_ip) >>  pre_lens[ix]);
+//Looks up the traffic through a cold flow cache of opt.cache_entries entries.
+//With opt.verify, the cached next-hops are checked against the algorithm.
+static int cached_run(const struct engine *e, const char *traffic, __uint128_t *ips, uint64_t cnt,
+                      int repeat, double *throughput, double *hit_rate)
+{
+  const char *name = e->title;
+  register uint64_t i;
+  struct flow_cache fc;
+  double delay, cpu_cycles;
+  char phase[128];
+  int ret = 0;
 
-//    printf("%s\n%s\n%d\n\n", ipv6_to_str(prefixes[ix]), ipv6_to_str(rep_ips[i]), pre_lens[ix]);
-  }
-  
-  printf("-----------------Generating sequential traffic-------------- \n");
-  //Find the longest prefix
-  __uint128_t max_prefix = 0;
-  uint8_t max_prefix_len = 0;
-  for (i = 0; i < prefix_cnt; i++) {
-    if (pre_lens[i] > max_prefix_len) {
-      max_prefix_len = pre_lens[i];
-      max_prefix = prefixes[i];
-    } 
-  }
-  
-  uint8_t prexlen_seq_traffic =  (ceil(max_prefix_len/8.0) - 1) * 8;
-  printf ("generating sequential traffic withing %s/%d\n", ipv6_to_str(max_prefix), prexlen_seq_traffic);
-  for (i = 0; i < SEQ_CNT; i++) {
-    seq_ips[i] = (((max_prefix >> (128 - prexlen_seq_traffic)) << 8) | ((__uint128_t)i)) << (128 - (prexlen_seq_traffic + 8));
-//    printf ("sequential IP = %s \n", ipv6_to_str(seq_ips[i]));
+  if (flow_cache_init(&fc, opt.cache_entries, cache_key64, e->lookup))
+    return -1;
+  stopwatch_start();
+  e->cached_loop(&fc, ips, cnt, repeat);
+  stopwatch_stop(&delay, &cpu_cycles);
+  snprintf(phase, sizeof(phase), "%s cached lookup for %s traffic", name, traffic);
+  report_perf(phase, cnt * repeat);
+  *throughput = (cnt * repeat * 1000) / delay;
+  *hit_rate = (double)fc.hits / (fc.hits + fc.misses);
+  printf ("%s lookup throughput for %s traffic through flow cache = %f Mlps, hit rate = %f \n",
+          name, traffic, *throughput, *hit_rate);
+
+  for (i = 0; opt.verify && i < cnt; i++) {
+    if (flow_cache_lookup(&fc, ips[i]) != e->lookup(ips[i])) {
+      printf ("%s flow cache returned a stale next-hop for %s traffic\n", name, traffic);
+      ret = -1;
+      break;
+    }
   }
+  flow_cache_free(&fc);
+  return ret;
+}
 
-  printf("---------------------Checking SAIL-U-------------------------- \n");
-
-  ret = sail_u_init();
-  if (ret < 0) {
-    puts("Failed to initialize SAIL-U");
-    sail_u_cleanup();
+//Measures real and repeated traffic through the flow cache. Their bare
+//lookups are measured as usual.
+static int flow_cache_bench(const struct engine *e, struct cache_result *cr)
+{
+  if ((opt.traffic & TR_REAL) &&
+      cached_run(e, "real", real_ips, real_ip_cnt, 1, &cr->throughput[CT_REAL], &cr->hit_rate[CT_REAL]))
     return -1;
-  }
+  if ((opt.traffic & TR_REP) &&
+      cached_run(e, "repeated", rep_ips, opt.rep_cnt, opt.repeat, &cr->throughput[CT_REP], &cr->hit_rate[CT_REP]))
+    return -1;
+  return 0;
+}
 
-  //Insrting into SAIL-U
-  stopwatch_start();
-  for (i = 0; i < prefix_cnt; i++) {
-    ret = sail_u_insert(prefixes[i], pre_lens[i], pre_nhs[i]);
-//We don't want to include this while measuring performance
-#ifdef TEST
-    if (ret) {
-      sprintf(prefixStr, "%s/%d %d", ipv6_to_str(prefixes[i]), pre_lens[i], pre_nhs[i]);
-      printf("Failed to insert %s into SAIL-U \n", prefixStr);
+//Generates Zipf traffic for each skew and measures the lookup throughput,
+//and also through the flow cache if it is enabled. The traffic of a skew is
+//the same for all the algorithms.
+static int zipf_sweep(const struct engine *e, struct fib *fib, struct zipf_result *zr, struct cache_result *cr)
+{
+  const char *name = e->title;
+  register uint64_t cnt = opt.rnd_cnt;
+  struct traffic_conf conf;
+  double delay, cpu_cycles;
+  char phase[128];
+
+  zr->runs = 0;
+  for (int k = 0; k < opt.num_skews; k++) {
+    conf.skew = opt.skews[k];
+    conf.working_set = opt.working_set;
+    conf.burst = opt.burst;
+    conf.seed = k + 1;
+    if (gen_zipf_traffic(zipf_ips, cnt, fib->prefixes, fib->pre_lens, fib->cnt, &conf))
       return -1;
+
+    stopwatch_start();
+    e->lookup_loop(zipf_ips, cnt, 1);
+    stopwatch_stop(&delay, &cpu_cycles);
+    snprintf(phase, sizeof(phase), "%s lookup for Zipf traffic with skew %.2f", name, conf.skew);
+    report_perf(phase, cnt);
+    zr->skew[k] = conf.skew;
+    zr->throughput[k] = (cnt * 1000) / delay;
+    zr->runs++;
+    printf ("%s lookup throughput for Zipf traffic with skew %.2f = %f Mlps \n", name, conf.skew, zr->throughput[k]);
+
+    if (opt.cache_entries) {
+      snprintf(phase, sizeof(phase), "Zipf (skew %.2f)", conf.skew);
+      if (cached_run(e, phase, zipf_ips, cnt, 1, &cr->zipf_throughput[k], &cr->zipf_hit_rate[k]))
+        return -1;
+      cr->zipf_runs++;
     }
-#endif
   }
-  stopwatch_stop(&delay, &cpu_cycles);
-  //Calculate avg. insertion time in microsec
-  res->sail_u_insert_time = delay / (1000 * prefix_cnt);
-  printf ("SAIL-U insertion time per prefix = %f microsec \n", res->sail_u_insert_time);
+  return 0;
+}
 
-  //Calculate memory consumption in MB
-  res->sail_u_mem_consumption = calc_sail_u_mem();
-  printf ("SAIL-U memory consumption = %f MB \n", res->sail_u_mem_consumption);
+//Loads the destination address of an IPv6 header in host byte order
+static __inline__ __uint128_t load_dst(const uint8_t *ip6)
+{
+  uint64_t hi, lo;
 
-  //Lookup for real traffic
-  stopwatch_start();
-  for (i = 0; i < real_ip_cnt; i++) {
-    nh = sail_u_lookup(real_ips[i]);
-#ifdef TEST
-    real_res[i] = nh;
-#endif
-  }
-  stopwatch_stop(&delay, &cpu_cycles);
-  res->sail_u_lookup_throughput_real_traffic = (real_ip_cnt * 1000) / delay;
-  printf ("SAIL-U lookup throughput for real traffic = %f Mlps \n", res->sail_u_lookup_throughput_real_traffic);
+  memcpy(&hi, ip6 + 24, sizeof(hi));
+  memcpy(&lo, ip6 + 32, sizeof(lo));
+  return ((__uint128_t)__builtin_bswap64(hi) << 64) | __builtin_bswap64(lo);
+}
 
-  //Lookup for random traffic
-  stopwatch_start();
-  for (i = 0; i < RND_CNT; i++) {
-    nh = sail_u_lookup(rnd_ips[i]);
-#ifdef TEST
-    rnd_res[i] = nh;
-#endif
+//Forwards a burst of packets the way a software router does: it parses the
+//headers of the whole burst, looks up all the destinations, and then rewrites
+//the MAC addresses and decrements the hop limit of the packets that have a
+//route. Keeping the stages apart lets the lookups of a burst overlap their
+//cache misses. Returns the number of packets forwarded.
+static uint32_t forward_burst(const struct engine *e, struct pcap_pkt *pkts, uint32_t n)
+{
+  __uint128_t keys[MAX_PKT_BURST];
+  uint8_t nhs[MAX_PKT_BURST];
+  uint8_t *hdr[MAX_PKT_BURST];
+  register uint32_t i, fwd = 0;
+  register uint8_t *ip6;
+
+  //The loader only keeps complete IPv6 headers, so parsing is just finding
+  //the header and loading the destination
+  for (i = 0; i < n; i++) {
+    hdr[i] = pcap.data + pkts[i].off;
+    keys[i] = load_dst(hdr[i] + pkts[i].l3);
+  }
+  e->burst_loop(keys, nhs, n);
+  for (i = 0; i < n; i++) {
+    ip6 = hdr[i] + pkts[i].l3;
+    //No route or the hop limit expires here. A router would send an ICMPv6
+    //error, we simply drop the packet.
+    if (!nhs[i] || ip6[7] <= 1)
+      continue;
+    ip6[7]--;
+    if (pkts[i].eth) {
+      memcpy(hdr[i], nh_mac[nhs[i]], 6);
+      memcpy(hdr[i] + 6, port_mac, 6);
+    }
+    fwd++;
   }
-  stopwatch_stop(&delay, &cpu_cycles);
-  res->sail_u_lookup_throughput_rnd_traffic = (RND_CNT * 1000) / delay;
-  printf ("SAIL-U lookup throughput for random traffic = %f Mlps \n", res->sail_u_lookup_throughput_rnd_traffic);
+  return fwd;
+}
 
-  //Lookup for sequential traffic
+//Replays the capture through the forwarding pipeline until at least
+//opt.rnd_cnt packets are forwarded or dropped, and reports packets/sec.
+static void pcap_replay(const struct engine *e, struct replay_result *rr)
+{
+  const char *name = e->title;
+  register uint64_t i, n;
+  uint64_t passes = (opt.rnd_cnt + pcap.cnt - 1) / pcap.cnt;
+  uint64_t fwd = 0;
+  double delay, cpu_cycles, total = 0;
+  char phase[128];
+
+  for (uint64_t p = 0; p < passes; p++) {
+    for (i = 0; i < pcap.cnt; i++)
+      pcap.data[pcap.pkts[i].off + pcap.pkts[i].l3 + 7] = pcap_hlim[i];
+    stopwatch_start();
+    for (i = 0; i < pcap.cnt; i += n) {
+      n = pcap.cnt - i < opt.pkt_burst ? pcap.cnt - i : opt.pkt_burst;
+      fwd += forward_burst(e, &pcap.pkts[i], n);
+    }
+    stopwatch_stop(&delay, &cpu_cycles);
+    total += delay;
+  }
+  //The counters are of the last pass
+  snprintf(phase, sizeof(phase), "%s pcap replay", name);
+  report_perf(phase, pcap.cnt);
+  rr->throughput = (passes * pcap.cnt * 1000) / total;
+  rr->forwarded = fwd / passes;
+  rr->dropped = pcap.cnt - rr->forwarded;
+  printf ("%s pcap replay with bursts of %d = %f Mpps, %" PRIu64 " forwarded and %" PRIu64 " dropped per pass\n",
+          name, opt.pkt_burst, rr->throughput, rr->forwarded, rr->dropped);
+}
+
+struct mt_arg {
+  const struct engine *e;
+  //Slice of the traffic looked up by this thread
+  __uint128_t *ips;
+  uint64_t cnt;
+  //# of times each lookup is repeated
+  int repeat;
+  int cpu;
+  pthread_barrier_t *barrier;
+  double delay;
+};
+
+static void *mt_lookup(void *arg)
+{
+  struct mt_arg *a = (struct mt_arg *) arg;
+  double cpu_cycles;
+  cpu_set_t set;
+
+  CPU_ZERO(&set);
+  CPU_SET(a->cpu, &set);
+  pthread_setaffinity_np(pthread_self(), sizeof(set), &set);
+
+  //Start all the threads together so that they contend with each other
+  pthread_barrier_wait(a->barrier);
   stopwatch_start();
-  for (i = 0; i < SEQ_CNT; i++) {
-    nh = sail_u_lookup(seq_ips[i]);
-#ifdef TEST
-    seq_res[i] = nh;
-#endif
+  a->e->lookup_loop(a->ips, a->cnt, a->repeat);
+  stopwatch_stop(&a->delay, &cpu_cycles);
+  stopwatch_thread_exit();
+  return NULL;
+}
+
+//Runs the lookups of the traffic with nthreads threads. Returns the aggregate
+//throughput in Mlps.
+static double run_mt_lookup(const struct engine *e, __uint128_t *ips, uint64_t cnt,
+                            int repeat, int nthreads, int ncpus)
+{
+  struct mt_arg args[nthreads];
+  pthread_t threads[nthreads];
+  pthread_barrier_t barrier;
+  double max_delay = 0;
+  int t;
+
+  pthread_barrier_init(&barrier, NULL, nthreads);
+  for (t = 0; t < nthreads; t++) {
+    args[t].e = e;
+    args[t].ips = ips + cnt * t / nthreads;
+    args[t].cnt = cnt * (t + 1) / nthreads - cnt * t / nthreads;
+    args[t].repeat = repeat;
+    args[t].cpu = t % ncpus;
+    args[t].barrier = &barrier;
+    args[t].delay = 0;
+    pthread_create(&threads[t], NULL, mt_lookup, &args[t]);
+  }
+  for (t = 0; t < nthreads; t++)
+    pthread_join(threads[t], NULL);
+  pthread_barrier_destroy(&barrier);
+
+  printf ("  %d threads, per-thread throughput:", nthreads);
+  for (t = 0; t < nthreads; t++) {
+    printf (" %.1f", (args[t].cnt * repeat * 1000) / args[t].delay);
+    if (args[t].delay > max_delay)
+      max_delay = args[t].delay;
+  }
+  printf (" Mlps\n");
+  //The slowest thread determines the aggregate throughput
+  return (cnt * repeat * 1000) / max_delay;
+}
+
+//Thread counts are 1, 2, 4, ... up to opt.threads. The threads are pinned to
+//the online cores round robin.
+static void mt_scaling(const struct engine *e, struct scaling_result *sc)
+{
+  const char *name = e->title;
+  __uint128_t *ips[NUM_MT_TRAFFIC] = {real_ips, rnd_ips, rep_ips};
+  uint64_t cnt[NUM_MT_TRAFFIC] = {real_ip_cnt, opt.rnd_cnt, opt.rep_cnt};
+  int repeat[NUM_MT_TRAFFIC] = {1, 1, opt.repeat};
+  int ncpus = sysconf(_SC_NPROCESSORS_ONLN);
+  int max_threads = opt.threads;
+  int n, r;
+
+  for (int tr = 0; tr < NUM_MT_TRAFFIC; tr++) {
+    printf ("%s multi-threaded lookup for %s traffic\n", name, mt_traffic_name[tr]);
+    r = 0;
+    for (n = 1; r < MAX_SCALING_RUNS; n = (n * 2 > max_threads && n < max_threads) ? max_threads : n * 2) {
+      if (n > max_threads)
+        break;
+      sc[tr].threads[r] = n;
+      sc[tr].throughput[r] = run_mt_lookup(e, ips[tr], cnt[tr], repeat[tr], n, ncpus);
+      sc[tr].efficiency[r] = sc[tr].throughput[r] / (n * sc[tr].throughput[0]);
+      printf ("  %d threads: %f Mlps, scaling efficiency %f\n", n, sc[tr].throughput[r], sc[tr].efficiency[r]);
+      r++;
+    }
+    sc[tr].runs = r;
   }
-  stopwatch_stop(&delay, &cpu_cycles);
-  res->sail_u_lookup_throughput_seq_traffic = (SEQ_CNT * 1000) / delay;
-  printf ("SAIL-U lookup throughput for sequential traffic = %f Mlps \n", res->sail_u_lookup_throughput_seq_traffic);
+}
 
-  //Lookup for prefix traffic
-  stopwatch_start();
-  for (i = 0; i < prefix_cnt; i++) {
-    nh = sail_u_lookup(prefixes[i]);
-#ifdef TEST
-    pre_res[i] = nh;
-#endif
+//Generates the route updates of the mixed workload from a FIB. opt.inserts
+//percent of them insert a more specific prefix under a random prefix, and
+//opt.withdraws percent withdraw a random one of the prefixes inserted so far
+//that is still announced. The rest change the next-hop of a random prefix,
+//and so do the withdrawals while there is nothing to withdraw.
+static int gen_updates(struct fib *fib)
+{
+  struct xorshift128_state rnd = {3, 5, 7, 11};
+  //Updates that inserted a prefix which is not withdrawn yet
+  uint32_t *announced;
+  uint64_t ann_cnt = 0;
+  uint32_t ix, pick;
+  int len;
+
+  if (!updates)
+    updates = (struct update *) malloc (UPD_CNT * sizeof(struct update));
+  announced = (uint32_t *) malloc (UPD_CNT * sizeof(uint32_t));
+  if (!updates || !announced) {
+    puts("Failed to allocate memory for updates");
+    free(announced);
+    return -1;
   }
-  stopwatch_stop(&delay, &cpu_cycles);
-  res->sail_u_lookup_time = delay/prefix_cnt;
-  res->sail_u_lookup_throughput_pre_traffic = (prefix_cnt * 1000) / delay;
-  res->sail_u_lookup_cpucycle = cpu_cycles/prefix_cnt;
-  printf ("SAIL-U lookup throughput for prefix traffic = %f Mlps \n", res->sail_u_lookup_throughput_pre_traffic);
-  
-  //Lookup for repeated traffic
-  stopwatch_start();
-  for (i = 0; i < REP_CNT; i++) {
-      for (j = 0; j < REPEAT; j++)
-        nh = sail_u_lookup(rep_ips[i]);
-#ifdef TEST
-      rep_res[i] = nh;
-#endif
+  for (uint64_t i = 0; i < UPD_CNT; i++) {
+    xorshift128(&rnd);
+    ix = rnd.a % fib->cnt;
+    len = fib->pre_lens[ix];
+    //Next-hop 0 means no route
+    updates[i].nh = rnd.b % 255 + 1;
+    updates[i].withdraw = false;
+    pick = rnd.c % 100;
+    if (pick >= opt.inserts && pick < opt.inserts + opt.withdraws && ann_cnt) {
+      ix = rnd.d % ann_cnt;
+      //The new next-hop is kept for the algorithms that can't withdraw
+      updates[i].prefix = updates[announced[ix]].prefix;
+      updates[i].len = updates[announced[ix]].len;
+      updates[i].withdraw = true;
+      announced[ix] = announced[--ann_cnt];
+      continue;
+    }
+    if (pick < opt.inserts && len < 128) {
+      //1 to 16 more bits below the prefix
+      len += rnd.d % 16 + 1;
+      if (len > 128)
+        len = 128;
+      xorshift128(&rnd);
+      updates[i].prefix = fib->prefixes[ix] | (xorshift_to_ipv6(&rnd) >> fib->pre_lens[ix]);
+      updates[i].prefix &= ~(__uint128_t)0 << (128 - len);
+      announced[ann_cnt++] = i;
+    } else {
+      updates[i].prefix = fib->prefixes[ix];
+    }
+    updates[i].len = len;
   }
-  stopwatch_stop(&delay, &cpu_cycles);
-  res->sail_u_lookup_time = delay/(REP_CNT * REPEAT);
-  res->sail_u_lookup_throughput_rep_traffic = (REP_CNT * REPEAT * 1000) / delay;
-  res->sail_u_lookup_cpucycle = cpu_cycles/(REP_CNT * REPEAT);
-  printf ("SAIL-U lookup throughput for repeated traffic = %f Mlps \n", res->sail_u_lookup_throughput_rep_traffic);
+  free(announced);
+  return 0;
+}
 
-  sail_u_cleanup();
+//Applies an update. An algorithm that can't withdraw routes changes the
+//next-hop of the prefix instead, so all of them apply as many updates.
+static int apply_update(const struct engine *e, const struct update *u)
+{
+  if (u->withdraw && e->remove)
+    return e->remove(u->prefix, u->len);
+  return e->insert(u->prefix, u->len, u->nh);
+}
 
-  printf("---------------------Checking SAIL-L-------------------------- \n");
+struct updater_arg {
+  const struct engine *e;
+  //Number of lookups done so far by the lookup thread
+  volatile uint64_t *progress;
+  volatile bool *done;
+  uint64_t applied;
+  uint64_t failed;
+  int cpu;
+  //TSC cycles spent in the successful updates
+  uint64_t cycles;
+};
 
-  ret = sail_l_init();
-  if (ret < 0) {
-    puts("Failed to initialize SAIL-L");
-    sail_l_cleanup();
-    return -1;
+//Applies one update every opt.update_ratio lookups done by the lookup thread.
+//Only the updates are timed, not the wait for the lookups.
+static void *updater(void *arg)
+{
+  struct updater_arg *a = (struct updater_arg *) arg;
+  struct update *u;
+  uint64_t t0, t1;
+  cpu_set_t set;
+  int spins;
+
+  CPU_ZERO(&set);
+  CPU_SET(a->cpu, &set);
+  pthread_setaffinity_np(pthread_self(), sizeof(set), &set);
+
+  while (!*a->done) {
+    for (spins = 0; *a->progress < (a->applied + 1) * opt.update_ratio && !*a->done; spins++) {
+      if (spins < 1024)
+        __builtin_ia32_pause();
+      else
+        sched_yield();
+    }
+    if (*a->done)
+      break;
+    u = &updates[a->applied % UPD_CNT];
+    t0 = tsc_begin();
+    if (apply_update(a->e, u)) {
+      a->failed++;
+    } else {
+      t1 = tsc_end();
+      a->cycles += t1 - t0;
+    }
+    a->applied++;
   }
+  stopwatch_thread_exit();
+  return NULL;
+}
 
-  //Insrting into SAIL-L
-  stopwatch_start();
-  for (i = 0; i < prefix_cnt; i++) {
-    ret = sail_l_insert(prefixes[i], pre_lens[i], pre_nhs[i]);
-#ifdef TEST
-    if (ret) {
-      sprintf(prefixStr, "%s/%d %d", ipv6_to_str(prefixes[i]), pre_lens[i], pre_nhs[i]);
-      printf("Failed to insert %s into SAIL-L \n", prefixStr);
+//Interleaves route updates with the lookups of repeated traffic. In
+//single-thread mode an update is applied after every opt.update_ratio
+//lookups. With opt.update_thread a dedicated thread applies them at the same
+//ratio while the lookups go on. The algorithms don't synchronize updates
+//with lookups, so a lookup may see a partially applied update. The
+//next-hops are not verified in this mode. The update rate only counts the
+//updates the algorithm applied and the time spent in them.
+static int mixed_workload(const struct engine *e, struct mixed_result *mr)
+{
+  const char *name = e->title;
+  register uint64_t i, k, cnt = opt.rep_cnt, ratio = opt.update_ratio;
+  register uint64_t t0, t1;
+  volatile uint64_t progress = 0;
+  volatile bool done = false;
+  uint64_t upd_cycles = 0, overhead, n;
+  struct updater_arg ua;
+  struct latency_result ovh;
+  double delay, cpu_cycles, ghz = stopwatch_tsc_ghz();
+  pthread_t thread;
+  struct update *u;
+  char phase[128];
+
+  memset(mr, 0, sizeof(*mr));
+  if (opt.update_thread) {
+    ua.e = e;
+    ua.progress = &progress;
+    ua.done = &done;
+    ua.applied = ua.failed = ua.cycles = 0;
+    ua.cpu = 1 % sysconf(_SC_NPROCESSORS_ONLN);
+    if (pthread_create(&thread, NULL, updater, &ua)) {
+      puts("Failed to create the update thread");
       return -1;
     }
-#endif
+    stopwatch_start();
+    for (i = 0; i < cnt; i += k) {
+      k = cnt - i < 256 ? cnt - i : 256;
+      e->lookup_loop(rep_ips + i, k, 1);
+      progress = i + k;
+    }
+    stopwatch_stop(&delay, &cpu_cycles);
+    done = true;
+    pthread_join(thread, NULL);
+    mr->updates = ua.applied;
+    mr->failed = ua.failed;
+    upd_cycles = ua.cycles;
+  } else {
+    stopwatch_start();
+    for (i = 0; i < cnt; i += k) {
+      k = cnt - i < ratio ? cnt - i : ratio;
+      e->lookup_loop(rep_ips + i, k, 1);
+      if (k < ratio)
+        break;
+      u = &updates[mr->updates++ % UPD_CNT];
+      t0 = tsc_begin();
+      if (apply_update(e, u)) {
+        mr->failed++;
+      } else {
+        t1 = tsc_end();
+        upd_cycles += t1 - t0;
+      }
+    }
+    stopwatch_stop(&delay, &cpu_cycles);
+  }
+  mr->update_rate = upd_cycles ? (mr->updates - mr->failed) * 1000000 * ghz / upd_cycles : 0;
+  snprintf(phase, sizeof(phase), "%s mixed lookup/update", name);
+  report_perf(phase, cnt);
+  mr->lookup_throughput = (cnt * 1000) / delay;
+  printf ("%s mixed workload: lookup throughput = %f Mlps, %" PRIu64 " updates (%" PRIu64 " failed), successful ones at %f K updates/sec \n",
+          name, mr->lookup_throughput, mr->updates, mr->failed, mr->update_rate);
+
+  //Lookup latency in the single-thread mixed workload. Update time is not
+  //included but the lookups right after an update see its cache misses.
+  sample_lookups(latency_loop<null_lookup>, rnd_ips, opt.rnd_cnt, 0, &ovh);
+  overhead = hist_percentile(&lat_hist, 50);
+  n = cnt < LAT_CNT ? cnt : LAT_CNT;
+  hist_reset(&lat_hist);
+  for (i = 0; i < n; i += k) {
+    k = n - i < ratio ? n - i : ratio;
+    record_latency(e->latency_loop, rep_ips + i, k, overhead);
+    if (k < ratio)
+      break;
+    u = &updates[(mr->updates + i / ratio) % UPD_CNT];
+    apply_update(e, u);
+  }
+  mr->latency.p50 = hist_percentile(&lat_hist, 50) / ghz;
+  mr->latency.p99 = hist_percentile(&lat_hist, 99) / ghz;
+  mr->latency.p999 = hist_percentile(&lat_hist, 99.9) / ghz;
+  printf ("%s mixed workload latency: p50 = %.1f ns, p99 = %.1f ns, p99.9 = %.1f ns\n",
+          name, mr->latency.p50, mr->latency.p99, mr->latency.p999);
+
+  //Once more through the flow cache. Every update invalidates the cache.
+  if (opt.cache_entries) {
+    struct flow_cache fc;
+    uint64_t base = mr->updates + n / ratio;
+
+    if (flow_cache_init(&fc, opt.cache_entries, cache_key64, e->lookup))
+      return -1;
+    stopwatch_start();
+    for (i = 0; i < cnt; i += k) {
+      k = cnt - i < ratio ? cnt - i : ratio;
+      e->cached_loop(&fc, rep_ips + i, k, 1);
+      if (k < ratio)
+        break;
+      u = &updates[(base + i / ratio) % UPD_CNT];
+      apply_update(e, u);
+      flow_cache_invalidate();
+      if (opt.verify && flow_cache_lookup(&fc, rep_ips[i + k - 1]) != e->lookup(rep_ips[i + k - 1])) {
+        printf ("%s flow cache returned a stale next-hop after an update\n", name);
+        flow_cache_free(&fc);
+        return -1;
+      }
+    }
+    stopwatch_stop(&delay, &cpu_cycles);
+    mr->cached_throughput = (cnt * 1000) / delay;
+    mr->cached_hit_rate = (double)fc.hits / (fc.hits + fc.misses);
+    printf ("%s mixed workload through flow cache: lookup throughput = %f Mlps, hit rate = %f \n",
+            name, mr->cached_throughput, mr->cached_hit_rate);
+    flow_cache_free(&fc);
   }
-  stopwatch_stop(&delay, &cpu_cycles);
-  //Calculate avg. insertion time in microsec
-  res->sail_l_insert_time = delay / (1000 * prefix_cnt);
-  printf ("SAIL-L insertion time per prefix = %f microsec \n", res->sail_l_insert_time);
+  return 0;
+}
 
-  //Calculate memory consumption in MB
-  res->sail_l_mem_consumption = calc_sail_l_mem();
-  printf ("SAIL-L memory consumption = %f MB \n", res->sail_l_mem_consumption);
+//64-bit fast-path lookup of the algorithm being measured. lookup64_key()
+//looks up a __uint128_t key with it for verification.
+static uint8_t (*cur_lookup64)(uint64_t key_hi, uint64_t key_lo);
 
-  //Lookup for real traffic
-  stopwatch_start();
-  for (i = 0; i < real_ip_cnt; i++) {
-    nh = sail_l_lookup(real_ips[i]);
-#ifdef TEST
-    if (nh != real_res[i]) {
-      printf("IP = %s\n", ipv6_to_str(real_ips[i]));
-      printf ("SAIL-U next-hop = %d\n", real_res[i]);
-      printf ("SAIL-L next-hop = %d\n", nh);
+static uint8_t lookup64_key(__uint128_t key)
+{
+  return cur_lookup64(key >> 64, key);
+}
+
+//Index of a traffic in ref_res
+static int traffic_idx(int traffic)
+{
+  return __builtin_ctz(traffic);
+}
+
+//Looks up the traffic again (outside the timed loop) and matches the
+//next-hops with the first algorithm that looked up the same traffic. The
+//first algorithm only records its next-hops.
+static int verify_lookups(const char *name, int traffic, uint8_t (*lookup)(__uint128_t),
+                          __uint128_t *ips, uint64_t cnt)
+{
+  int t = traffic_idx(traffic);
+  uint8_t nh;
+
+  if (!ref_valid[t]) {
+    for (uint64_t i = 0; i < cnt; i++)
+      ref_res[t][i] = lookup(ips[i]);
+    ref_valid[t] = true;
+    ref_name[t] = name;
+    return 0;
+  }
+
+  for (uint64_t i = 0; i < cnt; i++) {
+    nh = lookup(ips[i]);
+    if (nh != ref_res[t][i]) {
+      printf("IP = %s\n", ipv6_to_str(ips[i]));
+      printf ("%s next-hop = %d\n", ref_name[t], ref_res[t][i]);
+      printf ("%s next-hop = %d\n", name, nh);
       return -1;
     }
-#endif
   }
-  stopwatch_stop(&delay, &cpu_cycles);
-  res->sail_l_lookup_throughput_real_traffic = (real_ip_cnt * 1000) / delay;
-  printf ("SAIL-L lookup throughput for real traffic = %f Mlps \n", res->sail_l_lookup_throughput_real_traffic);
+  return 0;
+}
 
-  //Lookup for random traffic
-  stopwatch_start();
-  for (i = 0; i < RND_CNT; i++) {
-    nh = sail_l_lookup(rnd_ips[i]);
-#ifdef TEST
-    if (nh != rnd_res[i]) {
-      printf("IP = %s\n", ipv6_to_str(rnd_ips[i]));
-      printf ("SAIL-U next-hop = %d\n", rnd_res[i]);
-      printf ("SAIL-L next-hop = %d\n", nh);
+//Packets are built from the real traffic. So both the packet lookups must
+//return the same next-hops as the real traffic. lookup_addr is optional.
+static int verify_pkt_lookups(const char *name, uint8_t (*lookup)(__uint128_t),
+                              uint8_t (*lookup_addr)(const uint8_t *))
+{
+  int t = traffic_idx(TR_REAL);
+  uint8_t nh, ref;
+
+  for (uint64_t i = 0; i < PKT_CNT; i++) {
+    ref = ref_valid[t] ? ref_res[t][i % real_ip_cnt] : lookup(real_ips[i % real_ip_cnt]);
+    nh = lookup(in6_addr_to_uint128((struct in6_addr *)&pkts[i][DST_OFF]));
+    if (nh == ref && lookup_addr)
+      nh = lookup_addr(&pkts[i][DST_OFF]);
+    if (nh != ref) {
+      printf("IP = %s\n", ipv6_to_str(real_ips[i % real_ip_cnt]));
+      printf ("%s next-hop = %d\n", ref_valid[t] ? ref_name[t] : name, ref);
+      printf ("%s packet next-hop = %d\n", name, nh);
       return -1;
     }
-#endif
   }
-  stopwatch_stop(&delay, &cpu_cycles);
-  res->sail_l_lookup_throughput_rnd_traffic = (RND_CNT * 1000) / delay;
-  printf ("SAIL-L lookup throughput for random traffic = %f Mlps \n", res->sail_l_lookup_throughput_rnd_traffic);
+  return 0;
+}
 
-  //Lookup for sequential traffic
-  stopwatch_start();
-  for (i = 0; i < SEQ_CNT; i++) {
-    nh = sail_l_lookup(seq_ips[i]);
-#ifdef TEST
-    if (nh != seq_res[i]) {
-      printf("IP = %s \n", ipv6_to_str(seq_ips[i]));
-      printf ("SAIL-U next-hop = %d\n", seq_res[i]);
-      printf ("SAIL-L next-hop = %d\n", nh);
-      return -1;
-    }
-#endif
+//Looks up real and random traffic with the batched lookup of an algorithm
+//that keeps opt.batch_width lookups in flight, or as many as it can. With
+//opt.verify, the next-hops must match the scalar lookup.
+static int batch_lookups(const struct engine *e, struct engine_result *er)
+{
+  int traffic[2] = {TR_REAL, TR_RND};
+  const char *traffic_name[2] = {"real", "random"};
+  __uint128_t *ips[2] = {real_ips, rnd_ips};
+  uint64_t cnt[2] = {real_ip_cnt, opt.rnd_cnt};
+  double *throughput[2] = {&er->batch_throughput_real_traffic, &er->batch_throughput_rnd_traffic};
+  int width = opt.batch_width < e->max_batch ? opt.batch_width : e->max_batch;
+  double delay, cpu_cycles;
+  char phase[128];
+  uint8_t *nhs;
+
+  nhs = (uint8_t *) malloc (cnt[0] > cnt[1] ? cnt[0] : cnt[1]);
+  if (!nhs) {
+    puts("Failed to allocate memory for batched lookups");
+    return -1;
   }
-  stopwatch_stop(&delay, &cpu_cycles);
-  res->sail_l_lookup_throughput_seq_traffic = (SEQ_CNT * 1000) / delay;
-  printf ("SAIL-L lookup throughput for sequential traffic = %f Mlps \n", res->sail_l_lookup_throughput_seq_traffic);
-  
-  //Lookup for prefix traffic
-  stopwatch_start();
-  for (i = 0; i < prefix_cnt; i++) {
-    nh = sail_l_lookup(prefixes[i]);
-#ifdef TEST
-    if (nh != pre_res[i]) {
-      printf("IP = %s\n", ipv6_to_str(prefixes[i]));
-      printf ("SAIL-U next-hop = %d\n", pre_res[i]);
-      printf ("SAIL-L next-hop = %d\n", nh);
-      return -1;
+  for (int t = 0; t < 2; t++) {
+    if (!(opt.traffic & traffic[t]))
+      continue;
+    stopwatch_start();
+    e->lookup_batch(ips[t], nhs, cnt[t], width);
+    stopwatch_stop(&delay, &cpu_cycles);
+    snprintf(phase, sizeof(phase), "%s batched lookup for %s traffic", e->title, traffic_name[t]);
+    report_perf(phase, cnt[t]);
+    *throughput[t] = (cnt[t] * 1000) / delay;
+    printf ("%s batched lookup throughput for %s traffic with %d in flight = %f Mlps \n",
+            e->title, traffic_name[t], width, *throughput[t]);
+    for (uint64_t i = 0; opt.verify && i < cnt[t]; i++) {
+      if (nhs[i] != e->lookup(ips[t][i])) {
+        printf("IP = %s\n", ipv6_to_str(ips[t][i]));
+        printf ("%s next-hop = %d, batched next-hop = %d\n", e->title, e->lookup(ips[t][i]), nhs[i]);
+        free(nhs);
+        return -1;
+      }
     }
-#endif
   }
-  stopwatch_stop(&delay, &cpu_cycles);
-  res->sail_l_lookup_time = delay/prefix_cnt;
-  res->sail_l_lookup_throughput_pre_traffic = (prefix_cnt * 1000) / delay;
-  res->sail_l_lookup_cpucycle = cpu_cycles/prefix_cnt;
-  printf ("SAIL-L lookup throughput for prefix traffic = %f Mlps \n", res->sail_l_lookup_throughput_pre_traffic);
-  
-  //Lookup for repeated traffic
-  stopwatch_start();
-  for (i = 0; i < REP_CNT; i++) {
-    for (j = 0; j < REPEAT; j++)
-      nh = sail_l_lookup(rep_ips[i]);
-#ifdef TEST
-    if (nh != rep_res[i]) {
-      printf("IP = %s\n", ipv6_to_str(rep_ips[i]));
-      printf ("SAIL-U next-hop = %d\n", rep_res[i]);
-      printf ("SAIL-L next-hop = %d\n", nh);
+  free(nhs);
+  return 0;
+}
+
+//Random IPs checked against the RIB after the withdrawals
+#define WITHDRAW_CHECK_CNT (1ULL << 20)
+
+//Longest prefix match in a RIB. It probes every prefix length, so it's slow,
+//but it doesn't depend on any of the algorithms.
+static uint8_t rib_lookup(struct rib *r, __uint128_t key)
+{
+  int len;
+  uint8_t nh = rib_parent(r, key, 129, &len);
+
+  return nh ? nh : rib_find(r, key, 0);
+}
+
+//Matches the lookups of the keys with the longest prefix match in the RIB
+static int verify_rib(const char *name, uint8_t (*lookup)(__uint128_t), struct rib *r,
+                      const __uint128_t *ips, uint64_t cnt)
+{
+  uint8_t nh, ref;
+
+  for (uint64_t i = 0; i < cnt; i++) {
+    nh = lookup(ips[i]);
+    ref = rib_lookup(r, ips[i]);
+    if (nh != ref) {
+      printf("IP = %s\n", ipv6_to_str(ips[i]));
+      printf ("RIB next-hop after the withdrawals = %d\n", ref);
+      printf ("%s next-hop = %d\n", name, nh);
       return -1;
     }
-#endif
   }
-  stopwatch_stop(&delay, &cpu_cycles);
-  res->sail_l_lookup_time = delay/(REP_CNT * REPEAT);
-  res->sail_l_lookup_throughput_rep_traffic = (REP_CNT * REPEAT * 1000) / delay;
-  res->sail_l_lookup_cpucycle = cpu_cycles/(REP_CNT * REPEAT);
-  printf ("SAIL-L lookup throughput for repeated traffic = %f Mlps \n", res->sail_l_lookup_throughput_rep_traffic);
+  return 0;
+}
 
-  sail_l_cleanup();
+//Checks the lookups right after the withdrawals against a RIB of the FIB
+//without the withdrawn routes. The prefixes of the FIB, the withdrawn ones
+//included, and the first random IPs are looked up.
+static int verify_withdrawals(const char *name, uint8_t (*lookup)(__uint128_t), struct fib *fib,
+                              uint32_t *idx, uint64_t n)
+{
+  struct rib r;
+  uint64_t i;
+  int err = -1;
 
-  printf("---------------------Checking Poptrie-------------------------- \n");
+  if (rib_init(&r, 2 * fib->cnt)) {
+    puts("Failed to allocate memory for the RIB");
+    return -1;
+  }
+  for (i = 0; i < fib->cnt; i++) {
+    if (rib_insert(&r, fib->prefixes[i], fib->pre_lens[i], fib->pre_nhs[i]))
+      goto out;
+  }
+  for (i = 0; i < n; i++)
+    rib_delete(&r, fib->prefixes[idx[i]], fib->pre_lens[idx[i]]);
+
+  if (verify_rib(name, lookup, &r, fib->prefixes, fib->cnt))
+    goto out;
+  if ((opt.traffic & TR_RND) &&
+      verify_rib(name, lookup, &r, rnd_ips, opt.rnd_cnt < WITHDRAW_CHECK_CNT ? opt.rnd_cnt : WITHDRAW_CHECK_CNT))
+    goto out;
+  err = 0;
+out:
+  rib_cleanup(&r);
+  return err;
+}
 
-  ret = poptrie_init();
-  if (ret < 0) {
-    puts("Failed to initialize poptrie");
-    poptrie_cleanup();
+//Withdraws opt.withdrawals distinct random routes of the FIB one by one and
+//then announces them again. The average time of a withdrawal and of an
+//announcement is reported in microsec. With opt.verify, the lookups are
+//checked right after the withdrawals, see verify_withdrawals(). The FIB is the
+//same afterwards, so the lookups are verified once more.
+static int withdraw_routes(const struct engine *e, struct fib *fib, double *withdraw_time, double *announce_time)
+{
+  const char *name = e->title;
+  struct xorshift128_state rnd = {13, 17, 19, 23};
+  uint64_t i, j, n = opt.withdrawals < fib->cnt ? opt.withdrawals : fib->cnt;
+  uint64_t failed = 0;
+  uint32_t *idx, tmp;
+  double delay, cpu_cycles;
+  char phase[128];
+
+  idx = (uint32_t *) malloc (fib->cnt * sizeof(uint32_t));
+  if (!idx) {
+    puts("Failed to allocate memory for withdrawals");
     return -1;
   }
+  //The first n entries of a random permutation
+  for (i = 0; i < fib->cnt; i++)
+    idx[i] = i;
+  for (i = 0; i < n; i++) {
+    xorshift128(&rnd);
+    j = i + ((uint64_t)rnd.a << 32 | rnd.b) % (fib->cnt - i);
+    tmp = idx[i];
+    idx[i] = idx[j];
+    idx[j] = tmp;
+  }
 
-  //Inserting into Poptrie
   stopwatch_start();
-  for (i = 0; i < prefix_cnt; i++) {
-    ret = poptrie_insert(prefixes[i], pre_lens[i], pre_nhs[i]);
-#ifdef TEST
-    if (ret) {
-      sprintf(prefixStr, "%s/%d %d", ipv6_to_str(prefixes[i]), pre_lens[i], pre_nhs[i]);
-      printf("Failed to insert %s into poptrie \n", prefixStr);
-      return -1;
-    }
-#endif
+  for (i = 0; i < n; i++) {
+    if (e->remove(fib->prefixes[idx[i]], fib->pre_lens[idx[i]]))
+      failed++;
   }
   stopwatch_stop(&delay, &cpu_cycles);
-  //Calculate avg. insertion time in microsec
-  res->poptrie_insert_time = delay / (1000 * prefix_cnt);
-  printf ("Poptrie insertion time per prefix = %f microsec \n", res->poptrie_insert_time);
-
-  //Calculate memory consumption in MB
-  res->poptrie_mem_consumption = calc_poptrie_mem();
-  printf ("Poptrie memory consumption = %f MB \n", res->poptrie_mem_consumption);
+  snprintf(phase, sizeof(phase), "%s withdrawal", name);
+  report_perf(phase, n);
+  *withdraw_time = delay / (1000 * n);
+  if (opt.verify && !failed && verify_withdrawals(name, e->lookup, fib, idx, n)) {
+    printf ("%s lookups are wrong after the withdrawals\n", name);
+    free(idx);
+    return -1;
+  }
 
-  //Lookup for real traffic
   stopwatch_start();
-  for (i = 0; i < real_ip_cnt; i++) {
-    nh = poptrie_lookup(real_ips[i]);
-#ifdef TEST
-    if (nh != real_res[i]) {
-      printf("IP = %s\n", ipv6_to_str(real_ips[i]));
-      printf ("SAIL-U next-hop = %d\n", real_res[i]);
-      printf ("Poptrie next-hop = %d\n", nh);
-      return -1;
-    }
-#endif
+  for (i = 0; i < n; i++) {
+    if (e->insert(fib->prefixes[idx[i]], fib->pre_lens[idx[i]], fib->pre_nhs[idx[i]]))
+      failed++;
   }
   stopwatch_stop(&delay, &cpu_cycles);
-  res->poptrie_lookup_throughput_real_traffic = (real_ip_cnt * 1000) / delay;
-  printf ("Poptrie lookup throughput for real traffic = %f Mlps \n", res->poptrie_lookup_throughput_real_traffic);
-
-  //Lookup for random traffic
-  stopwatch_start();
-  for (i = 0; i < RND_CNT; i++) {
-    nh = poptrie_lookup(rnd_ips[i]);
-#ifdef TEST
-    if (nh != rnd_res[i]) {
-      printf("IP = %s\n", ipv6_to_str(rnd_ips[i]));
-      printf ("SAIL-U next-hop = %d\n", rnd_res[i]);
-      printf ("Poptrie next-hop = %d\n", nh);
+  snprintf(phase, sizeof(phase), "%s re-announcement", name);
+  report_perf(phase, n);
+  *announce_time = delay / (1000 * n);
+  free(idx);
+
+  printf ("%s withdrawal time per route = %f microsec, re-announcement = %f microsec (%" PRIu64 " routes, %" PRIu64 " failed) \n",
+          name, *withdraw_time, *announce_time, n, failed);
+  if (opt.verify) {
+    if (failed)
+      return -1;
+    if ((opt.traffic & TR_RND) && verify_lookups(name, TR_RND, e->lookup, rnd_ips, opt.rnd_cnt))
+      return -1;
+    if ((opt.traffic & TR_PRE) && verify_lookups(name, TR_PRE, e->lookup, fib->prefixes, fib->cnt))
       return -1;
-    }
-#endif
   }
-  stopwatch_stop(&delay, &cpu_cycles);
-  res->poptrie_lookup_throughput_rnd_traffic = (RND_CNT * 1000) / delay;
-  printf ("Poptrie lookup throughput for random traffic = %f Mlps \n", res->poptrie_lookup_throughput_rnd_traffic);
+  return 0;
+}
 
-  //Lookup for sequential traffic
-  stopwatch_start();
-  for (i = 0; i < SEQ_CNT; i++) {
-    nh = poptrie_lookup(seq_ips[i]);
-#ifdef TEST
-    if (nh != seq_res[i]) {
-      printf("IP = %s \n", ipv6_to_str(seq_ips[i]));
-      printf ("SAIL-U next-hop = %d\n", seq_res[i]);
-      printf ("Poptrie next-hop = %d\n", nh);
-      return -1;
-    }
-#endif
+//Index of an algorithm in engines[], or -1 if it isn't there
+static int engine_idx(const char *name)
+{
+  const struct engine *e = engine_find(name);
+
+  for (int i = 0; e && i < num_engines; i++) {
+    if (engines[i] == e)
+      return i;
   }
-  stopwatch_stop(&delay, &cpu_cycles);
-  res->poptrie_lookup_throughput_seq_traffic = (SEQ_CNT * 1000) / delay;
-  printf ("Poptrie lookup throughput for sequential traffic = %f Mlps \n", res->poptrie_lookup_throughput_seq_traffic);
-  
-  //Lookup for prefix traffic
-  stopwatch_start();
-  for (i = 0; i < prefix_cnt; i++) {
-    nh = poptrie_lookup(prefixes[i]);
-#ifdef TEST
-    if (nh != pre_res[i]) {
-      printf("IP = %s \n", ipv6_to_str(prefixes[i]));
-      printf ("SAIL-U next-hop = %d\n", pre_res[i]);
-      printf ("Poptrie next-hop = %d\n", nh);
-      return -1;
-    }
-#endif
+  return -1;
+}
+
+//Lookup throughput of an algorithm for a traffic
+static double *traffic_throughput(struct engine_result *er, int traffic)
+{
+  switch (traffic) {
+  case TR_REAL:
+    return &er->lookup_throughput_real_traffic;
+  case TR_RND:
+    return &er->lookup_throughput_rnd_traffic;
+  case TR_SEQ:
+    return &er->lookup_throughput_seq_traffic;
+  case TR_PRE:
+    return &er->lookup_throughput_pre_traffic;
+  default:
+    return &er->lookup_throughput_rep_traffic;
+  }
+}
+
+//Throughput of the packed layout of an algorithm for real, random or prefix
+//traffic
+static double *packed_throughput(struct engine_result *er, int traffic)
+{
+  switch (traffic) {
+  case TR_REAL:
+    return &er->packed_throughput_real_traffic;
+  case TR_RND:
+    return &er->packed_throughput_rnd_traffic;
+  default:
+    return &er->packed_throughput_pre_traffic;
   }
+}
+
+//Names of the traffics in the order of traffic_names
+const char *traffic_title[NUM_TRAFFIC] = {"real", "random", "sequential", "prefix", "repeated", "packet", "Zipf"};
+
+//IPs of a traffic looked up by lookup_traffic()
+static __uint128_t *traffic_ips(int traffic, struct fib *fib, uint64_t *cnt)
+{
+  switch (traffic) {
+  case TR_REAL:
+    *cnt = real_ip_cnt;
+    return real_ips;
+  case TR_RND:
+    *cnt = opt.rnd_cnt;
+    return rnd_ips;
+  case TR_SEQ:
+    *cnt = SEQ_CNT;
+    return seq_ips;
+  case TR_PRE:
+    *cnt = fib->cnt;
+    return fib->prefixes;
+  default:
+    *cnt = opt.rep_cnt;
+    return rep_ips;
+  }
+}
+
+//Looks up a traffic in a timed loop of an algorithm, each IP opt.repeat times
+//for repeated traffic. kind tells the lookup apart from the regular one, e.g.
+//"64-bit ". Only the regular lookup records the lookup time, of repeated
+//traffic or else of prefix traffic. With opt.verify, the next-hops of lookup
+//must match the first algorithm that looked up the traffic.
+static int lookup_traffic(const struct engine *e, const char *kind, struct fib *fib, int traffic,
+                          uint8_t (*loop)(const __uint128_t *, uint64_t, int), uint8_t (*lookup)(__uint128_t),
+                          double *throughput, struct engine_result *er)
+{
+  const char *name = traffic_title[traffic_idx(traffic)];
+  int repeat = traffic == TR_REP ? opt.repeat : 1;
+  double delay = 0, cpu_cycles = 0;
+  __uint128_t *ips;
+  char phase[128];
+  uint64_t cnt;
+
+  ips = traffic_ips(traffic, fib, &cnt);
+  stopwatch_start();
+  loop(ips, cnt, repeat);
   stopwatch_stop(&delay, &cpu_cycles);
-  res->poptrie_lookup_time = delay/prefix_cnt;
-  res->poptrie_lookup_throughput_pre_traffic = (prefix_cnt * 1000) / delay;
-  res->poptrie_lookup_cpucycle = cpu_cycles/prefix_cnt;
-  printf ("Poptrie lookup throughput for prefix traffic = %f Mlps \n", res->poptrie_lookup_throughput_pre_traffic);
+  snprintf(phase, sizeof(phase), "%s %slookup for %s traffic", e->title, kind, name);
+  report_perf(phase, cnt * repeat);
+  *throughput = (cnt * repeat * 1000) / delay;
+  if (!*kind && (traffic == TR_PRE || traffic == TR_REP)) {
+    er->lookup_time = delay / (cnt * repeat);
+    er->lookup_cpucycle = cpu_cycles / (cnt * repeat);
+  }
+  printf ("%s %slookup throughput for %s traffic = %f Mlps \n", e->title, kind, name, *throughput);
+  if (opt.verify && verify_lookups(e->title, traffic, lookup, ips, cnt))
+    return -1;
+  return 0;
+}
+
+//Looks up the destinations of the packets, converting them to __uint128_t
+//first and, if the algorithm can, straight from the packet header
+static int pkt_lookups(const struct engine *e, struct engine_result *er)
+{
+  double delay = 0, cpu_cycles = 0;
+  char phase[128];
 
-  //Lookup for repeated traffic
   stopwatch_start();
-  for (i = 0; i < REP_CNT; i++) {
-    for (j = 0; j < REPEAT; j++)
-      nh = poptrie_lookup(rep_ips[i]);
-#ifdef TEST
-    if (nh != rep_res[i]) {
-      printf("IP = %s \n", ipv6_to_str(rep_ips[i]));
-      printf ("SAIL-U next-hop = %d\n", rep_res[i]);
-      printf ("Poptrie next-hop = %d\n", nh);
-      return -1;
-    }
-#endif
+  e->pkt_loop(pkts[0], PKT_CNT, PKT_SIZE, DST_OFF);
+  stopwatch_stop(&delay, &cpu_cycles);
+  snprintf(phase, sizeof(phase), "%s lookup for packet traffic", e->title);
+  report_perf(phase, PKT_CNT);
+  er->lookup_throughput_pkt_traffic = (PKT_CNT * 1000) / delay;
+  printf ("%s lookup throughput for packet traffic = %f Mlps \n", e->title, er->lookup_throughput_pkt_traffic);
+
+  if (e->lookup_addr) {
+    stopwatch_start();
+    e->addr_loop(pkts[0], PKT_CNT, PKT_SIZE, DST_OFF);
+    stopwatch_stop(&delay, &cpu_cycles);
+    snprintf(phase, sizeof(phase), "%s zero-copy lookup for packet traffic", e->title);
+    report_perf(phase, PKT_CNT);
+    er->lookup_addr_throughput_pkt_traffic = (PKT_CNT * 1000) / delay;
+    printf ("%s zero-copy lookup throughput for packet traffic = %f Mlps \n", e->title,
+            er->lookup_addr_throughput_pkt_traffic);
+  }
+  if (opt.verify && verify_pkt_lookups(e->title, e->lookup, e->lookup_addr))
+    return -1;
+  return 0;
+}
+
+//Saves the packed layout of an algorithm to a temporary file and loads it
+//back in its place, so the lookups that follow verify the loaded one
+static int save_packed(const struct engine *e, struct engine_result *er)
+{
+  double delay = 0, cpu_cycles = 0;
+  FILE *fp;
+  int ret;
+
+  fp = tmpfile();
+  if (!fp) {
+    puts("Failed to create a file for the packed layout");
+    return -1;
   }
+  stopwatch_start();
+  ret = e->save(fp);
   stopwatch_stop(&delay, &cpu_cycles);
-  res->poptrie_lookup_time = delay/(REP_CNT * REPEAT);
-  res->poptrie_lookup_throughput_rep_traffic = (REP_CNT * REPEAT * 1000) / delay;
-  res->poptrie_lookup_cpucycle = cpu_cycles/(REP_CNT * REPEAT);
-  printf ("Poptrie lookup throughput for repeated traffic = %f Mlps \n", res->poptrie_lookup_throughput_rep_traffic);
+  er->save_time = delay / 1000000;
+  if (!ret) {
+    rewind(fp);
+    stopwatch_start();
+    ret = e->load(fp);
+    stopwatch_stop(&delay, &cpu_cycles);
+    er->load_time = delay / 1000000;
+  }
+  fclose(fp);
+  if (ret) {
+    printf("Failed to save and load the %s layout of %s\n", e->layout, e->title);
+    return -1;
+  }
+  printf ("%s %s layout saved in %f millisec and loaded in %f millisec \n", e->title, e->layout,
+          er->save_time, er->load_time);
+  return 0;
+}
 
-  poptrie_cleanup();
+//Makes the packed layout of an algorithm, e.g. the compact nodes of Poptrie,
+//and looks up real, random and prefix traffic on it
+static int packed_lookups(const struct engine *e, struct fib *fib, struct engine_result *er)
+{
+  int traffic[3] = {TR_REAL, TR_RND, TR_PRE};
+  struct engine_mem m = {0};
+  char kind[32];
+
+  if (e->pack()) {
+    printf("Failed to make the %s layout of %s\n", e->layout, e->title);
+    return 0;
+  }
+  er->packed_mem_consumption = e->packed_mem();
+  //The copy sits alongside the regular layout, which the updates still need
+  e->mem(&m);
+  printf ("%s %s memory consumption = %f MB against %f MB for the regular layout (%.1f%%) \n", e->title, e->layout,
+          er->packed_mem_consumption, m.total, 100 * er->packed_mem_consumption / m.total);
+  if (e->save && save_packed(e, er))
+    return -1;
 
-  printf("---------------------Checking CP-Trie-------------------------- \n");
+  snprintf(kind, sizeof(kind), "%s ", e->layout);
+  for (int t = 0; t < 3; t++) {
+    if ((opt.traffic & traffic[t]) &&
+        lookup_traffic(e, kind, fib, traffic[t], e->packed_loop, e->lookup_packed,
+                       packed_throughput(er, traffic[t]), er))
+      return -1;
+  }
+  return 0;
+}
 
-  ret = cptrie_init();
+//Inserts the prefixes of the FIB one by one and commits them
+static int insert_prefixes(const struct engine *e, struct fib *fib, struct engine_result *er)
+{
+  double delay = 0, cpu_cycles = 0;
+  char phase[128];
+  int ret;
+
+  ret = e->init();
   if (ret < 0) {
-    puts("Failed to initialize CP-Trie");
-    cptrie_cleanup();
+    printf("Failed to initialize %s\n", e->title);
+    e->cleanup();
     return -1;
   }
 
-  //Inserting into CP-Trie
   stopwatch_start();
-  for (i = 0; i < prefix_cnt; i++) {
-    ret = cptrie_insert(prefixes[i], pre_lens[i], pre_nhs[i]);
-#ifdef TEST
-    if (ret) {
-      sprintf(prefixStr, "%s/%d %d", ipv6_to_str(prefixes[i]), pre_lens[i], pre_nhs[i]);
-      printf("Failed to insert %s into CP-Trie \n", prefixStr);
+  for (uint64_t i = 0; i < fib->cnt; i++) {
+    ret = e->insert(fib->prefixes[i], fib->pre_lens[i], fib->pre_nhs[i]);
+    if (ret && opt.verify) {
+      printf("Failed to insert %s/%d %d into %s \n", ipv6_to_str(fib->prefixes[i]), fib->pre_lens[i],
+             fib->pre_nhs[i], e->title);
       return -1;
     }
-#endif
   }
+  if (e->commit)
+    e->commit();
   stopwatch_stop(&delay, &cpu_cycles);
+  snprintf(phase, sizeof(phase), "%s insertion", e->title);
+  report_perf(phase, fib->cnt);
   //Calculate avg. insertion time in microsec
-  res->cptrie_insert_time = delay/(1000 * prefix_cnt);
-  printf ("CP-Trie insertion time per prefix = %f microsec \n", res->cptrie_insert_time);
+  er->insert_time = delay / (1000 * fib->cnt);
+  printf ("%s insertion time per prefix = %f microsec \n", e->title, er->insert_time);
+  return 0;
+}
 
-  //Calculate memory consumption in MB
-  res->cptrie_mem_consumption = calc_cptrie_mem();
-  printf ("CP-Trie memory consumption = %f MB \n", res->cptrie_mem_consumption);
+//Reads the prefixes of a FIB and records the prefix counts in results
+static int load_fib(char *file, struct fib *fib, struct result *res)
+{
+  double delay = 0, cpu_cycles = 0;
+  int ret;
 
-  //Lookup for real traffic
+  printf("Reading FIB from file %s ....... \n", file);
   stopwatch_start();
-  for (i = 0; i < real_ip_cnt; i++) {
-    nh = cptrie_lookup(real_ips[i]);
-#ifdef TEST
-    if (nh != real_res[i]) {
-      printf("IP = %s\n", ipv6_to_str(real_ips[i]));
-      printf ("SAIL-U next-hop = %d\n", real_res[i]);
-      printf ("CP-Trie next-hop = %d\n", nh);
-      return -1;
-    }
-#endif
-  }
+  ret = fib_load(file, fib, opt.threads);
   stopwatch_stop(&delay, &cpu_cycles);
-  res->cptrie_lookup_throughput_real_traffic = (real_ip_cnt * 1000) / delay;
-  printf ("CP-Trie lookup throughput for real traffic = %f Mlps \n", res->cptrie_lookup_throughput_real_traffic);
+  if (ret)
+    return -1;
+  if (!fib->cnt) {
+    puts("The FIB is empty");
+    return -1;
+  }
+  printf("Loaded %" PRIu64 " prefixes in %f millisec \n", fib->cnt, delay / 1000000);
 
-  //Lookup for random traffic
-  stopwatch_start();
-  for (i = 0; i < RND_CNT; i++) {
-    nh = cptrie_lookup(rnd_ips[i]);
-#ifdef TEST
-    if (nh != rnd_res[i]) {
-      printf("IP = %s\n", ipv6_to_str(rnd_ips[i]));
-      printf ("SAIL-U next-hop = %d\n", rnd_res[i]);
-      printf ("CP-Trie next-hop = %d\n", nh);
-      return -1;
-    }
-#endif
+  for (uint64_t i = 0; res && i < fib->cnt; i++) {
+    //Record the prefix counts in results
+    res->total_prefixes++;
+    if (fib->pre_lens[i] >= 49 && fib->pre_lens[i] <= 64)
+      res->prefixes_49_64++;
+    else if (fib->pre_lens[i] >= 65 && fib->pre_lens[i] <= 128)
+      res->prefixes_65_128++;
+
+    //record prefix distribution across all the FIBs
+    record_prefix_len (fib->pre_lens[i]);
   }
-  stopwatch_stop(&delay, &cpu_cycles);
-  res->cptrie_lookup_throughput_rnd_traffic = (RND_CNT * 1000) / delay;
-  printf ("CP-Trie lookup throughput for random traffic = %f Mlps \n", res->cptrie_lookup_throughput_rnd_traffic);
+  return 0;
+}
 
-  //Lookup for sequential traffic
-  stopwatch_start();
-  for (i = 0; i < SEQ_CNT; i++) {
-    nh = cptrie_lookup(seq_ips[i]);
-#ifdef TEST
-    if (nh != seq_res[i]) {
-      printf("IP = %s \n", ipv6_to_str(seq_ips[i]));
-      printf ("SAIL-U next-hop = %d\n", seq_res[i]);
-      printf ("CP-Trie next-hop = %d\n", nh);
-      return -1;
+//The FIBs other than the one under test are loaded only for the algorithms
+//with several FIBs
+static void free_other_fibs(struct fib *fibs, int cnt)
+{
+  //FIB 0 belongs to the caller
+  for (int f = 1; f < cnt; f++)
+    fib_free(&fibs[f]);
+  free(fibs);
+}
+
+//Overlays the other FIBs of the run on the FIB under test, which is FIB 0,
+//and inserts all of them
+static int insert_fibs(const struct engine *e, struct fib *fib, struct result *res, struct engine_result *er)
+{
+  double delay = 0, cpu_cycles = 0;
+  uint64_t total_cnt = 0;
+  char phase[128];
+  int ret;
+
+  int fibs = opt.num_fibs < e->max_fibs ? opt.num_fibs : e->max_fibs;
+  struct fib *others = (struct fib *) calloc (fibs, sizeof(struct fib));
+  if (!others) {
+    printf("Failed to allocate memory for the FIBs of %s\n", e->title);
+    return -1;
+  }
+  int loaded = 1;
+  for (int i = 0; i < opt.num_fibs && loaded < fibs; i++) {
+    if (!strcmp(opt.fibs[i], res->fib))
+      continue;
+    if (load_fib((char *)opt.fibs[i], &others[loaded], NULL)) {
+      fib_free(&others[loaded]);
+      continue;
     }
-#endif
+    loaded++;
   }
-  stopwatch_stop(&delay, &cpu_cycles);
-  res->cptrie_lookup_throughput_seq_traffic = (SEQ_CNT * 1000) / delay;
-  printf ("CP-Trie lookup throughput for sequential traffic = %f Mlps \n", res->cptrie_lookup_throughput_seq_traffic);
+  fibs = loaded;
+  others[0] = *fib;
+  er->fibs = fibs;
 
-  //Lookup for prefix traffic
-  stopwatch_start();
-  for (i = 0; i < prefix_cnt; i++) {
-    nh = cptrie_lookup(prefixes[i]);
-#ifdef TEST
-    if (nh != pre_res[i]) {
-      printf("IP = %s \n", ipv6_to_str(prefixes[i]));
-      printf ("SAIL-U next-hop = %d\n", pre_res[i]);
-      printf ("CP-Trie next-hop = %d\n", nh);
-      return -1;
-    }
-#endif
+  ret = e->init_fibs(fibs);
+  if (ret < 0) {
+    printf("Failed to initialize %s\n", e->title);
+    e->cleanup();
+    free_other_fibs(others, fibs);
+    return -1;
   }
-  stopwatch_stop(&delay, &cpu_cycles);
-  res->cptrie_lookup_time = delay/prefix_cnt;
-  res->cptrie_lookup_throughput_pre_traffic = (prefix_cnt * 1000) / delay;
-  res->cptrie_lookup_cpucycle = cpu_cycles/prefix_cnt;
-  printf ("CP-Trie lookup throughput for prefix traffic = %f Mlps \n", res->cptrie_lookup_throughput_pre_traffic);
-  
-  //Lookup for repeated traffic
+
   stopwatch_start();
-  for (i = 0; i < REP_CNT; i++) {
-    for (j = 0; j < REPEAT; j++)
-      nh = cptrie_lookup(rep_ips[i]);
-#ifdef TEST
-    if (nh != rep_res[i]) {
-      printf("IP = %s \n", ipv6_to_str(rep_ips[i]));
-      printf ("SAIL-U next-hop = %d\n", rep_res[i]);
-      printf ("CP-Trie next-hop = %d\n", nh);
-      return -1;
+  for (int f = 0; f < fibs; f++) {
+    for (uint64_t i = 0; i < others[f].cnt; i++) {
+      ret = e->insert_fib(f, others[f].prefixes[i], others[f].pre_lens[i], others[f].pre_nhs[i]);
+      if (ret && opt.verify) {
+        printf("Failed to insert %s/%d %d into FIB %d of %s \n", ipv6_to_str(others[f].prefixes[i]),
+               others[f].pre_lens[i], others[f].pre_nhs[i], f, e->title);
+        free_other_fibs(others, fibs);
+        return -1;
+      }
     }
-#endif
+    total_cnt += others[f].cnt;
   }
+  if (e->commit)
+    e->commit();
   stopwatch_stop(&delay, &cpu_cycles);
-  res->cptrie_lookup_time = delay/(REP_CNT * REPEAT);
-  res->cptrie_lookup_throughput_rep_traffic = (REP_CNT * REPEAT * 1000) / delay;
-  res->cptrie_lookup_cpucycle = cpu_cycles/(REP_CNT * REPEAT);
-  printf ("CP-Trie lookup throughput for repeated traffic = %f Mlps \n", res->cptrie_lookup_throughput_rep_traffic);
-
-  cptrie_cleanup();
-
+  free_other_fibs(others, fibs);
+  printf("%s holds %d FIBs with %" PRIu64 " prefixes \n", e->title, fibs, total_cnt);
+  snprintf(phase, sizeof(phase), "%s insertion", e->title);
+  report_perf(phase, total_cnt);
+  //Calculate avg. insertion time in microsec
+  er->insert_time = delay / (1000 * total_cnt);
+  printf ("%s insertion time per prefix = %f microsec \n", e->title, er->insert_time);
   return 0;
 }
 
-//Calculates average matched prefix length for different FIBs for
-//different trafffics
-static int calc_avg_matched_prefix_len(char *file){
-  long long i = 0, j = 0;
-  //Number of IPs in PRE traffic
-  uint64_t prefix_cnt = 0;
-  //Prefixes in the FIB
-  __uint128_t prefixes[PRE_CNT];
-  //Prefix lengths
-   uint8_t pre_lens[PRE_CNT];
-  //Next-hops for the prefixes
-   uint8_t pre_nhs[PRE_CNT];
-  FILE *fp;
-  char v6str[256];
-  char buff[4096];
-  int prefixlen;
-  int nexthop;
+//Measures an algorithm on a FIB through its operations. The optional ones
+//are measured if the algorithm has them.
+static int bench_engine(const struct engine *e, struct fib *fib, struct result *res, struct engine_result *er)
+{
+  double delay = 0, cpu_cycles = 0;
+  struct engine_mem m;
+  char phase[128];
   int ret;
-  struct in6_addr v6addr;
-  uint64_t sum;
 
-  if ((fp = fopen(file, "r")) == NULL) {
-    puts("File not exists");
+  printf("---------------------Checking %s-------------------------- \n", e->title);
+
+  if (e->init_fibs)
+    ret = insert_fibs(e, fib, res, er);
+  else
+    ret = insert_prefixes(e, fib, er);
+  if (ret)
     return -1;
-  }
 
-  printf("\nReading FIB from file %s ....... \n", file);
-  
-  while ( !feof(fp) ) {
-    if ( !fgets(buff, sizeof(buff), fp) )
-      continue;
-    memset(v6str, 0, sizeof(v6str));
-    prefixlen = 0;
-    nexthop = 0;
-    ret = sscanf(buff, "%255[^'/']/%d\t%d", v6str, &prefixlen, &nexthop);
-    if ( ret < 0 ) {
-      puts ("The input file is not formatted properly");
+  //Calculate memory consumption in MB
+  memset(&m, 0, sizeof(m));
+  e->mem(&m);
+  er->mem_consumption = m.total;
+  er->lookup_mem_consumption = m.lookup;
+  er->update_mem_consumption = m.update;
+  er->onchip_mem_consumption = m.onchip;
+  if (e->config)
+    printf ("%s memory consumption (%s) = %f MB \n", e->title, e->config, m.total);
+  else
+    printf ("%s memory consumption = %f MB \n", e->title, m.total);
+  if (m.lookup)
+    printf ("%s resident memory = %f MB for lookups and %f MB for updates \n", e->title, m.lookup, m.update);
+  if (m.onchip)
+    printf ("%s on-chip memory consumption = %f MB \n", e->title, m.onchip);
+
+  if (opt.parallel_build && e->build) {
+    //Rebuild the FIB from scratch with the parallel builder
+    e->cleanup();
+    stopwatch_start();
+    ret = e->build(fib->prefixes, fib->pre_lens, fib->pre_nhs, fib->cnt, opt.threads);
+    stopwatch_stop(&delay, &cpu_cycles);
+    snprintf(phase, sizeof(phase), "%s parallel build", e->title);
+    report_perf(phase, fib->cnt);
+    if (ret) {
+      printf("Failed to build %s\n", e->title);
+      e->cleanup();
       return -1;
     }
-//    printf ("%s/%d %d\n", v6str, prefixlen, nexthop);
+    er->build_time = delay / 1000000;
+    printf ("%s parallel build time with %d threads = %f millisec \n", e->title, opt.threads, er->build_time);
+  }
 
-    ret = inet_pton(AF_INET6, v6str, &v6addr);
-    if ( ret != 1 ) {
-      puts ("Invalid IPv6 prefix");
-      return -1;
-    }
+  if ((opt.traffic & TR_REAL) &&
+      lookup_traffic(e, "", fib, TR_REAL, e->lookup_loop, e->lookup, &er->lookup_throughput_real_traffic, er))
+    return -1;
 
-    if (prefix_cnt >= PRE_CNT) {
-      puts ("The PRE traffic array is full");
-      return -1;
-    }
+  if ((opt.traffic & TR_RND) &&
+      lookup_traffic(e, "", fib, TR_RND, e->lookup_loop, e->lookup, &er->lookup_throughput_rnd_traffic, er))
+    return -1;
 
-    //Store prefix info
-    prefixes[prefix_cnt] = in6_addr_to_uint128(&v6addr);
-    pre_lens[prefix_cnt] = prefixlen;
-    pre_nhs[prefix_cnt] = nexthop;
-    prefix_cnt++;
+  //Lookup for random traffic, each IP in the next FIB
+  if ((opt.traffic & TR_RND) && e->lookup_fib) {
+    stopwatch_start();
+    e->fib_loop(rnd_ips, opt.rnd_cnt, er->fibs);
+    stopwatch_stop(&delay, &cpu_cycles);
+    snprintf(phase, sizeof(phase), "%s lookup for random traffic across the FIBs", e->title);
+    report_perf(phase, opt.rnd_cnt);
+    er->lookup_throughput_multi_traffic = (opt.rnd_cnt * 1000) / delay;
+    printf ("%s lookup throughput for random traffic across %d FIBs = %f Mlps \n", e->title, (int)er->fibs,
+            er->lookup_throughput_multi_traffic);
   }
 
-  printf("---------------------SAIL-U-------------------------- \n");
-
-  ret = sail_u_init();
-  if (ret < 0) {
-    puts("Failed to initialize SAIL-U");
-    sail_u_cleanup();
+  if ((opt.traffic & TR_PKT) && pkt_lookups(e, er))
     return -1;
-  }
 
-  //Insrting into SAIL-U
-  for (i = 0; i < prefix_cnt; i++) {
-    ret = sail_u_insert(prefixes[i], pre_lens[i], pre_nhs[i]);
+  //64-bit fast-path lookup for real and random traffic
+  if (e->lookup64) {
+    cur_lookup64 = e->lookup64;
+    if ((opt.traffic & TR_REAL) && lookup_traffic(e, "64-bit ", fib, TR_REAL, e->lookup64_loop, lookup64_key,
+                                                  &er->lookup64_throughput_real_traffic, er))
+      return -1;
+    if ((opt.traffic & TR_RND) && lookup_traffic(e, "64-bit ", fib, TR_RND, e->lookup64_loop, lookup64_key,
+                                                 &er->lookup64_throughput_rnd_traffic, er))
+      return -1;
   }
 
-  //Matched prefix length for real traffic
-  sum = 0;
-  for (i = 0; i < real_ip_cnt; i++) {
-    sum += sail_u_matched_prefix_len(real_ips[i]);
-  }
-  printf ("SAIL-U Real traffic prefix length = %llu\n", sum/real_ip_cnt);
+  //Interleaved lookups of real and random traffic
+  if (opt.batch_width && e->lookup_batch && batch_lookups(e, er))
+    return -1;
 
-  //Matched prefix length for random traffic
-  sum = 0;
-  for (i = 0; i < RND_CNT; i++) {
-    sum += sail_u_matched_prefix_len(rnd_ips[i]);
-  }
-  printf ("SAIL-U Random traffic prefix length = %llu\n", sum/RND_CNT);
+  if ((opt.traffic & TR_SEQ) &&
+      lookup_traffic(e, "", fib, TR_SEQ, e->lookup_loop, e->lookup, &er->lookup_throughput_seq_traffic, er))
+    return -1;
 
-  //Matched prefix length for sequential traffic
-  sum = 0;
-  for (i = 0; i < SEQ_CNT; i++) {
-    sum += sail_u_matched_prefix_len(seq_ips[i]);
-  }
-  printf ("SAIL-U Sequencial traffic prefix length = %llu\n", sum/SEQ_CNT);
+  if ((opt.traffic & TR_PRE) &&
+      lookup_traffic(e, "", fib, TR_PRE, e->lookup_loop, e->lookup, &er->lookup_throughput_pre_traffic, er))
+    return -1;
 
-  //Matched prefix length for prefix traffic
-  sum = 0;
-  for (i = 0; i < prefix_cnt; i++) {
-    sum += sail_u_matched_prefix_len(prefixes[i]);
-  }
-  printf ("SAIL-U Prefix traffic prefix length = %llu\n", sum/prefix_cnt);
-  
-  //Matched prefix length for repeated traffic
-  sum = 0;
-  for (i = 0; i < prefix_cnt; i++) {
-      for (j = 0; j < REPEAT; j++)
-        sum += sail_u_matched_prefix_len(prefixes[i]);
-  }
-  printf ("SAIL-U Repeated traffic prefix length = %llu\n", sum/(prefix_cnt * REPEAT));
+  if (e->pack && packed_lookups(e, fib, er))
+    return -1;
 
-  sail_u_cleanup();
+  if ((opt.traffic & TR_REP) &&
+      lookup_traffic(e, "", fib, TR_REP, e->lookup_loop, e->lookup, &er->lookup_throughput_rep_traffic, er))
+    return -1;
 
-  printf("---------------------SAIL-L-------------------------- \n");
+  if ((opt.traffic & TR_ZIPF) && zipf_sweep(e, fib, &er->zipf, &er->cache))
+    return -1;
 
-  ret = sail_l_init();
-  if (ret < 0) {
-    puts("Failed to initialize SAIL-L");
-    sail_l_cleanup();
+  if (opt.cache_entries && flow_cache_bench(e, &er->cache))
     return -1;
-  }
 
-  //Insrting into SAIL-L
-  for (i = 0; i < prefix_cnt; i++) {
-    ret = sail_l_insert(prefixes[i], pre_lens[i], pre_nhs[i]);
-  }
+  if (pcap.cnt)
+    pcap_replay(e, &er->replay);
 
-  //Matched prefix length for real traffic
-  sum = 0;
-  for (i = 0; i < real_ip_cnt; i++) {
-    sum += sail_l_matched_prefix_len(real_ips[i]);
-  }
-  printf ("SAIL-L Real traffic prefix length = %llu\n", sum/real_ip_cnt);
+  if (opt.multi_thread)
+    mt_scaling(e, er->scaling);
 
-  //Matched prefix length for random traffic
-  sum = 0;
-  for (i = 0; i < RND_CNT; i++) {
-    sum += sail_l_matched_prefix_len(rnd_ips[i]);
-  }
-  printf ("SAIL-L Random traffic prefix length = %llu\n", sum/RND_CNT);
+  if (opt.latency)
+    sample_latency(e, fib->prefixes, fib->cnt, er->latency);
 
-  //Matched prefix length for sequential traffic
-  sum = 0;
-  for (i = 0; i < SEQ_CNT; i++) {
-    sum += sail_l_matched_prefix_len(seq_ips[i]);
+  if (opt.withdrawals && e->remove && withdraw_routes(e, fib, &er->withdraw_time, &er->announce_time))
+    return -1;
+
+  //It changes the FIB, so it goes last
+  if (opt.update_ratio && mixed_workload(e, &er->mixed))
+    return -1;
+
+  e->cleanup();
+  return 0;
+}
+
+//Generates repeated and sequential traffic from the prefixes of a FIB
+static void gen_fib_traffic(struct fib *fib)
+{
+  long long i = 0;
+  __uint128_t *prefixes = fib->prefixes;
+  uint8_t *pre_lens = fib->pre_lens;
+  uint64_t prefix_cnt = fib->cnt;
+
+  printf("-----------------Generating repeated traffic-------------- \n");
+  struct xorshift32_state rnd_idx = {1};
+  xorshift128_state rnd_ip = {1, 1, 1, 1};
+  
+  for (i = 0; i < opt.rep_cnt; i++) {
+    //generate a 32-bit random number
+    xorshift32(&rnd_idx);
+    //generate a 128-bit random number
+    xorshift128(&rnd_ip);
+    //select an IP from prefix traffic
+    uint32_t ix = rnd_idx.a % prefix_cnt;
+    //Add the new random number to the right of the prefix to generate the IP
+    rep_ips[i] = prefixes[ix] | (xorshift_to_ipv6(&rnd_ip) >>  pre_lens[ix]);
+
+//    printf("%s\n%s\n%d\n\n", ipv6_to_str(prefixes[ix]), ipv6_to_str(rep_ips[i]), pre_lens[ix]);
   }
-  printf ("SAIL-L Sequencial traffic prefix length = %llu\n", sum/SEQ_CNT);
   
-  //Matched prefix length for prefix traffic
-  sum = 0;
+  printf("-----------------Generating sequential traffic-------------- \n");
+  //Find the longest prefix
+  __uint128_t max_prefix = 0;
+  uint8_t max_prefix_len = 0;
   for (i = 0; i < prefix_cnt; i++) {
-    sum += sail_l_matched_prefix_len(prefixes[i]);
+    if (pre_lens[i] > max_prefix_len) {
+      max_prefix_len = pre_lens[i];
+      max_prefix = prefixes[i];
+    } 
   }
-  printf ("SAIL-L Prefix traffic prefix length = %llu\n", sum/prefix_cnt);
   
-  //Matched prefix length for repeated traffic
-  sum = 0;
-  for (i = 0; i < prefix_cnt; i++) {
-    for (j = 0; j < REPEAT; j++)
-      sum += sail_l_matched_prefix_len(prefixes[i]);
+  uint8_t prexlen_seq_traffic =  (ceil(max_prefix_len/8.0) - 1) * 8;
+  printf ("generating sequential traffic withing %s/%d\n", ipv6_to_str(max_prefix), prexlen_seq_traffic);
+  for (i = 0; i < SEQ_CNT; i++) {
+    seq_ips[i] = (((max_prefix >> (128 - prexlen_seq_traffic)) << 8) | ((__uint128_t)i)) << (128 - (prexlen_seq_traffic + 8));
+//    printf ("sequential IP = %s \n", ipv6_to_str(seq_ips[i]));
   }
-  printf ("SAIL-L Repeated traffic prefix length = %llu\n", sum/(prefix_cnt * REPEAT));
-
-  sail_l_cleanup();
+}
 
-  printf("---------------------Poptrie-------------------------- \n");
+int test(char *file, struct result *res){
+  struct fib fib;
+  uint8_t *pre_res;
+  int ret = 0;
 
-  ret = poptrie_init();
-  if (ret < 0) {
-    puts("Failed to initialize poptrie");
-    poptrie_cleanup();
+  if (load_fib(file, &fib, res)) {
+    fib_free(&fib);
     return -1;
   }
-
-  //Inserting into Poptrie
-  for (i = 0; i < prefix_cnt; i++) {
-    ret = poptrie_insert(prefixes[i], pre_lens[i], pre_nhs[i]);
-  }
-
-  //Matched prefix length for real traffic
-  sum = 0;
-  for (i = 0; i < real_ip_cnt; i++) {
-    sum += poptrie_matched_prefix_len(real_ips[i]);
+  gen_fib_traffic(&fib);
+  cache_key64 = opt.cache_key64 && !res->prefixes_65_128;
+  if (opt.cache_entries && opt.cache_key64 && !cache_key64)
+    puts("The FIB has prefixes longer than 64, so the flow cache is keyed by the whole address");
+  if (opt.update_ratio && gen_updates(&fib)) {
+    fib_free(&fib);
+    return -1;
   }
-  printf ("Poptrie Real traffic prefix length = %llu\n", sum/real_ip_cnt);
 
-  //Matched prefix length for random traffic
-  sum = 0;
-  for (i = 0; i < RND_CNT; i++) {
-    sum += poptrie_matched_prefix_len(rnd_ips[i]);
+  if (opt.verify) {
+    //Prefix traffic is as large as the FIB
+    pre_res = (uint8_t *) realloc (ref_res[traffic_idx(TR_PRE)], fib.cnt);
+    if (!pre_res) {
+      puts ("Failed to allocate memory for verification");
+      fib_free(&fib);
+      return -1;
+    }
+    ref_res[traffic_idx(TR_PRE)] = pre_res;
   }
-  printf ("Poptrie Random traffic prefix length = %llu\n", sum/RND_CNT);
 
-  //Matched prefix length for sequential traffic
-  sum = 0;
-  for (i = 0; i < SEQ_CNT; i++) {
-    sum += poptrie_matched_prefix_len(seq_ips[i]);
-  }
-  printf ("Poptrie Sequencial traffic prefix length = %llu\n", sum/SEQ_CNT);
-  
-  //Matched prefix length for prefix traffic
-  sum = 0;
-  for (i = 0; i < prefix_cnt; i++) {
-    sum += poptrie_matched_prefix_len(prefixes[i]);
-  }
-  printf ("Poptrie Prefix traffic prefix length = %llu\n", sum/prefix_cnt);
+  //The first algorithm becomes the reference for this FIB
+  memset(ref_valid, 0, sizeof(ref_valid));
 
-  //Matched prefix length for repeated traffic
-  sum = 0;
-  for (i = 0; i < prefix_cnt; i++) {
-    for (j = 0; j < REPEAT; j++)
-      sum += poptrie_matched_prefix_len(prefixes[i]);
+  for (int e = 0; e < num_engines; e++) {
+    if ((opt.engines & (1U << e)) && bench_engine(engines[e], &fib, res, &res->eng[e])) {
+      ret = -1;
+      break;
+    }
   }
-  printf ("Poptrie Repeated traffic prefix length = %llu\n", sum/(prefix_cnt * REPEAT));
 
-  poptrie_cleanup();
+  fib_free(&fib);
+  return ret;
+}
 
-  printf("---------------------CP-Trie-------------------------- \n");
+//Calculates average matched prefix length for different FIBs for
+//different trafffics
+static int calc_avg_matched_prefix_len(char *file){
+  long long i = 0, j = 0;
+  struct fib fib;
+  __uint128_t *prefixes;
+  uint64_t prefix_cnt;
+  int ret;
+  uint64_t sum;
 
-  ret = cptrie_init();
-  if (ret < 0) {
-    puts("Failed to initialize CP-Trie");
-    cptrie_cleanup();
+  printf("\n");
+  if (load_fib(file, &fib, NULL)) {
+    fib_free(&fib);
     return -1;
   }
+  prefixes = fib.prefixes;
+  prefix_cnt = fib.cnt;
+  gen_fib_traffic(&fib);
 
-  //Inserting into CP-Trie
-  for (i = 0; i < prefix_cnt; i++) {
-    ret = cptrie_insert(prefixes[i], pre_lens[i], pre_nhs[i]);
-  }
+  for (int e = 0; e < num_engines; e++) {
+    const struct engine *eng = engines[e];
 
-  //Matched prefix length for real traffic
-  sum = 0;
-  for (i = 0; i < real_ip_cnt; i++) {
-    sum += cptrie_matched_prefix_len(real_ips[i]);
-  }
-  printf ("CP-Trie Real traffic prefix length = %llu\n", sum/real_ip_cnt);
+    if (!(opt.engines & (1U << e)) || !eng->matched_prefix_len)
+      continue;
+    printf("---------------------%s-------------------------- \n", eng->title);
 
-  //Matched prefix length for random traffic
-  sum = 0;
-  for (i = 0; i < RND_CNT; i++) {
-    sum += cptrie_matched_prefix_len(rnd_ips[i]);
-  }
-  printf ("CP-Trie Random traffic prefix length = %llu\n", sum/RND_CNT);
+    ret = eng->init();
+    if (ret < 0) {
+      printf("Failed to initialize %s\n", eng->title);
+      eng->cleanup();
+      fib_free(&fib);
+      return -1;
+    }
 
-  //Matched prefix length for sequential traffic
-  sum = 0;
-  for (i = 0; i < SEQ_CNT; i++) {
-    sum += cptrie_matched_prefix_len(seq_ips[i]);
-  }
-  printf ("CP-Trie Sequencial traffic prefix length = %llu\n", sum/SEQ_CNT);
-  
-  //Matched prefix length for prefix traffic
-  sum = 0;
-  for (i = 0; i < prefix_cnt; i++) {
-    sum += cptrie_matched_prefix_len(prefixes[i]);
-  }
-  printf ("CP-Trie Prefix traffic prefix length = %llu\n", sum/prefix_cnt);
-  
-  //Matched prefix length for repeated traffic
-  sum = 0;
-  for (i = 0; i < prefix_cnt; i++) {
-    for (j = 0; j < REPEAT; j++)
-      sum += cptrie_matched_prefix_len(prefixes[i]);
-  }
-  printf ("CP-Trie Repeated traffic prefix length = %llu\n", sum/(prefix_cnt * REPEAT));
+    for (i = 0; i < prefix_cnt; i++) {
+      ret = eng->insert(prefixes[i], fib.pre_lens[i], fib.pre_nhs[i]);
+    }
+    if (eng->commit)
+      eng->commit();
 
-  cptrie_cleanup();
+    //Matched prefix length for real traffic
+    sum = 0;
+    for (i = 0; i < real_ip_cnt; i++) {
+      sum += eng->matched_prefix_len(real_ips[i]);
+    }
+    printf ("%s Real traffic prefix length = %llu\n", eng->title, sum/real_ip_cnt);
+
+    //Matched prefix length for random traffic
+    sum = 0;
+    for (i = 0; i < opt.rnd_cnt; i++) {
+      sum += eng->matched_prefix_len(rnd_ips[i]);
+    }
+    printf ("%s Random traffic prefix length = %llu\n", eng->title, sum/opt.rnd_cnt);
+
+    //Matched prefix length for sequential traffic
+    sum = 0;
+    for (i = 0; i < SEQ_CNT; i++) {
+      sum += eng->matched_prefix_len(seq_ips[i]);
+    }
+    printf ("%s Sequencial traffic prefix length = %llu\n", eng->title, sum/SEQ_CNT);
+
+    //Matched prefix length for prefix traffic
+    sum = 0;
+    for (i = 0; i < prefix_cnt; i++) {
+      sum += eng->matched_prefix_len(prefixes[i]);
+    }
+    printf ("%s Prefix traffic prefix length = %llu\n", eng->title, sum/prefix_cnt);
+
+    //Matched prefix length for repeated traffic
+    sum = 0;
+    for (i = 0; i < prefix_cnt; i++) {
+      for (j = 0; j < opt.repeat; j++)
+        sum += eng->matched_prefix_len(prefixes[i]);
+    }
+    printf ("%s Repeated traffic prefix length = %llu\n", eng->title, sum/(prefix_cnt * opt.repeat));
 
+    eng->cleanup();
+  }
+
+  fib_free(&fib);
   return 0;
 }
 
+//Writes the lookup throughput of a traffic for every algorithm along with
+//the lookups the algorithm has on top of the regular one
+static void write_traffic_summery(FILE *output, struct result *res, int traffic)
+{
+  int cp = engine_idx("cptrie"), pop = engine_idx("poptrie");
+
+  for (int e = 0; e < num_engines; e++) {
+    const struct engine *eng = engines[e];
+    struct engine_result *er = &res->eng[e];
+
+    fprintf (output, "%s lookup throughput: %f Mlps \n", eng->title, *traffic_throughput(er, traffic));
+    if (er->packed_mem_consumption && traffic != TR_SEQ && traffic != TR_REP)
+      fprintf (output, "%s %s lookup throughput: %f Mlps \n", eng->title, eng->layout,
+               *packed_throughput(er, traffic));
+    if (eng->lookup64 && (traffic == TR_REAL || traffic == TR_RND))
+      fprintf (output, "%s 64-bit lookup throughput: %f Mlps \n", eng->title,
+               traffic == TR_REAL ? er->lookup64_throughput_real_traffic : er->lookup64_throughput_rnd_traffic);
+    if (eng->lookup_batch && opt.batch_width && (traffic == TR_REAL || traffic == TR_RND))
+      fprintf (output, "%s batched lookup throughput (%d in flight): %f Mlps \n", eng->title,
+               opt.batch_width < eng->max_batch ? opt.batch_width : eng->max_batch,
+               traffic == TR_REAL ? er->batch_throughput_real_traffic : er->batch_throughput_rnd_traffic);
+    if (eng->lookup_fib && traffic == TR_RND)
+      fprintf (output, "%s lookup throughput across the FIBs: %f Mlps \n", eng->title,
+               er->lookup_throughput_multi_traffic);
+  }
+  if (cp >= 0 && pop >= 0)
+    fprintf (output, "CP-Trie achieves %f X lookup throughput compared to Poptrie\n",
+             *traffic_throughput(&res->eng[cp], traffic) / *traffic_throughput(&res->eng[pop], traffic));
+}
+
 void write_summery (struct result *res, int num_fibs)
 {
+  int traffic[5] = {TR_REAL, TR_RND, TR_SEQ, TR_PRE, TR_REP};
+  int cp = engine_idx("cptrie"), pop = engine_idx("poptrie");
   FILE *output;
 
   output = fopen("summery.data", "w");
@@ -1058,229 +1958,932 @@ void write_summery (struct result *res, int num_fibs)
     fprintf(output, "Prefixes (49-64): %llu\n", res[i].prefixes_49_64);
     fprintf(output, "Prefixes (65-128): %llu\n", res[i].prefixes_65_128);
     fprintf(output,"\n");
-    fprintf (output, "SAIL-U insertion: %f microsec \n", res[i].sail_u_insert_time);
-    fprintf (output, "SAIL-L insertion: %f microsec \n", res[i].sail_l_insert_time);
-    fprintf (output, "Poptrie insertion: %f microsec \n", res[i].poptrie_insert_time);
-    fprintf (output, "CP-Trie insertion: %f microsec \n", res[i].cptrie_insert_time);
+    for (int e = 0; e < num_engines; e++) {
+      if (engines[e]->max_fibs)
+        fprintf (output, "%s insertion (%d FIBs): %f microsec \n", engines[e]->title, (int)res[i].eng[e].fibs,
+                 res[i].eng[e].insert_time);
+      else
+        fprintf (output, "%s insertion: %f microsec \n", engines[e]->title, res[i].eng[e].insert_time);
+    }
+    if (opt.parallel_build) {
+      fprintf(output,"\n");
+      for (int e = 0; e < num_engines; e++) {
+        if (engines[e]->build)
+          fprintf (output, "%s parallel build: %f millisec \n", engines[e]->title, res[i].eng[e].build_time);
+      }
+    }
+    if (opt.withdrawals) {
+      fprintf(output,"\n");
+      for (int e = 0; e < num_engines; e++) {
+        if (!engines[e]->remove)
+          continue;
+        fprintf (output, "%s withdrawal: %f microsec \n", engines[e]->title, res[i].eng[e].withdraw_time);
+        fprintf (output, "%s re-announcement: %f microsec \n", engines[e]->title, res[i].eng[e].announce_time);
+      }
+    }
     fprintf(output,"\n");
-    fprintf (output, "SAIL-U memory: %f MB \n", res[i].sail_u_mem_consumption);
-    fprintf (output, "SAIL-L memory: %f MB \n", res[i].sail_l_mem_consumption);
-    fprintf (output, "Poptrie memory: %f MB \n", res[i].poptrie_mem_consumption);
-    fprintf (output, "CP-Trie memory: %f MB \n", res[i].cptrie_mem_consumption);
-    fprintf (output, "CP-Trie consumes %f X memory compared to Poptrie\n", res[i].cptrie_mem_consumption/res[i].poptrie_mem_consumption);
+    for (int e = 0; e < num_engines; e++) {
+      const struct engine *eng = engines[e];
+      struct engine_result *er = &res[i].eng[e];
+
+      if (eng->config)
+        fprintf (output, "%s memory (%s): %f MB \n", eng->title, eng->config, er->mem_consumption);
+      else if (eng->max_fibs)
+        fprintf (output, "%s memory (%d FIBs): %f MB \n", eng->title, (int)er->fibs, er->mem_consumption);
+      else
+        fprintf (output, "%s memory: %f MB \n", eng->title, er->mem_consumption);
+      if (er->lookup_mem_consumption)
+        fprintf (output, "%s resident memory: %f MB for lookups, %f MB for updates \n", eng->title,
+                 er->lookup_mem_consumption, er->update_mem_consumption);
+      if (er->onchip_mem_consumption)
+        fprintf (output, "%s on-chip memory: %f MB \n", eng->title, er->onchip_mem_consumption);
+      if (er->packed_mem_consumption)
+        fprintf (output, "%s %s memory: %f MB \n", eng->title, eng->layout, er->packed_mem_consumption);
+      if (eng->save && er->packed_mem_consumption)
+        fprintf (output, "%s %s layout save / load: %f / %f millisec \n", eng->title, eng->layout,
+                 er->save_time, er->load_time);
+    }
+    if (cp >= 0 && pop >= 0)
+      fprintf (output, "CP-Trie consumes %f X memory compared to Poptrie\n",
+               res[i].eng[cp].mem_consumption/res[i].eng[pop].mem_consumption);
     fprintf(output,"\n");
-    fprintf (output, "SAIL-U lookup time: %f ns \n", res[i].sail_u_lookup_time);
-    fprintf (output, "SAIL-L lookup time: %f ns \n", res[i].sail_l_lookup_time);
-    fprintf (output, "Poptrie lookup time: %f ns \n", res[i].poptrie_lookup_time);
-    fprintf (output, "CP-Trie lookup time: %f ns \n", res[i].cptrie_lookup_time);
+    for (int e = 0; e < num_engines; e++)
+      fprintf (output, "%s lookup time: %f ns \n", engines[e]->title, res[i].eng[e].lookup_time);
     fprintf(output, "\n");
-    fprintf (output, "SAIL-U lookup cpu cycle: %f \n", res[i].sail_u_lookup_cpucycle);
-    fprintf (output, "SAIL-L lookup cpu cycle: %f \n", res[i].sail_l_lookup_cpucycle);
-    fprintf (output, "Poptrie lookup cpu cycle: %f \n", res[i].poptrie_lookup_cpucycle);
-    fprintf (output, "CP-Trie lookup cpu cycle: %f \n", res[i].cptrie_lookup_cpucycle);
-    fprintf(output, "\n");
-    fprintf(output, "Real traffic\n");
-    fprintf(output, "--------------------------------------------------\n");
-    fprintf (output, "SAIL-U lookup throughput: %f Mlps \n", res[i].sail_u_lookup_throughput_real_traffic);
-    fprintf (output, "SAIL-L lookup throughput: %f Mlps \n", res[i].sail_l_lookup_throughput_real_traffic);
-    fprintf (output, "Poptrie lookup throughput: %f Mlps \n", res[i].poptrie_lookup_throughput_real_traffic);
-    fprintf (output, "CP-Trie lookup throughput: %f Mlps \n", res[i].cptrie_lookup_throughput_real_traffic);
-    fprintf (output, "CP-Trie achieves %f X lookup throughput compared to Poptrie\n", res[i].cptrie_lookup_throughput_real_traffic/res[i].poptrie_lookup_throughput_real_traffic);
+    for (int e = 0; e < num_engines; e++)
+      fprintf (output, "%s lookup cpu cycle: %f \n", engines[e]->title, res[i].eng[e].lookup_cpucycle);
     fprintf(output, "\n");
-    fprintf(output, "Random traffic\n");
-    fprintf(output, "--------------------------------------------------\n");
-    fprintf (output, "SAIL-U lookup throughput: %f Mlps \n", res[i].sail_u_lookup_throughput_rnd_traffic);
-    fprintf (output, "SAIL-L lookup throughput: %f Mlps \n", res[i].sail_l_lookup_throughput_rnd_traffic);
-    fprintf (output, "Poptrie lookup throughput: %f Mlps \n", res[i].poptrie_lookup_throughput_rnd_traffic);
-    fprintf (output, "CP-Trie lookup throughput: %f Mlps \n", res[i].cptrie_lookup_throughput_rnd_traffic);
-    fprintf (output, "CP-Trie achieves %f X lookup throughput compared to Poptrie\n", res[i].cptrie_lookup_throughput_rnd_traffic/res[i].poptrie_lookup_throughput_rnd_traffic);
-    fprintf(output, "\n");
-    fprintf(output, "Sequential traffic\n");
-    fprintf(output, "--------------------------------------------------\n");
-    fprintf (output, "SAIL-U lookup throughput: %f Mlps \n", res[i].sail_u_lookup_throughput_seq_traffic);
-    fprintf (output, "SAIL-L lookup throughput: %f Mlps \n", res[i].sail_l_lookup_throughput_seq_traffic);
-    fprintf (output, "Poptrie lookup throughput: %f Mlps \n", res[i].poptrie_lookup_throughput_seq_traffic);
-    fprintf (output, "CP-Trie lookup throughput: %f Mlps \n", res[i].cptrie_lookup_throughput_seq_traffic);
-    fprintf (output, "CP-Trie achieves %f X lookup throughput compared to Poptrie\n", res[i].cptrie_lookup_throughput_seq_traffic/res[i].poptrie_lookup_throughput_seq_traffic);
-    fprintf(output, "\n");
-    fprintf(output, "Prefix traffic\n");
-    fprintf(output, "--------------------------------------------------\n");
-    fprintf (output, "SAIL-U lookup throughput: %f Mlps \n", res[i].sail_u_lookup_throughput_pre_traffic);
-    fprintf (output, "SAIL-L lookup throughput: %f Mlps \n", res[i].sail_l_lookup_throughput_pre_traffic);
-    fprintf (output, "Poptrie lookup throughput: %f Mlps \n", res[i].poptrie_lookup_throughput_pre_traffic);
-    fprintf (output, "CP-Trie lookup throughput: %f Mlps \n", res[i].cptrie_lookup_throughput_pre_traffic);
-    fprintf (output, "CP-Trie achieves %f X lookup throughput compared to Poptrie\n", res[i].cptrie_lookup_throughput_pre_traffic/res[i].poptrie_lookup_throughput_pre_traffic);
-    fprintf(output, "\n");
-    fprintf(output, "Repeated traffic\n");
+    for (int t = 0; t < 5; t++) {
+      fprintf(output, "%c%s traffic\n", toupper(traffic_title[t][0]), traffic_title[t] + 1);
+      fprintf(output, "--------------------------------------------------\n");
+      write_traffic_summery(output, &res[i], traffic[t]);
+      fprintf(output, "\n");
+    }
+    if (opt.latency) {
+      for (int t = 0; t < NUM_LAT_TRAFFIC; t++) {
+        fprintf(output, "%s traffic latency (p50 / p99 / p99.9)\n", lat_traffic_name[t]);
+        fprintf(output, "--------------------------------------------------\n");
+        for (int e = 0; e < num_engines; e++) {
+          struct latency_result *lr = &res[i].eng[e].latency[t];
+
+          fprintf (output, "%s: %f / %f / %f ns \n", engines[e]->title, lr->p50, lr->p99, lr->p999);
+        }
+        fprintf(output, "\n");
+      }
+    }
+    if (opt.multi_thread) {
+      for (int t = 0; t < NUM_MT_TRAFFIC; t++) {
+        fprintf(output, "%s traffic multi-threaded lookup (threads: Mlps, efficiency)\n", mt_traffic_name[t]);
+        fprintf(output, "--------------------------------------------------\n");
+        for (int a = 0; a < num_engines; a++) {
+          struct scaling_result *sc = &res[i].eng[a].scaling[t];
+
+          fprintf (output, "%s:", engines[a]->title);
+          for (int r = 0; r < sc->runs; r++)
+            fprintf (output, " %d: %f, %f;", sc->threads[r], sc->throughput[r], sc->efficiency[r]);
+          fprintf (output, "\n");
+        }
+        fprintf(output, "\n");
+      }
+    }
+    if (opt.traffic & TR_ZIPF) {
+      fprintf(output, "Zipf traffic (skew: Mlps)\n");
+      fprintf(output, "--------------------------------------------------\n");
+      for (int e = 0; e < num_engines; e++) {
+        struct zipf_result *zr = &res[i].eng[e].zipf;
+
+        fprintf (output, "%s:", engine_names[e]);
+        for (int k = 0; k < zr->runs; k++)
+          fprintf (output, " %.2f: %f;", zr->skew[k], zr->throughput[k]);
+        fprintf (output, "\n");
+      }
+      fprintf(output, "\n");
+    }
+    if (opt.update_ratio) {
+      fprintf(output, "Mixed workload, an update every %" PRIu64 " lookups (%d%% inserts, %d%% withdrawals)%s\n",
+              opt.update_ratio, opt.inserts, opt.withdraws, opt.update_thread ? " from an update thread" : "");
+      fprintf(output, "--------------------------------------------------\n");
+      for (int e = 0; e < num_engines; e++) {
+        struct mixed_result *mr = &res[i].eng[e].mixed;
+
+        fprintf (output, "%s: %f Mlps, %f K updates/sec, p50 / p99 / p99.9 = %f / %f / %f ns \n", engine_names[e],
+                 mr->lookup_throughput, mr->update_rate, mr->latency.p50, mr->latency.p99, mr->latency.p999);
+      }
+      fprintf(output, "\n");
+    }
+    if (opt.cache_entries) {
+      fprintf(output, "Flow cache of %" PRIu64 " entries keyed by %s (Mlps, hit rate)\n", opt.cache_entries,
+              opt.cache_key64 ? "/64, or /128 if the FIB has longer prefixes" : "/128");
+      fprintf(output, "--------------------------------------------------\n");
+      for (int e = 0; e < num_engines; e++) {
+        struct cache_result *cr = &res[i].eng[e].cache;
+
+        fprintf (output, "%s:", engine_names[e]);
+        for (int t = 0; t < NUM_CACHE_TRAFFIC; t++)
+          fprintf (output, " %s: %f, %f;", cache_traffic_name[t], cr->throughput[t], cr->hit_rate[t]);
+        for (int k = 0; k < cr->zipf_runs; k++)
+          fprintf (output, " Zipf %.2f: %f, %f;", opt.skews[k], cr->zipf_throughput[k], cr->zipf_hit_rate[k]);
+        if (opt.update_ratio)
+          fprintf (output, " Mixed: %f, %f;", res[i].eng[e].mixed.cached_throughput,
+                   res[i].eng[e].mixed.cached_hit_rate);
+        fprintf (output, "\n");
+      }
+      fprintf(output, "\n");
+    }
+    if (pcap.cnt) {
+      fprintf(output, "pcap replay of %s with bursts of %d (Mpps, forwarded / dropped per pass)\n", pcap_file, opt.pkt_burst);
+      fprintf(output, "--------------------------------------------------\n");
+      for (int e = 0; e < num_engines; e++) {
+        struct replay_result *rr = &res[i].eng[e].replay;
+
+        fprintf (output, "%s: %f Mpps, %" PRIu64 " / %" PRIu64 " \n", engine_names[e], rr->throughput,
+                 rr->forwarded, rr->dropped);
+      }
+      fprintf(output, "\n");
+    }
+    fprintf(output, "Packet traffic (conversion to __uint128_t / straight from header)\n");
     fprintf(output, "--------------------------------------------------\n");
-    fprintf (output, "SAIL-U lookup throughput: %f Mlps \n", res[i].sail_u_lookup_throughput_rep_traffic);
-    fprintf (output, "SAIL-L lookup throughput: %f Mlps \n", res[i].sail_l_lookup_throughput_rep_traffic);
-    fprintf (output, "Poptrie lookup throughput: %f Mlps \n", res[i].poptrie_lookup_throughput_rep_traffic);
-    fprintf (output, "CP-Trie lookup throughput: %f Mlps \n", res[i].cptrie_lookup_throughput_rep_traffic);
-    fprintf (output, "CP-Trie achieves %f X lookup throughput compared to Poptrie \n", res[i].cptrie_lookup_throughput_rep_traffic/res[i].poptrie_lookup_throughput_rep_traffic);
+    for (int e = 0; e < num_engines; e++) {
+      if (engines[e]->lookup_addr)
+        fprintf (output, "%s lookup throughput: %f / %f Mlps \n", engines[e]->title,
+                 res[i].eng[e].lookup_throughput_pkt_traffic, res[i].eng[e].lookup_addr_throughput_pkt_traffic);
+      else
+        fprintf (output, "%s lookup throughput: %f Mlps \n", engines[e]->title,
+                 res[i].eng[e].lookup_throughput_pkt_traffic);
+    }
     fprintf(output, "\n");
   }
 
   fclose(output);
 }
 
-int read_real_traffic (char *file) {
+//Reads the CPU model from /proc/cpuinfo
+static void read_cpu_model(char *model, int len)
+{
+  char buff[512];
+  char *p;
   FILE *fp;
-  char v6str[256];
-  char buff[4096];
-  int ret;
-  struct in6_addr v6addr;
 
-  if ((fp = fopen(file, "r")) == NULL) {
-    puts("File not exists");
-    return -1;
+  snprintf(model, len, "unknown");
+  if ((fp = fopen("/proc/cpuinfo", "r")) == NULL)
+    return;
+  while (fgets(buff, sizeof(buff), fp)) {
+    if (strncmp(buff, "model name", 10) || !(p = strchr(buff, ':')))
+      continue;
+    //Skip ": " and drop the newline
+    p += 2;
+    p[strcspn(p, "\n")] = 0;
+    snprintf(model, len, "%s", p);
+    break;
   }
-  
-  while ( !feof(fp) ) {
-    if ( !fgets(buff, sizeof(buff), fp) )
+  fclose(fp);
+}
+
+//Writes a JSON string with escaping
+static void json_str(FILE *fp, const char *s)
+{
+  fputc('"', fp);
+  for (; *s; s++) {
+    if (*s == '"' || *s == '\\')
+      fprintf(fp, "\\%c", *s);
+    else if ((unsigned char)*s < 0x20)
+      fprintf(fp, "\\u%04x", *s);
+    else
+      fputc(*s, fp);
+  }
+  fputc('"', fp);
+}
+
+//JSON has no representation of inf and nan. They show up when a phase is
+//skipped or is too short to be measured.
+static void json_double(FILE *fp, double v)
+{
+  if (isfinite(v))
+    fprintf(fp, "%.6f", v);
+  else
+    fprintf(fp, "null");
+}
+
+//Writes a comma separated list of selected names
+static void json_names(FILE *fp, uint32_t bitmap, const char **names, int cnt)
+{
+  bool first = true;
+
+  fprintf(fp, "[");
+  for (int i = 0; i < cnt; i++) {
+    if (!(bitmap & (1U << i)))
       continue;
-    memset(v6str, 0, sizeof(v6str));
-    ret = sscanf(buff, "%[^'\n']s", v6str);
-    if ( ret < 0 ) {
-      puts ("Invalid IP");
-      return -1;
+    fprintf(fp, "%s", first ? "" : ", ");
+    json_str(fp, names[i]);
+    first = false;
+  }
+  fprintf(fp, "]");
+}
+
+//Writes every field of the results along with the information about the run
+//in summery.json. Latency and scaling results are nested by algorithm and
+//traffic.
+void write_json (struct result *res, int num_fibs)
+{
+  struct scaling_result *sc;
+  struct latency_result *lat;
+  struct zipf_result *zr;
+  struct mixed_result *mr;
+  struct replay_result *rr;
+  struct cache_result *cr;
+  char cpu_model[256];
+  FILE *output;
+
+  output = fopen("summery.json", "w");
+  if (!output) {
+    puts("Failed to open summery.json");
+    return;
+  }
+  read_cpu_model(cpu_model, sizeof(cpu_model));
+
+  fprintf(output, "{\n  \"metadata\": {\n");
+  fprintf(output, "    \"cpu_model\": ");
+  json_str(output, cpu_model);
+  fprintf(output, ",\n    \"tsc_ghz\": ");
+  json_double(output, stopwatch_tsc_ghz());
+  fprintf(output, ",\n    \"compiler\": ");
+  json_str(output, "g++ " __VERSION__);
+  fprintf(output, ",\n    \"compiler_flags\": ");
+  json_str(output, BUILD_FLAGS);
+  fprintf(output, ",\n    \"git_revision\": ");
+  json_str(output, GIT_REV);
+  fprintf(output, ",\n    \"algorithms\": ");
+  json_names(output, opt.engines, engine_names, num_engines);
+  fprintf(output, ",\n    \"traffics\": ");
+  json_names(output, opt.traffic, traffic_names, NUM_TRAFFIC);
+  fprintf(output, ",\n    \"rnd_cnt\": %" PRIu64 ",\n    \"rep_cnt\": %" PRIu64, opt.rnd_cnt, opt.rep_cnt);
+  fprintf(output, ",\n    \"repeat\": %d,\n    \"threads\": %d", opt.repeat, opt.threads);
+  fprintf(output, ",\n    \"working_set\": %" PRIu64 ",\n    \"burst\": %f", opt.working_set, opt.burst);
+  fprintf(output, ",\n    \"update_ratio\": %" PRIu64 ",\n    \"inserts\": %d,\n    \"withdraws\": %d",
+          opt.update_ratio, opt.inserts, opt.withdraws);
+  fprintf(output, ",\n    \"update_thread\": %s", opt.update_thread ? "true" : "false");
+  fprintf(output, ",\n    \"pcap_file\": ");
+  json_str(output, pcap_file ? pcap_file : "");
+  fprintf(output, ",\n    \"pcap_packets\": %" PRIu64 ",\n    \"pkt_burst\": %d", pcap.cnt, opt.pkt_burst);
+  fprintf(output, ",\n    \"cache_entries\": %" PRIu64 ",\n    \"cache_key64\": %s",
+          opt.cache_entries, opt.cache_key64 ? "true" : "false");
+  fprintf(output, ",\n    \"withdrawals\": %" PRIu64, opt.withdrawals);
+  fprintf(output, ",\n    \"batch_width\": %d", opt.batch_width);
+  fprintf(output, ",\n    \"configs\": {");
+  for (int e = 0, first = 1; e < num_engines; e++) {
+    if (!engines[e]->config)
+      continue;
+    fprintf(output, "%s\"%s\": ", first ? "" : ", ", engine_names[e]);
+    json_str(output, engines[e]->config);
+    first = 0;
+  }
+  fprintf(output, "}");
+  fprintf(output, ",\n    \"real_ip_cnt\": %" PRIu64 "\n  },\n", real_ip_cnt);
+
+  fprintf(output, "  \"results\": [\n");
+  for (int i = 0; i < num_fibs; i++) {
+    fprintf(output, "    {\n      \"fib\": ");
+    json_str(output, res[i].fib);
+    fprintf(output, ",\n      \"total_prefixes\": %" PRIu64, res[i].total_prefixes);
+    fprintf(output, ",\n      \"prefixes_49_64\": %" PRIu64, res[i].prefixes_49_64);
+    fprintf(output, ",\n      \"prefixes_65_128\": %" PRIu64, res[i].prefixes_65_128);
+    for (int e = 0; e < num_engines; e++) {
+      for (int f = 0; f < NUM_RESULT_FIELD; f++) {
+        fprintf(output, ",\n      \"%s_%s\": ", engine_names[e], result_fields[f].name);
+        json_double(output, *(double *)((char *)&res[i].eng[e] + result_fields[f].offset));
+      }
     }
 
-    ret = inet_pton(AF_INET6, v6str, &v6addr);
-    if ( ret < 0 ) {
-      printf ("Invalid IPv6 prefix %s \n", v6str);
-      return -1;
+    fprintf(output, ",\n      \"latency\": {");
+    for (int e = 0; e < num_engines; e++) {
+      lat = res[i].eng[e].latency;
+      fprintf(output, "%s\n        \"%s\": {", e ? "," : "", engine_names[e]);
+      for (int t = 0; t < NUM_LAT_TRAFFIC; t++) {
+        fprintf(output, "%s\"%s\": {\"p50\": ", t ? ", " : "", lat_traffic_name[t]);
+        json_double(output, lat[t].p50);
+        fprintf(output, ", \"p99\": ");
+        json_double(output, lat[t].p99);
+        fprintf(output, ", \"p999\": ");
+        json_double(output, lat[t].p999);
+        fprintf(output, "}");
+      }
+      fprintf(output, "}");
+    }
+    fprintf(output, "\n      },\n      \"scaling\": {");
+    for (int e = 0; e < num_engines; e++) {
+      sc = res[i].eng[e].scaling;
+      fprintf(output, "%s\n        \"%s\": {", e ? "," : "", engine_names[e]);
+      for (int t = 0; t < NUM_MT_TRAFFIC; t++) {
+        fprintf(output, "%s\"%s\": [", t ? ", " : "", mt_traffic_name[t]);
+        for (int r = 0; r < sc[t].runs; r++) {
+          fprintf(output, "%s{\"threads\": %d, \"throughput\": ", r ? ", " : "", sc[t].threads[r]);
+          json_double(output, sc[t].throughput[r]);
+          fprintf(output, ", \"efficiency\": ");
+          json_double(output, sc[t].efficiency[r]);
+          fprintf(output, "}");
+        }
+        fprintf(output, "]");
+      }
+      fprintf(output, "}");
+    }
+    fprintf(output, "\n      },\n      \"zipf\": {");
+    for (int e = 0; e < num_engines; e++) {
+      zr = &res[i].eng[e].zipf;
+      fprintf(output, "%s\n        \"%s\": [", e ? "," : "", engine_names[e]);
+      for (int k = 0; k < zr->runs; k++) {
+        fprintf(output, "%s{\"skew\": %f, \"throughput\": ", k ? ", " : "", zr->skew[k]);
+        json_double(output, zr->throughput[k]);
+        fprintf(output, "}");
+      }
+      fprintf(output, "]");
+    }
+    fprintf(output, "\n      },\n      \"mixed\": {");
+    for (int e = 0; e < num_engines; e++) {
+      mr = &res[i].eng[e].mixed;
+      fprintf(output, "%s\n        \"%s\": {\"lookup_throughput\": ", e ? "," : "", engine_names[e]);
+      json_double(output, mr->lookup_throughput);
+      fprintf(output, ", \"update_rate\": ");
+      json_double(output, mr->update_rate);
+      fprintf(output, ", \"updates\": %" PRIu64 ", \"failed\": %" PRIu64 ", \"p50\": ", mr->updates, mr->failed);
+      json_double(output, mr->latency.p50);
+      fprintf(output, ", \"p99\": ");
+      json_double(output, mr->latency.p99);
+      fprintf(output, ", \"p999\": ");
+      json_double(output, mr->latency.p999);
+      fprintf(output, ", \"cached_throughput\": ");
+      json_double(output, mr->cached_throughput);
+      fprintf(output, ", \"cached_hit_rate\": ");
+      json_double(output, mr->cached_hit_rate);
+      fprintf(output, "}");
+    }
+    fprintf(output, "\n      },\n      \"replay\": {");
+    for (int e = 0; e < num_engines; e++) {
+      rr = &res[i].eng[e].replay;
+      fprintf(output, "%s\n        \"%s\": {\"throughput\": ", e ? "," : "", engine_names[e]);
+      json_double(output, rr->throughput);
+      fprintf(output, ", \"forwarded\": %" PRIu64 ", \"dropped\": %" PRIu64 "}", rr->forwarded, rr->dropped);
+    }
+    fprintf(output, "\n      },\n      \"flow_cache\": {");
+    for (int e = 0; e < num_engines; e++) {
+      cr = &res[i].eng[e].cache;
+      fprintf(output, "%s\n        \"%s\": {", e ? "," : "", engine_names[e]);
+      for (int t = 0; t < NUM_CACHE_TRAFFIC; t++) {
+        fprintf(output, "\"%s\": {\"throughput\": ", cache_traffic_name[t]);
+        json_double(output, cr->throughput[t]);
+        fprintf(output, ", \"hit_rate\": ");
+        json_double(output, cr->hit_rate[t]);
+        fprintf(output, "}, ");
+      }
+      fprintf(output, "\"zipf\": [");
+      for (int k = 0; k < cr->zipf_runs; k++) {
+        fprintf(output, "%s{\"skew\": %f, \"throughput\": ", k ? ", " : "", opt.skews[k]);
+        json_double(output, cr->zipf_throughput[k]);
+        fprintf(output, ", \"hit_rate\": ");
+        json_double(output, cr->zipf_hit_rate[k]);
+        fprintf(output, "}");
+      }
+      fprintf(output, "]}");
     }
+    fprintf(output, "\n      }\n    }%s\n", i < num_fibs - 1 ? "," : "");
+  }
+  fprintf(output, "  ]\n}\n");
+  fclose(output);
+}
 
-    if (real_ip_cnt >= REAL_CNT) {
-      puts ("The real traffic array is full. Ignoring rest of the traffic");
+//Writes one row per FIB in summery.csv. Latency and scaling results are
+//flattened into columns such as sail_u_latency_Real_p99 and
+//cptrie_scaling_Random_4_throughput.
+void write_csv (struct result *res, int num_fibs)
+{
+  struct scaling_result *sc;
+  struct latency_result *lat;
+  struct zipf_result *zr;
+  struct mixed_result *mr;
+  struct replay_result *rr;
+  struct cache_result *cr;
+  char cpu_model[256];
+  FILE *output;
+
+  output = fopen("summery.csv", "w");
+  if (!output) {
+    puts("Failed to open summery.csv");
+    return;
+  }
+  read_cpu_model(cpu_model, sizeof(cpu_model));
+  //CSV fields can't have commas or quotes without quoting
+  for (char *p = cpu_model; *p; p++) {
+    if (*p == ',' || *p == '"')
+      *p = ' ';
+  }
+
+  //Header. The thread counts of the scaling runs are the same for all FIBs.
+  fprintf(output, "git_revision,cpu_model,tsc_ghz,compiler_flags,fib,total_prefixes,prefixes_49_64,prefixes_65_128");
+  for (int e = 0; e < num_engines; e++) {
+    for (int f = 0; f < NUM_RESULT_FIELD; f++)
+      fprintf(output, ",%s_%s", engine_names[e], result_fields[f].name);
+  }
+  for (int e = 0; e < num_engines; e++) {
+    for (int t = 0; t < NUM_LAT_TRAFFIC; t++)
+      fprintf(output, ",%s_latency_%s_p50,%s_latency_%s_p99,%s_latency_%s_p999",
+              engine_names[e], lat_traffic_name[t], engine_names[e], lat_traffic_name[t],
+              engine_names[e], lat_traffic_name[t]);
+  }
+  for (int e = 0; num_fibs && e < num_engines; e++) {
+    sc = res[0].eng[e].scaling;
+    for (int t = 0; t < NUM_MT_TRAFFIC; t++) {
+      for (int r = 0; r < sc[t].runs; r++)
+        fprintf(output, ",%s_scaling_%s_%d_throughput,%s_scaling_%s_%d_efficiency",
+                engine_names[e], mt_traffic_name[t], sc[t].threads[r],
+                engine_names[e], mt_traffic_name[t], sc[t].threads[r]);
+    }
+  }
+  for (int e = 0; (opt.traffic & TR_ZIPF) && e < num_engines; e++) {
+    for (int k = 0; k < opt.num_skews; k++)
+      fprintf(output, ",%s_zipf_%.2f_throughput", engine_names[e], opt.skews[k]);
+  }
+  for (int e = 0; e < num_engines; e++)
+    fprintf(output, ",%s_mixed_lookup_throughput,%s_mixed_update_rate,%s_mixed_updates,%s_mixed_failed"
+            ",%s_mixed_p50,%s_mixed_p99,%s_mixed_p999", engine_names[e], engine_names[e], engine_names[e],
+            engine_names[e], engine_names[e], engine_names[e], engine_names[e]);
+  for (int e = 0; pcap.cnt && e < num_engines; e++)
+    fprintf(output, ",%s_replay_throughput,%s_replay_forwarded,%s_replay_dropped",
+            engine_names[e], engine_names[e], engine_names[e]);
+  for (int e = 0; opt.cache_entries && e < num_engines; e++) {
+    for (int t = 0; t < NUM_CACHE_TRAFFIC; t++)
+      fprintf(output, ",%s_cache_%s_throughput,%s_cache_%s_hit_rate", engine_names[e], cache_traffic_name[t],
+              engine_names[e], cache_traffic_name[t]);
+    for (int k = 0; (opt.traffic & TR_ZIPF) && k < opt.num_skews; k++)
+      fprintf(output, ",%s_cache_zipf_%.2f_throughput,%s_cache_zipf_%.2f_hit_rate", engine_names[e], opt.skews[k],
+              engine_names[e], opt.skews[k]);
+    fprintf(output, ",%s_cache_mixed_throughput,%s_cache_mixed_hit_rate", engine_names[e], engine_names[e]);
+  }
+  fprintf(output, "\n");
+
+  for (int i = 0; i < num_fibs; i++) {
+    fprintf(output, "%s,%s,%f,%s,%s", GIT_REV, cpu_model, stopwatch_tsc_ghz(), BUILD_FLAGS, res[i].fib);
+    fprintf(output, ",%" PRIu64 ",%" PRIu64 ",%" PRIu64, res[i].total_prefixes,
+            res[i].prefixes_49_64, res[i].prefixes_65_128);
+    for (int e = 0; e < num_engines; e++) {
+      for (int f = 0; f < NUM_RESULT_FIELD; f++)
+        fprintf(output, ",%f", *(double *)((char *)&res[i].eng[e] + result_fields[f].offset));
+    }
+    for (int e = 0; e < num_engines; e++) {
+      lat = res[i].eng[e].latency;
+      for (int t = 0; t < NUM_LAT_TRAFFIC; t++)
+        fprintf(output, ",%f,%f,%f", lat[t].p50, lat[t].p99, lat[t].p999);
+    }
+    for (int e = 0; e < num_engines; e++) {
+      sc = res[i].eng[e].scaling;
+      for (int t = 0; t < NUM_MT_TRAFFIC; t++) {
+        for (int r = 0; r < sc[t].runs; r++)
+          fprintf(output, ",%f,%f", sc[t].throughput[r], sc[t].efficiency[r]);
+      }
+    }
+    for (int e = 0; (opt.traffic & TR_ZIPF) && e < num_engines; e++) {
+      zr = &res[i].eng[e].zipf;
+      for (int k = 0; k < opt.num_skews; k++)
+        fprintf(output, ",%f", k < zr->runs ? zr->throughput[k] : 0);
+    }
+    for (int e = 0; e < num_engines; e++) {
+      mr = &res[i].eng[e].mixed;
+      fprintf(output, ",%f,%f,%" PRIu64 ",%" PRIu64 ",%f,%f,%f", mr->lookup_throughput, mr->update_rate,
+              mr->updates, mr->failed, mr->latency.p50, mr->latency.p99, mr->latency.p999);
+    }
+    for (int e = 0; pcap.cnt && e < num_engines; e++) {
+      rr = &res[i].eng[e].replay;
+      fprintf(output, ",%f,%" PRIu64 ",%" PRIu64, rr->throughput, rr->forwarded, rr->dropped);
+    }
+    for (int e = 0; opt.cache_entries && e < num_engines; e++) {
+      cr = &res[i].eng[e].cache;
+      for (int t = 0; t < NUM_CACHE_TRAFFIC; t++)
+        fprintf(output, ",%f,%f", cr->throughput[t], cr->hit_rate[t]);
+      for (int k = 0; (opt.traffic & TR_ZIPF) && k < opt.num_skews; k++)
+        fprintf(output, ",%f,%f", k < cr->zipf_runs ? cr->zipf_throughput[k] : 0,
+                k < cr->zipf_runs ? cr->zipf_hit_rate[k] : 0);
+      mr = &res[i].eng[e].mixed;
+      fprintf(output, ",%f,%f", mr->cached_throughput, mr->cached_hit_rate);
+    }
+    fprintf(output, "\n");
+  }
+  fclose(output);
+}
+
+//FIBs measured when none is given with -f
+const char *default_fibs[] = {
+  "fibs/ip6/routes-293",
+  "fibs/ip6/routes-852",
+  "fibs/ip6/routes-19016",
+  "fibs/ip6/routes-19151",
+  "fibs/ip6/routes-19653",
+  "fibs/ip6/routes-23367",
+  "fibs/ip6/routes-53828",
+  "fibs/ip6/routes-199524",
+  "fibs/ip6/routes-395570",
+};
+#define NUM_DEFAULT_FIB (sizeof(default_fibs) / sizeof(default_fibs[0]))
+//Maximum number of FIBs given with -f
+#define MAX_FIB 64
+
+//Converts a comma separated list of names into a bitmap where names[i] is
+//bit i. "all" selects all of them. Returns 0 for an unknown name.
+static uint32_t parse_list(char *arg, const char **names, int cnt)
+{
+  uint32_t bitmap = 0;
+  char *tok, *save;
+  int i;
+
+  for (tok = strtok_r(arg, ",", &save); tok; tok = strtok_r(NULL, ",", &save)) {
+    if (!strcmp(tok, "all")) {
+      bitmap |= (1U << cnt) - 1;
+      continue;
+    }
+    for (i = 0; i < cnt; i++) {
+      if (!strcmp(tok, names[i]))
+        break;
+    }
+    if (i == cnt) {
+      printf ("Unknown name %s\n", tok);
       return 0;
     }
+    bitmap |= 1U << i;
+  }
+  return bitmap;
+}
 
-    real_ips[real_ip_cnt++] = in6_addr_to_uint128(&v6addr);
+//Parses a comma separated list of skews. Returns the number of skews or -1.
+static int parse_skews(const char *arg, double *skews)
+{
+  char buff[256], *tok, *save, *end;
+  int n = 0;
+
+  snprintf(buff, sizeof(buff), "%s", arg);
+  for (tok = strtok_r(buff, ",", &save); tok; tok = strtok_r(NULL, ",", &save)) {
+    if (n >= MAX_SKEWS) {
+      printf ("At most %d skews are supported\n", MAX_SKEWS);
+      return -1;
+    }
+    skews[n] = strtod(tok, &end);
+    if (*end || skews[n] < 0) {
+      printf ("Invalid skew %s\n", tok);
+      return -1;
+    }
+    n++;
   }
-  return 0;
+  return n;
 }
 
-//Total number of FIBs is 7
-#define NUM_FIB 9
+static void usage(const char *prog)
+{
+  printf ("Usage: %s [options]\n", prog);
+  printf ("  -f FIB       FIB file, can be repeated (default: all FIBs in fibs/ip6)\n");
+  printf ("  -R FILE      real traffic, text or binary (default: real_traffic)\n");
+  printf ("  -C FILE      convert the text real traffic to binary FILE and exit\n");
+  printf ("  -e LIST      algorithms: ");
+  for (int e = 0; e < num_engines; e++)
+    printf ("%s%s", e ? "," : "", engines[e]->name);
+  printf (" or all (default: all)\n");
+  printf ("  -t LIST      traffics: real,rnd,seq,pre,rep,pkt,zipf or all (default: all)\n");
+  printf ("  -n COUNT     number of IPs in random and repeated traffic (default: %llu)\n", RND_CNT);
+  printf ("  -r REPEAT    # of times a lookup is repeated in repeated traffic (default: %d)\n", REPEAT);
+  printf ("  -z LIST      skews of Zipf traffic (default: %s)\n", ZIPF_SKEWS);
+  printf ("  -W FLOWS     number of flows in Zipf traffic (default: %llu)\n", WORKING_SET);
+  printf ("  -B LENGTH    mean packet train length of Zipf traffic (default: %d)\n", BURST);
+  printf ("  -u LOOKUPS   mixed workload with an update after every LOOKUPS lookups\n");
+  printf ("  -i PERCENT   percentage of inserts among the updates (default: %d)\n", INSERTS);
+  printf ("  -x PERCENT   percentage of withdrawals among the updates (default: %d)\n", WITHDRAWS);
+  printf ("  -T           apply the updates from a dedicated thread\n");
+  printf ("  -P FILE      replay the IPv6 packets of a pcap or pcapng file through each algorithm\n");
+  printf ("  -k BURST     packets forwarded together in pcap replay (default: %d)\n", PKT_BURST);
+  printf ("  -c ENTRIES   also measure the lookups through a flow cache of ENTRIES entries,\n");
+  printf ("               ENTRIES/64 keys it by the upper 64 bits of the destination\n");
+  printf ("  -a WIDTH     lookups in flight in the batched lookups, 0 disables them (default: %d)\n", BATCH_WIDTH);
+  printf ("  -d COUNT     withdraw COUNT random routes and announce them again (SAIL-U, SAIL-L, Poptrie and DXR)\n");
+  printf ("  -j THREADS   threads for parallel build and multi-threaded lookup (default: online cores)\n");
+  printf ("  -v           verify the lookups of all algorithms against each other\n");
+  printf ("  -m           calculate average matched prefix length instead of performance\n");
+  printf ("  -w           write the generated traffics to files\n");
+  printf ("  -b           rebuild each FIB with the parallel builder\n");
+  printf ("  -p           report hardware counters per operation\n");
+  printf ("  -l           report lookup latency percentiles\n");
+  printf ("  -M           measure multi-threaded lookup scaling\n");
+  printf ("  -h           show this help\n");
+}
 
-int main() {
+int main(int argc, char **argv) {
   int ret = 0;
   long long i;
   struct xorshift128_state state = {1, 1, 1, 1};
+  const char *fibs[MAX_FIB];
+  int num_fibs = 0;
+  const char *traffic_file = "real_traffic";
+  const char *convert_file = NULL;
+  int max_batch = 0;
+  int c;
+
+  for (int e = 0; e < num_engines; e++) {
+    engine_names[e] = engines[e]->name;
+    if (engines[e]->max_batch > max_batch)
+      max_batch = engines[e]->max_batch;
+  }
+  opt.engines = (1U << num_engines) - 1;
+  opt.traffic = TR_ALL;
+  opt.rnd_cnt = RND_CNT;
+  opt.rep_cnt = REP_CNT;
+  opt.repeat = REPEAT;
+  opt.threads = sysconf(_SC_NPROCESSORS_ONLN);
+  opt.num_skews = parse_skews(ZIPF_SKEWS, opt.skews);
+  opt.working_set = WORKING_SET;
+  opt.burst = BURST;
+  opt.inserts = INSERTS;
+  opt.withdraws = WITHDRAWS;
+  opt.pkt_burst = PKT_BURST;
+  opt.batch_width = BATCH_WIDTH;
+
+  while ((c = getopt(argc, argv, "f:R:C:e:t:n:r:z:W:B:u:i:x:TP:k:c:d:a:j:vmwbplMh")) != -1) {
+    switch (c) {
+    case 'f':
+      if (num_fibs >= MAX_FIB) {
+        printf ("At most %d FIBs are supported\n", MAX_FIB);
+        return -1;
+      }
+      fibs[num_fibs++] = optarg;
+      break;
+    case 'R':
+      traffic_file = optarg;
+      break;
+    case 'C':
+      convert_file = optarg;
+      break;
+    case 'e':
+      opt.engines = parse_list(optarg, engine_names, num_engines);
+      if (!opt.engines)
+        return -1;
+      break;
+    case 't':
+      opt.traffic = parse_list(optarg, traffic_names, NUM_TRAFFIC);
+      if (!opt.traffic)
+        return -1;
+      break;
+    case 'n':
+      opt.rnd_cnt = opt.rep_cnt = strtoull(optarg, NULL, 0);
+      break;
+    case 'r':
+      opt.repeat = atoi(optarg);
+      break;
+    case 'z':
+      opt.num_skews = parse_skews(optarg, opt.skews);
+      if (opt.num_skews < 0)
+        return -1;
+      break;
+    case 'W':
+      opt.working_set = strtoull(optarg, NULL, 0);
+      break;
+    case 'B':
+      opt.burst = atof(optarg);
+      break;
+    case 'u':
+      opt.update_ratio = strtoull(optarg, NULL, 0);
+      break;
+    case 'i':
+      opt.inserts = atoi(optarg);
+      break;
+    case 'x':
+      opt.withdraws = atoi(optarg);
+      break;
+    case 'T':
+      opt.update_thread = true;
+      break;
+    case 'P':
+      pcap_file = optarg;
+      break;
+    case 'k':
+      opt.pkt_burst = atoi(optarg);
+      break;
+    case 'c': {
+      char *end;
+
+      opt.cache_entries = strtoull(optarg, &end, 0);
+      if (!strcmp(end, "/64")) {
+        opt.cache_key64 = true;
+      } else if (*end && strcmp(end, "/128")) {
+        printf ("Invalid flow cache size %s\n", optarg);
+        return -1;
+      }
+      break;
+    }
+    case 'a':
+      opt.batch_width = atoi(optarg);
+      break;
+    case 'd':
+      opt.withdrawals = strtoull(optarg, NULL, 0);
+      break;
+    case 'j':
+      opt.threads = atoi(optarg);
+      break;
+    case 'v':
+      opt.verify = true;
+      break;
+    case 'm':
+      opt.matched_len = true;
+      break;
+    case 'w':
+      opt.record_traffic = true;
+      break;
+    case 'b':
+      opt.parallel_build = true;
+      break;
+    case 'p':
+      opt.perf = true;
+      break;
+    case 'l':
+      opt.latency = true;
+      break;
+    case 'M':
+      opt.multi_thread = true;
+      break;
+    case 'h':
+      usage(argv[0]);
+      return 0;
+    default:
+      usage(argv[0]);
+      return -1;
+    }
+  }
+  if (!opt.rnd_cnt || opt.repeat < 1 || opt.threads < 1 || !opt.working_set || opt.burst < 1) {
+    puts ("Traffic size, repeat count, thread count and working set must be positive and train length at least 1");
+    return -1;
+  }
+  if (opt.pkt_burst < 1 || opt.pkt_burst > MAX_PKT_BURST) {
+    printf ("Burst size must be between 1 and %d\n", MAX_PKT_BURST);
+    return -1;
+  }
+  if (opt.inserts < 0 || opt.withdraws < 0 || opt.inserts + opt.withdraws > 100) {
+    puts ("Insertion and withdrawal percentages must be between 0 and 100 and add up to at most 100");
+    return -1;
+  }
+  if (opt.batch_width < 0 || opt.batch_width > max_batch) {
+    printf ("Lookups in flight must be between 0 and %d\n", max_batch);
+    return -1;
+  }
+  if (!num_fibs) {
+    for (; num_fibs < NUM_DEFAULT_FIB; num_fibs++)
+      fibs[num_fibs] = default_fibs[num_fibs];
+  }
+  opt.fibs = fibs;
+  opt.num_fibs = num_fibs;
+
+  rnd_ips = (__uint128_t *) malloc (opt.rnd_cnt * sizeof(__uint128_t));
+  rep_ips = (__uint128_t *) malloc (opt.rep_cnt * sizeof(__uint128_t));
+  if (opt.traffic & TR_ZIPF)
+    zipf_ips = (__uint128_t *) malloc (opt.rnd_cnt * sizeof(__uint128_t));
+  if (!rnd_ips || !rep_ips || ((opt.traffic & TR_ZIPF) && !zipf_ips)) {
+    puts ("Failed to allocate memory for traffic");
+    return -1;
+  }
+
+  if (convert_file) {
+    ret = traffic_file_convert(traffic_file, convert_file);
+    return ret;
+  }
 
   //Read real traffic from file
-  ret = read_real_traffic("real_traffic");
+  ret = traffic_file_open(traffic_file, &real_traffic);
   if (ret) {
     puts ("Error in reading real traffic from file"); 
     return -1;
   }
+  real_ips = real_traffic.ips;
+  real_ip_cnt = real_traffic.cnt;
+  if (!real_ip_cnt) {
+    puts ("Real traffic is empty");
+    return -1;
+  }
+
+  if (pcap_file) {
+    if (pcap_trace_open(pcap_file, &pcap)) {
+      puts ("Error in reading packets from pcap file");
+      return -1;
+    }
+    printf ("Loaded %" PRIu64 " IPv6 packets from %s (%" PRIu64 " other packets skipped)\n",
+            pcap.cnt, pcap_file, pcap.skipped);
+    pcap_hlim = (uint8_t *) malloc (pcap.cnt);
+    if (!pcap_hlim) {
+      puts ("Failed to allocate memory for packets");
+      return -1;
+    }
+    for (i = 0; i < pcap.cnt; i++)
+      pcap_hlim[i] = pcap.data[pcap.pkts[i].off + pcap.pkts[i].l3 + 7];
+    //Locally administered MAC addresses. The last byte is the next-hop.
+    for (i = 0; i < 256; i++) {
+      nh_mac[i][0] = 0x02;
+      nh_mac[i][5] = i;
+    }
+  }
+
+  if (opt.verify) {
+    uint64_t ref_cnt[NUM_TRAFFIC] = {real_ip_cnt, opt.rnd_cnt, SEQ_CNT, 0, opt.rep_cnt, 0, 0};
+
+    for (int t = 0; t < NUM_TRAFFIC; t++) {
+      ref_res[t] = (uint8_t *) malloc (ref_cnt[t] + 1);
+      if (!ref_res[t]) {
+        puts ("Failed to allocate memory for verification");
+        return -1;
+      }
+    }
+  }
 
   //Generate random IPv6 addresses for random traffic.
-  for (i = 0; i < RND_CNT;) {
+  for (i = 0; i < opt.rnd_cnt;) {
     //Generate a new 128-bit random number
     xorshift128(&state);
     //Generate random IPv6 addresses within 0x2000::/4 
     rnd_ips[i++] = (((__uint128_t)0x2) << 124) | (xorshift_to_ipv6(&state) >> 4);
   }
 
+  //Build packets from the real traffic
+  for (i = 0; i < PKT_CNT; i++) {
+    __uint128_t ip = real_ips[i % real_ip_cnt];
+    //EtherType IPv6
+    pkts[i][12] = 0x86;
+    pkts[i][13] = 0xDD;
+    //IPv6 version
+    pkts[i][14] = 0x60;
+    for (int k = 15; k >= 0; k--) {
+      pkts[i][DST_OFF + k] = ip & 0XFF;
+      ip >>= 8;
+    }
+  }
+
 //  //Generate 2^16 sequential IPv6 addresses within 2402:4f00:4000::/120
 //  for (i = 0; i < SEQ_CNT; i++) {
 //    seq_ips[i] = (((__uint128_t)0x24024F004000ULL) << 80) | ((__uint128_t)i);
 //  }
 
-#ifdef CALC_MATCHED_PREFIX_LEN
-  calc_avg_matched_prefix_len ("fibs/ip6/routes-293");
-  calc_avg_matched_prefix_len ("fibs/ip6/routes-852");
-  calc_avg_matched_prefix_len ("fibs/ip6/routes-19016");
-  calc_avg_matched_prefix_len ("fibs/ip6/routes-19151");
-  calc_avg_matched_prefix_len ("fibs/ip6/routes-19653");
-  calc_avg_matched_prefix_len ("fibs/ip6/routes-23367");
-  calc_avg_matched_prefix_len ("fibs/ip6/routes-53828");
-  calc_avg_matched_prefix_len ("fibs/ip6/routes-199524");
-  calc_avg_matched_prefix_len ("fibs/ip6/routes-395570");
-  exit (0);
-#endif
+  if (opt.matched_len) {
+    for (i = 0; i < num_fibs; i++)
+      calc_avg_matched_prefix_len ((char *)fibs[i]);
+    return 0;
+  }
 
-  struct result res[NUM_FIB];
-  memset (res, 0, sizeof (res));
+  struct result *res = (struct result *) calloc (num_fibs, sizeof (struct result));
+  if (!res) {
+    puts ("Failed to allocate memory for results");
+    return -1;
+  }
+  for (i = 0; i < num_fibs; i++) {
+    res[i].eng = (struct engine_result *) calloc (num_engines, sizeof (struct engine_result));
+    if (!res[i].eng) {
+      puts ("Failed to allocate memory for results");
+      return -1;
+    }
+  }
   //Our stopwatch supports both high-resulation counter and 
   //CPU performance counter. Here we initialize stop watch with
-  //CPU performance counter (TSC register).
+  //CPU performance counter (TSC register), or with the hardware
+  //counters if they are asked for.
   //It only needs to be called once. No cleanup is needed.
-  stopwatch_init(TSC); 
+  stopwatch_init(opt.perf ? PERF : TSC);
 
-  ret = test ("fibs/ip6/routes-293", &res[0]);
-  if (ret) 
-    return -1;
-  puts ("The test case passed\n");
-
-  ret = test ("fibs/ip6/routes-852", &res[1]);
-  if (ret) 
-    return -1;
-  puts ("The test case passed\n");
-
-  ret = test ("fibs/ip6/routes-19016", &res[2]);
-  if (ret) 
-    return -1;
-  puts ("The test case passed\n");
-
-  ret = test ("fibs/ip6/routes-19151", &res[3]);
-  if (ret) 
-    return -1;
-  puts ("The test case passed\n");
-
-  ret = test ("fibs/ip6/routes-19653", &res[4]);
-  if (ret) 
-    return -1;
-  puts ("The test case passed\n");
-
-  ret = test ("fibs/ip6/routes-23367", &res[5]);
-  if (ret) 
-    return -1;
-  puts ("The test case passed\n");
-
-  ret = test ("fibs/ip6/routes-53828", &res[6]);
-  if (ret) 
-    return -1;
-  puts ("The test case passed\n");
-  
-  ret = test ("fibs/ip6/routes-199524", &res[7]);
-  if (ret) 
-    return -1;
-  puts ("The test case passed\n");
-  
-  ret = test ("fibs/ip6/routes-395570", &res[8]);
-  if (ret) 
-    return -1;
-  puts ("The test case passed\n");
+  for (i = 0; i < num_fibs; i++) {
+    res[i].fib = fibs[i];
+    ret = test ((char *)fibs[i], &res[i]);
+    if (ret) 
+      return -1;
+    puts ("The test case passed\n");
+  }
   
   puts ("All tests have passed");
-  write_summery(res, NUM_FIB);
+  write_summery(res, num_fibs);
+  write_json(res, num_fibs);
+  write_csv(res, num_fibs);
 
-#ifdef RECORD_TRAFFIC
-  FILE *seq_traffic, *rnd_traffic, *rep_traffic;
+  if (opt.record_traffic) {
+    FILE *seq_traffic, *rnd_traffic, *rep_traffic;
   
-  //Recording repeated traffic
-  rep_traffic = fopen("rep_traffic", "w");
-  for (i = 0; i < REP_CNT; i++) {
-    fprintf(rep_traffic, "%s\n", ipv6_to_str(rep_ips[i]));
-  }
-  fclose(rep_traffic);
+    //Recording repeated traffic
+    rep_traffic = fopen("rep_traffic", "w");
+    for (i = 0; i < opt.rep_cnt; i++) {
+      fprintf(rep_traffic, "%s\n", ipv6_to_str(rep_ips[i]));
+    }
+    fclose(rep_traffic);
 
-  //Recording sequential traffic
-  seq_traffic = fopen("seq_traffic", "w");
-  for (i = 0; i < SEQ_CNT; i++) {
-    fprintf(seq_traffic, "%s\n", ipv6_to_str(seq_ips[i]));
-  }
-  fclose(seq_traffic);
+    //Recording sequential traffic
+    seq_traffic = fopen("seq_traffic", "w");
+    for (i = 0; i < SEQ_CNT; i++) {
+      fprintf(seq_traffic, "%s\n", ipv6_to_str(seq_ips[i]));
+    }
+    fclose(seq_traffic);
 
-  //Recording random traffic
-  rnd_traffic = fopen("rnd_traffic", "w");
-  for (i = 0; i < RND_CNT; i++) {
-    fprintf(rnd_traffic, "%s\n", ipv6_to_str(rnd_ips[i]));
+    //Recording random traffic
+    rnd_traffic = fopen("rnd_traffic", "w");
+    for (i = 0; i < opt.rnd_cnt; i++) {
+      fprintf(rnd_traffic, "%s\n", ipv6_to_str(rnd_ips[i]));
+    }
+    fclose(rnd_traffic);
   }
-  fclose(rnd_traffic);
-#endif
+  for (i = 0; i < num_fibs; i++)
+    free(res[i].eng);
+  free(res);
+  traffic_file_close(&real_traffic);
+  return 0;
 }
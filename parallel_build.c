@@ -0,0 +1,252 @@
+/*
+ *   Copyright (c) 2019-2021 MD Iftakharul Islam (Tamim) <tamim@csebuet.org>
+ *
+ *   This program is free software; you can redistribute it and/or modify
+ *   it under the terms of the GNU General Public License as published by
+ *   the Free Software Foundation; either version 3 of the License, or
+ *   (at your option) any later version.
+ *
+ *   This program is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *   GNU General Public License for more details.
+ *
+ *   You should have received a copy of the GNU General Public License
+ *   along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+#include "parallel_build.h"
+#include <pthread.h>
+#include <string.h>
+
+//We create a few fragments per thread. Because the FIB is very skewed
+//(most of the prefixes are under a handful of roots), having more fragments
+//than threads lets the idle threads pick up the remaining work.
+int num_fragments(int nthreads)
+{
+  int n = nthreads * 4;
+
+  if (n < 1)
+    n = 1;
+  return n > MAX_FRAGS ? MAX_FRAGS : n;
+}
+
+//Range of roots [*lo, *hi] covered by a prefix
+static void root_range(__uint128_t prefix, uint8_t prefix_len, uint32_t *lo, uint32_t *hi)
+{
+  *lo = prefix >> 112;
+  if (prefix_len >= 16) {
+    *hi = *lo;
+  } else {
+    *lo &= ~((1U << (16 - prefix_len)) - 1);
+    *hi = *lo + (1U << (16 - prefix_len)) - 1;
+  }
+}
+
+//Split the roots into num_frags ranges containing roughly the same number of
+//prefixes. Returns the actual number of fragments which may be smaller than
+//num_frags if the prefixes are concentrated under a few roots.
+int partition_fib(__uint128_t *prefixes, uint8_t *pre_lens, uint64_t cnt, int num_frags, struct fragment *frags)
+{
+  uint64_t weight[NUM_ROOT_UNITS] = {0};
+  uint64_t total = 0, acc = 0;
+  uint32_t lo, hi, u;
+  uint64_t i;
+  int f;
+
+  if (num_frags < 1 || num_frags > MAX_FRAGS) {
+    puts("Invalid number of fragments");
+    return -1;
+  }
+
+  //Count the prefixes under each unit of roots
+  for (i = 0; i < cnt; i++) {
+    //Default route is not part of any fragment
+    if (!pre_lens[i])
+      continue;
+    root_range(prefixes[i], pre_lens[i], &lo, &hi);
+    for (u = lo / ROOT_UNIT; u <= hi / ROOT_UNIT; u++) {
+      weight[u]++;
+      total++;
+    }
+  }
+
+  memset(frags, 0, num_frags * sizeof(struct fragment));
+  f = 0;
+  for (u = 0; u < NUM_ROOT_UNITS; u++) {
+    acc += weight[u];
+    if (f < num_frags - 1 && acc * num_frags >= total * (f + 1)) {
+      frags[f].root_hi = (u + 1) * ROOT_UNIT;
+      f++;
+      frags[f].root_lo = (u + 1) * ROOT_UNIT;
+    }
+  }
+  frags[f].root_hi = ROOT_SIZE;
+  //The last cut may have been made at the very end
+  if (frags[f].root_lo == ROOT_SIZE)
+    f--;
+  num_frags = f + 1;
+
+  //Count the prefixes of each fragment, then store their indices
+  for (i = 0; i < cnt; i++) {
+    if (!pre_lens[i])
+      continue;
+    root_range(prefixes[i], pre_lens[i], &lo, &hi);
+    for (f = 0; f < num_frags; f++) {
+      if (frags[f].root_lo <= hi && lo < frags[f].root_hi)
+        frags[f].pre_cnt++;
+    }
+  }
+  for (f = 0; f < num_frags; f++) {
+    frags[f].pre_idx = (uint32_t *) malloc ((frags[f].pre_cnt + 1) * sizeof(uint32_t));
+    if (!frags[f].pre_idx) {
+      puts("Failed to allocate memory for fragments");
+      free_partition(frags, num_frags);
+      return -1;
+    }
+    frags[f].pre_cnt = 0;
+  }
+  for (i = 0; i < cnt; i++) {
+    if (!pre_lens[i])
+      continue;
+    root_range(prefixes[i], pre_lens[i], &lo, &hi);
+    for (f = 0; f < num_frags; f++) {
+      if (frags[f].root_lo <= hi && lo < frags[f].root_hi)
+        frags[f].pre_idx[frags[f].pre_cnt++] = i;
+    }
+  }
+  return num_frags;
+}
+
+void free_partition(struct fragment *frags, int num_frags)
+{
+  for (int f = 0; f < num_frags; f++) {
+    free(frags[f].pre_idx);
+    frags[f].pre_idx = NULL;
+    frags[f].pre_cnt = 0;
+  }
+}
+
+//Number of the prefixes of a fragment longer than each length. A chunk (or
+//node) under an entry of length len is only created for such a prefix, at
+//most one per level, so they bound the levels of the fragment.
+void fragment_longer(struct fragment *f, uint8_t *pre_lens, uint32_t *longer)
+{
+  memset(longer, 0, NUM_LENS * sizeof(longer[0]));
+  for (uint64_t i = 0; i < f->pre_cnt; i++) {
+    for (int len = 0; len < pre_lens[f->pre_idx[i]]; len++)
+      longer[len]++;
+  }
+}
+
+//Number of chunks of a level under the entries of length len. A fragment
+//needs no more than its prefixes longer than len, and never more than size,
+//which is what a full trie gets (longer is NULL).
+uint32_t fragment_size(const uint32_t *longer, int len, uint32_t size)
+{
+  if (!longer || longer[len] >= size)
+    return size;
+  return longer[len] ? longer[len] : 1;
+}
+
+//Inserts the prefixes of a fragment. A prefix shorter than 16 may span
+//multiple fragments. Such a prefix is clipped to the fragment by inserting one
+//piece for each root, i.e. at level 16 but with its original prefix length.
+//This is exactly what leaf pushing does anyway.
+int insert_fragment(struct fragment *f, __uint128_t *prefixes, uint8_t *pre_lens, uint8_t *pre_nhs, frag_insert_fn insert, void *trie)
+{
+  uint32_t lo, hi, r;
+  uint64_t i;
+  uint32_t k;
+  int err;
+
+  for (i = 0; i < f->pre_cnt; i++) {
+    k = f->pre_idx[i];
+    root_range(prefixes[k], pre_lens[k], &lo, &hi);
+    if (lo >= f->root_lo && hi < f->root_hi) {
+      err = insert(trie, prefixes[k], pre_lens[k], pre_nhs[k], pre_lens[k]);
+      if (err)
+        return err;
+      continue;
+    }
+    if (lo < f->root_lo)
+      lo = f->root_lo;
+    if (hi >= f->root_hi)
+      hi = f->root_hi - 1;
+    for (r = lo; r <= hi; r++) {
+      err = insert(trie, (__uint128_t)r << 112, pre_lens[k], pre_nhs[k], 16);
+      if (err)
+        return err;
+    }
+  }
+  return 0;
+}
+
+//Returns next-hop of the default route (the last one wins like insertion)
+//or 0 if there is no default route.
+int find_default_route(uint8_t *pre_lens, uint8_t *pre_nhs, uint64_t cnt)
+{
+  int nh = 0;
+
+  for (uint64_t i = 0; i < cnt; i++) {
+    if (!pre_lens[i])
+      nh = pre_nhs[i];
+  }
+  return nh;
+}
+
+struct task_queue {
+  void (*fn)(int task, void *arg);
+  void *arg;
+  int ntasks;
+  //Next task to be picked up
+  volatile int next;
+};
+
+static void *worker(void *arg)
+{
+  struct task_queue *q = (struct task_queue *) arg;
+  int task;
+
+  //Each worker keeps taking the next unstarted task. So a thread that gets a
+  //small fragment simply moves on to the next one.
+  while ((task = __sync_fetch_and_add(&q->next, 1)) < q->ntasks)
+    q->fn(task, q->arg);
+  return NULL;
+}
+
+//Runs fn(task, arg) for every task in [0, ntasks) using nthreads threads
+//(including the calling thread) and waits for all of them to finish.
+int run_tasks(int nthreads, int ntasks, void (*fn)(int task, void *arg), void *arg)
+{
+  struct task_queue q;
+  pthread_t *threads;
+  int i, n = 0;
+
+  q.fn = fn;
+  q.arg = arg;
+  q.ntasks = ntasks;
+  q.next = 0;
+
+  if (nthreads > ntasks)
+    nthreads = ntasks;
+  if (nthreads <= 1) {
+    worker(&q);
+    return 0;
+  }
+
+  threads = (pthread_t *) calloc (nthreads - 1, sizeof(pthread_t));
+  if (!threads)
+    return -1;
+  for (i = 0; i < nthreads - 1; i++) {
+    if (pthread_create(&threads[i], NULL, worker, &q))
+      break;
+    n++;
+  }
+  //The calling thread works too
+  worker(&q);
+  for (i = 0; i < n; i++)
+    pthread_join(threads[i], NULL);
+  free(threads);
+  return 0;
+}
@@ -0,0 +1,65 @@
+/*
+ *   Copyright (c) 2019-2021 MD Iftakharul Islam (Tamim) <tamim@csebuet.org>
+ *
+ *   This program is free software; you can redistribute it and/or modify
+ *   it under the terms of the GNU General Public License as published by
+ *   the Free Software Foundation; either version 3 of the License, or
+ *   (at your option) any later version.
+ *
+ *   This program is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *   GNU General Public License for more details.
+ *
+ *   You should have received a copy of the GNU General Public License
+ *   along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+#ifndef PARALLEL_BUILD_H_
+#define PARALLEL_BUILD_H_
+
+#include <stdint.h>
+#include <stdlib.h>
+#include <stdio.h>
+
+/*
+ *All the lookup algorithms here index their first level with the 16 MSBs of
+ *the key. Subtrees under different 16-bit roots never share a chunk, and the
+ *chunks (and leaves) of each level are stored in key order. So a FIB can be
+ *built as independent fragments, each covering a contiguous range of roots,
+ *which are then concatenated level by level. Only the cumulative offsets
+ *(cumu_popcnt, base0/base1, chunk IDs) need to be shifted while merging.
+ */
+#define ROOT_SIZE 65536
+//Fragment boundaries are multiple of 64 roots so that a 64-bit bitmap in
+//CP-Trie level 16 never straddles two fragments.
+#define ROOT_UNIT 64
+#define NUM_ROOT_UNITS (ROOT_SIZE / ROOT_UNIT)
+//Every fragment has its own first level, so don't create too many of them
+#define MAX_FRAGS 64
+//Lengths 0 to 128, see fragment_longer()
+#define NUM_LENS 129
+
+struct fragment {
+  //The fragment covers the roots [root_lo, root_hi)
+  uint32_t root_lo;
+  uint32_t root_hi;
+  //Index of the prefixes (in original order) that overlap with the fragment
+  uint32_t *pre_idx;
+  uint64_t pre_cnt;
+};
+
+//Inserts a route in a fragment. This is the recursive insert function of the
+//algorithm where level may be larger than prefix_len.
+typedef int (*frag_insert_fn)(void *trie, __uint128_t key, int prefix_len, int nexthop, int level);
+
+int num_fragments(int nthreads);
+int partition_fib(__uint128_t *prefixes, uint8_t *pre_lens, uint64_t cnt, int num_frags, struct fragment *frags);
+void free_partition(struct fragment *frags, int num_frags);
+void fragment_longer(struct fragment *f, uint8_t *pre_lens, uint32_t *longer);
+uint32_t fragment_size(const uint32_t *longer, int len, uint32_t size);
+int insert_fragment(struct fragment *f, __uint128_t *prefixes, uint8_t *pre_lens, uint8_t *pre_nhs, frag_insert_fn insert, void *trie);
+int find_default_route(uint8_t *pre_lens, uint8_t *pre_nhs, uint64_t cnt);
+int run_tasks(int nthreads, int ntasks, void (*fn)(int task, void *arg), void *arg);
+
+#endif /* PARALLEL_BUILD_H_ */
@@ -0,0 +1,306 @@
+/*
+ *   Copyright (c) 2019-2021 MD Iftakharul Islam (Tamim) <tamim@csebuet.org>
+ *
+ *   This program is free software; you can redistribute it and/or modify
+ *   it under the terms of the GNU General Public License as published by
+ *   the Free Software Foundation; either version 3 of the License, or
+ *   (at your option) any later version.
+ *
+ *   This program is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *   GNU General Public License for more details.
+ *
+ *   You should have received a copy of the GNU General Public License
+ *   along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+#include "pcap_trace.h"
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+//Magic numbers of pcap with microsecond and nanosecond timestamps
+#define PCAP_MAGIC 0xa1b2c3d4
+#define PCAP_MAGIC_NS 0xa1b23c4d
+#define PCAP_HDR_LEN 24
+#define PCAP_REC_LEN 16
+
+//pcapng block types
+#define PCAPNG_SHB 0x0A0D0D0A
+#define PCAPNG_IDB 1
+#define PCAPNG_PB 2
+#define PCAPNG_SPB 3
+#define PCAPNG_EPB 6
+#define PCAPNG_BYTE_ORDER 0x1A2B3C4D
+//Interfaces beyond this are ignored
+#define PCAPNG_MAX_IFACES 256
+
+//Packets are copied to slots of multiple of this size
+#define SLOT_ALIGN 64
+
+#define ETH_P_IPV6 0x86DD
+#define ETH_P_8021Q 0x8100
+#define ETH_P_8021AD 0x88A8
+
+//The trace is parsed twice. The first pass only counts the packets and the
+//bytes, the second one copies them.
+struct loader {
+  struct pcap_trace *tr;
+  uint64_t bytes;
+  bool copy;
+};
+
+static uint16_t rd16(const uint8_t *p, bool swap)
+{
+  uint16_t v;
+
+  memcpy(&v, p, sizeof(v));
+  return swap ? __builtin_bswap16(v) : v;
+}
+
+static uint32_t rd32(const uint8_t *p, bool swap)
+{
+  uint32_t v;
+
+  memcpy(&v, p, sizeof(v));
+  return swap ? __builtin_bswap32(v) : v;
+}
+
+//Returns the offset of the IPv6 header in a packet or -1 if it is not an
+//IPv6 packet
+static int find_l3(int linktype, const uint8_t *p, uint32_t len, uint8_t *eth)
+{
+  uint32_t off, type;
+
+  *eth = 0;
+  switch (linktype) {
+  case LINKTYPE_ETHERNET:
+    if (len < ETH_HDR_LEN)
+      return -1;
+    off = 12;
+    type = (p[off] << 8) | p[off + 1];
+    //Skip VLAN tags
+    while ((type == ETH_P_8021Q || type == ETH_P_8021AD) && off + 6 <= len) {
+      off += 4;
+      type = (p[off] << 8) | p[off + 1];
+    }
+    if (type != ETH_P_IPV6)
+      return -1;
+    *eth = 1;
+    off += 2;
+    break;
+  case LINKTYPE_LINUX_SLL:
+    if (len < 16 || ((p[14] << 8) | p[15]) != ETH_P_IPV6)
+      return -1;
+    off = 16;
+    break;
+  case LINKTYPE_RAW:
+  case LINKTYPE_IPV6:
+    off = 0;
+    break;
+  default:
+    return -1;
+  }
+  if (len < off + IP6_HDR_LEN || (p[off] >> 4) != 6)
+    return -1;
+  return off;
+}
+
+static void add_packet(struct loader *ld, int linktype, const uint8_t *p, uint32_t caplen)
+{
+  struct pcap_trace *tr = ld->tr;
+  struct pcap_pkt *pkt;
+  uint8_t eth;
+  int l3;
+
+  l3 = find_l3(linktype, p, caplen, &eth);
+  if (l3 < 0) {
+    if (!ld->copy)
+      tr->skipped++;
+    return;
+  }
+  //Only the headers matter for forwarding
+  if (caplen > UINT16_MAX)
+    caplen = UINT16_MAX;
+  if (ld->copy) {
+    pkt = &tr->pkts[tr->cnt];
+    pkt->off = ld->bytes;
+    pkt->len = caplen;
+    pkt->l3 = l3;
+    pkt->eth = eth;
+    memcpy(tr->data + ld->bytes, p, caplen);
+  }
+  tr->cnt++;
+  ld->bytes += (caplen + SLOT_ALIGN - 1) / SLOT_ALIGN * SLOT_ALIGN;
+}
+
+static int parse_pcap(const uint8_t *map, size_t len, struct loader *ld)
+{
+  uint32_t magic, caplen;
+  int linktype;
+  size_t off;
+  bool swap;
+
+  magic = rd32(map, false);
+  swap = magic == __builtin_bswap32(PCAP_MAGIC) || magic == __builtin_bswap32(PCAP_MAGIC_NS);
+  //The upper bits may carry FCS information
+  linktype = rd32(map + 20, swap) & 0xFFFF;
+  for (off = PCAP_HDR_LEN; off + PCAP_REC_LEN <= len; off += PCAP_REC_LEN + caplen) {
+    caplen = rd32(map + off + 8, swap);
+    if (off + PCAP_REC_LEN + caplen > len) {
+      puts("pcap file is truncated, ignoring the last packet");
+      break;
+    }
+    add_packet(ld, linktype, map + off + PCAP_REC_LEN, caplen);
+  }
+  return 0;
+}
+
+static int parse_pcapng(const uint8_t *map, size_t len, struct loader *ld)
+{
+  int ifaces[PCAPNG_MAX_IFACES];
+  uint32_t type, blen, iface, caplen, num_ifaces = 0;
+  const uint8_t *b;
+  size_t off;
+  bool swap = false;
+
+  for (off = 0; off + 12 <= len; off += blen) {
+    b = map + off;
+    type = rd32(b, swap);
+    //The byte order may change at each section
+    if (type == PCAPNG_SHB) {
+      if (off + 16 > len)
+        break;
+      if (rd32(b + 8, false) == PCAPNG_BYTE_ORDER) {
+        swap = false;
+      } else if (rd32(b + 8, true) == PCAPNG_BYTE_ORDER) {
+        swap = true;
+      } else {
+        puts("Invalid pcapng section header");
+        return -1;
+      }
+      num_ifaces = 0;
+    } else if (!off) {
+      puts("pcapng file does not start with a section header");
+      return -1;
+    }
+    blen = rd32(b + 4, swap);
+    if (blen < 12 || blen % 4) {
+      puts("Invalid pcapng block");
+      return -1;
+    }
+    if (off + blen > len) {
+      puts("pcapng file is truncated, ignoring the last block");
+      break;
+    }
+
+    switch (type) {
+    case PCAPNG_IDB:
+      if (blen >= 20 && num_ifaces < PCAPNG_MAX_IFACES)
+        ifaces[num_ifaces++] = rd16(b + 8, swap);
+      break;
+    case PCAPNG_EPB:
+    case PCAPNG_PB:
+      if (blen < 32)
+        break;
+      iface = type == PCAPNG_EPB ? rd32(b + 8, swap) : rd16(b + 8, swap);
+      caplen = rd32(b + 20, swap);
+      if (iface < num_ifaces && caplen <= blen - 32)
+        add_packet(ld, ifaces[iface], b + 28, caplen);
+      break;
+    case PCAPNG_SPB:
+      //The captured length is implied by the block length
+      if (blen < 16 || !num_ifaces)
+        break;
+      caplen = rd32(b + 8, swap);
+      if (caplen > blen - 16)
+        caplen = blen - 16;
+      add_packet(ld, ifaces[0], b + 12, caplen);
+      break;
+    default:
+      break;
+    }
+  }
+  return 0;
+}
+
+static int parse(const uint8_t *map, size_t len, struct loader *ld)
+{
+  uint32_t magic = rd32(map, false);
+
+  if (magic == PCAPNG_SHB)
+    return parse_pcapng(map, len, ld);
+  if (magic == PCAP_MAGIC || magic == PCAP_MAGIC_NS ||
+      magic == __builtin_bswap32(PCAP_MAGIC) || magic == __builtin_bswap32(PCAP_MAGIC_NS)) {
+    if (len < PCAP_HDR_LEN) {
+      puts("Invalid pcap file");
+      return -1;
+    }
+    return parse_pcap(map, len, ld);
+  }
+  puts("Not a pcap or pcapng file");
+  return -1;
+}
+
+//Reads the IPv6 packets of a pcap or pcapng file into memory
+int pcap_trace_open(const char *file, struct pcap_trace *tr)
+{
+  struct loader ld;
+  struct stat st;
+  uint8_t *map;
+  void *data;
+  int fd, ret;
+
+  memset(tr, 0, sizeof(*tr));
+  if ((fd = open(file, O_RDONLY)) < 0) {
+    puts("File not exists");
+    return -1;
+  }
+  if (fstat(fd, &st) || st.st_size < 4) {
+    puts("Invalid pcap file");
+    close(fd);
+    return -1;
+  }
+  map = (uint8_t *) mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE | MAP_POPULATE, fd, 0);
+  close(fd);
+  if (map == MAP_FAILED) {
+    puts("Failed to map the pcap file");
+    return -1;
+  }
+
+  ld.tr = tr;
+  ld.bytes = 0;
+  ld.copy = false;
+  ret = parse(map, st.st_size, &ld);
+  if (!ret && !tr->cnt) {
+    puts("There is no IPv6 packet in the pcap file");
+    ret = -1;
+  }
+  if (!ret) {
+    tr->pkts = (struct pcap_pkt *) malloc (tr->cnt * sizeof(struct pcap_pkt));
+    if (!tr->pkts || posix_memalign(&data, SLOT_ALIGN, ld.bytes)) {
+      puts("Failed to allocate memory for the packets");
+      ret = -1;
+    } else {
+      tr->data = (uint8_t *) data;
+      tr->cnt = 0;
+      ld.bytes = 0;
+      ld.copy = true;
+      ret = parse(map, st.st_size, &ld);
+    }
+  }
+  munmap(map, st.st_size);
+  if (ret)
+    pcap_trace_close(tr);
+  return ret;
+}
+
+void pcap_trace_close(struct pcap_trace *tr)
+{
+  free(tr->data);
+  free(tr->pkts);
+  memset(tr, 0, sizeof(*tr));
+}
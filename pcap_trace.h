@@ -0,0 +1,65 @@
+/*
+ *   Copyright (c) 2019-2021 MD Iftakharul Islam (Tamim) <tamim@csebuet.org>
+ *
+ *   This program is free software; you can redistribute it and/or modify
+ *   it under the terms of the GNU General Public License as published by
+ *   the Free Software Foundation; either version 3 of the License, or
+ *   (at your option) any later version.
+ *
+ *   This program is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *   GNU General Public License for more details.
+ *
+ *   You should have received a copy of the GNU General Public License
+ *   along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+#ifndef PCAP_TRACE_H_
+#define PCAP_TRACE_H_
+
+#include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+
+/*
+ *A packet capture (pcap or pcapng) loaded in memory for replay. Only the
+ *IPv6 packets are kept. Each packet is copied to a 64-byte aligned slot, as
+ *a NIC would place it in a packet buffer, so that the headers of a packet
+ *never share a cache line with another packet.
+ */
+//Link types of the captures we can parse
+#define LINKTYPE_ETHERNET 1
+#define LINKTYPE_RAW 101
+#define LINKTYPE_LINUX_SLL 113
+#define LINKTYPE_IPV6 229
+
+//Size of the Ethernet and IPv6 headers
+#define ETH_HDR_LEN 14
+#define IP6_HDR_LEN 40
+
+struct pcap_pkt {
+  //Offset of the packet in pcap_trace.data
+  uint64_t off;
+  //Captured length
+  uint16_t len;
+  //Offset of the IPv6 header in the packet
+  uint8_t l3;
+  //The packet starts with an Ethernet header whose MAC addresses can be
+  //rewritten
+  uint8_t eth;
+};
+
+struct pcap_trace {
+  uint8_t *data;
+  struct pcap_pkt *pkts;
+  uint64_t cnt;
+  //Packets that are not IPv6 or are truncated before the end of the IPv6
+  //header
+  uint64_t skipped;
+};
+
+int pcap_trace_open(const char *file, struct pcap_trace *tr);
+void pcap_trace_close(struct pcap_trace *tr);
+
+#endif /* PCAP_TRACE_H_ */
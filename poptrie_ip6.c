@@ -16,29 +16,18 @@
  *
  */
 #include "poptrie_ip6.h"
+#include "parallel_build.h"
 #include <assert.h>
 
-//Size of each level. They may need to be increased to accomodate larger routing table
-#define DIRSIZE 65536
-#define SIZE16 400
-#define SIZE22 3000
-#define SIZE28 16000
-#define SIZE34 14000
-#define SIZE40 15000
-#define SIZE46 28000
-#define SIZE52 2000
-#define SIZE58 2000
-#define SIZE64 1000
-#define SIZE70 100
-#define SIZE76 100
-#define SIZE82 100
-#define SIZE88 100
-#define SIZE94 100
-#define SIZE100 100
-#define SIZE106 100
-#define SIZE112 100
-#define SIZE118 100
-#define SIZE124 100
+//Size of each level by its level number. They may need to be increased to
+//accomodate larger routing table. With a direct pointing wider than 16 bits,
+//a level falls between two of these and gets the sum of both.
+static const uint32_t level_sizes[][2] = {
+  {16, 400}, {22, 3000}, {28, 16000}, {34, 14000}, {40, 15000}, {46, 28000},
+  {52, 2000}, {58, 2000}, {64, 1000}, {70, 100}, {76, 100}, {82, 100},
+  {88, 100}, {94, 100}, {100, 100}, {106, 100}, {112, 100}, {118, 100},
+  {124, 100}
+};
 #define N_SIZE 2500000
 
 #define MSK 0X8000000000000000ULL
@@ -46,39 +35,67 @@
 /*Calculates the number of bits set to 1*/
 #define POPCNT(X) (__builtin_popcountll(X))
 
+//Stride of a key in a level. The last level may have fewer than 6 bits
+//left, e.g. level 124 with s = 16. Its stride is padded with zeros to 6 bits.
+static __inline__ uint32_t level_stride(__uint128_t key, int level_num)
+{
+  if (level_num + 6 > 128)
+    return (key & ((1U << (128 - level_num)) - 1)) << (level_num - 122);
+  return (key >> (122 - level_num)) & 63;
+}
+
+//Same as level_stride() on the two 64-bit halves of a key. A level may take
+//its bits from both halves, e.g. level 60 with s = 18.
+static __inline__ uint32_t level_stride64(uint64_t key_hi, uint64_t key_lo, int level_num)
+{
+  if (level_num + 6 <= 64)
+    return (key_hi >> (58 - level_num)) & 63;
+  if (level_num < 64)
+    return ((key_hi << (level_num - 58)) | (key_lo >> (122 - level_num))) & 63;
+  if (level_num + 6 > 128)
+    return (key_lo & ((1U << (128 - level_num)) - 1)) << (level_num - 122);
+  return (key_lo >> (122 - level_num)) & 63;
+}
+
 //Forward declaration
-static int _poptrie_insert(__uint128_t key, int prefix_len, int nexthop, int level);
+static int _poptrie_insert(struct poptrie *t, __uint128_t key, int prefix_len, int nexthop, int level);
 
 struct poptrie poptrie;
 
-int poptrie_init () {
+static uint32_t level_size(int level_num)
+{
+  uint32_t size = 0;
+
+  for (int i = 0; i < sizeof(level_sizes) / sizeof(level_sizes[0]); i++) {
+    if (level_sizes[i][0] < level_num + 6 && level_num < level_sizes[i][0] + 6)
+      size += level_sizes[i][1];
+  }
+  return size;
+}
+
+//A fragment of a parallel build sizes its levels from longer, see
+//fragment_longer(). It's NULL for a full size Poptrie.
+static int _poptrie_init (struct poptrie *t, const uint32_t *longer) {
   int err = 0;
+  int k;
+  uint32_t size, nodes = 0;
+
+  memset(t, 0, sizeof(*t));
+  err |= leaf_init (&t->dir_leafs, POPTRIE_DIRSIZE);
+  err |= dir_init (&t->dir, POPTRIE_DIRSIZE);
+  for (k = 0; k < POPTRIE_LEVELS; k++) {
+    size = fragment_size(longer, POPTRIE_S + 6 * k, level_size(POPTRIE_S + 6 * k));
+    nodes += size;
+    err |= poptrie_level_init (&t->L[k], POPTRIE_S + 6 * k, size, k ? &t->L[k - 1] : NULL);
+  }
+  //A node has at most 64 leaves. One more node is left for the leaves
+  //inserted before they are pushed to the next level.
+  size = N_SIZE;
+  if (longer && (uint64_t)(nodes + 1) * 64 < N_SIZE)
+    size = (nodes + 1) * 64;
+  err |= leaf_init (&t->leafs, size);
 
-  memset(&poptrie, 0, sizeof(poptrie));
-  err = leaf_init (&poptrie.leafs16, DIRSIZE);
-  err = dir_init (&poptrie.dir16, DIRSIZE);
-  err = leaf_init (&poptrie.leafs, N_SIZE);
-  err = poptrie_level_init (&poptrie.L16, 16, SIZE16, NULL);
-  err = poptrie_level_init (&poptrie.L22, 22, SIZE22, &poptrie.L16);
-  err = poptrie_level_init (&poptrie.L28, 28, SIZE28, &poptrie.L22);
-  err = poptrie_level_init (&poptrie.L34, 34, SIZE34, &poptrie.L28);
-  err = poptrie_level_init (&poptrie.L40, 40, SIZE40, &poptrie.L34);
-  err = poptrie_level_init (&poptrie.L46, 46, SIZE46, &poptrie.L40);
-  err = poptrie_level_init (&poptrie.L52, 52, SIZE52, &poptrie.L46);
-  err = poptrie_level_init (&poptrie.L58, 58, SIZE58, &poptrie.L52);
-  err = poptrie_level_init (&poptrie.L64, 64, SIZE64, &poptrie.L58);
-  err = poptrie_level_init (&poptrie.L70, 70, SIZE70, &poptrie.L64);
-  err = poptrie_level_init (&poptrie.L76, 76, SIZE76, &poptrie.L70);
-  err = poptrie_level_init (&poptrie.L82, 82, SIZE82, &poptrie.L76);
-  err = poptrie_level_init (&poptrie.L88, 88, SIZE88, &poptrie.L82);
-  err = poptrie_level_init (&poptrie.L94, 94, SIZE94, &poptrie.L88);
-  err = poptrie_level_init (&poptrie.L100, 100, SIZE100, &poptrie.L94);
-  err = poptrie_level_init (&poptrie.L106, 106, SIZE106, &poptrie.L100);
-  err = poptrie_level_init (&poptrie.L112, 112, SIZE112, &poptrie.L106);
-  err = poptrie_level_init (&poptrie.L118, 118, SIZE118, &poptrie.L112);
-  err = poptrie_level_init (&poptrie.L124, 124, SIZE124, &poptrie.L118);
-
-  poptrie.leafs16.count = DIRSIZE;
+  t->dir_leafs.count = POPTRIE_DIRSIZE;
 
   if (err)
     return -1;   
@@ -86,43 +103,65 @@ int poptrie_init () {
     return 1;
 }
 
-int poptrie_cleanup() {
+//Drops the compact copy of the levels
+static void compact_free(struct poptrie *t)
+{
+  for (int k = 0; k < POPTRIE_LEVELS; k++) {
+    free(t->C[k].B);
+    free(t->C[k].base0);
+    free(t->C[k].base1);
+  }
+  memset(t->C, 0, sizeof(t->C));
+  t->compact = 0;
+}
+
+static int _poptrie_cleanup (struct poptrie *t) {
   int err = 0;
+  int k;
 
-  leaf_cleanup(&poptrie.leafs16);
-  dir_cleanup(&poptrie.dir16);
-  leaf_cleanup(&poptrie.leafs);
-  poptrie_level_cleanup(&poptrie.L16);
-  poptrie_level_cleanup(&poptrie.L22);
-  poptrie_level_cleanup(&poptrie.L28);
-  poptrie_level_cleanup(&poptrie.L34);
-  poptrie_level_cleanup(&poptrie.L40);
-  poptrie_level_cleanup(&poptrie.L46);
-  poptrie_level_cleanup(&poptrie.L52);
-  poptrie_level_cleanup(&poptrie.L58);
-  poptrie_level_cleanup(&poptrie.L64);
-  poptrie_level_cleanup(&poptrie.L70);
-  poptrie_level_cleanup(&poptrie.L76);
-  poptrie_level_cleanup(&poptrie.L82);
-  poptrie_level_cleanup(&poptrie.L88);
-  poptrie_level_cleanup(&poptrie.L94);
-  poptrie_level_cleanup(&poptrie.L100);
-  poptrie_level_cleanup(&poptrie.L106);
-  poptrie_level_cleanup(&poptrie.L112);
-  poptrie_level_cleanup(&poptrie.L118);
-  poptrie_level_cleanup(&poptrie.L124);
-  memset(&poptrie, 0, sizeof(poptrie));
+  leaf_cleanup(&t->dir_leafs);
+  dir_cleanup(&t->dir);
+  leaf_cleanup(&t->leafs);
+  for (k = 0; k < POPTRIE_LEVELS; k++)
+    poptrie_level_cleanup(&t->L[k]);
+  compact_free(t);
+  rib_cleanup(&t->rib);
+  memset(t, 0, sizeof(*t));
   return 0;
 }
 
+//Initial size of the RIB. It grows as needed.
+#define RIB_SIZE 65536
+
+int poptrie_init () {
+  int ret = _poptrie_init (&poptrie, NULL);
+
+  if (ret < 0 || rib_init (&poptrie.rib, RIB_SIZE))
+    return -1;
+  //The FIB is loaded in bulk, see poptrie_commit()
+  dir_defer (&poptrie.dir);
+  return ret;
+}
+
+//Makes the routes inserted since poptrie_init() visible to the lookups. The
+//chunk IDs of the direct pointing aren't maintained until then, so loading a
+//FIB doesn't shift them on each new chunk. The updates after the commit are
+//applied in place.
+void poptrie_commit() {
+  dir_commit (&poptrie.dir);
+}
+
+int poptrie_cleanup() {
+  return _poptrie_cleanup (&poptrie);
+}
+
 //Calculate memory in MB
 double calc_poptrie_mem() {
-  return (mem_size (&poptrie.L16) + mem_size (&poptrie.L22) + mem_size (&poptrie.L28) + mem_size (&poptrie.L34) +
-         mem_size (&poptrie.L40) + mem_size (&poptrie.L46) + mem_size (&poptrie.L52) + mem_size (&poptrie.L58) +
-         mem_size (&poptrie.L64) + mem_size (&poptrie.L70) + mem_size (&poptrie.L76) + mem_size (&poptrie.L82) +
-         mem_size (&poptrie.L88) + mem_size (&poptrie.L94) + mem_size (&poptrie.L100) + mem_size (&poptrie.L106) +
-         mem_size (&poptrie.L112) + mem_size (&poptrie.L118) + mem_size (&poptrie.L124) + mem_size(&poptrie.leafs16) +
-         mem_size(&poptrie.leafs) + mem_size(&poptrie.dir16)) / (1024 * 1024);
+  double mem = mem_size(&poptrie.dir_leafs) + mem_size(&poptrie.leafs) + mem_size(&poptrie.dir);
+
+  for (int k = 0; k < POPTRIE_LEVELS; k++)
+    mem += mem_size(&poptrie.L[k]);
+  return mem / (1024 * 1024);
 }
 
 //Calculates base1 from the previous chunk or checks from the upper levels.
@@ -186,7 +225,7 @@ static uint32_t calc_n_idx(struct poptrie_level *l, uint32_t idx, uint32_t strid
 //There can be at most 64 leaves.
 #define ARR_SIZE 64
 
-static int insert_leaf(struct poptrie_level *l, int level, uint32_t idx, uint32_t stride,
+static int insert_leaf(struct poptrie *t, struct poptrie_level *l, int level, uint32_t idx, uint32_t stride,
                  __uint128_t key, int prefix_len,
                  int nexthop, struct leaf *leaf) {
   __uint128_t matching_prefix;
@@ -197,8 +236,6 @@ static int insert_leaf(struct poptrie_level *l, int level, uint32_t idx, uint32_
   register uint32_t n_idx;
   //level to which the leaf belong to currently.
   register int curr_level = l->level_num + 6;
-  //level to which the leaf may will be pushed.
-  register int dst_level = curr_level + 6;
   //Note that, level >= prefix_len. We use level to calculate the number of
   // leaves. We don't use prefix_len for it. 
   register uint32_t num_leafs = 1U << (curr_level - level);
@@ -212,8 +249,8 @@ static int insert_leaf(struct poptrie_level *l, int level, uint32_t idx, uint32_
   register long long last_n_idx = -1;
 
   if (leaf->count + num_leafs >= leaf->size) {
-      puts ("Leaf array is full. Please increase the size.");
-      exit (1);
+    puts ("Leaf array is full. Please increase the size.");
+    return -1;
   }
 
   for (i = 0; i < num_leafs; i++) {
@@ -249,9 +286,10 @@ static int insert_leaf(struct poptrie_level *l, int level, uint32_t idx, uint32_
           if (last_n_idx == n_idx) {
             leaf_idx[k].num_consecutive_leaves++;
           } else {
-            //New start index
+            //New start index. n_idx doesn't count the leaves of the previous
+            //batches which are inserted before this one.
             k++;
-            leaf_idx[k].start_idx = n_idx;
+            leaf_idx[k].start_idx = n_idx + new_prefixes;
             leaf_idx[k].num_consecutive_leaves = 1;
             last_n_idx = n_idx;
           }
@@ -286,28 +324,22 @@ static int insert_leaf(struct poptrie_level *l, int level, uint32_t idx, uint32_
   //Insert the leaves in a batch
   leaf_insert (leaf, leaf_idx, ARR_SIZE, nexthop, prefix_len);
 
-  //Leaf pushing
+  //Leaf pushing to both halves of each slot
   if (l->chield) {
     for (i = 0; i < leaf_pushing_prefixes_count; i++) {
-      if (curr_level == 124) {
-        //Pushing from level 124 to level 130
-        matching_prefix = leaf_pushing_prefixes[i] + (0 << 3);
-        _poptrie_insert (matching_prefix, prefix_len, nexthop, curr_level + 1);
-        matching_prefix = leaf_pushing_prefixes[i] + (1 << 3);
-        _poptrie_insert (matching_prefix, prefix_len, nexthop, curr_level + 1);
-      } else {
-        matching_prefix =  ((leaf_pushing_prefixes[i] >> (128 - dst_level)) + (0 << 5)) << (128 - dst_level);
-        _poptrie_insert (matching_prefix, prefix_len , nexthop, curr_level + 1);
-        matching_prefix =  ((leaf_pushing_prefixes[i] >> (128 - dst_level)) + (1 << 5)) << (128 - dst_level);
-        _poptrie_insert (matching_prefix, prefix_len , nexthop, curr_level + 1);
-      }
+      matching_prefix = leaf_pushing_prefixes[i];
+      if (_poptrie_insert (t, matching_prefix, prefix_len, nexthop, curr_level + 1))
+        return -1;
+      matching_prefix |= (__uint128_t)1 << (127 - curr_level);
+      if (_poptrie_insert (t, matching_prefix, prefix_len, nexthop, curr_level + 1))
+        return -1;
     }
   }
   return 0;
 }
 
 //Checks if there a leaf in the level; if yes, it then move the leafs to the next level
-static int leaf_pushing (struct poptrie_level *l, uint32_t idx, uint32_t stride, struct leaf *leafs, __uint128_t key) {
+static int leaf_pushing (struct poptrie *t, struct poptrie_level *l, uint32_t idx, uint32_t stride, struct leaf *leafs, __uint128_t key) {
   register uint32_t n_idx;
   register __uint128_t matching_key;
   register long long i;
@@ -352,17 +384,11 @@ static int leaf_pushing (struct poptrie_level *l, uint32_t idx, uint32_t stride,
       runner = runner->chield;
     }
 
-    if (curr_level != 124) {
-      //Key to which the match was found and add 6 bits to the right
-      matching_key = (key >> (128 - curr_level)) << 6;
-      _poptrie_insert ((matching_key + (0 << 5)) << (122 - curr_level), prefix_len, next_hop, curr_level + 1);
-      _poptrie_insert ((matching_key + (1 << 5)) << (122 - curr_level), prefix_len, next_hop, curr_level + 1);
-    } else {
-      //Pushing from level 124 to level 130
-      matching_key = (key >> 4) << 4;
-      _poptrie_insert (matching_key + (0 << 3), prefix_len, next_hop, curr_level + 1);
-      _poptrie_insert (matching_key + (1 << 3), prefix_len, next_hop, curr_level + 1);
-    }
+    //Key of the slot where the match was found, pushed to both halves of it
+    matching_key = (key >> (128 - curr_level)) << (128 - curr_level);
+    if (_poptrie_insert (t, matching_key, prefix_len, next_hop, curr_level + 1) ||
+        _poptrie_insert (t, matching_key | ((__uint128_t)1 << (127 - curr_level)), prefix_len, next_hop, curr_level + 1))
+      return -1;
   }
   return 0;
 }
@@ -373,16 +399,24 @@ int poptrie_insert(__uint128_t key, int prefix_len, int nexthop) {
     puts ("nexthop cannot be 0. Please fix the routing table");
     exit (1);
   }
+  compact_free(&poptrie);
   //level is same as prefix len
-  return _poptrie_insert(key, prefix_len, nexthop, prefix_len);
+  if (_poptrie_insert(&poptrie, key, prefix_len, nexthop, prefix_len))
+    return -1;
+  if (rib_insert(&poptrie.rib, key, prefix_len, nexthop)) {
+    puts ("Failed to add the route to the RIB");
+    return -1;
+  }
+  return 0;
 }
 
 //This function will be called by poptrie_insert() and by itself recursively for
 //leaf pushing. When called by poptrie_insert(), level and prefix length should
 //be same. When called recursively, level will be higher than the prefix length.
-static int _poptrie_insert(__uint128_t key, int prefix_len, int nexthop, int level) {
-  register int i, j;
+static int _poptrie_insert(struct poptrie *t, __uint128_t key, int prefix_len, int nexthop, int level) {
+  register int i, k;
   register uint32_t stride;
+  register struct poptrie_level *l;
   //Index to arrays at each level
   register uint32_t idx;
   register int err = 0;
@@ -391,263 +425,591 @@ static int _poptrie_insert(__uint128_t key, int prefix_len, int nexthop, int lev
   register uint8_t tmp_next_hop, tmp_prefix_len;
 
   if (prefix_len == 0) {
-    poptrie.def_nh = nexthop;
+    t->def_nh = nexthop;
     goto finish;
   }
 
-  /*Eextract 16 bits from MSB.*/
-  idx = key >> 112;
-  if (level <= 16) {
-    /*All the leafs in level 1~16 will be stored in level 16.*/
-    num_leafs = 1U << (16 - level);
+  /*Extract S bits from MSB.*/
+  idx = key >> (128 - POPTRIE_S);
+  if (level <= POPTRIE_S) {
+    /*All the leafs in level 1~S will be stored in the direct pointing.*/
+    num_leafs = 1U << (POPTRIE_S - level);
     for (i = 0; i < num_leafs; i++) {
       //Longer prefix exist, so move the prefix to upper level
-      if (poptrie.dir16.c[idx + i] != 0) {
-        //The pushing is performed by two insert call
-        _poptrie_insert (key, prefix_len , nexthop, 16 + 1);
-        _poptrie_insert (key | ((__uint128_t)1 <<(128 - 16 - 1)), prefix_len , nexthop, 16 + 1);
+      if (dir_ckid(&t->dir, idx + i) != 0) {
+        //The pushing is performed by two insert call under this root
+        err = _poptrie_insert (t, (__uint128_t)(idx + i) << (128 - POPTRIE_S), prefix_len , nexthop, POPTRIE_S + 1);
+        if (err) goto error;
+        err = _poptrie_insert (t, ((__uint128_t)(idx + i) << (128 - POPTRIE_S)) | ((__uint128_t)1 << (127 - POPTRIE_S)),
+                               prefix_len , nexthop, POPTRIE_S + 1);
+        if (err) goto error;
       } else {
         /*Longer prefix exists*/
-        if (poptrie.leafs16.P[idx + i] > prefix_len)
+        if (t->dir_leafs.P[idx + i] > prefix_len)
           continue;
-        poptrie.leafs16.N[idx + i] = nexthop;
-        poptrie.leafs16.P[idx + i] = prefix_len;
+        t->dir_leafs.N[idx + i] = nexthop;
+        t->dir_leafs.P[idx + i] = prefix_len;
       }
     }
     goto finish;
   }
 
-  //There is a matching prefix in level 16, leaf pushing to next level
-  if (poptrie.leafs16.N[idx]) {
-    tmp_next_hop = poptrie.leafs16.N[idx];
-    tmp_prefix_len = poptrie.leafs16.P[idx];
+  //There is a matching prefix in the direct pointing, leaf pushing to next level
+  if (t->dir_leafs.N[idx]) {
+    tmp_next_hop = t->dir_leafs.N[idx];
+    tmp_prefix_len = t->dir_leafs.P[idx];
     //set this to zero before making recursive call. Otherwise the call will come here again
-    poptrie.leafs16.N[idx] = 0;
-    poptrie.leafs16.P[idx] = 0;
-    _poptrie_insert((key >> 112) << 112, tmp_prefix_len, tmp_next_hop, 16 + 1);
-    _poptrie_insert(((key >> 112) << 112) | ((__uint128_t)1 <<(128 - 16 - 1)), tmp_prefix_len, tmp_next_hop, 16 + 1);
+    t->dir_leafs.N[idx] = 0;
+    t->dir_leafs.P[idx] = 0;
+    err = _poptrie_insert(t, (__uint128_t)idx << (128 - POPTRIE_S), tmp_prefix_len, tmp_next_hop, POPTRIE_S + 1);
+    if (err) goto error;
+    err = _poptrie_insert(t, ((__uint128_t)idx << (128 - POPTRIE_S)) | ((__uint128_t)1 << (127 - POPTRIE_S)),
+                          tmp_prefix_len, tmp_next_hop, POPTRIE_S + 1);
+    if (err) goto error;
   }
 
-  //The prefix length is longer than 16, so get index to level 16 from DIR array
-  if (poptrie.dir16.c[idx] == 0) {
+  //The prefix length is longer than S, so get index to the first level from DIR array
+  if (dir_ckid(&t->dir, idx) == 0) {
     //Calculate chunk ID from dir
-    chunk_id = calc_ckid(&poptrie.dir16, idx);
+    chunk_id = calc_ckid(&t->dir, idx);
     if (!chunk_id)
       goto error;
-    //Insert into level 16
-    err = node_insert(&poptrie.L16, chunk_id);
+    //Insert into the first level
+    err = node_insert(&t->L[0], chunk_id);
     if (err)
       goto error;
     //Update dir
-    err = update_ckid(&poptrie.dir16, idx, chunk_id);
+    err = update_ckid(&t->dir, idx, chunk_id);
     if (err)
       goto error;
   }
-  idx = poptrie.dir16.c[idx] - 1;
-
-  //Visiting level 16. Note that in Poptrie, leaf will always be in the
-  //last (leaf) level. So level 16 will contain pointer to these leaves with
-  //prefix length 17-22
-  stride = (key >> 106) & 63;
-  if (level <= 22) {
-    err = insert_leaf(&poptrie.L16, level, idx, stride, key, prefix_len, nexthop, &poptrie.leafs);
+  idx = dir_ckid(&t->dir, idx) - 1;
+
+  //Visiting the levels. Note that in Poptrie, leaf will always be in the
+  //last (leaf) level. So a level contains pointers to the leaves of the
+  //prefixes with length level_num + 1 to level_num + 6.
+  for (k = 0; k < POPTRIE_LEVELS; k++) {
+    l = &t->L[k];
+    stride = level_stride(key, l->level_num);
+    if (level <= l->level_num + 6) {
+      err = insert_leaf(t, l, level, idx, stride, key, prefix_len, nexthop, &t->leafs);
+      if (err) goto error;
+      goto finish;
+    }
+    err = leaf_pushing (t, l, idx, stride, &t->leafs, key);
     if (err) goto error;
-    goto finish;
+    idx = get_idx_to_next_level (l, idx, stride);
+    if (idx == (uint32_t)-1)
+      goto error;
   }
-  leaf_pushing (&poptrie.L16, idx, stride, &poptrie.leafs, key);
+  return 0;
 
-  //Visiting level 22. It will contain pointers to the prefixes with length 23-28
-  idx = get_idx_to_next_level (&poptrie.L16, idx, stride);
-  stride = (key >> 100) & 63;
-  if (level <= 28) {
-    err = insert_leaf(&poptrie.L22, level, idx, stride, key, prefix_len, nexthop, &poptrie.leafs);
-    if (err) goto error;
-    goto finish;
+error:
+  puts("Something went wrong in route insertion");
+  return -1;
+finish:
+  return 0;
+}
+
+#define NUM_LEVELS POPTRIE_LEVELS
+
+struct poptrie_build {
+  __uint128_t *prefixes;
+  uint8_t *pre_lens;
+  uint8_t *pre_nhs;
+  struct fragment frags[MAX_FRAGS];
+  //Each fragment is built as a separate Poptrie
+  struct poptrie tries[MAX_FRAGS];
+  //Number of nodes and leaves in each level of each fragment
+  uint32_t nodes[MAX_FRAGS][NUM_LEVELS];
+  uint32_t leaves[MAX_FRAGS][NUM_LEVELS];
+  //Where the nodes and the leaves of a fragment go in the merged Poptrie
+  uint32_t node_off[MAX_FRAGS][NUM_LEVELS + 1];
+  uint32_t leaf_off[MAX_FRAGS][NUM_LEVELS];
+  //Where the leaves of a level start in the fragment's own leaf array
+  uint32_t leaf_start[MAX_FRAGS][NUM_LEVELS];
+  uint64_t cnt;
+  struct rib rib;
+  int err;
+};
+
+static int frag_insert(void *trie, __uint128_t key, int prefix_len, int nexthop, int level)
+{
+  return _poptrie_insert((struct poptrie *)trie, key, prefix_len, nexthop, level);
+}
+
+static void build_fragment(int f, void *arg)
+{
+  struct poptrie_build *b = (struct poptrie_build *) arg;
+  struct poptrie *t = &b->tries[f];
+  struct poptrie_level *l;
+  uint32_t i, leaves;
+  uint32_t longer[NUM_LENS];
+  int k;
+
+  fragment_longer(&b->frags[f], b->pre_lens, longer);
+  if (_poptrie_init(t, longer) < 0) {
+    b->err = -1;
+    return;
   }
-  leaf_pushing (&poptrie.L22, idx, stride, &poptrie.leafs, key);
+  dir_defer(&t->dir);
+  if (insert_fragment(&b->frags[f], b->prefixes, b->pre_lens, b->pre_nhs, frag_insert, t)) {
+    b->err = -1;
+    return;
+  }
+  dir_commit(&t->dir);
+
+  for (l = &t->L[0], k = 0; l; l = l->chield, k++) {
+    leaves = 0;
+    for (i = 0; i < l->count; i++)
+      leaves += POPCNT(l->B[i].leafvec);
+    b->nodes[f][k] = l->count;
+    b->leaves[f][k] = leaves;
+  }
+}
 
-  //Visiting level 28. It will contain pointers to the prefixes with length 29-34
-  idx = get_idx_to_next_level (&poptrie.L22, idx, stride);
-  stride = (key >> 94) & 63;
-  if (level <= 34) {
-    err = insert_leaf(&poptrie.L28, level, idx, stride, key, prefix_len, nexthop, &poptrie.leafs);
-    if (err) goto error;
-    goto finish;
+static void build_rib(struct poptrie_build *b)
+{
+  if (rib_init(&b->rib, 2 * b->cnt)) {
+    b->err = -1;
+    return;
+  }
+  for (uint64_t i = 0; i < b->cnt; i++) {
+    if (rib_insert(&b->rib, b->prefixes[i], b->pre_lens[i], b->pre_nhs[i])) {
+      b->err = -1;
+      return;
+    }
   }
-  leaf_pushing (&poptrie.L28, idx, stride, &poptrie.leafs, key);
+}
 
-  //Visiting level 34
-  idx = get_idx_to_next_level (&poptrie.L28, idx, stride);
-  stride = (key >> 88) & 63;
-  if (level <= 40) {
-    err = insert_leaf(&poptrie.L34, level, idx, stride, key, prefix_len, nexthop, &poptrie.leafs);
-    if (err) goto error;
-    goto finish;
+//Task 0 fills the RIB while the other tasks build the fragments
+static void build_task(int task, void *arg)
+{
+  struct poptrie_build *b = (struct poptrie_build *) arg;
+
+  if (task)
+    build_fragment(task - 1, arg);
+  else
+    build_rib(b);
+}
+
+//Copies a fragment to the global Poptrie and shifts its bases and chunk IDs
+static void merge_fragment(int f, void *arg)
+{
+  struct poptrie_build *b = (struct poptrie_build *) arg;
+  struct poptrie *t = &b->tries[f];
+  struct poptrie_level *src, *dst;
+  uint32_t i, r, base0_shift, base1_shift;
+  int k;
+
+  //Direct pointing and its leaves are shared by all the fragments. Copy only
+  //the entries under the 16-bit roots of this fragment.
+  for (r = b->frags[f].root_lo << (POPTRIE_S - 16); r < b->frags[f].root_hi << (POPTRIE_S - 16); r++) {
+    poptrie.dir_leafs.N[r] = t->dir_leafs.N[r];
+    poptrie.dir_leafs.P[r] = t->dir_leafs.P[r];
+    if (t->dir.c[r])
+      poptrie.dir.c[r] = t->dir.c[r] + b->node_off[f][0];
   }
-  leaf_pushing (&poptrie.L34, idx, stride, &poptrie.leafs, key);
 
-  //Visiting level 40
-  idx = get_idx_to_next_level (&poptrie.L34, idx, stride);
-  stride = (key >> 82) & 63;
-  if (level <= 46) {
-    err = insert_leaf(&poptrie.L40, level, idx, stride, key, prefix_len, nexthop, &poptrie.leafs);
-    if (err) goto error;
-    goto finish;
+  for (src = &t->L[0], dst = &poptrie.L[0], k = 0; src; src = src->chield, dst = dst->chield, k++) {
+    base0_shift = b->node_off[f][k + 1];
+    base1_shift = b->leaf_off[f][k] - b->leaf_start[f][k];
+    for (i = 0; i < src->count; i++) {
+      dst->B[b->node_off[f][k] + i] = src->B[i];
+      dst->B[b->node_off[f][k] + i].base0 += base0_shift;
+      dst->B[b->node_off[f][k] + i].base1 += base1_shift;
+    }
+
+    memcpy(&poptrie.leafs.N[b->leaf_off[f][k]], &t->leafs.N[b->leaf_start[f][k]], b->leaves[f][k]);
+    memcpy(&poptrie.leafs.P[b->leaf_off[f][k]], &t->leafs.P[b->leaf_start[f][k]], b->leaves[f][k]);
   }
-  leaf_pushing (&poptrie.L40, idx, stride, &poptrie.leafs, key);
+  _poptrie_cleanup(t);
+}
 
-  //Visiting level 46
-  idx = get_idx_to_next_level (&poptrie.L40, idx, stride);
-  stride = (key >> 76) & 63;
-  if (level <= 52) {
-    err = insert_leaf(&poptrie.L46, level, idx, stride, key, prefix_len, nexthop, &poptrie.leafs);
-    if (err) goto error;
-    goto finish;
+static void cleanup_fragment(int f, void *arg)
+{
+  struct poptrie_build *b = (struct poptrie_build *) arg;
+
+  _poptrie_cleanup(&b->tries[f]);
+}
+
+//Builds the Poptrie from scratch using nthreads threads. The FIB is split into
+//fragments by the 16 MSBs, each fragment is built independently and then they
+//are concatenated level by level. This replaces poptrie_init(); the Poptrie
+//needs to be cleaned up with poptrie_cleanup() as usual.
+int poptrie_build(__uint128_t *prefixes, uint8_t *pre_lens, uint8_t *pre_nhs, uint64_t cnt, int nthreads)
+{
+  struct poptrie_build *b;
+  struct poptrie_level *l;
+  uint32_t nodes, leaves;
+  int num_frags, f, k;
+  int err = 0;
+
+  b = (struct poptrie_build *) calloc (1, sizeof(struct poptrie_build));
+  if (!b)
+    return -1;
+  b->prefixes = prefixes;
+  b->pre_lens = pre_lens;
+  b->pre_nhs = pre_nhs;
+  b->cnt = cnt;
+
+  num_frags = partition_fib(prefixes, pre_lens, cnt, num_fragments(nthreads), b->frags);
+  if (num_frags < 0) {
+    free(b);
+    return -1;
   }
-  leaf_pushing (&poptrie.L46, idx, stride, &poptrie.leafs, key);
 
-  //Visiting level 52
-  idx = get_idx_to_next_level (&poptrie.L46, idx, stride);
-  stride = (key >> 70) & 63;
-  if (level <= 58) {
-    err = insert_leaf(&poptrie.L52, level, idx, stride, key, prefix_len, nexthop, &poptrie.leafs);
-    if (err) goto error;
-    goto finish;
+  run_tasks(nthreads, num_frags + 1, build_task, b);
+  if (b->err) {
+    puts("Failed to build Poptrie fragments");
+    err = -1;
+    goto cleanup_frags;
   }
-  leaf_pushing (&poptrie.L52, idx, stride, &poptrie.leafs, key);
 
-  //Visiting level 58
-  idx = get_idx_to_next_level (&poptrie.L52, idx, stride);
-  stride = (key >> 64) & 63;
-  if (level <= 64) {
-    err = insert_leaf(&poptrie.L58, level, idx, stride, key, prefix_len, nexthop, &poptrie.leafs);
-    if (err) goto error;
-    goto finish;
+  //Prefix sum of the node and leaf counts of the fragments. The leaves are
+  //stored level by level, and within a level in the order of fragments.
+  leaves = 0;
+  for (k = 0; k < NUM_LEVELS; k++) {
+    nodes = 0;
+    for (f = 0; f < num_frags; f++) {
+      b->node_off[f][k] = nodes;
+      nodes += b->nodes[f][k];
+      b->leaf_start[f][k] = (k == 0) ? 0 : b->leaf_start[f][k - 1] + b->leaves[f][k - 1];
+      b->leaf_off[f][k] = leaves;
+      leaves += b->leaves[f][k];
+    }
   }
-  leaf_pushing (&poptrie.L58, idx, stride, &poptrie.leafs, key);
 
-  //Visiting level 64
-  idx = get_idx_to_next_level (&poptrie.L58, idx, stride);
-  stride = (key >> 58) & 63;
-  if (level <= 70) {
-    err = insert_leaf(&poptrie.L64, level, idx, stride, key, prefix_len, nexthop, &poptrie.leafs);
-    if (err) goto error;
-    goto finish;
+  if (_poptrie_init(&poptrie, NULL) < 0) {
+    err = -1;
+    goto cleanup_frags;
   }
-  leaf_pushing (&poptrie.L64, idx, stride, &poptrie.leafs, key);
+  poptrie.def_nh = find_default_route(pre_lens, pre_nhs, cnt);
 
-  //Visiting level 70
-  idx = get_idx_to_next_level (&poptrie.L64, idx, stride);
-  stride = (key >> 52) & 63;
-  if (level <= 76) {
-    err = insert_leaf(&poptrie.L70, level, idx, stride, key, prefix_len, nexthop, &poptrie.leafs);
-    if (err) goto error;
-    goto finish;
+  for (l = &poptrie.L[0], k = 0; l; l = l->chield, k++) {
+    l->count = b->node_off[num_frags - 1][k] + b->nodes[num_frags - 1][k];
+    if (l->count > l->size) {
+      printf("Cannot insert chunk in level %d . Please increase the level size\n", l->level_num);
+      err = -1;
+    }
+  }
+  //Chunk ID in direct pointing is 16 bits unless s > 16
+  if (poptrie.L[0].count > (ckid_t)-1) {
+    puts("Too many nodes in the first level");
+    err = -1;
+  }
+  poptrie.leafs.count = leaves;
+  if (leaves >= poptrie.leafs.size) {
+    puts ("Leaf array is full. Please increase the size.");
+    err = -1;
+  }
+  if (err) {
+    _poptrie_cleanup(&poptrie);
+    goto cleanup_frags;
   }
-  leaf_pushing (&poptrie.L70, idx, stride, &poptrie.leafs, key);
 
-  //Visiting level 76
-  idx = get_idx_to_next_level (&poptrie.L70, idx, stride);
-  stride = (key >> 46) & 63;
-  if (level <= 82) {
-    err = insert_leaf(&poptrie.L76, level, idx, stride, key, prefix_len, nexthop, &poptrie.leafs);
-    if (err) goto error;
-    goto finish;
+  poptrie.rib = b->rib;
+  run_tasks(nthreads, num_frags, merge_fragment, b);
+  dir_sync(&poptrie.dir);
+  free_partition(b->frags, num_frags);
+  free(b);
+  return 0;
+
+cleanup_frags:
+  rib_cleanup(&b->rib);
+  run_tasks(nthreads, num_frags, cleanup_fragment, b);
+  free_partition(b->frags, num_frags);
+  free(b);
+  return err;
+}
+
+/*Calculating index to the next level*/
+#define IDX_NXT(NODE, STRIDE) (NODE->base0 + POPCNT(NODE->vec & \
+                              ((2ULL << STRIDE) - 1)) - 1)
+
+//Removes the leaves of the slots in mask from a node. The leaves of a node are
+//contiguous, so they are compacted in place and the rest of the leaf array is
+//shifted left only once.
+static void remove_leaves(struct poptrie *t, struct poptrie_level *l, uint32_t idx, uint64_t mask)
+{
+  register struct poptrie_node *node = &l->B[idx];
+  register struct leaf *leafs = &t->leafs;
+  register struct poptrie_level *runner;
+  register uint32_t removed = POPCNT(node->leafvec & mask);
+  register uint32_t end = node->base1 + POPCNT(node->leafvec);
+  register uint32_t j = node->base1, k = node->base1;
+  register uint64_t bits;
+  register long long i;
+
+  if (!removed)
+    return;
+
+  for (bits = node->leafvec; bits; bits &= bits - 1, k++) {
+    if (mask & bits & -bits)
+      continue;
+    leafs->N[j] = leafs->N[k];
+    leafs->P[j] = leafs->P[k];
+    j++;
   }
-  leaf_pushing (&poptrie.L76, idx, stride, &poptrie.leafs, key);
+  memmove(&leafs->N[j], &leafs->N[end], (leafs->count - end) * sizeof(leafs->N[0]));
+  memmove(&leafs->P[j], &leafs->P[end], (leafs->count - end) * sizeof(leafs->P[0]));
 
-  //Visiting level 82
-  idx = get_idx_to_next_level (&poptrie.L76, idx, stride);
-  stride = (key >> 40) & 63;
-  if (level <= 88) {
-    err = insert_leaf(&poptrie.L82, level, idx, stride, key, prefix_len, nexthop, &poptrie.leafs);
-    if (err) goto error;
-    goto finish;
+  //reset the freed elements
+  leafs->count -= removed;
+  memset(&leafs->N[leafs->count], 0, removed * sizeof(leafs->N[0]));
+  memset(&leafs->P[leafs->count], 0, removed * sizeof(leafs->P[0]));
+  node->leafvec &= ~mask;
+
+  //Update base1 of following chunks
+  for (i = idx + 1; i < l->count; i++) {
+    if (l->B[i].leafvec)
+      l->B[i].base1 -= removed;
   }
-  leaf_pushing (&poptrie.L82, idx, stride, &poptrie.leafs, key);
 
-  //Visiting level 88
-  idx = get_idx_to_next_level (&poptrie.L82, idx, stride);
-  stride = (key >> 34) & 63;
-  if (level <= 94) {
-    err = insert_leaf(&poptrie.L88, level, idx, stride, key, prefix_len, nexthop, &poptrie.leafs);
-    if (err) goto error;
-    goto finish;
+  //Update base1 of children
+  runner = l->chield;
+  while (runner) {
+    for (i = 0; i < runner->count; i++) {
+      if (runner->B[i].leafvec)
+        runner->B[i].base1 -= removed;
+    }
+    runner = runner->chield;
   }
-  leaf_pushing (&poptrie.L88, idx, stride, &poptrie.leafs, key);
+}
 
-  //Visiting level 94
-  idx = get_idx_to_next_level (&poptrie.L88, idx, stride);
-  stride = (key >> 28) & 63;
-  if (level <= 100) {
-    err = insert_leaf(&poptrie.L94, level, idx, stride, key, prefix_len, nexthop, &poptrie.leafs);
-    if (err) goto error;
-    goto finish;
+//Adds a single leaf to an empty slot of a node
+static void add_leaf(struct poptrie *t, struct poptrie_level *l, uint32_t idx, uint32_t stride,
+                     uint8_t nexthop, uint8_t prefix_len)
+{
+  register struct poptrie_level *runner;
+  register uint32_t n_idx;
+  register long long i;
+
+  n_idx = calc_n_idx(l, idx, stride);
+  l->B[idx].leafvec |= (1ULL << stride);
+  l->B[idx].base1 = calc_base1(l, idx);
+
+  //Update base1 of following chunks
+  for (i = idx + 1; i < l->count; i++) {
+    if (l->B[i].leafvec)
+      l->B[i].base1++;
   }
-  leaf_pushing (&poptrie.L94, idx, stride, &poptrie.leafs, key);
 
-  //Visiting level 100
-  idx = get_idx_to_next_level (&poptrie.L94, idx, stride);
-  stride = (key >> 22) & 63;
-  if (level <= 106) {
-    err = insert_leaf(&poptrie.L100, level, idx, stride, key, prefix_len, nexthop, &poptrie.leafs);
-    if (err) goto error;
-    goto finish;
+  //Update base1 of children
+  runner = l->chield;
+  while (runner) {
+    for (i = 0; i < runner->count; i++) {
+      if (runner->B[i].leafvec)
+        runner->B[i].base1++;
+    }
+    runner = runner->chield;
   }
-  leaf_pushing (&poptrie.L100, idx, stride, &poptrie.leafs, key);
 
-  //Visiting level 106
-  idx = get_idx_to_next_level (&poptrie.L100, idx, stride);
-  stride = (key >> 16) & 63;
-  if (level <= 112) {
-    err = insert_leaf(&poptrie.L106, level, idx, stride, key, prefix_len, nexthop, &poptrie.leafs);
-    if (err) goto error;
-    goto finish;
+  leaf_insert(&t->leafs, n_idx, nexthop, prefix_len);
+}
+
+//Removes a node that has neither children nor leaves. For the first level parent_idx
+//is the index to the direct pointing, otherwise it's the parent node whose bit
+//at stride is turned off.
+static void remove_node(struct poptrie *t, struct poptrie_level *l, uint32_t idx,
+                        uint32_t parent_idx, uint32_t stride)
+{
+  register struct poptrie_level *parent = l->parent;
+  register long long i;
+
+  //shift each element one step left
+  memmove(&l->B[idx], &l->B[idx + 1], (l->count - idx - 1) * sizeof(struct poptrie_node));
+  l->count--;
+  memset(&l->B[l->count], 0, sizeof(struct poptrie_node));
+
+  if (!parent) {
+    remove_ckid(&t->dir, parent_idx);
+    return;
   }
-  leaf_pushing (&poptrie.L106, idx, stride, &poptrie.leafs, key);
 
-  //Visiting level 112
-  idx = get_idx_to_next_level (&poptrie.L106, idx, stride);
-  stride = (key >> 10) & 63;
-  if (level <= 118) {
-    err = insert_leaf(&poptrie.L112, level, idx, stride, key, prefix_len, nexthop, &poptrie.leafs);
-    if (err) goto error;
-    goto finish;
+  parent->B[parent_idx].vec &= ~(1ULL << stride);
+  //Update offset of the chunks to the right
+  for (i = (long long)parent_idx + 1; i < parent->count; i++) {
+    if (parent->B[i].vec)
+      parent->B[i].base0--;
   }
-  leaf_pushing (&poptrie.L112, idx, stride, &poptrie.leafs, key);
+}
 
-  //Visiting level 118
-  idx = get_idx_to_next_level (&poptrie.L112, idx, stride);
-  stride = (key >> 4) & 63;
-  if (level <= 124) {
-    err = insert_leaf(&poptrie.L118, level, idx, stride, key, prefix_len, nexthop, &poptrie.leafs);
-    if (err) goto error;
-    goto finish;
+//A node can be merged into the slot of its parent if it has no children and
+//all of its 64 leaves have been pushed from a single prefix that is not longer
+//than the slot. This undoes the leaf pushing.
+static int leaves_mergeable(struct poptrie *t, struct poptrie_node *node, int slot_len,
+                            uint8_t *nexthop, uint8_t *prefix_len)
+{
+  register uint32_t i, n_idx = node->base1;
+
+  if (node->vec || node->leafvec != ~0ULL)
+    return 0;
+  *nexthop = t->leafs.N[n_idx];
+  *prefix_len = t->leafs.P[n_idx];
+  if (*prefix_len > slot_len)
+    return 0;
+  for (i = 1; i < 64; i++) {
+    if (t->leafs.N[n_idx + i] != *nexthop || t->leafs.P[n_idx + i] != *prefix_len)
+      return 0;
   }
-  leaf_pushing (&poptrie.L118, idx, stride, &poptrie.leafs, key);
+  return 1;
+}
 
-  //Visiting level 124
-  idx = get_idx_to_next_level (&poptrie.L118, idx, stride);
-  stride = (key & 15) << 2;
-  if (level <= 130) {
-    err = insert_leaf(&poptrie.L124, level, idx, stride, key, prefix_len, nexthop, &poptrie.leafs);
-    if (err) goto error;
-    goto finish;
+//Removes the child at stride if it became empty, or turns it back into a
+//single leaf if possible.
+static void merge_child(struct poptrie *t, struct poptrie_level *l, uint32_t idx, uint32_t stride)
+{
+  register struct poptrie_node *node = &l->B[idx];
+  register uint32_t c_idx;
+  register int has_leaves;
+  uint8_t nexthop, prefix_len;
+
+  if (!(node->vec & (1ULL << stride)))
+    return;
+  c_idx = IDX_NXT(node, stride);
+  if (l->chield->B[c_idx].vec)
+    return;
+
+  has_leaves = l->chield->B[c_idx].leafvec != 0;
+  if (has_leaves) {
+    if (!leaves_mergeable(t, &l->chield->B[c_idx], l->level_num + 6, &nexthop, &prefix_len))
+      return;
+    remove_leaves(t, l->chield, c_idx, ~0ULL);
   }
-  return 0;
+  remove_node(t, l->chield, c_idx, idx, stride);
+  if (has_leaves)
+    add_leaf(t, l, idx, stride, nexthop, prefix_len);
+}
 
-error:
-  puts("Something went wrong in route insertion");
-  return -1;
-finish:
-//  leaf_print (&poptrie.leafs);
-//  poptrie_level_print (&poptrie.L40);
+//Same as merge_child() for the node of a root in the first level
+static void merge_root(struct poptrie *t, uint32_t root)
+{
+  register uint32_t c_idx;
+  register int has_leaves;
+  uint8_t nexthop, prefix_len;
+
+  if (!dir_ckid(&t->dir, root))
+    return;
+  c_idx = dir_ckid(&t->dir, root) - 1;
+  if (t->L[0].B[c_idx].vec)
+    return;
+
+  has_leaves = t->L[0].B[c_idx].leafvec != 0;
+  if (has_leaves) {
+    if (!leaves_mergeable(t, &t->L[0].B[c_idx], POPTRIE_S, &nexthop, &prefix_len))
+      return;
+    remove_leaves(t, &t->L[0], c_idx, ~0ULL);
+  }
+  remove_node(t, &t->L[0], c_idx, root, 0);
+  if (has_leaves) {
+    t->dir_leafs.N[root] = nexthop;
+    t->dir_leafs.P[root] = prefix_len;
+  }
+}
+
+//Goes through the slots [stride, stride + num) of a node and the subtrees below
+//them. The leaves of the deleted prefix get the next-hop and the length of the
+//covering prefix, or are removed if there is no covering prefix. Then the
+//children that became empty or uniform are merged.
+static void delete_leaves(struct poptrie *t, struct poptrie_level *l, uint32_t idx, uint32_t stride,
+                          uint32_t num, int prefix_len, uint8_t nexthop, uint8_t cover_len)
+{
+  register struct poptrie_node *node = &l->B[idx];
+  register uint32_t bit_spot, n_idx;
+  register uint64_t removed = 0;
+
+  for (bit_spot = stride; bit_spot < stride + num; bit_spot++) {
+    if (node->vec & (1ULL << bit_spot)) {
+      delete_leaves(t, l->chield, IDX_NXT(node, bit_spot), 0, 64, prefix_len, nexthop, cover_len);
+      merge_child(t, l, idx, bit_spot);
+    } else if (node->leafvec & (1ULL << bit_spot)) {
+      n_idx = calc_n_idx(l, idx, bit_spot);
+      //Longer prefix exists
+      if (t->leafs.P[n_idx] != prefix_len)
+        continue;
+      if (nexthop) {
+        t->leafs.N[n_idx] = nexthop;
+        t->leafs.P[n_idx] = cover_len;
+      } else {
+        removed |= (1ULL << bit_spot);
+      }
+    }
+  }
+  remove_leaves(t, l, idx, removed);
+}
+
+static int _poptrie_delete(struct poptrie *t, __uint128_t key, int prefix_len,
+                           uint8_t nexthop, uint8_t cover_len)
+{
+  register struct poptrie_level *l;
+  register uint32_t i, num, stride, root;
+  //Node and stride at each level on the way to the prefix
+  uint32_t path_idx[NUM_LEVELS], path_stride[NUM_LEVELS];
+  register int k;
+
+  root = key >> (128 - POPTRIE_S);
+  if (prefix_len <= POPTRIE_S) {
+    num = 1U << (POPTRIE_S - prefix_len);
+    for (i = root; i < root + num; i++) {
+      if (dir_ckid(&t->dir, i)) {
+        delete_leaves(t, &t->L[0], dir_ckid(&t->dir, i) - 1, 0, 64, prefix_len, nexthop, cover_len);
+        merge_root(t, i);
+      } else if (t->dir_leafs.P[i] == prefix_len) {
+        t->dir_leafs.N[i] = nexthop;
+        t->dir_leafs.P[i] = cover_len;
+      }
+    }
+    return 0;
+  }
+
+  //The prefix was never inserted into the trie, e.g. the level was full
+  if (!dir_ckid(&t->dir, root))
+    return 0;
+
+  //Walk down to the node holding the leaves of the prefix
+  l = &t->L[0];
+  path_idx[0] = dir_ckid(&t->dir, root) - 1;
+  for (k = 0; ; k++) {
+    stride = level_stride(key, l->level_num);
+    if (prefix_len <= l->level_num + 6)
+      break;
+    if (!(l->B[path_idx[k]].vec & (1ULL << stride)))
+      return 0;
+    path_stride[k] = stride;
+    path_idx[k + 1] = IDX_NXT((&l->B[path_idx[k]]), stride);
+    l = l->chield;
+  }
+
+  delete_leaves(t, l, path_idx[k], stride, 1U << (l->level_num + 6 - prefix_len),
+                prefix_len, nexthop, cover_len);
+
+  //The nodes on the way may have become empty too
+  while (k-- > 0) {
+    l = l->parent;
+    merge_child(t, l, path_idx[k], path_stride[k]);
+  }
+  merge_root(t, root);
   return 0;
 }
 
-/*Calculating index to the next level*/
-#define IDX_NXT(NODE, STRIDE) (NODE->base0 + POPCNT(NODE->vec & \
-                              ((2ULL << STRIDE) - 1)) - 1)
+//Withdraws a route. The leaves of the prefix are restored from the longest
+//shorter prefix covering it, found in the RIB, and the nodes that are no
+//longer needed are merged back. Returns -1 if the route doesn't exist.
+int poptrie_delete(__uint128_t key, int prefix_len) {
+  int nexthop, cover_len;
+
+  if (!rib_delete(&poptrie.rib, key, prefix_len))
+    return -1;
+  compact_free(&poptrie);
+  if (prefix_len == 0) {
+    poptrie.def_nh = 0;
+    return 0;
+  }
+  key &= ~(__uint128_t)0 << (128 - prefix_len);
+  nexthop = rib_parent(&poptrie.rib, key, prefix_len, &cover_len);
+  return _poptrie_delete(&poptrie, key, prefix_len, nexthop, cover_len);
+}
 
 uint8_t poptrie_lookup(__uint128_t key) {
   register uint32_t n_idx;
@@ -655,247 +1017,331 @@ uint8_t poptrie_lookup(__uint128_t key) {
   register uint32_t idx;
   register struct poptrie_node *node;
   register uint8_t nh = poptrie.def_nh;
+  register int k;
 
-  idx = key >> 112;
-  if (poptrie.leafs16.N[idx]) {
-    return poptrie.leafs16.N[idx];
+  idx = key >> (128 - POPTRIE_S);
+  if (poptrie.dir_leafs.N[idx]) {
+    return poptrie.dir_leafs.N[idx];
   }
 
-  idx = poptrie.dir16.c[idx];
+  idx = poptrie.dir.c[idx];
   if (!idx)
     return nh;
-  node = &poptrie.L16.B[idx - 1];
-  stride = (key >> 106) & 63;
-  if (node->vec & (1ULL << stride)) {
+  node = &poptrie.L[0].B[idx - 1];
+  stride = level_stride(key, POPTRIE_S);
+  //Fully unrolled, so the level and the shifts are constants in each step
+#pragma GCC unroll 32
+  for (k = 1; k < POPTRIE_LEVELS; k++) {
+    if (!(node->vec & (1ULL << stride)))
+      break;
     idx = IDX_NXT(node, stride);
-    node = &poptrie.L22.B[idx];
-    stride = (key >> 100) & 63;
-    if (node->vec & (1ULL << stride)) {
-      idx = idx = IDX_NXT(node, stride);
-      node = &poptrie.L28.B[idx];
-      stride = ((key >> 94) & 63);
-      if (node->vec & (1ULL << stride)) {
-        idx = idx = IDX_NXT(node, stride);
-        node = &poptrie.L34.B[idx];
-        stride = ((key >> 88) & 63);
-        if (node->vec & (1ULL << stride)) {
-          idx = idx = IDX_NXT(node, stride);
-          node = &poptrie.L40.B[idx];
-          stride = ((key >> 82) & 63);
-          if (node->vec & (1ULL << stride)) {
-            idx = IDX_NXT(node, stride);
-            node = &poptrie.L46.B[idx];
-            stride = ((key >> 76) & 63);
-            if (node->vec & (1ULL << stride)) {
-              idx = IDX_NXT(node, stride);
-              node = &poptrie.L52.B[idx];
-              stride = ((key >> 70) & 63);
-              if (node->vec & (1ULL << stride)) {
-                idx = IDX_NXT(node, stride);
-                node = &poptrie.L58.B[idx];
-                stride = ((key >> 64) & 63);
-                if (node->vec & (1ULL << stride)) {
-                  idx = IDX_NXT(node, stride);
-                  node = &poptrie.L64.B[idx];
-                  stride = ((key >> 58) & 63);
-                  if (node->vec & (1ULL << stride)) {
-                    idx = IDX_NXT(node, stride);
-                    node = &poptrie.L70.B[idx];
-                    stride = ((key >> 52) & 63);
-                    if (node->vec & (1ULL << stride)) {
-                      idx = IDX_NXT(node, stride);
-                      node = &poptrie.L76.B[idx];
-                      stride = ((key >> 46) & 63);
-                      if (node->vec & (1ULL << stride)) {
-                        idx = IDX_NXT(node, stride);
-                        node = &poptrie.L82.B[idx];
-                        stride = ((key >> 40) & 63);
-                        if (node->vec & (1ULL << stride)) {
-                          idx = IDX_NXT(node, stride);
-                          node = &poptrie.L88.B[idx];
-                          stride = ((key >> 34) & 63);
-                          if (node->vec & (1ULL << stride)) {
-                            idx = IDX_NXT(node, stride);
-                            node = &poptrie.L94.B[idx];
-                            stride = ((key >> 28) & 63);
-                            if (node->vec & (1ULL << stride)) {
-                              idx = IDX_NXT(node, stride);
-                              node = &poptrie.L100.B[idx];
-                              stride = ((key >> 22) & 63);
-                              if (node->vec & (1ULL << stride)) {
-                                idx = IDX_NXT(node, stride);
-                                node = &poptrie.L106.B[idx];
-                                stride = ((key >> 16) & 63);
-                                if (node->vec & (1ULL << stride)) {
-                                  idx = IDX_NXT(node, stride);
-                                  node = &poptrie.L112.B[idx];
-                                  stride = ((key >> 10) & 63);
-                                  if (node->vec & (1ULL << stride)) {
-                                    idx = IDX_NXT(node, stride);
-                                    node = &poptrie.L118.B[idx];
-                                    stride = ((key >> 4) & 63);
-                                    if (node->vec & (1ULL << stride)) {
-                                      idx = IDX_NXT(node, stride);
-                                      node = &poptrie.L124.B[idx];
-                                      stride = (key & 15) << 2;
-                                    }
-                                  }
-                                }
-                              }
-                            }
-                          }
-                        }
-                      }
-                    }
-                  }
-                }
-              }
-            }
-          }
+    node = &poptrie.L[k].B[idx];
+    stride = level_stride(key, POPTRIE_S + 6 * k);
+  }
+  if (node->leafvec & (1ULL << stride)) {
+    n_idx = node->base1 + POPCNT(node->leafvec & ((2ULL << stride) - 1)) - 1;
+    nh = poptrie.leafs.N[n_idx];
+  }
+
+  return nh;
+}
+
+//Same as poptrie_lookup() except that the key is given as two 64-bit halves.
+//Most of the prefixes are not longer than 64, so the lookup runs on the upper
+//half with 64-bit arithmetic. The lower half is used only if the match is
+//longer than 64 bits.
+uint8_t poptrie_lookup64(uint64_t key_hi, uint64_t key_lo) {
+  register uint32_t n_idx;
+  register uint32_t stride;
+  register uint32_t idx;
+  register struct poptrie_node *node;
+  register uint8_t nh = poptrie.def_nh;
+  register int k;
+
+  idx = key_hi >> (64 - POPTRIE_S);
+  if (poptrie.dir_leafs.N[idx]) {
+    return poptrie.dir_leafs.N[idx];
+  }
+
+  idx = poptrie.dir.c[idx];
+  if (!idx)
+    return nh;
+  node = &poptrie.L[0].B[idx - 1];
+  stride = level_stride64(key_hi, key_lo, POPTRIE_S);
+#pragma GCC unroll 32
+  for (k = 1; k < POPTRIE_LEVELS; k++) {
+    if (!(node->vec & (1ULL << stride)))
+      break;
+    idx = IDX_NXT(node, stride);
+    node = &poptrie.L[k].B[idx];
+    stride = level_stride64(key_hi, key_lo, POPTRIE_S + 6 * k);
+  }
+  if (node->leafvec & (1ULL << stride)) {
+    n_idx = node->base1 + POPCNT(node->leafvec & ((2ULL << stride) - 1)) - 1;
+    nh = poptrie.leafs.N[n_idx];
+  }
+
+  return nh;
+}
+
+//Node idx of a compact level
+#define CNODE(C, IDX) (&(C)->B[(IDX) / POPTRIE_CNODES].n[(IDX) % POPTRIE_CNODES])
+
+//Makes the compact copy of the levels, which only poptrie_lookup_compact()
+//reads. Returns -1 if an offset doesn't fit in 16 bits, in which case only
+//the regular layout can be used.
+int poptrie_compact() {
+  register struct poptrie_level *l;
+  register struct poptrie_clevel *c;
+  register struct poptrie_cnode *node;
+  register uint32_t i, blk, nblks, lines;
+  int has_base0, has_base1;
+  int k;
+
+  compact_free(&poptrie);
+  for (k = 0; k < POPTRIE_LEVELS; k++) {
+    l = &poptrie.L[k];
+    c = &poptrie.C[k];
+    nblks = (l->count >> POPTRIE_CBLOCK_BITS) + 1;
+    lines = l->count / POPTRIE_CNODES + 1;
+    if (posix_memalign((void **)&c->B, sizeof(struct poptrie_cline), lines * sizeof(struct poptrie_cline)))
+      c->B = NULL;
+    c->base0 = (uint32_t *) calloc (nblks, sizeof(uint32_t));
+    c->base1 = (uint32_t *) calloc (nblks, sizeof(uint32_t));
+    if (!c->B || !c->base0 || !c->base1) {
+      puts("Failed to allocate memory for compact Poptrie");
+      goto error;
+    }
+    memset(c->B, 0, lines * sizeof(struct poptrie_cline));
+    c->count = l->count;
+
+    for (i = 0; i < l->count; i++) {
+      blk = i >> POPTRIE_CBLOCK_BITS;
+      node = CNODE(c, i);
+      //base0 (base1) is valid only if the node has children (leaves). The
+      //first such node of a block sets the base of the block.
+      if (!(i & ((1U << POPTRIE_CBLOCK_BITS) - 1)))
+        has_base0 = has_base1 = 0;
+      node->vec = l->B[i].vec;
+      node->leafvec = l->B[i].leafvec;
+      if (l->B[i].vec) {
+        if (!has_base0) {
+          c->base0[blk] = l->B[i].base0;
+          has_base0 = 1;
+        }
+        if (l->B[i].base0 - c->base0[blk] > UINT16_MAX)
+          goto error;
+        node->base0 = l->B[i].base0 - c->base0[blk];
+      }
+      if (l->B[i].leafvec) {
+        if (!has_base1) {
+          c->base1[blk] = l->B[i].base1;
+          has_base1 = 1;
         }
+        if (l->B[i].base1 - c->base1[blk] > UINT16_MAX)
+          goto error;
+        node->base1 = l->B[i].base1 - c->base1[blk];
       }
     }
   }
+  poptrie.compact = 1;
+  return 0;
+
+error:
+  compact_free(&poptrie);
+  return -1;
+}
+
+//Calculate memory of the compact layout in MB
+double calc_poptrie_compact_mem() {
+  double mem = mem_size(&poptrie.dir_leafs) + mem_size(&poptrie.leafs) + mem_size(&poptrie.dir);
+
+  for (int k = 0; k < POPTRIE_LEVELS; k++) {
+    mem += (poptrie.C[k].count + POPTRIE_CNODES - 1) / POPTRIE_CNODES * sizeof(struct poptrie_cline);
+    mem += ((poptrie.C[k].count >> POPTRIE_CBLOCK_BITS) + 1) * 2 * sizeof(uint32_t);
+  }
+  return mem / (1024 * 1024);
+}
+
+//Same as poptrie_lookup() on the compact layout, which must have been made
+//by poptrie_compact() after the last update. The base of the block of a node
+//is added to its bases. The blocks are few, so they stay in the cache.
+uint8_t poptrie_lookup_compact(__uint128_t key) {
+  register uint32_t n_idx;
+  register uint32_t stride;
+  register uint32_t idx;
+  register struct poptrie_cnode *node;
+  register uint8_t nh = poptrie.def_nh;
+  register int k;
+
+  idx = key >> (128 - POPTRIE_S);
+  if (poptrie.dir_leafs.N[idx]) {
+    return poptrie.dir_leafs.N[idx];
+  }
+
+  idx = poptrie.dir.c[idx];
+  if (!idx)
+    return nh;
+  idx--;
+  node = CNODE(&poptrie.C[0], idx);
+  stride = level_stride(key, POPTRIE_S);
+#pragma GCC unroll 32
+  for (k = 1; k < POPTRIE_LEVELS; k++) {
+    if (!(node->vec & (1ULL << stride)))
+      break;
+    idx = poptrie.C[k - 1].base0[idx >> POPTRIE_CBLOCK_BITS] + IDX_NXT(node, stride);
+    node = CNODE(&poptrie.C[k], idx);
+    stride = level_stride(key, POPTRIE_S + 6 * k);
+  }
   if (node->leafvec & (1ULL << stride)) {
-    n_idx = node->base1 + POPCNT(node->leafvec & ((2ULL << stride) - 1)) - 1;
+    n_idx = poptrie.C[k - 1].base1[idx >> POPTRIE_CBLOCK_BITS] + node->base1 +
+            POPCNT(node->leafvec & ((2ULL << stride) - 1)) - 1;
     nh = poptrie.leafs.N[n_idx];
   }
 
   return nh;
 }
 
+//Where a lookup of poptrie_lookup_batch() is suspended
+enum amac_stage {AMAC_NODE, AMAC_LEAF, AMAC_DONE};
+
+struct amac_state {
+  __uint128_t key;
+  struct poptrie_node *node;
+  //Index of the key in the batch
+  uint64_t pos;
+  uint32_t n_idx;
+  int level;
+  int stage;
+};
+
+//Starts the lookups of the following keys in a slot until one of them needs
+//a node. The direct pointing is small enough to stay in the cache, so the
+//lookups ending there are done right away without a context switch.
+static __inline__ uint64_t amac_start(struct amac_state *s, const __uint128_t *keys, uint8_t *nhs,
+                                      uint64_t next, uint64_t cnt)
+{
+  register uint32_t idx;
+
+  for (; next < cnt; next++) {
+    idx = keys[next] >> (128 - POPTRIE_S);
+    if (poptrie.dir_leafs.N[idx]) {
+      nhs[next] = poptrie.dir_leafs.N[idx];
+      continue;
+    }
+    idx = poptrie.dir.c[idx];
+    if (!idx) {
+      nhs[next] = poptrie.def_nh;
+      continue;
+    }
+    s->key = keys[next];
+    s->pos = next;
+    s->node = &poptrie.L[0].B[idx - 1];
+    s->level = 0;
+    s->stage = AMAC_NODE;
+    __builtin_prefetch(s->node);
+    return next + 1;
+  }
+  s->stage = AMAC_DONE;
+  return next;
+}
+
+//Looks up cnt keys with up to width lookups in flight (asynchronous memory
+//access chaining). Each lookup is a small state machine. A lookup issues a
+//prefetch for the next node or leaf and yields to the next lookup instead of
+//waiting for it. By the time it comes back around, the line is hopefully in
+//the cache, so the cache misses of different keys overlap. The next-hops
+//are stored in nhs in the order of the keys.
+void poptrie_lookup_batch(const __uint128_t *keys, uint8_t *nhs, uint64_t cnt, int width)
+{
+  struct amac_state st[POPTRIE_MAX_BATCH];
+  struct poptrie_node *B[NUM_LEVELS];
+  register struct amac_state *s;
+  register struct poptrie_node *node;
+  register uint32_t stride;
+  register uint64_t next = 0;
+  register int i, active = 0;
+
+  if (width < 1)
+    width = 1;
+  if (width > POPTRIE_MAX_BATCH)
+    width = POPTRIE_MAX_BATCH;
+  for (i = 0; i < NUM_LEVELS; i++)
+    B[i] = poptrie.L[i].B;
+
+  for (i = 0; i < width; i++) {
+    next = amac_start(&st[i], keys, nhs, next, cnt);
+    if (st[i].stage != AMAC_DONE)
+      active++;
+  }
+
+  i = 0;
+  while (active) {
+    s = &st[i];
+    switch (s->stage) {
+    case AMAC_NODE:
+      node = s->node;
+      stride = level_stride(s->key, POPTRIE_S + 6 * s->level);
+      if (node->vec & (1ULL << stride)) {
+        s->node = &B[++s->level][IDX_NXT(node, stride)];
+        __builtin_prefetch(s->node);
+        break;
+      }
+      if (!(node->leafvec & (1ULL << stride))) {
+        nhs[s->pos] = poptrie.def_nh;
+        goto finish;
+      }
+      s->n_idx = node->base1 + POPCNT(node->leafvec & ((2ULL << stride) - 1)) - 1;
+      s->stage = AMAC_LEAF;
+      __builtin_prefetch(&poptrie.leafs.N[s->n_idx]);
+      break;
+    case AMAC_LEAF:
+      nhs[s->pos] = poptrie.leafs.N[s->n_idx];
+      goto finish;
+    default:
+      break;
+    }
+    goto next_state;
+
+finish:
+    //Start the next key in place of the finished one
+    next = amac_start(s, keys, nhs, next, cnt);
+    if (s->stage == AMAC_DONE)
+      active--;
+next_state:
+    if (++i == width)
+      i = 0;
+  }
+}
 //This is same as FIB lookup, except it returns matched prefix length instead
 //of next-hop index
 uint8_t poptrie_matched_prefix_len(__uint128_t key) {
-  register uint32_t n_idx;
   register uint32_t stride;
   register uint32_t idx;
   register struct poptrie_node *node;
-  register uint8_t nh = poptrie.def_nh;
   int k;
 
-  idx = key >> 112;
-  if (poptrie.leafs16.N[idx]) {
-    return 16;
+  idx = key >> (128 - POPTRIE_S);
+  if (poptrie.dir_leafs.N[idx]) {
+    return POPTRIE_S;
   }
 
-  idx = poptrie.dir16.c[idx];
+  idx = poptrie.dir.c[idx];
   if (!idx) {
-    return 16;
+    return POPTRIE_S;
   }
-  node = &poptrie.L16.B[idx - 1];
-  stride = (key >> 106) & 63;
-  k = 22;
-  if (node->vec & (1ULL << stride)) {
-    k = 28;
+  node = &poptrie.L[0].B[idx - 1];
+  stride = level_stride(key, POPTRIE_S);
+  for (k = 1; k < POPTRIE_LEVELS; k++) {
+    if (!(node->vec & (1ULL << stride)))
+      break;
     idx = IDX_NXT(node, stride);
-    node = &poptrie.L22.B[idx];
-    stride = (key >> 100) & 63;
-    if (node->vec & (1ULL << stride)) {
-      k = 34;
-      idx = idx = IDX_NXT(node, stride);
-      node = &poptrie.L28.B[idx];
-      stride = ((key >> 94) & 63);
-      if (node->vec & (1ULL << stride)) {
-        k = 40;
-        idx = idx = IDX_NXT(node, stride);
-        node = &poptrie.L34.B[idx];
-        stride = ((key >> 88) & 63);
-        if (node->vec & (1ULL << stride)) {
-          k = 46;
-          idx = idx = IDX_NXT(node, stride);
-          node = &poptrie.L40.B[idx];
-          stride = ((key >> 82) & 63);
-          if (node->vec & (1ULL << stride)) {
-            k = 52;
-            idx = IDX_NXT(node, stride);
-            node = &poptrie.L46.B[idx];
-            stride = ((key >> 76) & 63);
-            if (node->vec & (1ULL << stride)) {
-              k = 58;
-              idx = IDX_NXT(node, stride);
-              node = &poptrie.L52.B[idx];
-              stride = ((key >> 70) & 63);
-              if (node->vec & (1ULL << stride)) {
-                k = 64;
-                idx = IDX_NXT(node, stride);
-                node = &poptrie.L58.B[idx];
-                stride = ((key >> 64) & 63);
-                if (node->vec & (1ULL << stride)) {
-                  k = 70;
-                  idx = IDX_NXT(node, stride);
-                  node = &poptrie.L64.B[idx];
-                  stride = ((key >> 58) & 63);
-                  if (node->vec & (1ULL << stride)) {
-                    k = 76;
-                    idx = IDX_NXT(node, stride);
-                    node = &poptrie.L70.B[idx];
-                    stride = ((key >> 52) & 63);
-                    if (node->vec & (1ULL << stride)) {
-                      k = 82;
-                      idx = IDX_NXT(node, stride);
-                      node = &poptrie.L76.B[idx];
-                      stride = ((key >> 46) & 63);
-                      if (node->vec & (1ULL << stride)) {
-                        k = 88;
-                        idx = IDX_NXT(node, stride);
-                        node = &poptrie.L82.B[idx];
-                        stride = ((key >> 40) & 63);
-                        if (node->vec & (1ULL << stride)) {
-                          k = 94;
-                          idx = IDX_NXT(node, stride);
-                          node = &poptrie.L88.B[idx];
-                          stride = ((key >> 34) & 63);
-                          if (node->vec & (1ULL << stride)) {
-                            k = 100;
-                            idx = IDX_NXT(node, stride);
-                            node = &poptrie.L94.B[idx];
-                            stride = ((key >> 28) & 63);
-                            if (node->vec & (1ULL << stride)) {
-                              k = 106;
-                              idx = IDX_NXT(node, stride);
-                              node = &poptrie.L100.B[idx];
-                              stride = ((key >> 22) & 63);
-                              if (node->vec & (1ULL << stride)) {
-                                k = 112;
-                                idx = IDX_NXT(node, stride);
-                                node = &poptrie.L106.B[idx];
-                                stride = ((key >> 16) & 63);
-                                if (node->vec & (1ULL << stride)) {
-                                  k = 118;
-                                  idx = IDX_NXT(node, stride);
-                                  node = &poptrie.L112.B[idx];
-                                  stride = ((key >> 10) & 63);
-                                  if (node->vec & (1ULL << stride)) {
-                                    k = 124;
-                                    idx = IDX_NXT(node, stride);
-                                    node = &poptrie.L118.B[idx];
-                                    stride = ((key >> 4) & 63);
-                                    if (node->vec & (1ULL << stride)) {
-                                      k = 130;
-                                      idx = IDX_NXT(node, stride);
-                                      node = &poptrie.L124.B[idx];
-                                      stride = (key & 15) << 2;
-                                    }
-                                  }
-                                }
-                              }
-                            }
-                          }
-                        }
-                      }
-                    }
-                  }
-                }
-              }
-            }
-          }
-        }
-      }
-    }
+    node = &poptrie.L[k].B[idx];
+    stride = level_stride(key, POPTRIE_S + 6 * k);
   }
+  //The leaves of the node at L[k - 1] are of level S + 6 * k
   if (node->leafvec & (1ULL << stride)) {
-    return k;
+    return POPTRIE_S + 6 * k;
   }
-  return 16;
+  return POPTRIE_S;
 }
@@ -0,0 +1,155 @@
+/*
+ *   Copyright (c) 2019-2021 MD Iftakharul Islam (Tamim) <tamim@csebuet.org>
+ *
+ *   This program is free software; you can redistribute it and/or modify
+ *   it under the terms of the GNU General Public License as published by
+ *   the Free Software Foundation; either version 3 of the License, or
+ *   (at your option) any later version.
+ *
+ *   This program is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *   GNU General Public License for more details.
+ *
+ *   You should have received a copy of the GNU General Public License
+ *   along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+#include "rank.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define POPCNT(X) (__builtin_popcountll(X))
+
+int rank_init (struct rank *r, uint32_t size) {
+  r->blocks = (size + RANK_BLOCK - 1) / RANK_BLOCK;
+  r->bits = (uint64_t *) calloc (r->blocks * RANK_WORDS, sizeof(uint64_t));
+  r->tree = (uint32_t *) calloc (r->blocks + 1, sizeof(uint32_t));
+
+  if (!r->bits || !r->tree)
+    return -1;
+  return 0;
+}
+
+int rank_cleanup (struct rank *r) {
+  free(r->bits);
+  free(r->tree);
+  r->bits = NULL;
+  r->tree = NULL;
+  r->blocks = 0;
+  return 0;
+}
+
+int rank_test (struct rank *r, uint32_t idx) {
+  return (r->bits[idx / 64] >> (idx % 64)) & 1;
+}
+
+static void tree_add (struct rank *r, uint32_t blk, int32_t val) {
+  for (uint32_t i = blk + 1; i <= r->blocks; i += i & -i)
+    r->tree[i] += val;
+}
+
+void rank_set (struct rank *r, uint32_t idx) {
+  if (rank_test(r, idx))
+    return;
+  r->bits[idx / 64] |= 1ULL << (idx % 64);
+  tree_add(r, idx / RANK_BLOCK, 1);
+}
+
+void rank_clear (struct rank *r, uint32_t idx) {
+  if (!rank_test(r, idx))
+    return;
+  r->bits[idx / 64] &= ~(1ULL << (idx % 64));
+  tree_add(r, idx / RANK_BLOCK, -1);
+}
+
+//Number of bits set in [0, idx)
+uint32_t rank_count (struct rank *r, uint32_t idx) {
+  uint32_t blk = idx / RANK_BLOCK;
+  uint32_t w = idx / 64;
+  uint32_t cnt = 0;
+
+  for (uint32_t i = blk; i > 0; i -= i & -i)
+    cnt += r->tree[i];
+  for (uint32_t i = blk * RANK_WORDS; i < w; i++)
+    cnt += POPCNT(r->bits[i]);
+  if (idx % 64)
+    cnt += POPCNT(r->bits[w] << (64 - idx % 64));
+  return cnt;
+}
+
+//Number of bits set in block blk and the blocks covered by its children in
+//the Fenwick tree, i.e. the value of tree[blk + 1]
+static uint32_t tree_node (struct rank *r, uint32_t blk) {
+  uint32_t i = blk + 1, cnt = 0;
+
+  for (uint32_t j = 0; j < RANK_WORDS; j++)
+    cnt += POPCNT(r->bits[blk * RANK_WORDS + j]);
+  for (uint32_t k = 1; k < (i & -i); k <<= 1)
+    cnt += r->tree[i - k];
+  return cnt;
+}
+
+//Recounts the Fenwick tree nodes of the blocks [first, last) and of the nodes
+//above them
+static void recount (struct rank *r, uint32_t first, uint32_t last) {
+  uint32_t blk;
+
+  for (blk = first; blk < last; blk++)
+    r->tree[blk + 1] = tree_node(r, blk);
+  for (blk = last; blk && blk + (blk & -blk) <= r->blocks; ) {
+    blk += blk & -blk;
+    r->tree[blk] = tree_node(r, blk - 1);
+  }
+}
+
+//Inserts n clear bits at idx and shifts [idx, end) to the right. idx and n
+//must be multiples of 64, which is the case for the chunks of a level. Only
+//the blocks that moved and the nodes above them are recounted, so appending
+//is cheap.
+int rank_insert (struct rank *r, uint32_t idx, uint32_t n, uint32_t end) {
+  uint32_t words = r->blocks * RANK_WORDS;
+  uint32_t from = idx / 64, shift = n / 64, to = (end + 63) / 64;
+
+  if (idx % 64 || n % 64 || to < from || to + shift > words) {
+    puts("Invalid rank insertion");
+    return -1;
+  }
+  memmove(&r->bits[from + shift], &r->bits[from], (to - from) * sizeof(uint64_t));
+  memset(&r->bits[from], 0, shift * sizeof(uint64_t));
+  recount(r, from / RANK_WORDS, (to + shift + RANK_WORDS - 1) / RANK_WORDS);
+  return 0;
+}
+
+//Removes the n bits at idx and shifts [idx + n, end) to the left, the inverse
+//of rank_insert(). The bits freed at the end are cleared.
+int rank_remove (struct rank *r, uint32_t idx, uint32_t n, uint32_t end) {
+  uint32_t words = r->blocks * RANK_WORDS;
+  uint32_t from = idx / 64, shift = n / 64, to = (end + 63) / 64;
+
+  if (idx % 64 || n % 64 || to < from + shift || to > words) {
+    puts("Invalid rank removal");
+    return -1;
+  }
+  memmove(&r->bits[from], &r->bits[from + shift], (to - from - shift) * sizeof(uint64_t));
+  memset(&r->bits[to - shift], 0, shift * sizeof(uint64_t));
+  recount(r, from / RANK_WORDS, (to + RANK_WORDS - 1) / RANK_WORDS);
+  return 0;
+}
+
+//Rebuilds the Fenwick tree from the bitmap in O(n)
+void rank_build (struct rank *r) {
+  uint32_t i, j;
+
+  for (i = 1; i <= r->blocks; i++) {
+    r->tree[i] = 0;
+    for (j = 0; j < RANK_WORDS; j++)
+      r->tree[i] += POPCNT(r->bits[(i - 1) * RANK_WORDS + j]);
+  }
+  for (i = 1; i <= r->blocks; i++) {
+    j = i + (i & -i);
+    if (j <= r->blocks)
+      r->tree[j] += r->tree[i];
+  }
+}
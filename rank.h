@@ -0,0 +1,47 @@
+/*
+ *   Copyright (c) 2019-2021 MD Iftakharul Islam (Tamim) <tamim@csebuet.org>
+ *
+ *   This program is free software; you can redistribute it and/or modify
+ *   it under the terms of the GNU General Public License as published by
+ *   the Free Software Foundation; either version 3 of the License, or
+ *   (at your option) any later version.
+ *
+ *   This program is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *   GNU General Public License for more details.
+ *
+ *   You should have received a copy of the GNU General Public License
+ *   along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+#ifndef RANK_H_
+#define RANK_H_
+
+#include <stdint.h>
+
+//Rank of a bitmap, i.e. the number of bits set before an index. Chunk IDs
+//are the rank of the entries that have a chunk, so they can be derived from
+//it in O(log n) while the flat arrays read by the lookups are left stale.
+//A Fenwick tree keeps the number of bits set in each block of RANK_BLOCK bits.
+#define RANK_BLOCK 256
+#define RANK_WORDS (RANK_BLOCK / 64)
+
+struct rank {
+  uint64_t *bits;
+  //Fenwick tree over the blocks, 1-based
+  uint32_t *tree;
+  uint32_t blocks;
+};
+
+int rank_init (struct rank *r, uint32_t size);
+int rank_cleanup (struct rank *r);
+int rank_test (struct rank *r, uint32_t idx);
+void rank_set (struct rank *r, uint32_t idx);
+void rank_clear (struct rank *r, uint32_t idx);
+uint32_t rank_count (struct rank *r, uint32_t idx);
+int rank_insert (struct rank *r, uint32_t idx, uint32_t n, uint32_t end);
+int rank_remove (struct rank *r, uint32_t idx, uint32_t n, uint32_t end);
+void rank_build (struct rank *r);
+
+#endif /* RANK_H_ */
@@ -0,0 +1,180 @@
+/*
+ *   Copyright (c) 2019-2021 MD Iftakharul Islam (Tamim) <tamim@csebuet.org>
+ *
+ *   This program is free software; you can redistribute it and/or modify
+ *   it under the terms of the GNU General Public License as published by
+ *   the Free Software Foundation; either version 3 of the License, or
+ *   (at your option) any later version.
+ *
+ *   This program is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *   GNU General Public License for more details.
+ *
+ *   You should have received a copy of the GNU General Public License
+ *   along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+#include "rib.h"
+#include <string.h>
+
+static __inline__ __uint128_t rib_mask (__uint128_t prefix, int len)
+{
+  if (!len)
+    return 0;
+  return prefix & (~(__uint128_t)0 << (128 - len));
+}
+
+static __inline__ uint64_t rib_hash (uint64_t hi, uint64_t lo, int len)
+{
+  uint64_t h = hi * 0x9E3779B97F4A7C15ULL ^ lo * 0xC2B2AE3D27D4EB4FULL ^ len;
+
+  h ^= h >> 29;
+  h *= 0xBF58476D1CE4E5B9ULL;
+  return h ^ (h >> 32);
+}
+
+//Slot holding the prefix or the free slot where it would go
+static uint64_t rib_slot (struct rib *r, uint64_t hi, uint64_t lo, int len)
+{
+  uint64_t mask = r->size - 1;
+  uint64_t i = rib_hash(hi, lo, len) & mask;
+
+  while (r->e[i].len != RIB_EMPTY &&
+         (r->e[i].len != len || r->e[i].hi != hi || r->e[i].lo != lo))
+    i = (i + 1) & mask;
+  return i;
+}
+
+int rib_init (struct rib *r, uint64_t size)
+{
+  uint64_t n = 16;
+
+  while (n < size)
+    n <<= 1;
+  memset(r, 0, sizeof(*r));
+  r->e = (struct rib_entry *) malloc (n * sizeof(struct rib_entry));
+  if (!r->e)
+    return -1;
+  for (uint64_t i = 0; i < n; i++)
+    r->e[i].len = RIB_EMPTY;
+  r->size = n;
+  return 0;
+}
+
+int rib_cleanup (struct rib *r)
+{
+  free(r->e);
+  memset(r, 0, sizeof(*r));
+  return 0;
+}
+
+//Doubles the table when it's half full
+static int rib_grow (struct rib *r)
+{
+  struct rib_entry *old = r->e;
+  uint64_t old_size = r->size, i, j;
+  uint64_t size = old_size ? 2 * old_size : 16;
+
+  r->e = (struct rib_entry *) malloc (size * sizeof(struct rib_entry));
+  if (!r->e) {
+    r->e = old;
+    return -1;
+  }
+  r->size = size;
+  for (i = 0; i < r->size; i++)
+    r->e[i].len = RIB_EMPTY;
+  for (i = 0; i < old_size; i++) {
+    if (old[i].len == RIB_EMPTY)
+      continue;
+    j = rib_slot(r, old[i].hi, old[i].lo, old[i].len);
+    r->e[j] = old[i];
+  }
+  free(old);
+  return 0;
+}
+
+//Adds a prefix or overrides the next-hop of an existing one
+int rib_insert (struct rib *r, __uint128_t prefix, int len, int nh)
+{
+  uint64_t i;
+
+  if (len < 0 || len > 128)
+    return -1;
+  if (2 * (r->count + 1) > r->size && rib_grow(r))
+    return -1;
+  prefix = rib_mask(prefix, len);
+  i = rib_slot(r, prefix >> 64, prefix, len);
+  if (r->e[i].len == RIB_EMPTY) {
+    r->e[i].hi = prefix >> 64;
+    r->e[i].lo = prefix;
+    r->e[i].len = len;
+    r->count++;
+    r->len_cnt[len]++;
+  }
+  r->e[i].nh = nh;
+  return 0;
+}
+
+//Removes a prefix and returns its next-hop, or 0 if it doesn't exist. The
+//following entries of the probe sequence are shifted back, so there is no
+//tombstone.
+int rib_delete (struct rib *r, __uint128_t prefix, int len)
+{
+  uint64_t mask = r->size - 1;
+  uint64_t i, j, k;
+  int nh;
+
+  if (len < 0 || len > 128 || !r->count)
+    return 0;
+  prefix = rib_mask(prefix, len);
+  i = rib_slot(r, prefix >> 64, prefix, len);
+  if (r->e[i].len == RIB_EMPTY)
+    return 0;
+  nh = r->e[i].nh;
+  r->count--;
+  r->len_cnt[len]--;
+
+  for (j = (i + 1) & mask; r->e[j].len != RIB_EMPTY; j = (j + 1) & mask) {
+    k = rib_hash(r->e[j].hi, r->e[j].lo, r->e[j].len) & mask;
+    //Move the entry to the hole unless its home slot is between the hole and it
+    if (i <= j ? (k <= i || k > j) : (k <= i && k > j)) {
+      r->e[i] = r->e[j];
+      i = j;
+    }
+  }
+  r->e[i].len = RIB_EMPTY;
+  return nh;
+}
+
+//Returns the next-hop of a prefix, or 0 if it doesn't exist
+int rib_find (struct rib *r, __uint128_t prefix, int len)
+{
+  uint64_t i;
+
+  if (len < 0 || len > 128 || !r->count)
+    return 0;
+  prefix = rib_mask(prefix, len);
+  i = rib_slot(r, prefix >> 64, prefix, len);
+  return r->e[i].len == RIB_EMPTY ? 0 : r->e[i].nh;
+}
+
+//Returns the next-hop of the longest prefix shorter than len that covers the
+//prefix and stores its length in parent_len. The default route isn't
+//considered. Returns 0 if there is no such prefix.
+int rib_parent (struct rib *r, __uint128_t prefix, int len, int *parent_len)
+{
+  int l, nh;
+
+  for (l = len - 1; l > 0; l--) {
+    if (!r->len_cnt[l])
+      continue;
+    nh = rib_find(r, prefix, l);
+    if (nh) {
+      *parent_len = l;
+      return nh;
+    }
+  }
+  *parent_len = 0;
+  return 0;
+}
@@ -0,0 +1,58 @@
+/*
+ *   Copyright (c) 2019-2021 MD Iftakharul Islam (Tamim) <tamim@csebuet.org>
+ *
+ *   This program is free software; you can redistribute it and/or modify
+ *   it under the terms of the GNU General Public License as published by
+ *   the Free Software Foundation; either version 3 of the License, or
+ *   (at your option) any later version.
+ *
+ *   This program is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *   GNU General Public License for more details.
+ *
+ *   You should have received a copy of the GNU General Public License
+ *   along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+#ifndef RIB_H_
+#define RIB_H_
+
+#include <stdint.h>
+#include <stdlib.h>
+#include <stdio.h>
+
+/*
+ *The algorithms here store only the longest match of each slot after leaf
+ *pushing. So once a prefix is withdrawn, the trie alone cannot tell which
+ *shorter prefix used to cover it. The RIB keeps every announced prefix in a
+ *hash table keyed by (prefix, length) so that the covering prefix can be
+ *found by probing the shorter lengths that exist. It's only used by route
+ *updates, never by the lookups.
+ */
+struct rib_entry {
+  uint64_t hi, lo;
+  //RIB_EMPTY marks a free slot
+  uint8_t len;
+  uint8_t nh;
+};
+
+#define RIB_EMPTY 0xFF
+
+struct rib {
+  struct rib_entry *e;
+  //Power of two
+  uint64_t size;
+  uint64_t count;
+  //Number of prefixes of each length
+  uint32_t len_cnt[129];
+};
+
+int rib_init (struct rib *r, uint64_t size);
+int rib_cleanup (struct rib *r);
+int rib_insert (struct rib *r, __uint128_t prefix, int len, int nh);
+int rib_delete (struct rib *r, __uint128_t prefix, int len);
+int rib_find (struct rib *r, __uint128_t prefix, int len);
+int rib_parent (struct rib *r, __uint128_t prefix, int len, int *parent_len);
+
+#endif /* RIB_H_ */
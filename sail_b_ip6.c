@@ -0,0 +1,302 @@
+/*
+ *   Copyright (c) 2019-2021 MD Iftakharul Islam (Tamim) <tamim@csebuet.org>
+ *
+ *   This program is free software; you can redistribute it and/or modify
+ *   it under the terms of the GNU General Public License as published by
+ *   the Free Software Foundation; either version 3 of the License, or
+ *   (at your option) any later version.
+ *
+ *   This program is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *   GNU General Public License for more details.
+ *
+ *   You should have received a copy of the GNU General Public License
+ *   along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+#include "sail_b_ip6.h"
+
+//SAIL_B of the SAIL paper adapted to IPv6. The prefixes are pushed to levels
+//16, 24, ..., 128 like SAIL-U. A lookup first finds the longest matching
+//level with the small "on-chip" structures and then reads a single next-hop
+//from the large "off-chip" ones:
+// - Level 16 is a direct array of next-hops.
+// - Level 24 is a bitmap of 2^24 bits and a direct array of next-hops.
+// - Levels 32 to 128 have a Bloom filter each and a hash table of the
+//   next-hops. A false positive of the filter costs a miss in the table.
+//Empty levels are skipped, so only the populated ones are probed.
+
+#define SAIL_B_HASHED 13
+//Initial slots of a hash table. A table is doubled when it's half full and
+//its Bloom filter has 8 bits per slot, i.e. at least 16 bits per entry.
+#define SAIL_B_SLOTS 1024
+#define SAIL_B_BLOOM_BITS 8
+//Bits probed in the Bloom filter for each key
+#define SAIL_B_HASHES 3
+
+struct sail_b_entry {
+  //Key of the entry, i.e. the level_num MSBs of the prefix
+  uint64_t hi, lo;
+  uint8_t nh;
+  //Prefix length, 0 if the slot is empty
+  uint8_t len;
+};
+
+struct sail_b_level {
+  uint8_t level_num;
+  uint64_t *bloom;
+  struct sail_b_entry *E;
+  //Number of slots, a power of 2
+  uint64_t size;
+  uint64_t count;
+};
+
+struct sail_b {
+  uint8_t def_nh;
+  //P is the prefix length, only needed for updates
+  uint8_t *N16, *P16;
+  uint64_t *B24;
+  uint8_t *N24, *P24;
+  //Level 32 + 8 * k
+  struct sail_b_level L[SAIL_B_HASHED];
+  //Levels of L that have an entry
+  uint32_t populated;
+};
+
+struct sail_b sail_b;
+
+static __inline__ uint64_t hash_key(uint64_t hi, uint64_t lo)
+{
+  register uint64_t h = lo * 0x9E3779B97F4A7C15ULL ^ hi * 0xC2B2AE3D27D4EB4FULL;
+
+  h ^= h >> 29;
+  h *= 0xBF58476D1CE4E5B9ULL;
+  h ^= h >> 32;
+  return h;
+}
+
+static __inline__ int bloom_test(struct sail_b_level *l, uint64_t h)
+{
+  register uint64_t mask = l->size * SAIL_B_BLOOM_BITS - 1;
+  register uint64_t step = (h >> 32) | 1, bit;
+
+  for (int i = 0; i < SAIL_B_HASHES; i++, h += step) {
+    bit = h & mask;
+    if (!(l->bloom[bit / 64] & (1ULL << (bit % 64))))
+      return 0;
+  }
+  return 1;
+}
+
+static void bloom_add(struct sail_b_level *l, uint64_t h)
+{
+  register uint64_t mask = l->size * SAIL_B_BLOOM_BITS - 1;
+  register uint64_t step = (h >> 32) | 1, bit;
+
+  for (int i = 0; i < SAIL_B_HASHES; i++, h += step) {
+    bit = h & mask;
+    l->bloom[bit / 64] |= 1ULL << (bit % 64);
+  }
+}
+
+//Slot of the key, or the empty slot where it goes. Linear probing.
+static __inline__ struct sail_b_entry *find_slot(struct sail_b_level *l, uint64_t hi, uint64_t lo, uint64_t h)
+{
+  register uint64_t i = (h >> 40) & (l->size - 1);
+  register struct sail_b_entry *e;
+
+  for (;; i = (i + 1) & (l->size - 1)) {
+    e = &l->E[i];
+    if (!e->len || (e->hi == hi && e->lo == lo))
+      return e;
+  }
+}
+
+static int level_init(struct sail_b_level *l, uint8_t level_num, uint64_t size)
+{
+  l->level_num = level_num;
+  l->size = size;
+  l->count = 0;
+  l->E = (struct sail_b_entry *) calloc (size, sizeof(struct sail_b_entry));
+  l->bloom = (uint64_t *) calloc (size * SAIL_B_BLOOM_BITS / 64, sizeof(uint64_t));
+  if (!l->E || !l->bloom)
+    return -1;
+  return 0;
+}
+
+static void level_cleanup(struct sail_b_level *l)
+{
+  free(l->E);
+  free(l->bloom);
+  memset(l, 0, sizeof(*l));
+}
+
+//Doubles the hash table and rebuilds its Bloom filter
+static int level_grow(struct sail_b_level *l)
+{
+  struct sail_b_level old = *l;
+  struct sail_b_entry *e;
+  uint64_t h;
+
+  if (level_init(l, old.level_num, old.size * 2)) {
+    level_cleanup(l);
+    *l = old;
+    puts("Failed to grow a SAIL-B level");
+    return -1;
+  }
+  for (uint64_t i = 0; i < old.size; i++) {
+    if (!old.E[i].len)
+      continue;
+    h = hash_key(old.E[i].hi, old.E[i].lo);
+    e = find_slot(l, old.E[i].hi, old.E[i].lo, h);
+    *e = old.E[i];
+    bloom_add(l, h);
+    l->count++;
+  }
+  level_cleanup(&old);
+  return 0;
+}
+
+int sail_b_init () {
+  int err = 0;
+
+  memset(&sail_b, 0, sizeof(sail_b));
+  sail_b.N16 = (uint8_t *) calloc (1 << 16, sizeof(uint8_t));
+  sail_b.P16 = (uint8_t *) calloc (1 << 16, sizeof(uint8_t));
+  sail_b.B24 = (uint64_t *) calloc ((1 << 24) / 64, sizeof(uint64_t));
+  sail_b.N24 = (uint8_t *) calloc (1 << 24, sizeof(uint8_t));
+  sail_b.P24 = (uint8_t *) calloc (1 << 24, sizeof(uint8_t));
+  if (!sail_b.N16 || !sail_b.P16 || !sail_b.B24 || !sail_b.N24 || !sail_b.P24)
+    return -1;
+  for (int k = 0; k < SAIL_B_HASHED; k++)
+    err |= level_init(&sail_b.L[k], 32 + 8 * k, SAIL_B_SLOTS);
+  return err;
+}
+
+int sail_b_cleanup() {
+  free(sail_b.N16);
+  free(sail_b.P16);
+  free(sail_b.B24);
+  free(sail_b.N24);
+  free(sail_b.P24);
+  for (int k = 0; k < SAIL_B_HASHED; k++)
+    level_cleanup(&sail_b.L[k]);
+  memset(&sail_b, 0, sizeof(sail_b));
+  return 0;
+}
+
+//Calculate memory in MB. P is only needed for updates, so it's not counted
+//like in the other SAILs.
+double calc_sail_b_mem() {
+  double mem = (1 << 16) + (1 << 24) + calc_sail_b_onchip_mem() * 1024 * 1024;
+
+  for (int k = 0; k < SAIL_B_HASHED; k++)
+    mem += sail_b.L[k].size * sizeof(struct sail_b_entry);
+  return mem / (1024 * 1024);
+}
+
+//Memory of the bitmap and the Bloom filters in MB
+double calc_sail_b_onchip_mem() {
+  double mem = (1 << 24) / 8;
+
+  for (int k = 0; k < SAIL_B_HASHED; k++)
+    mem += sail_b.L[k].size * SAIL_B_BLOOM_BITS / 8;
+  return mem / (1024 * 1024);
+}
+
+static int insert_hashed(struct sail_b_level *l, __uint128_t key, int prefix_len, int nexthop)
+{
+  uint64_t hi = key >> 64, lo = key, h = hash_key(hi, lo);
+  struct sail_b_entry *e = find_slot(l, hi, lo, h);
+
+  if (e->len) {
+    /*Longer prefix exists*/
+    if (e->len <= prefix_len) {
+      e->nh = nexthop;
+      e->len = prefix_len;
+    }
+    return 0;
+  }
+  e->hi = hi;
+  e->lo = lo;
+  e->nh = nexthop;
+  e->len = prefix_len;
+  bloom_add(l, h);
+  if (++l->count * 2 > l->size)
+    return level_grow(l);
+  return 0;
+}
+
+int sail_b_insert(__uint128_t key, int prefix_len, int nexthop) {
+  register uint32_t num_leafs, idx;
+  int level, k, err = 0;
+
+  //nexthop cannot be 0. We use 0 to indicate that next-hop doesn't exist.
+  if (!nexthop) {
+    puts ("nexthop cannot be 0. Please fix the routing table");
+    exit (1);
+  }
+  if (prefix_len == 0) {
+    sail_b.def_nh = nexthop;
+    return 0;
+  }
+
+  //Level pushing
+  level = prefix_len <= 16 ? 16 : (prefix_len + 7) / 8 * 8;
+  num_leafs = 1U << (level - prefix_len);
+  if (level <= 24) {
+    uint8_t *N = level == 16 ? sail_b.N16 : sail_b.N24;
+    uint8_t *P = level == 16 ? sail_b.P16 : sail_b.P24;
+
+    idx = key >> (128 - level);
+    for (uint32_t i = idx; i < idx + num_leafs; i++) {
+      /*Longer prefix exists*/
+      if (P[i] > prefix_len)
+        continue;
+      N[i] = nexthop;
+      P[i] = prefix_len;
+      if (level == 24)
+        sail_b.B24[i / 64] |= 1ULL << (i % 64);
+    }
+    return 0;
+  }
+
+  k = (level - 32) / 8;
+  for (uint32_t i = 0; i < num_leafs; i++)
+    err |= insert_hashed(&sail_b.L[k], (key >> (128 - level)) + i, prefix_len, nexthop);
+  sail_b.populated |= 1U << k;
+  return err;
+}
+
+uint8_t sail_b_lookup(__uint128_t key) {
+  register struct sail_b_level *l;
+  register struct sail_b_entry *e;
+  register __uint128_t prefix;
+  register uint64_t h;
+  register uint32_t idx;
+  register int k;
+
+  //The longest matching level first
+  for (k = SAIL_B_HASHED - 1; k >= 0; k--) {
+    if (!(sail_b.populated & (1U << k)))
+      continue;
+    l = &sail_b.L[k];
+    prefix = key >> (96 - 8 * k);
+    h = hash_key(prefix >> 64, prefix);
+    if (!bloom_test(l, h))
+      continue;
+    e = find_slot(l, prefix >> 64, prefix, h);
+    //Not a false positive
+    if (e->len)
+      return e->nh;
+  }
+
+  idx = key >> 104;
+  if (sail_b.B24[idx / 64] & (1ULL << (idx % 64)))
+    return sail_b.N24[idx];
+  idx = key >> 112;
+  if (sail_b.N16[idx])
+    return sail_b.N16[idx];
+  return sail_b.def_nh;
+}
@@ -17,6 +17,9 @@
  */
 #include "sail_l_ip6.h"
 #include "level_sail.h"
+#include "parallel_build.h"
+#include "rib.h"
+#include <immintrin.h>
 
 /*chunk size is 2^8*/
 #define CNK_8 256
@@ -40,63 +43,95 @@
 
 #define MSK 0X8000000000000000ULL
 
-//forward declaration
-int _sail_l_insert(__uint128_t key, int prefix_len, int nexthop, int level);
 
 struct sail_l {
   uint8_t def_nh;
   struct sail_level level16, level24, level32, level40, level48, level56, level64, level72, level80, level88, level96, level104, level112, level120, level128; 
+  //Lookup image made by sail_l_pack(), dropped by any update
+  struct sail_packed packed;
+  //Announced routes, needed to restore the covering prefix on a withdrawal.
+  //Not counted in the memory consumption as the lookups never touch it.
+  struct rib rib;
 };
 
 struct sail_l sail_l;
 
-int sail_l_init () {
+//forward declaration
+static int _sail_l_insert(struct sail_l *t, __uint128_t key, int prefix_len, int nexthop, int level);
+
+//A fragment of a parallel build sizes its levels from longer, see
+//fragment_longer(). It's NULL for a full size SAIL-L.
+static int _sail_l_init (struct sail_l *t, const uint32_t *longer) {
   int err = 0;
 
-  memset(&sail_l, 0, sizeof(sail_l));
-  err = sail_level_init (&sail_l.level16, 16, CNK16, CNK_8, NULL);
-  err = sail_level_init (&sail_l.level24, 24, CNK24, CNK_8, &sail_l.level16);
-  err = sail_level_init (&sail_l.level32, 32, CNK32, CNK_8, &sail_l.level24);
-  err = sail_level_init (&sail_l.level40, 40, CNK40, CNK_8, &sail_l.level32);
-  err = sail_level_init (&sail_l.level48, 48, CNK48, CNK_8, &sail_l.level40);
-  err = sail_level_init (&sail_l.level56, 56, CNK56, CNK_8, &sail_l.level48);
-  err = sail_level_init (&sail_l.level64, 64, CNK64, CNK_8, &sail_l.level56);
-  err = sail_level_init (&sail_l.level72, 72, CNK72, CNK_8, &sail_l.level64);
-  err = sail_level_init (&sail_l.level80, 80, CNK80, CNK_8, &sail_l.level72);
-  err = sail_level_init (&sail_l.level88, 88, CNK88, CNK_8, &sail_l.level80);
-  err = sail_level_init (&sail_l.level96, 96, CNK96, CNK_8, &sail_l.level88);
-  err = sail_level_init (&sail_l.level104, 104, CNK104, CNK_8, &sail_l.level96);
-  err = sail_level_init (&sail_l.level112, 112, CNK112, CNK_8, &sail_l.level104);
-  err = sail_level_init (&sail_l.level120, 120, CNK120, CNK_8, &sail_l.level112);
-  err = sail_level_init (&sail_l.level128, 128, CNK128, CNK_8, &sail_l.level120);
+  memset(t, 0, sizeof(*t));
+  err = sail_level_init (&t->level16, 16, CNK16, CNK_8, NULL);
+  err = sail_level_init (&t->level24, 24, fragment_size(longer, 16, CNK24), CNK_8, &t->level16);
+  err = sail_level_init (&t->level32, 32, fragment_size(longer, 24, CNK32), CNK_8, &t->level24);
+  err = sail_level_init (&t->level40, 40, fragment_size(longer, 32, CNK40), CNK_8, &t->level32);
+  err = sail_level_init (&t->level48, 48, fragment_size(longer, 40, CNK48), CNK_8, &t->level40);
+  err = sail_level_init (&t->level56, 56, fragment_size(longer, 48, CNK56), CNK_8, &t->level48);
+  err = sail_level_init (&t->level64, 64, fragment_size(longer, 56, CNK64), CNK_8, &t->level56);
+  err = sail_level_init (&t->level72, 72, fragment_size(longer, 64, CNK72), CNK_8, &t->level64);
+  err = sail_level_init (&t->level80, 80, fragment_size(longer, 72, CNK80), CNK_8, &t->level72);
+  err = sail_level_init (&t->level88, 88, fragment_size(longer, 80, CNK88), CNK_8, &t->level80);
+  err = sail_level_init (&t->level96, 96, fragment_size(longer, 88, CNK96), CNK_8, &t->level88);
+  err = sail_level_init (&t->level104, 104, fragment_size(longer, 96, CNK104), CNK_8, &t->level96);
+  err = sail_level_init (&t->level112, 112, fragment_size(longer, 104, CNK112), CNK_8, &t->level104);
+  err = sail_level_init (&t->level120, 120, fragment_size(longer, 112, CNK120), CNK_8, &t->level112);
+  err = sail_level_init (&t->level128, 128, fragment_size(longer, 120, CNK128), CNK_8, &t->level120);
   //level 16 is always populated
-  sail_l.level16.count = CNK16;
+  t->level16.count = CNK16;
 
   return err;
 }
 
-int sail_l_cleanup() {
+static int _sail_l_cleanup (struct sail_l *t) {
   int err = 0;
 
-  sail_level_cleanup (&sail_l.level16);
-  sail_level_cleanup (&sail_l.level24);
-  sail_level_cleanup (&sail_l.level32);
-  sail_level_cleanup (&sail_l.level40);
-  sail_level_cleanup (&sail_l.level48);
-  sail_level_cleanup (&sail_l.level56);
-  sail_level_cleanup (&sail_l.level64);
-  sail_level_cleanup (&sail_l.level72);
-  sail_level_cleanup (&sail_l.level80);
-  sail_level_cleanup (&sail_l.level88);
-  sail_level_cleanup (&sail_l.level96);
-  sail_level_cleanup (&sail_l.level104);
-  sail_level_cleanup (&sail_l.level112);
-  sail_level_cleanup (&sail_l.level120);
-  sail_level_cleanup (&sail_l.level128);
-  memset(&sail_l, 0, sizeof(sail_l));
+  sail_level_cleanup (&t->level16);
+  sail_level_cleanup (&t->level24);
+  sail_level_cleanup (&t->level32);
+  sail_level_cleanup (&t->level40);
+  sail_level_cleanup (&t->level48);
+  sail_level_cleanup (&t->level56);
+  sail_level_cleanup (&t->level64);
+  sail_level_cleanup (&t->level72);
+  sail_level_cleanup (&t->level80);
+  sail_level_cleanup (&t->level88);
+  sail_level_cleanup (&t->level96);
+  sail_level_cleanup (&t->level104);
+  sail_level_cleanup (&t->level112);
+  sail_level_cleanup (&t->level120);
+  sail_level_cleanup (&t->level128);
+  sail_unpack (&t->packed);
+  rib_cleanup (&t->rib);
+  memset(t, 0, sizeof(*t));
   return err;
 }
 
+//Initial size of the RIB, it grows as needed
+#define RIB_SIZE 65536
+
+int sail_l_init () {
+  if (_sail_l_init (&sail_l, NULL) || rib_init (&sail_l.rib, RIB_SIZE))
+    return -1;
+  return 0;
+}
+
+//Makes the routes inserted since sail_l_init() visible to the lookups. The
+//chunk IDs of the levels aren't maintained until then, so loading a FIB
+//doesn't shift them on each new chunk. After the commit, a new chunk is
+//appended to its level, see sail_level_commit().
+void sail_l_commit() {
+  for (struct sail_level *l = &sail_l.level16; l; l = l->chield)
+    sail_level_commit (l);
+}
+
+int sail_l_cleanup() {
+  return _sail_l_cleanup (&sail_l);
+}
+
 //Calculate memory in MB
 double calc_sail_l_mem() {
   return (mem_size (&sail_l.level16) + mem_size (&sail_l.level24) + mem_size (&sail_l.level32) + mem_size (&sail_l.level40) + mem_size (&sail_l.level48) +
@@ -104,7 +139,7 @@ double calc_sail_l_mem() {
          mem_size (&sail_l.level96) + mem_size (&sail_l.level104) + mem_size (&sail_l.level112) + mem_size (&sail_l.level120) + mem_size (&sail_l.level128)) / (1024*1024);
 }
 
-static int insert_leaf(struct sail_level *c, uint32_t idx, int level, __uint128_t key, int prefix_len, int nexthop)
+static int insert_leaf(struct sail_l *t, struct sail_level *c, uint32_t idx, int level, __uint128_t key, int prefix_len, int nexthop)
 {
   //Level pushing prefixes
   __uint128_t lp_prefixes[256];
@@ -118,7 +153,7 @@ static int insert_leaf(struct sail_level *c, uint32_t idx, int level, __uint128_
   num_leafs = 1U << (c->level_num - level);
   for (i = 0; i < num_leafs; i++) {
     //The prefix should be pushed to upper level
-    if (c->C[idx + i]) {
+    if (sail_level_ckid(c, idx + i)) {
       //Prefix that needs to be pushed to next level
       lp_prefixes[lp_count++] = ((key >> (128 - c->level_num)) + i) << (128 - c->level_num);
     } else {
@@ -134,16 +169,16 @@ static int insert_leaf(struct sail_level *c, uint32_t idx, int level, __uint128_
   if (c->chield) {
     for (i = 0; i < lp_count; i++) {
       matching_key = ((lp_prefixes[i] >> (128 - c->chield->level_num)) + (0 << 7)) << (128 - c->chield->level_num);
-      _sail_l_insert (matching_key, prefix_len , nexthop, c->level_num + 1);
+      _sail_l_insert (t, matching_key, prefix_len , nexthop, c->level_num + 1);
       matching_key = ((lp_prefixes[i] >> (128 - c->chield->level_num)) + (1 << 7)) << (128 - c->chield->level_num);
-      _sail_l_insert (matching_key, prefix_len , nexthop, c->level_num + 1);
+      _sail_l_insert (t, matching_key, prefix_len , nexthop, c->level_num + 1);
     }
   }
   return 0;
 }
 
 //Checks if there a leaf in the level; if yes, push it to the next level.
-static int leaf_pushing(struct sail_level *c, uint32_t idx, int level, __uint128_t key) {
+static int leaf_pushing(struct sail_l *t, struct sail_level *c, uint32_t idx, int level, __uint128_t key) {
   register uint8_t next_hop, prefix_len;
   register int i;
   register __uint128_t matching_key;
@@ -157,8 +192,8 @@ static int leaf_pushing(struct sail_level *c, uint32_t idx, int level, __uint128
     c->P[idx] = 0;
     //Key to which the match was found and add 8 bits to the right
     matching_key = (key >> (128 - c->level_num)) << 8;
-    _sail_l_insert ((matching_key + (0 << 7)) << (120 - c->level_num), prefix_len, next_hop, c->level_num + 1);
-    _sail_l_insert ((matching_key + (1 << 7)) << (120 - c->level_num), prefix_len, next_hop, c->level_num + 1);
+    _sail_l_insert (t, (matching_key + (0 << 7)) << (120 - c->level_num), prefix_len, next_hop, c->level_num + 1);
+    _sail_l_insert (t, (matching_key + (1 << 7)) << (120 - c->level_num), prefix_len, next_hop, c->level_num + 1);
   }
   return 0;
 }
@@ -169,140 +204,176 @@ int sail_l_insert(__uint128_t key, int prefix_len, int nexthop) {
     puts ("nexthop cannot be 0. Please fix the routing table");
     exit (1);
   }
+  if (sail_l.packed.mem)
+    sail_unpack(&sail_l.packed);
   //level is same as prefix len
-  return _sail_l_insert(key, prefix_len, nexthop, prefix_len);
+  if (_sail_l_insert(&sail_l, key, prefix_len, nexthop, prefix_len))
+    return -1;
+  if (rib_insert(&sail_l.rib, key, prefix_len, nexthop)) {
+    puts ("Failed to add the route to the RIB");
+    return -1;
+  }
+  return 0;
 }
 
 //This function will be called by sail_l_insert() and by itself recursively for
 //leaf pushing. When called by sail_l_insert(), level and prefix length should
 //be same. When called recursively, level will be higher than the prefix length.
-int _sail_l_insert(__uint128_t key, int prefix_len, int nexthop, int level) {
+static int _sail_l_insert(struct sail_l *t, __uint128_t key, int prefix_len, int nexthop, int level) {
   register uint32_t chunk_id = 0;
   //Index to N and C array at each level
   register uint32_t idx;
   register int err = 0;
 
   if (prefix_len == 0) {
-    sail_l.def_nh = nexthop;
+    t->def_nh = nexthop;
     goto finish;
   }
 
   /*Eextract 16 bits from MSB.*/
   idx = key >> 112;
   if (level <= 16) {
-    insert_leaf(&sail_l.level16, idx, level, key, prefix_len, nexthop);
+    insert_leaf(t, &t->level16, idx, level, key, prefix_len, nexthop);
     goto finish;
   }
-  leaf_pushing(&sail_l.level16, idx, level, key);
+  leaf_pushing(t, &t->level16, idx, level, key);
 
-  chunk_id = get_chunk_id_frm_parent (&sail_l.level16, idx);
+  chunk_id = get_chunk_id_frm_parent (&t->level16, idx);
+  if (!chunk_id)
+    return -1;
   idx = (chunk_id - 1) * CNK_8 + ((key >> 104) & 0XFF);
   if (level <= 24) {
-    insert_leaf(&sail_l.level24, idx, level, key, prefix_len, nexthop);
+    insert_leaf(t, &t->level24, idx, level, key, prefix_len, nexthop);
     goto finish;
   }
-  leaf_pushing(&sail_l.level24, idx, level, key);
+  leaf_pushing(t, &t->level24, idx, level, key);
 
-  chunk_id = get_chunk_id_frm_parent (&sail_l.level24, idx);        
+  chunk_id = get_chunk_id_frm_parent (&t->level24, idx);        
+  if (!chunk_id)
+    return -1;
   idx = (chunk_id - 1) * CNK_8 + ((key >> 96) & 0XFF);
   if (level <= 32) {
-    insert_leaf(&sail_l.level32, idx, level, key, prefix_len, nexthop);
+    insert_leaf(t, &t->level32, idx, level, key, prefix_len, nexthop);
     goto finish;
   }
-  leaf_pushing(&sail_l.level32, idx, level, key);
+  leaf_pushing(t, &t->level32, idx, level, key);
 
-  chunk_id = get_chunk_id_frm_parent (&sail_l.level32, idx);
+  chunk_id = get_chunk_id_frm_parent (&t->level32, idx);
+  if (!chunk_id)
+    return -1;
   idx = (chunk_id - 1) * CNK_8 + ((key >> 88) & 0XFF);
   if (level <= 40) {
-    insert_leaf(&sail_l.level40, idx, level, key, prefix_len, nexthop);
+    insert_leaf(t, &t->level40, idx, level, key, prefix_len, nexthop);
     goto finish;
   }
-  leaf_pushing(&sail_l.level40, idx, level, key);
+  leaf_pushing(t, &t->level40, idx, level, key);
 
-  chunk_id = get_chunk_id_frm_parent (&sail_l.level40, idx);
+  chunk_id = get_chunk_id_frm_parent (&t->level40, idx);
+  if (!chunk_id)
+    return -1;
   idx = (chunk_id - 1) * CNK_8 + ((key >> 80) & 0XFF);
   if (level <= 48) {
-    insert_leaf(&sail_l.level48, idx, level, key, prefix_len, nexthop);
+    insert_leaf(t, &t->level48, idx, level, key, prefix_len, nexthop);
     goto finish;
   }
-  leaf_pushing(&sail_l.level48, idx, level, key);
+  leaf_pushing(t, &t->level48, idx, level, key);
 
-  chunk_id = get_chunk_id_frm_parent (&sail_l.level48, idx);
+  chunk_id = get_chunk_id_frm_parent (&t->level48, idx);
+  if (!chunk_id)
+    return -1;
   idx = (chunk_id - 1) * CNK_8 + ((key >> 72) & 0XFF);
   if (level <= 56) {
-    insert_leaf(&sail_l.level56, idx, level, key, prefix_len, nexthop);
+    insert_leaf(t, &t->level56, idx, level, key, prefix_len, nexthop);
     goto finish;
   }
-  leaf_pushing(&sail_l.level56, idx, level, key);
+  leaf_pushing(t, &t->level56, idx, level, key);
 
-  chunk_id = get_chunk_id_frm_parent (&sail_l.level56, idx);
+  chunk_id = get_chunk_id_frm_parent (&t->level56, idx);
+  if (!chunk_id)
+    return -1;
   idx = (chunk_id - 1) * CNK_8 + ((key >> 64) & 0XFF);
   if (level <= 64) {
-    insert_leaf(&sail_l.level64, idx, level, key, prefix_len, nexthop);
+    insert_leaf(t, &t->level64, idx, level, key, prefix_len, nexthop);
     goto finish;
   }
-  leaf_pushing(&sail_l.level64, idx, level, key);
+  leaf_pushing(t, &t->level64, idx, level, key);
 
-  chunk_id = get_chunk_id_frm_parent (&sail_l.level64, idx);
+  chunk_id = get_chunk_id_frm_parent (&t->level64, idx);
+  if (!chunk_id)
+    return -1;
   idx = (chunk_id - 1) * CNK_8 + ((key >> 56) & 0XFF);
   if (level <= 72) {
-    insert_leaf(&sail_l.level72, idx, level, key, prefix_len, nexthop);
+    insert_leaf(t, &t->level72, idx, level, key, prefix_len, nexthop);
     goto finish;
   }
-  leaf_pushing(&sail_l.level72, idx, level, key);
+  leaf_pushing(t, &t->level72, idx, level, key);
 
-  chunk_id = get_chunk_id_frm_parent (&sail_l.level72, idx);
+  chunk_id = get_chunk_id_frm_parent (&t->level72, idx);
+  if (!chunk_id)
+    return -1;
   idx = (chunk_id - 1) * CNK_8 + ((key >> 48) & 0XFF);
   if (level <= 80) {
-    insert_leaf(&sail_l.level80, idx, level, key, prefix_len, nexthop);
+    insert_leaf(t, &t->level80, idx, level, key, prefix_len, nexthop);
     goto finish;
   }
-  leaf_pushing(&sail_l.level80, idx, level, key);
+  leaf_pushing(t, &t->level80, idx, level, key);
 
-  chunk_id = get_chunk_id_frm_parent (&sail_l.level80, idx);
+  chunk_id = get_chunk_id_frm_parent (&t->level80, idx);
+  if (!chunk_id)
+    return -1;
   idx = (chunk_id - 1) * CNK_8 + ((key >> 40) & 0XFF);
   if (level <= 88) {
-    insert_leaf(&sail_l.level88, idx, level, key, prefix_len, nexthop);
+    insert_leaf(t, &t->level88, idx, level, key, prefix_len, nexthop);
     goto finish;
   }
-  leaf_pushing(&sail_l.level88, idx, level, key);
+  leaf_pushing(t, &t->level88, idx, level, key);
 
-  chunk_id = get_chunk_id_frm_parent (&sail_l.level88, idx);
+  chunk_id = get_chunk_id_frm_parent (&t->level88, idx);
+  if (!chunk_id)
+    return -1;
   idx = (chunk_id - 1) * CNK_8 + ((key >> 32) & 0XFF);
   if (level <= 96) {
-    insert_leaf(&sail_l.level96, idx, level, key, prefix_len, nexthop);
+    insert_leaf(t, &t->level96, idx, level, key, prefix_len, nexthop);
     goto finish;
   }
-  leaf_pushing(&sail_l.level96, idx, level, key);
+  leaf_pushing(t, &t->level96, idx, level, key);
 
-  chunk_id = get_chunk_id_frm_parent (&sail_l.level96, idx);
+  chunk_id = get_chunk_id_frm_parent (&t->level96, idx);
+  if (!chunk_id)
+    return -1;
   idx = (chunk_id - 1) * CNK_8 + ((key >> 24) & 0XFF);
   if (level <= 104) {
-    insert_leaf(&sail_l.level104, idx, level, key, prefix_len, nexthop);
+    insert_leaf(t, &t->level104, idx, level, key, prefix_len, nexthop);
     goto finish;
   }
-  leaf_pushing(&sail_l.level104, idx, level, key);
+  leaf_pushing(t, &t->level104, idx, level, key);
 
-  chunk_id = get_chunk_id_frm_parent (&sail_l.level104, idx);
+  chunk_id = get_chunk_id_frm_parent (&t->level104, idx);
+  if (!chunk_id)
+    return -1;
   idx = (chunk_id - 1) * CNK_8 + ((key >> 16) & 0XFF);
   if (level <= 112) {
-    insert_leaf(&sail_l.level112, idx, level, key, prefix_len, nexthop);
+    insert_leaf(t, &t->level112, idx, level, key, prefix_len, nexthop);
     goto finish;
   }
-  leaf_pushing(&sail_l.level112, idx, level, key);
+  leaf_pushing(t, &t->level112, idx, level, key);
 
-  chunk_id = get_chunk_id_frm_parent (&sail_l.level112, idx);
+  chunk_id = get_chunk_id_frm_parent (&t->level112, idx);
+  if (!chunk_id)
+    return -1;
   idx = (chunk_id - 1) * CNK_8 + ((key >> 8) & 0XFF);
   if (level <= 120) {
-    insert_leaf(&sail_l.level120, idx, level, key, prefix_len, nexthop);
+    insert_leaf(t, &t->level120, idx, level, key, prefix_len, nexthop);
     goto finish;
   }
-  leaf_pushing(&sail_l.level120, idx, level, key);
+  leaf_pushing(t, &t->level120, idx, level, key);
 
-  chunk_id = get_chunk_id_frm_parent (&sail_l.level120, idx);
+  chunk_id = get_chunk_id_frm_parent (&t->level120, idx);
+  if (!chunk_id)
+    return -1;
   idx = (chunk_id - 1) * CNK_8 + (key & 0XFF);
   if (level <= 128) {
-    insert_leaf(&sail_l.level128, idx, level, key, prefix_len, nexthop);
+    insert_leaf(t, &t->level128, idx, level, key, prefix_len, nexthop);
     goto finish;
   }
 error:
@@ -313,6 +384,320 @@ finish:
 
 }
 
+//Folds the chunk of entry idx back into the entry if it only holds the leaves
+//pushed from the entry, i.e. of prefixes no longer than the level of the
+//entry. Returns 1 if the chunk was released.
+static int merge_chunk(struct sail_level *c, uint32_t idx)
+{
+  register struct sail_level *l = c->chield;
+  register uint32_t chunk_id, first, i;
+  register uint8_t nexthop, prefix_len;
+
+  chunk_id = sail_level_ckid(c, idx);
+  if (!chunk_id)
+    return 0;
+  first = (chunk_id - 1) * CNK_8;
+  for (i = first; i < first + CNK_8; i++) {
+    if (sail_level_ckid(l, i) || l->P[i] > c->level_num || l->N[i] != l->N[first])
+      return 0;
+  }
+  nexthop = l->N[first];
+  prefix_len = l->P[first];
+  if (release_chunk_frm_parent(c, idx))
+    return 0;
+  c->N[idx] = nexthop;
+  c->P[idx] = prefix_len;
+  return 1;
+}
+
+//Restores the leaves of a withdrawn prefix in num entries from idx and in the
+//chunks below them. They get the next-hop and the length of the covering
+//prefix, or are cleared if there is none. Then the chunks left with pushed
+//leaves only are merged.
+static void delete_leaves(struct sail_level *c, uint32_t idx, uint32_t num, int prefix_len,
+                          uint8_t nexthop, uint8_t cover_len)
+{
+  register uint32_t i, chunk_id;
+
+  for (i = idx; i < idx + num; i++) {
+    chunk_id = sail_level_ckid(c, i);
+    if (chunk_id) {
+      delete_leaves(c->chield, (chunk_id - 1) * CNK_8, CNK_8, prefix_len, nexthop, cover_len);
+      merge_chunk(c, i);
+    } else if (c->P[i] == prefix_len) {
+      //Otherwise a longer prefix exists
+      c->N[i] = nexthop;
+      c->P[i] = cover_len;
+    }
+  }
+}
+
+static int _sail_l_delete(struct sail_l *t, __uint128_t key, int prefix_len, uint8_t nexthop, uint8_t cover_len)
+{
+  register struct sail_level *c = &t->level16;
+  register uint32_t idx, chunk_id;
+  //Entry at each level on the way to the prefix
+  uint32_t path[SAIL_LEVELS];
+  register int k = 0;
+
+  /*Eextract 16 bits from MSB.*/
+  idx = key >> 112;
+  while (prefix_len > c->level_num) {
+    chunk_id = sail_level_ckid(c, idx);
+    //The prefix was never inserted, e.g. the level was full
+    if (!chunk_id)
+      return 0;
+    path[k++] = idx;
+    c = c->chield;
+    idx = (chunk_id - 1) * CNK_8 + ((key >> (128 - c->level_num)) & 0XFF);
+  }
+
+  delete_leaves(c, idx, 1U << (c->level_num - prefix_len), prefix_len, nexthop, cover_len);
+
+  //The chunks on the way may hold pushed leaves only now
+  while (k-- > 0) {
+    c = c->parent;
+    if (!merge_chunk(c, path[k]))
+      break;
+  }
+  return 0;
+}
+
+//Withdraws a route. The leaves of the prefix are restored from the longest
+//shorter prefix covering it, found in the RIB, and the chunks that are no
+//longer needed are released. Returns -1 if the route doesn't exist.
+int sail_l_delete(__uint128_t key, int prefix_len) {
+  int nexthop, cover_len;
+
+  if (!rib_delete(&sail_l.rib, key, prefix_len))
+    return -1;
+  if (sail_l.packed.mem)
+    sail_unpack(&sail_l.packed);
+  if (prefix_len == 0) {
+    sail_l.def_nh = 0;
+    return 0;
+  }
+  key &= ~(__uint128_t)0 << (128 - prefix_len);
+  nexthop = rib_parent(&sail_l.rib, key, prefix_len, &cover_len);
+  return _sail_l_delete(&sail_l, key, prefix_len, nexthop, cover_len);
+}
+
+//Number of levels (16, 24, ..., 128)
+#define NUM_LEVELS 15
+
+struct sail_l_build {
+  __uint128_t *prefixes;
+  uint8_t *pre_lens;
+  uint8_t *pre_nhs;
+  uint64_t cnt;
+  struct fragment frags[MAX_FRAGS];
+  //Each fragment is built as a separate SAIL-L
+  struct sail_l tries[MAX_FRAGS];
+  //Number of chunks in each level of each fragment
+  uint32_t chunks[MAX_FRAGS][NUM_LEVELS];
+  //Where the chunks of a fragment go in the merged SAIL-L
+  uint32_t chunk_off[MAX_FRAGS][NUM_LEVELS + 1];
+  //Filled while the fragments are built
+  struct rib rib;
+  int err;
+};
+
+static int frag_insert(void *trie, __uint128_t key, int prefix_len, int nexthop, int level)
+{
+  return _sail_l_insert((struct sail_l *)trie, key, prefix_len, nexthop, level);
+}
+
+static void build_fragment(int f, void *arg)
+{
+  struct sail_l_build *b = (struct sail_l_build *) arg;
+  struct sail_l *t = &b->tries[f];
+  struct sail_level *l;
+  uint32_t longer[NUM_LENS];
+  int k;
+
+  fragment_longer(&b->frags[f], b->pre_lens, longer);
+  if (_sail_l_init(t, longer) ||
+      insert_fragment(&b->frags[f], b->prefixes, b->pre_lens, b->pre_nhs, frag_insert, t)) {
+    b->err = -1;
+    return;
+  }
+
+  for (l = &t->level16, k = 0; l; l = l->chield, k++) {
+    sail_level_commit(l);
+    b->chunks[f][k] = l->count;
+  }
+}
+
+static void build_rib(struct sail_l_build *b)
+{
+  if (rib_init(&b->rib, 2 * b->cnt)) {
+    b->err = -1;
+    return;
+  }
+  for (uint64_t i = 0; i < b->cnt; i++) {
+    if (rib_insert(&b->rib, b->prefixes[i], b->pre_lens[i], b->pre_nhs[i])) {
+      b->err = -1;
+      return;
+    }
+  }
+}
+
+//Task 0 fills the RIB while the other tasks build the fragments
+static void build_task(int task, void *arg)
+{
+  struct sail_l_build *b = (struct sail_l_build *) arg;
+
+  if (task)
+    build_fragment(task - 1, arg);
+  else
+    build_rib(b);
+}
+
+static void merge_fragment(int f, void *arg)
+{
+  struct sail_l_build *b = (struct sail_l_build *) arg;
+
+  sail_level_merge(&sail_l.level16, &b->tries[f].level16, b->frags[f].root_lo, b->frags[f].root_hi, b->chunk_off[f]);
+  _sail_l_cleanup(&b->tries[f]);
+}
+
+static void cleanup_fragment(int f, void *arg)
+{
+  struct sail_l_build *b = (struct sail_l_build *) arg;
+
+  _sail_l_cleanup(&b->tries[f]);
+}
+
+//Builds SAIL-L from scratch using nthreads threads (see cptrie_build()).
+//This replaces sail_l_init(); it needs to be cleaned up with sail_l_cleanup().
+int sail_l_build(__uint128_t *prefixes, uint8_t *pre_lens, uint8_t *pre_nhs, uint64_t cnt, int nthreads)
+{
+  struct sail_l_build *b;
+  struct sail_level *l;
+  uint32_t chunks;
+  int num_frags, f, k;
+  int err = 0;
+
+  b = (struct sail_l_build *) calloc (1, sizeof(struct sail_l_build));
+  if (!b)
+    return -1;
+  b->prefixes = prefixes;
+  b->pre_lens = pre_lens;
+  b->pre_nhs = pre_nhs;
+  b->cnt = cnt;
+
+  num_frags = partition_fib(prefixes, pre_lens, cnt, num_fragments(nthreads), b->frags);
+  if (num_frags < 0) {
+    free(b);
+    return -1;
+  }
+
+  run_tasks(nthreads, num_frags + 1, build_task, b);
+  if (b->err) {
+    puts("Failed to build SAIL-L fragments");
+    err = -1;
+    goto cleanup_frags;
+  }
+
+  //Prefix sum of the chunk counts of the fragments
+  for (k = 0; k < NUM_LEVELS; k++) {
+    chunks = 0;
+    for (f = 0; f < num_frags; f++) {
+      b->chunk_off[f][k] = chunks;
+      chunks += b->chunks[f][k];
+    }
+  }
+
+  err = _sail_l_init(&sail_l, NULL);
+  if (err)
+    goto cleanup_frags;
+  sail_l.def_nh = find_default_route(pre_lens, pre_nhs, cnt);
+
+  for (l = sail_l.level16.chield, k = 1; l; l = l->chield, k++) {
+    l->count = b->chunk_off[num_frags - 1][k] + b->chunks[num_frags - 1][k];
+    if (l->count > l->size / l->cnk_size) {
+      printf("Cannot insert a new chunk in level %d. Please increase the array size\n", l->level_num);
+      err = -1;
+    }
+  }
+  if (err) {
+    _sail_l_cleanup(&sail_l);
+    goto cleanup_frags;
+  }
+
+  sail_l.rib = b->rib;
+  run_tasks(nthreads, num_frags, merge_fragment, b);
+  for (l = &sail_l.level16; l; l = l->chield)
+    sail_level_sync(l);
+  free_partition(b->frags, num_frags);
+  free(b);
+  return 0;
+
+cleanup_frags:
+  rib_cleanup(&b->rib);
+  run_tasks(nthreads, num_frags, cleanup_fragment, b);
+  free_partition(b->frags, num_frags);
+  free(b);
+  return err;
+}
+
+//Makes the packed lookup image of the committed SAIL-L, see struct
+//sail_packed. It's read by sail_l_lookup_packed() until the next update.
+int sail_l_pack() {
+  sail_unpack(&sail_l.packed);
+  return sail_pack(&sail_l.packed, &sail_l.level16, sail_l.def_nh, 1);
+}
+
+//Writes the packed image to a file
+int sail_l_save(FILE *fp) {
+  return sail_packed_save(&sail_l.packed, 1, fp);
+}
+
+//Reads a packed image written by sail_l_save(), which is then read by
+//sail_l_lookup_packed() until the next update
+int sail_l_load(FILE *fp) {
+  return sail_packed_load(&sail_l.packed, 1, fp);
+}
+
+//Memory of the packed image in MB
+double calc_sail_l_packed_mem() {
+  return (double)sail_l.packed.size / (1024 * 1024);
+}
+
+//Resident memory of the lookup arrays of the levels in MB. The resident
+//memory of the update-only arrays is stored in ctrl.
+double calc_sail_l_resident(double *ctrl) {
+  double mem = 0;
+
+  *ctrl = 0;
+  for (struct sail_level *l = &sail_l.level16; l; l = l->chield)
+    mem += sail_level_resident(l, ctrl);
+  *ctrl /= 1024 * 1024;
+  return mem / (1024 * 1024);
+}
+
+uint8_t sail_l_lookup_packed(__uint128_t key) {
+  register struct sail_packed *p = &sail_l.packed;
+  register uint32_t idx, e;
+  register int k;
+
+  /*extract 16 bits from MSB*/
+  idx = key >> 112;
+
+#pragma GCC unroll 16
+  for (k = 0; k < SAIL_LEVELS - 1; k++) {
+    e = p->E[k][idx];
+    if (e & SAIL_PACKED_NH)
+      return e & 0XFF;
+    if (!e)
+      return p->def_nh;
+    idx = (e - 1) * CNK_8 + ((key >> (104 - 8 * k)) & 0XFF);
+  }
+  if (p->N[idx] != 0)
+    return p->N[idx];
+  return p->def_nh;
+}
+
 uint8_t sail_l_lookup(__uint128_t key) {
   register uint32_t idx;
   register uint8_t nh = sail_l.def_nh;
@@ -410,6 +795,233 @@ uint8_t sail_l_lookup(__uint128_t key) {
   return nh;
 }
 
+//Keys looked up together by one AVX2 vector in sail_l_lookup_batch()
+#define LANES 8
+
+//Key in each lane after load_keys()
+static const int key_of_lane[LANES] = {0, 2, 4, 6, 1, 3, 5, 7};
+
+//Transposes LANES keys into the 32-bit words W[0] (LSBs) to W[3] (MSBs). The
+//unpacks work within 128-bit halves, so the keys end up in the lanes in the
+//order of key_of_lane.
+__attribute__((target("avx2")))
+static __inline__ void load_keys(const __uint128_t *keys, __m256i *W)
+{
+  __m256i a0 = _mm256_loadu_si256((const __m256i *)&keys[0]);
+  __m256i a1 = _mm256_loadu_si256((const __m256i *)&keys[2]);
+  __m256i a2 = _mm256_loadu_si256((const __m256i *)&keys[4]);
+  __m256i a3 = _mm256_loadu_si256((const __m256i *)&keys[6]);
+  __m256i t0 = _mm256_unpacklo_epi32(a0, a1);
+  __m256i t1 = _mm256_unpackhi_epi32(a0, a1);
+  __m256i t2 = _mm256_unpacklo_epi32(a2, a3);
+  __m256i t3 = _mm256_unpackhi_epi32(a2, a3);
+
+  W[0] = _mm256_unpacklo_epi64(t0, t2);
+  W[1] = _mm256_unpackhi_epi64(t0, t2);
+  W[2] = _mm256_unpacklo_epi64(t1, t3);
+  W[3] = _mm256_unpackhi_epi64(t1, t3);
+}
+
+//One step of the lookups of a vector of LANES keys. The lanes that find no
+//chunk at level k are done and take the next-hop of the entry, if any. The
+//rest move to their entry in level k + 1. W holds the keys as 32-bit words.
+__attribute__((target("avx2")))
+static __inline__ void batch_step(__m256i *idx, __m256i *active, __m256i *nh, const __m256i *W,
+                                  uint32_t *C, uint8_t *N, int k)
+{
+  const __m256i zero = _mm256_setzero_si256();
+  const __m256i byte = _mm256_set1_epi32(0XFF);
+  //Byte of the key that indexes the chunk in level k + 1
+  const int b = 13 - k;
+  __m256i c, done, n;
+
+  c = _mm256_mask_i32gather_epi32(zero, (const int *)C, *idx, *active, 4);
+  done = _mm256_andnot_si256(_mm256_cmpgt_epi32(c, zero), *active);
+  //N is padded, so the 4-byte gather doesn't read past the last entry
+  n = _mm256_and_si256(_mm256_mask_i32gather_epi32(zero, (const int *)N, *idx, done, 1), byte);
+  done = _mm256_andnot_si256(_mm256_cmpeq_epi32(n, zero), done);
+  *nh = _mm256_blendv_epi8(*nh, n, done);
+  *active = _mm256_cmpgt_epi32(c, zero);
+  *idx = _mm256_add_epi32(_mm256_slli_epi32(_mm256_sub_epi32(c, _mm256_set1_epi32(1)), 8),
+                          _mm256_and_si256(_mm256_srl_epi32(W[b >> 2], _mm_cvtsi32_si128((b & 3) * 8)), byte));
+}
+
+//Looks up cnt keys LANES at a time with AVX2 gathers. The lanes of a vector
+//walk the levels in lockstep and drop out as they find no chunk, so a level
+//costs one gather of C for the lanes still active and one gather of N for
+//the lanes done. width / LANES vectors are interleaved so that their gathers
+//overlap. The next-hops are stored in nhs in the order of the keys.
+__attribute__((target("avx2")))
+static void lookup_batch_avx2(const __uint128_t *keys, uint8_t *nhs, uint64_t cnt, int width)
+{
+  uint32_t *C[SAIL_LEVELS];
+  uint8_t *N[SAIL_LEVELS];
+  __m256i idx[SAIL_L_MAX_VECS], active[SAIL_L_MAX_VECS], nh[SAIL_L_MAX_VECS];
+  //Words of the keys, W[v][w] has word w of each key of vector v
+  __m256i W[SAIL_L_MAX_VECS][4];
+  uint32_t out[LANES];
+  struct sail_level *l;
+  register uint64_t i = 0;
+  register int vecs, v, k, w, any;
+
+  for (l = &sail_l.level16, k = 0; l; l = l->chield, k++) {
+    C[k] = l->C;
+    N[k] = l->N;
+  }
+  vecs = width / LANES;
+  if (vecs < 1)
+    vecs = 1;
+  if (vecs > SAIL_L_MAX_VECS)
+    vecs = SAIL_L_MAX_VECS;
+
+  for (; i + vecs * LANES <= cnt; i += vecs * LANES) {
+    for (v = 0; v < vecs; v++) {
+      load_keys(&keys[i + v * LANES], W[v]);
+      /*extract 16 bits from MSB*/
+      idx[v] = _mm256_srli_epi32(W[v][3], 16);
+      active[v] = _mm256_set1_epi32(-1);
+      nh[v] = _mm256_set1_epi32(sail_l.def_nh);
+    }
+    for (k = 0; k < SAIL_LEVELS - 1; k++) {
+      any = 0;
+      for (v = 0; v < vecs; v++) {
+        if (_mm256_testz_si256(active[v], active[v]))
+          continue;
+        batch_step(&idx[v], &active[v], &nh[v], W[v], C[k], N[k], k);
+        any = 1;
+      }
+      if (!any)
+        break;
+    }
+    for (v = 0; v < vecs; v++) {
+      //The lanes that got to level 128 read its N
+      if (k == SAIL_LEVELS - 1 && !_mm256_testz_si256(active[v], active[v])) {
+        __m256i n = _mm256_and_si256(_mm256_mask_i32gather_epi32(_mm256_setzero_si256(), (const int *)N[k], idx[v], active[v], 1),
+                                     _mm256_set1_epi32(0XFF));
+        active[v] = _mm256_andnot_si256(_mm256_cmpeq_epi32(n, _mm256_setzero_si256()), active[v]);
+        nh[v] = _mm256_blendv_epi8(nh[v], n, active[v]);
+      }
+      _mm256_storeu_si256((__m256i *)out, nh[v]);
+      for (w = 0; w < LANES; w++)
+        nhs[i + v * LANES + key_of_lane[w]] = out[w];
+    }
+  }
+  for (; i < cnt; i++)
+    nhs[i] = sail_l_lookup(keys[i]);
+}
+
+//Batched lookup with AVX2 gathers, see lookup_batch_avx2(). Falls back to
+//the scalar lookup if the CPU doesn't have AVX2.
+void sail_l_lookup_batch(const __uint128_t *keys, uint8_t *nhs, uint64_t cnt, int width)
+{
+  if (__builtin_cpu_supports("avx2")) {
+    lookup_batch_avx2(keys, nhs, cnt, width);
+    return;
+  }
+  for (uint64_t i = 0; i < cnt; i++)
+    nhs[i] = sail_l_lookup(keys[i]);
+}
+
+//Same as sail_l_lookup() except that the key is the IPv6 address in network
+//byte order, e.g. the destination address in a packet header. As the chunk
+//size is 2^8, each level reads just one byte of the address.
+uint8_t sail_l_lookup_addr(const uint8_t *addr) {
+  register uint32_t idx;
+  register uint8_t nh = sail_l.def_nh;
+
+  /*extract 16 bits from MSB*/
+  idx = (addr[0] << 8) | addr[1];
+
+  if (sail_l.level16.C[idx] != 0) {
+    idx = (sail_l.level16.C[idx] - 1) * CNK_8 + addr[2];
+    if (sail_l.level24.C[idx] != 0) {
+      idx = (sail_l.level24.C[idx] - 1) * CNK_8 + addr[3];
+      if (sail_l.level32.C[idx] != 0) {
+        idx = (sail_l.level32.C[idx] - 1) * CNK_8 + addr[4];
+        if (sail_l.level40.C[idx] != 0) {
+          idx = (sail_l.level40.C[idx] - 1) * CNK_8 + addr[5];
+          if (sail_l.level48.C[idx] != 0) {
+            idx = (sail_l.level48.C[idx] - 1) * CNK_8 + addr[6];
+            if (sail_l.level56.C[idx] != 0) {
+              idx = (sail_l.level56.C[idx] - 1) * CNK_8 + addr[7];
+              if (sail_l.level64.C[idx] != 0) {
+                idx = (sail_l.level64.C[idx] - 1) * CNK_8 + addr[8];
+                if (sail_l.level72.C[idx] != 0) {
+                  idx = (sail_l.level72.C[idx] - 1) * CNK_8 + addr[9];
+                  if (sail_l.level80.C[idx] != 0) {
+                    idx = (sail_l.level80.C[idx] - 1) * CNK_8 + addr[10];
+                    if (sail_l.level88.C[idx] != 0) {
+                      idx = (sail_l.level88.C[idx] - 1) * CNK_8 + addr[11];
+                      if (sail_l.level96.C[idx] != 0) {
+                        idx = (sail_l.level96.C[idx] - 1) * CNK_8 + addr[12];
+                        if (sail_l.level104.C[idx] != 0) {
+                          idx = (sail_l.level104.C[idx] - 1) * CNK_8 + addr[13];
+                          if (sail_l.level112.C[idx] != 0) {
+                            idx = (sail_l.level112.C[idx] - 1) * CNK_8 + addr[14];
+                            if (sail_l.level120.C[idx] != 0) {
+                              idx = (sail_l.level120.C[idx] - 1) * CNK_8 + addr[15];
+                              if (sail_l.level128.N[idx] != 0)
+                                return sail_l.level128.N[idx];
+                            } else {
+                              if (sail_l.level120.N[idx] != 0)
+                                return sail_l.level120.N[idx];
+                            }
+
+                          } else {
+                            if (sail_l.level112.N[idx] != 0)
+                              return sail_l.level112.N[idx];
+                          }
+                        } else {
+                          if (sail_l.level104.N[idx] != 0)
+                            return sail_l.level104.N[idx];
+                        }
+                      } else {
+                        if (sail_l.level96.N[idx] != 0)
+                          return sail_l.level96.N[idx];
+                      }
+                    } else {
+                      if (sail_l.level88.N[idx] != 0)
+                        return sail_l.level88.N[idx];
+                    }
+                  } else {
+                    if (sail_l.level80.N[idx] != 0)
+                      return sail_l.level80.N[idx];
+                  }
+                } else {
+                  if (sail_l.level72.N[idx] != 0)
+                    return sail_l.level72.N[idx];
+                }
+              } else {
+                if (sail_l.level64.N[idx] != 0)
+                  return sail_l.level64.N[idx];
+              }
+            } else {
+              if (sail_l.level56.N[idx] != 0)
+                return sail_l.level56.N[idx];
+            }
+          } else {
+            if (sail_l.level48.N[idx] != 0)
+              return sail_l.level48.N[idx];
+          }
+        } else {
+          if (sail_l.level40.N[idx] != 0)
+            return sail_l.level40.N[idx];
+        }
+      } else {
+        if (sail_l.level32.N[idx] != 0)
+          return sail_l.level32.N[idx];
+      }
+    } else {
+      if (sail_l.level24.N[idx] != 0)
+        return sail_l.level24.N[idx];
+    }
+  } else {
+    if (sail_l.level16.N[idx] != 0)
+      return sail_l.level16.N[idx];
+  }
+  return nh;
+}
+
 //This is same as FIB lookup, except it returns matched prefix length instead
 //of next-hop index
 uint8_t sail_l_matched_prefix_len(__uint128_t key) {
@@ -25,11 +25,25 @@
 #include <stdint.h>
 #include <string.h>
 
+//Maximum number of AVX2 vectors of 8 keys interleaved by sail_l_lookup_batch()
+#define SAIL_L_MAX_VECS 8
+
 int sail_l_init();
+void sail_l_commit();
 int sail_l_cleanup();
 double calc_sail_l_mem();
 int sail_l_insert(__uint128_t ip, int prefix_len, int nexthop);
+int sail_l_delete(__uint128_t ip, int prefix_len);
+int sail_l_build(__uint128_t *prefixes, uint8_t *pre_lens, uint8_t *pre_nhs, uint64_t cnt, int nthreads);
 uint8_t sail_l_lookup(__uint128_t key);
+uint8_t sail_l_lookup_addr(const uint8_t *addr);
+void sail_l_lookup_batch(const __uint128_t *keys, uint8_t *nhs, uint64_t cnt, int width);
+int sail_l_pack();
+double calc_sail_l_packed_mem();
+int sail_l_save(FILE *fp);
+int sail_l_load(FILE *fp);
+double calc_sail_l_resident(double *ctrl);
+uint8_t sail_l_lookup_packed(__uint128_t key);
 uint8_t sail_l_matched_prefix_len(__uint128_t key);
 
 
@@ -0,0 +1,212 @@
+/*
+ *   Copyright (c) 2019-2021 MD Iftakharul Islam (Tamim) <tamim@csebuet.org>
+ *
+ *   This program is free software; you can redistribute it and/or modify
+ *   it under the terms of the GNU General Public License as published by
+ *   the Free Software Foundation; either version 3 of the License, or
+ *   (at your option) any later version.
+ *
+ *   This program is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *   GNU General Public License for more details.
+ *
+ *   You should have received a copy of the GNU General Public License
+ *   along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+#include "sail_m_ip6.h"
+#include "level_sail.h"
+
+//SAIL_M of the SAIL paper, i.e. several FIBs sharing a single SAIL. The
+//levels are those of SAIL-L. The chunks are built on the overlay of the
+//FIBs, so an entry either points to a chunk for all the FIBs or holds a
+//next-hop for each of them. Pivot pushing is done at every level: when an
+//entry gets a chunk for one FIB, the leaves of all the FIBs are pushed into
+//it. A lookup walks the shared chunk IDs and reads the next-hop of its FIB
+//at the end.
+
+/*chunk size is 2^8*/
+#define CNK_8 256
+
+//The overlay has more chunks than a single FIB. These may need to be
+//increased for a larger number of FIBs.
+static const uint32_t sail_m_chunks[SAIL_LEVELS] = {65536/CNK_8, 400, 28000, 36000, 56000, 2800, 2800,
+                                                    2000, 2000, 2000, 2000, 2000, 2000, 2000, 2000};
+
+struct sail_m {
+  int fibs;
+  uint8_t def_nh[SAIL_M_MAX_FIBS];
+  //Level 16 + 8 * k
+  struct sail_level L[SAIL_LEVELS];
+};
+
+struct sail_m sail_m;
+
+//forward declaration
+static int _sail_m_insert(struct sail_m *t, int fib, __uint128_t key, int prefix_len, int nexthop, int level);
+
+int sail_m_init (int fibs) {
+  int k, err = 0;
+
+  memset(&sail_m, 0, sizeof(sail_m));
+  if (fibs < 1 || fibs > SAIL_M_MAX_FIBS) {
+    printf("SAIL-M supports 1 to %d FIBs\n", SAIL_M_MAX_FIBS);
+    return -1;
+  }
+  sail_m.fibs = fibs;
+  for (k = 0; k < SAIL_LEVELS; k++)
+    err |= sail_level_init_multi (&sail_m.L[k], 16 + 8 * k, sail_m_chunks[k], CNK_8, k ? &sail_m.L[k - 1] : NULL, fibs);
+  //level 16 is always populated
+  sail_m.L[0].count = sail_m_chunks[0];
+  return err;
+}
+
+//Makes the routes inserted since sail_m_init() visible to the lookups, see
+//sail_l_commit()
+void sail_m_commit() {
+  for (int k = 0; k < SAIL_LEVELS; k++)
+    sail_level_commit (&sail_m.L[k]);
+}
+
+int sail_m_cleanup() {
+  for (int k = 0; k < SAIL_LEVELS; k++)
+    sail_level_cleanup (&sail_m.L[k]);
+  memset(&sail_m, 0, sizeof(sail_m));
+  return 0;
+}
+
+//Calculate memory in MB
+double calc_sail_m_mem() {
+  double mem = 0;
+
+  for (int k = 0; k < SAIL_LEVELS; k++)
+    mem += mem_size (&sail_m.L[k]);
+  return mem / (1024 * 1024);
+}
+
+static int insert_leaf(struct sail_m *t, struct sail_level *c, int fib, uint32_t idx, int level,
+                       __uint128_t key, int prefix_len, int nexthop)
+{
+  //Level pushing prefixes
+  __uint128_t lp_prefixes[256];
+  register int lp_count = 0;
+  /*Number of leafs need to be inserted for this prefix*/
+  register uint32_t num_leafs;
+  register uint64_t n;
+  register __uint128_t matching_key;
+  int i;
+
+  //level pushing
+  num_leafs = 1U << (c->level_num - level);
+  for (i = 0; i < num_leafs; i++) {
+    n = (uint64_t)(idx + i) * c->width + fib;
+    //The prefix should be pushed to upper level
+    if (sail_level_ckid(c, idx + i)) {
+      lp_prefixes[lp_count++] = ((key >> (128 - c->level_num)) + i) << (128 - c->level_num);
+    } else {
+      /*Longer prefix exists*/
+      if (c->P[n] > prefix_len)
+        continue;
+      c->N[n] = nexthop;
+      c->P[n] = prefix_len;
+    }
+  }
+
+  //Leaf pushing
+  if (c->chield) {
+    for (i = 0; i < lp_count; i++) {
+      matching_key = ((lp_prefixes[i] >> (128 - c->chield->level_num)) + (0 << 7)) << (128 - c->chield->level_num);
+      _sail_m_insert (t, fib, matching_key, prefix_len, nexthop, c->level_num + 1);
+      matching_key = ((lp_prefixes[i] >> (128 - c->chield->level_num)) + (1 << 7)) << (128 - c->chield->level_num);
+      _sail_m_insert (t, fib, matching_key, prefix_len, nexthop, c->level_num + 1);
+    }
+  }
+  return 0;
+}
+
+//Pivot pushing. The entry is about to get a chunk, so the leaves of all the
+//FIBs in it are pushed to the next level.
+static void pivot_pushing(struct sail_m *t, struct sail_level *c, uint32_t idx, __uint128_t key) {
+  register uint8_t next_hop, prefix_len;
+  register uint64_t n;
+  register __uint128_t matching_key;
+
+  if (!c->chield)
+    return;
+  //Key to which the match was found and add 8 bits to the right
+  matching_key = (key >> (128 - c->level_num)) << 8;
+  for (int fib = 0; fib < t->fibs; fib++) {
+    n = (uint64_t)idx * c->width + fib;
+    if (!c->N[n])
+      continue;
+    next_hop = c->N[n];
+    prefix_len = c->P[n];
+    //Set the entry to 0
+    c->N[n] = 0;
+    c->P[n] = 0;
+    _sail_m_insert (t, fib, (matching_key + (0 << 7)) << (120 - c->level_num), prefix_len, next_hop, c->level_num + 1);
+    _sail_m_insert (t, fib, (matching_key + (1 << 7)) << (120 - c->level_num), prefix_len, next_hop, c->level_num + 1);
+  }
+}
+
+int sail_m_insert(int fib, __uint128_t key, int prefix_len, int nexthop) {
+  //nexthop cannot be 0. We use 0 to indicate that next-hop doesn't exist.
+  if (!nexthop) {
+    puts ("nexthop cannot be 0. Please fix the routing table");
+    exit (1);
+  }
+  if (fib < 0 || fib >= sail_m.fibs) {
+    puts ("Invalid FIB");
+    return -1;
+  }
+  //level is same as prefix len
+  return _sail_m_insert(&sail_m, fib, key, prefix_len, nexthop, prefix_len);
+}
+
+//Same as _sail_l_insert() with the levels walked in a loop. When called
+//recursively for pushing, level is higher than the prefix length.
+static int _sail_m_insert(struct sail_m *t, int fib, __uint128_t key, int prefix_len, int nexthop, int level) {
+  register struct sail_level *c = &t->L[0];
+  register uint32_t chunk_id;
+  //Index to N and C array at each level
+  register uint32_t idx;
+
+  if (prefix_len == 0) {
+    t->def_nh[fib] = nexthop;
+    return 0;
+  }
+
+  /*Eextract 16 bits from MSB.*/
+  idx = key >> 112;
+  for (;;) {
+    if (level <= c->level_num || !c->chield)
+      return insert_leaf(t, c, fib, idx, level, key, prefix_len, nexthop);
+    pivot_pushing(t, c, idx, key);
+    chunk_id = get_chunk_id_frm_parent (c, idx);
+    if (!chunk_id)
+      return -1;
+    idx = (chunk_id - 1) * CNK_8 + ((key >> (120 - c->level_num)) & 0XFF);
+    c = c->chield;
+  }
+}
+
+uint8_t sail_m_lookup(int fib, __uint128_t key) {
+  register struct sail_level *L = sail_m.L;
+  register uint32_t idx, chunk_id;
+  register uint8_t nh;
+  register int k;
+
+  /*extract 16 bits from MSB*/
+  idx = key >> 112;
+
+#pragma GCC unroll 16
+  for (k = 0; k < SAIL_LEVELS - 1; k++) {
+    chunk_id = L[k].C[idx];
+    if (!chunk_id)
+      break;
+    idx = (chunk_id - 1) * CNK_8 + ((key >> (104 - 8 * k)) & 0XFF);
+  }
+  nh = L[k].N[(uint64_t)idx * sail_m.fibs + fib];
+  return nh ? nh : sail_m.def_nh[fib];
+}
@@ -0,0 +1,39 @@
+/*
+ *   Copyright (c) 2019-2021 MD Iftakharul Islam (Tamim) <tamim@csebuet.org>
+ *
+ *   This program is free software; you can redistribute it and/or modify
+ *   it under the terms of the GNU General Public License as published by
+ *   the Free Software Foundation; either version 3 of the License, or
+ *   (at your option) any later version.
+ *
+ *   This program is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *   GNU General Public License for more details.
+ *
+ *   You should have received a copy of the GNU General Public License
+ *   along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+#ifndef SAIL_M_IP6_H_
+#define SAIL_M_IP6_H_
+
+#include <math.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <time.h>
+#include <stdint.h>
+#include <string.h>
+
+//Maximum number of FIBs sharing a SAIL-M, e.g. one for each virtual router
+#define SAIL_M_MAX_FIBS 16
+
+int sail_m_init(int fibs);
+void sail_m_commit();
+int sail_m_cleanup();
+double calc_sail_m_mem();
+int sail_m_insert(int fib, __uint128_t ip, int prefix_len, int nexthop);
+uint8_t sail_m_lookup(int fib, __uint128_t key);
+
+
+#endif /* SAIL_M_IP6_H_ */
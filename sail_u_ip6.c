@@ -17,6 +17,8 @@
  */
 #include "sail_u_ip6.h"
 #include "level_sail.h"
+#include "parallel_build.h"
+#include "rib.h"
 
 /*chunk size is 2^8*/
 #define CNK_8 256
@@ -43,57 +45,91 @@
 struct sail_u {
   uint8_t def_nh;
   struct sail_level level16, level24, level32, level40, level48, level56, level64, level72, level80, level88, level96, level104, level112, level120, level128; 
+  //Lookup image made by sail_u_pack(), dropped by any update
+  struct sail_packed packed;
+  //Announced routes, needed to restore the covering prefix on a withdrawal.
+  //Not counted in the memory consumption as the lookups never touch it.
+  struct rib rib;
 };
 
 struct sail_u sail_u;
 
-int sail_u_init () {
+//forward declaration
+static int _sail_u_insert(struct sail_u *t, __uint128_t key, int prefix_len, int nexthop, int level);
+
+//A fragment of a parallel build sizes its levels from longer, see
+//fragment_longer(). It's NULL for a full size SAIL-U.
+static int _sail_u_init (struct sail_u *t, const uint32_t *longer) {
   int err = 0;
 
-  memset(&sail_u, 0, sizeof(sail_u));
-  err = sail_level_init (&sail_u.level16, 16, CNK16, CNK_8, NULL);
-  err = sail_level_init (&sail_u.level24, 24, CNK24, CNK_8, &sail_u.level16);
-  err = sail_level_init (&sail_u.level32, 32, CNK32, CNK_8, &sail_u.level24);
-  err = sail_level_init (&sail_u.level40, 40, CNK40, CNK_8, &sail_u.level32);
-  err = sail_level_init (&sail_u.level48, 48, CNK48, CNK_8, &sail_u.level40);
-  err = sail_level_init (&sail_u.level56, 56, CNK56, CNK_8, &sail_u.level48);
-  err = sail_level_init (&sail_u.level64, 64, CNK64, CNK_8, &sail_u.level56);
-  err = sail_level_init (&sail_u.level72, 72, CNK72, CNK_8, &sail_u.level64);
-  err = sail_level_init (&sail_u.level80, 80, CNK80, CNK_8, &sail_u.level72);
-  err = sail_level_init (&sail_u.level88, 88, CNK88, CNK_8, &sail_u.level80);
-  err = sail_level_init (&sail_u.level96, 96, CNK96, CNK_8, &sail_u.level88);
-  err = sail_level_init (&sail_u.level104, 104, CNK104, CNK_8, &sail_u.level96);
-  err = sail_level_init (&sail_u.level112, 112, CNK112, CNK_8, &sail_u.level104);
-  err = sail_level_init (&sail_u.level120, 120, CNK120, CNK_8, &sail_u.level112);
-  err = sail_level_init (&sail_u.level128, 128, CNK128, CNK_8, &sail_u.level120);
+  memset(t, 0, sizeof(*t));
+  err = sail_level_init (&t->level16, 16, CNK16, CNK_8, NULL);
+  err = sail_level_init (&t->level24, 24, fragment_size(longer, 16, CNK24), CNK_8, &t->level16);
+  err = sail_level_init (&t->level32, 32, fragment_size(longer, 24, CNK32), CNK_8, &t->level24);
+  err = sail_level_init (&t->level40, 40, fragment_size(longer, 32, CNK40), CNK_8, &t->level32);
+  err = sail_level_init (&t->level48, 48, fragment_size(longer, 40, CNK48), CNK_8, &t->level40);
+  err = sail_level_init (&t->level56, 56, fragment_size(longer, 48, CNK56), CNK_8, &t->level48);
+  err = sail_level_init (&t->level64, 64, fragment_size(longer, 56, CNK64), CNK_8, &t->level56);
+  err = sail_level_init (&t->level72, 72, fragment_size(longer, 64, CNK72), CNK_8, &t->level64);
+  err = sail_level_init (&t->level80, 80, fragment_size(longer, 72, CNK80), CNK_8, &t->level72);
+  err = sail_level_init (&t->level88, 88, fragment_size(longer, 80, CNK88), CNK_8, &t->level80);
+  err = sail_level_init (&t->level96, 96, fragment_size(longer, 88, CNK96), CNK_8, &t->level88);
+  err = sail_level_init (&t->level104, 104, fragment_size(longer, 96, CNK104), CNK_8, &t->level96);
+  err = sail_level_init (&t->level112, 112, fragment_size(longer, 104, CNK112), CNK_8, &t->level104);
+  err = sail_level_init (&t->level120, 120, fragment_size(longer, 112, CNK120), CNK_8, &t->level112);
+  err = sail_level_init (&t->level128, 128, fragment_size(longer, 120, CNK128), CNK_8, &t->level120);
   //level 16 is always populated
-  sail_u.level16.count = CNK16;
+  t->level16.count = CNK16;
 
   return err;
 }
 
-int sail_u_cleanup() {
+static int _sail_u_cleanup (struct sail_u *t) {
   int err = 0;
 
-  sail_level_cleanup (&sail_u.level16);
-  sail_level_cleanup (&sail_u.level24);
-  sail_level_cleanup (&sail_u.level32);
-  sail_level_cleanup (&sail_u.level40);
-  sail_level_cleanup (&sail_u.level48);
-  sail_level_cleanup (&sail_u.level56);
-  sail_level_cleanup (&sail_u.level64);
-  sail_level_cleanup (&sail_u.level72);
-  sail_level_cleanup (&sail_u.level80);
-  sail_level_cleanup (&sail_u.level88);
-  sail_level_cleanup (&sail_u.level96);
-  sail_level_cleanup (&sail_u.level104);
-  sail_level_cleanup (&sail_u.level112);
-  sail_level_cleanup (&sail_u.level120);
-  sail_level_cleanup (&sail_u.level128);
-  memset(&sail_u, 0, sizeof(sail_u));
+  sail_level_cleanup (&t->level16);
+  sail_level_cleanup (&t->level24);
+  sail_level_cleanup (&t->level32);
+  sail_level_cleanup (&t->level40);
+  sail_level_cleanup (&t->level48);
+  sail_level_cleanup (&t->level56);
+  sail_level_cleanup (&t->level64);
+  sail_level_cleanup (&t->level72);
+  sail_level_cleanup (&t->level80);
+  sail_level_cleanup (&t->level88);
+  sail_level_cleanup (&t->level96);
+  sail_level_cleanup (&t->level104);
+  sail_level_cleanup (&t->level112);
+  sail_level_cleanup (&t->level120);
+  sail_level_cleanup (&t->level128);
+  sail_unpack (&t->packed);
+  rib_cleanup (&t->rib);
+  memset(t, 0, sizeof(*t));
   return err;
 }
 
+//Initial size of the RIB, it grows as needed
+#define RIB_SIZE 65536
+
+int sail_u_init () {
+  if (_sail_u_init (&sail_u, NULL) || rib_init (&sail_u.rib, RIB_SIZE))
+    return -1;
+  return 0;
+}
+
+//Makes the routes inserted since sail_u_init() visible to the lookups. The
+//chunk IDs of the levels aren't maintained until then, so loading a FIB
+//doesn't shift them on each new chunk. After the commit, a new chunk is
+//appended to its level, see sail_level_commit().
+void sail_u_commit() {
+  for (struct sail_level *l = &sail_u.level16; l; l = l->chield)
+    sail_level_commit (l);
+}
+
+int sail_u_cleanup() {
+  return _sail_u_cleanup (&sail_u);
+}
+
 //Calculate memory in MB
 double calc_sail_u_mem() {
   return (mem_size (&sail_u.level16) + mem_size (&sail_u.level24) + mem_size (&sail_u.level32) + mem_size (&sail_u.level40) + mem_size (&sail_u.level48) +
@@ -101,17 +137,17 @@ double calc_sail_u_mem() {
          mem_size (&sail_u.level96) + mem_size (&sail_u.level104) + mem_size (&sail_u.level112) + mem_size (&sail_u.level120) + mem_size (&sail_u.level128)) / (1024*1024);
 }
 
-static int insert_leaf(struct sail_level *c, uint32_t idx, int prefix_len, int nexthop)
+static int insert_leaf(struct sail_level *c, uint32_t idx, int level, int prefix_len, int nexthop)
 {
   register uint32_t num_leafs;/*Number of leafs need to be inserted for this prefix*/
 
-  if (prefix_len > c->level_num || (c->parent != NULL && prefix_len <= c->parent->level_num )) {
+  if (level > c->level_num || (c->parent != NULL && level <= c->parent->level_num )) {
     puts ("Invalid level");
     return -1;
   }
 
   //level pushing
-  num_leafs = 1U << (c->level_num - prefix_len);
+  num_leafs = 1U << (c->level_num - level);
   for (int i = 0; i < num_leafs; i++) {
     /*Longer prefix exists*/
     if (c->P[idx + i] > prefix_len)
@@ -123,123 +159,166 @@ static int insert_leaf(struct sail_level *c, uint32_t idx, int prefix_len, int n
 }
 
 int sail_u_insert(__uint128_t key, int prefix_len, int nexthop) {
-  register uint32_t chunk_id = 0;
-  register uint32_t idx;
-  register int err = 0;
-  
   //nexthop cannot be 0. We use 0 to indicate that next-hop doesn't exist.
   if (!nexthop) {
     puts ("nexthop cannot be 0. Please fix the routing table");
     exit (1);
   }
+  if (sail_u.packed.mem)
+    sail_unpack(&sail_u.packed);
+  //level is same as prefix len
+  if (_sail_u_insert(&sail_u, key, prefix_len, nexthop, prefix_len))
+    return -1;
+  if (rib_insert(&sail_u.rib, key, prefix_len, nexthop)) {
+    puts ("Failed to add the route to the RIB");
+    return -1;
+  }
+  return 0;
+}
+
+//When called by sail_u_insert(), level and prefix length are the same. While
+//building the FIB in parallel, a prefix shorter than 16 may be inserted one
+//root at a time, i.e. at level 16 with its original prefix length.
+static int _sail_u_insert(struct sail_u *t, __uint128_t key, int prefix_len, int nexthop, int level) {
+  register uint32_t chunk_id = 0;
+  register uint32_t idx;
+  register int err = 0;
 
   if (prefix_len == 0) {
-    sail_u.def_nh = nexthop;
+    t->def_nh = nexthop;
     goto finish;
   }
 
   /*Eextract 16 bits from MSB.*/
   idx = key >> 112;
-  if (prefix_len <= 16) {
-    insert_leaf(&sail_u.level16, idx, prefix_len, nexthop);
+  if (level <= 16) {
+    insert_leaf(&t->level16, idx, level, prefix_len, nexthop);
     goto finish;
   }
   
-  chunk_id = get_chunk_id_frm_parent (&sail_u.level16, idx);
+  chunk_id = get_chunk_id_frm_parent (&t->level16, idx);
+  if (!chunk_id)
+    return -1;
   idx = (chunk_id - 1) * CNK_8 + ((key >> 104) & 0XFF);
-  if (prefix_len <= 24) {
-    insert_leaf(&sail_u.level24, idx, prefix_len, nexthop);
+  if (level <= 24) {
+    insert_leaf(&t->level24, idx, level, prefix_len, nexthop);
     goto finish;
   }
   
-  chunk_id = get_chunk_id_frm_parent (&sail_u.level24, idx);        
+  chunk_id = get_chunk_id_frm_parent (&t->level24, idx);        
+  if (!chunk_id)
+    return -1;
   idx = (chunk_id - 1) * CNK_8 + ((key >> 96) & 0XFF);
-  if (prefix_len <= 32) {
-    insert_leaf(&sail_u.level32, idx, prefix_len, nexthop);
+  if (level <= 32) {
+    insert_leaf(&t->level32, idx, level, prefix_len, nexthop);
     goto finish;
   }
   
-  chunk_id = get_chunk_id_frm_parent (&sail_u.level32, idx);
+  chunk_id = get_chunk_id_frm_parent (&t->level32, idx);
+  if (!chunk_id)
+    return -1;
   idx = (chunk_id - 1) * CNK_8 + ((key >> 88) & 0XFF);
-  if (prefix_len <= 40) {
-    insert_leaf(&sail_u.level40, idx, prefix_len, nexthop);
+  if (level <= 40) {
+    insert_leaf(&t->level40, idx, level, prefix_len, nexthop);
     goto finish;
   }
   
-  chunk_id = get_chunk_id_frm_parent (&sail_u.level40, idx);
+  chunk_id = get_chunk_id_frm_parent (&t->level40, idx);
+  if (!chunk_id)
+    return -1;
   idx = (chunk_id - 1) * CNK_8 + ((key >> 80) & 0XFF);
-  if (prefix_len <= 48) {
-    insert_leaf(&sail_u.level48, idx, prefix_len, nexthop);
+  if (level <= 48) {
+    insert_leaf(&t->level48, idx, level, prefix_len, nexthop);
     goto finish;
   }
   
-  chunk_id = get_chunk_id_frm_parent (&sail_u.level48, idx);
+  chunk_id = get_chunk_id_frm_parent (&t->level48, idx);
+  if (!chunk_id)
+    return -1;
   idx = (chunk_id - 1) * CNK_8 + ((key >> 72) & 0XFF);
-  if (prefix_len <= 56) {
-    insert_leaf(&sail_u.level56, idx, prefix_len, nexthop);
+  if (level <= 56) {
+    insert_leaf(&t->level56, idx, level, prefix_len, nexthop);
     goto finish;
   }
   
-  chunk_id = get_chunk_id_frm_parent (&sail_u.level56, idx);
+  chunk_id = get_chunk_id_frm_parent (&t->level56, idx);
+  if (!chunk_id)
+    return -1;
   idx = (chunk_id - 1) * CNK_8 + ((key >> 64) & 0XFF);
-  if (prefix_len <= 64) {
-    insert_leaf(&sail_u.level64, idx, prefix_len, nexthop);
+  if (level <= 64) {
+    insert_leaf(&t->level64, idx, level, prefix_len, nexthop);
     goto finish;
   }
   
-  chunk_id = get_chunk_id_frm_parent (&sail_u.level64, idx);
+  chunk_id = get_chunk_id_frm_parent (&t->level64, idx);
+  if (!chunk_id)
+    return -1;
   idx = (chunk_id - 1) * CNK_8 + ((key >> 56) & 0XFF);
-  if (prefix_len <= 72) {
-    insert_leaf(&sail_u.level72, idx, prefix_len, nexthop);
+  if (level <= 72) {
+    insert_leaf(&t->level72, idx, level, prefix_len, nexthop);
     goto finish;
   }
   
-  chunk_id = get_chunk_id_frm_parent (&sail_u.level72, idx);
+  chunk_id = get_chunk_id_frm_parent (&t->level72, idx);
+  if (!chunk_id)
+    return -1;
   idx = (chunk_id - 1) * CNK_8 + ((key >> 48) & 0XFF);
-  if (prefix_len <= 80) {
-    insert_leaf(&sail_u.level80, idx, prefix_len, nexthop);
+  if (level <= 80) {
+    insert_leaf(&t->level80, idx, level, prefix_len, nexthop);
     goto finish;
   }
   
-  chunk_id = get_chunk_id_frm_parent (&sail_u.level80, idx);
+  chunk_id = get_chunk_id_frm_parent (&t->level80, idx);
+  if (!chunk_id)
+    return -1;
   idx = (chunk_id - 1) * CNK_8 + ((key >> 40) & 0XFF);
-  if (prefix_len <= 88) {
-    insert_leaf(&sail_u.level88, idx, prefix_len, nexthop);
+  if (level <= 88) {
+    insert_leaf(&t->level88, idx, level, prefix_len, nexthop);
     goto finish;
   }
   
-  chunk_id = get_chunk_id_frm_parent (&sail_u.level88, idx);
+  chunk_id = get_chunk_id_frm_parent (&t->level88, idx);
+  if (!chunk_id)
+    return -1;
   idx = (chunk_id - 1) * CNK_8 + ((key >> 32) & 0XFF);
-  if (prefix_len <= 96) {
-    insert_leaf(&sail_u.level96, idx, prefix_len, nexthop);
+  if (level <= 96) {
+    insert_leaf(&t->level96, idx, level, prefix_len, nexthop);
     goto finish;
   }
   
-  chunk_id = get_chunk_id_frm_parent (&sail_u.level96, idx);
+  chunk_id = get_chunk_id_frm_parent (&t->level96, idx);
+  if (!chunk_id)
+    return -1;
   idx = (chunk_id - 1) * CNK_8 + ((key >> 24) & 0XFF);
-  if (prefix_len <= 104) {
-    insert_leaf(&sail_u.level104, idx, prefix_len, nexthop);
+  if (level <= 104) {
+    insert_leaf(&t->level104, idx, level, prefix_len, nexthop);
     goto finish;
   }
   
-  chunk_id = get_chunk_id_frm_parent (&sail_u.level104, idx);
+  chunk_id = get_chunk_id_frm_parent (&t->level104, idx);
+  if (!chunk_id)
+    return -1;
   idx = (chunk_id - 1) * CNK_8 + ((key >> 16) & 0XFF);
-  if (prefix_len <= 112) {
-    insert_leaf(&sail_u.level112, idx, prefix_len, nexthop);
+  if (level <= 112) {
+    insert_leaf(&t->level112, idx, level, prefix_len, nexthop);
     goto finish;
   }
   
-  chunk_id = get_chunk_id_frm_parent (&sail_u.level112, idx);
+  chunk_id = get_chunk_id_frm_parent (&t->level112, idx);
+  if (!chunk_id)
+    return -1;
   idx = (chunk_id - 1) * CNK_8 + ((key >> 8) & 0XFF);
-  if (prefix_len <= 120) {
-    insert_leaf(&sail_u.level120, idx, prefix_len, nexthop);
+  if (level <= 120) {
+    insert_leaf(&t->level120, idx, level, prefix_len, nexthop);
     goto finish;
   }
   
-  chunk_id = get_chunk_id_frm_parent (&sail_u.level120, idx);
+  chunk_id = get_chunk_id_frm_parent (&t->level120, idx);
+  if (!chunk_id)
+    return -1;
   idx = (chunk_id - 1) * CNK_8 + (key & 0XFF);
-  if (prefix_len <= 128) {
-    insert_leaf(&sail_u.level128, idx, prefix_len, nexthop);
+  if (level <= 128) {
+    insert_leaf(&t->level128, idx, level, prefix_len, nexthop);
     goto finish;
   }
 error:
@@ -250,6 +329,305 @@ finish:
 
 }
 
+//Releases the chunk of entry idx if it's empty, i.e. it has neither a leaf
+//nor a chunk below it. Returns 1 if the chunk was released.
+static int release_empty_chunk(struct sail_level *c, uint32_t idx)
+{
+  register struct sail_level *l = c->chield;
+  register uint32_t chunk_id, first, i;
+
+  chunk_id = sail_level_ckid(c, idx);
+  if (!chunk_id)
+    return 0;
+  first = (chunk_id - 1) * CNK_8;
+  for (i = first; i < first + CNK_8; i++) {
+    if (l->N[i] || sail_level_ckid(l, i))
+      return 0;
+  }
+  return !release_chunk_frm_parent(c, idx);
+}
+
+static int _sail_u_delete(struct sail_u *t, __uint128_t key, int prefix_len, uint8_t nexthop, uint8_t cover_len)
+{
+  register struct sail_level *c = &t->level16;
+  register uint32_t idx, chunk_id, i, num;
+  //Entry at each level on the way to the prefix
+  uint32_t path[SAIL_LEVELS];
+  register int k = 0;
+
+  /*Eextract 16 bits from MSB.*/
+  idx = key >> 112;
+  while (prefix_len > c->level_num) {
+    chunk_id = sail_level_ckid(c, idx);
+    //The prefix was never inserted, e.g. the level was full
+    if (!chunk_id)
+      return 0;
+    path[k++] = idx;
+    c = c->chield;
+    idx = (chunk_id - 1) * CNK_8 + ((key >> (128 - c->level_num)) & 0XFF);
+  }
+
+  //Each level only holds the prefixes pushed to it, so the covering prefix
+  //takes over only if it's in the same level. Otherwise the lookup finds it
+  //on the way.
+  if (c->parent && cover_len <= c->parent->level_num) {
+    nexthop = 0;
+    cover_len = 0;
+  }
+  num = 1U << (c->level_num - prefix_len);
+  for (i = idx; i < idx + num; i++) {
+    //Otherwise a longer prefix exists
+    if (c->P[i] == prefix_len) {
+      c->N[i] = nexthop;
+      c->P[i] = cover_len;
+    }
+  }
+
+  //The chunks on the way may be empty now
+  while (k-- > 0) {
+    c = c->parent;
+    if (!release_empty_chunk(c, path[k]))
+      break;
+  }
+  return 0;
+}
+
+//Withdraws a route. The leaves of the prefix are restored from the longest
+//shorter prefix covering it, found in the RIB, and the chunks left empty are
+//released. Returns -1 if the route doesn't exist.
+int sail_u_delete(__uint128_t key, int prefix_len) {
+  int nexthop, cover_len;
+
+  if (!rib_delete(&sail_u.rib, key, prefix_len))
+    return -1;
+  if (sail_u.packed.mem)
+    sail_unpack(&sail_u.packed);
+  if (prefix_len == 0) {
+    sail_u.def_nh = 0;
+    return 0;
+  }
+  key &= ~(__uint128_t)0 << (128 - prefix_len);
+  nexthop = rib_parent(&sail_u.rib, key, prefix_len, &cover_len);
+  return _sail_u_delete(&sail_u, key, prefix_len, nexthop, cover_len);
+}
+
+//Number of levels (16, 24, ..., 128)
+#define NUM_LEVELS 15
+
+struct sail_u_build {
+  __uint128_t *prefixes;
+  uint8_t *pre_lens;
+  uint8_t *pre_nhs;
+  uint64_t cnt;
+  struct fragment frags[MAX_FRAGS];
+  //Each fragment is built as a separate SAIL-U
+  struct sail_u tries[MAX_FRAGS];
+  //Number of chunks in each level of each fragment
+  uint32_t chunks[MAX_FRAGS][NUM_LEVELS];
+  //Where the chunks of a fragment go in the merged SAIL-U
+  uint32_t chunk_off[MAX_FRAGS][NUM_LEVELS + 1];
+  //Filled while the fragments are built
+  struct rib rib;
+  int err;
+};
+
+static int frag_insert(void *trie, __uint128_t key, int prefix_len, int nexthop, int level)
+{
+  return _sail_u_insert((struct sail_u *)trie, key, prefix_len, nexthop, level);
+}
+
+static void build_fragment(int f, void *arg)
+{
+  struct sail_u_build *b = (struct sail_u_build *) arg;
+  struct sail_u *t = &b->tries[f];
+  struct sail_level *l;
+  uint32_t longer[NUM_LENS];
+  int k;
+
+  fragment_longer(&b->frags[f], b->pre_lens, longer);
+  if (_sail_u_init(t, longer) ||
+      insert_fragment(&b->frags[f], b->prefixes, b->pre_lens, b->pre_nhs, frag_insert, t)) {
+    b->err = -1;
+    return;
+  }
+
+  for (l = &t->level16, k = 0; l; l = l->chield, k++) {
+    sail_level_commit(l);
+    b->chunks[f][k] = l->count;
+  }
+}
+
+static void build_rib(struct sail_u_build *b)
+{
+  if (rib_init(&b->rib, 2 * b->cnt)) {
+    b->err = -1;
+    return;
+  }
+  for (uint64_t i = 0; i < b->cnt; i++) {
+    if (rib_insert(&b->rib, b->prefixes[i], b->pre_lens[i], b->pre_nhs[i])) {
+      b->err = -1;
+      return;
+    }
+  }
+}
+
+//Task 0 fills the RIB while the other tasks build the fragments
+static void build_task(int task, void *arg)
+{
+  struct sail_u_build *b = (struct sail_u_build *) arg;
+
+  if (task)
+    build_fragment(task - 1, arg);
+  else
+    build_rib(b);
+}
+
+static void merge_fragment(int f, void *arg)
+{
+  struct sail_u_build *b = (struct sail_u_build *) arg;
+
+  sail_level_merge(&sail_u.level16, &b->tries[f].level16, b->frags[f].root_lo, b->frags[f].root_hi, b->chunk_off[f]);
+  _sail_u_cleanup(&b->tries[f]);
+}
+
+static void cleanup_fragment(int f, void *arg)
+{
+  struct sail_u_build *b = (struct sail_u_build *) arg;
+
+  _sail_u_cleanup(&b->tries[f]);
+}
+
+//Builds SAIL-U from scratch using nthreads threads (see cptrie_build()).
+//This replaces sail_u_init(); it needs to be cleaned up with sail_u_cleanup().
+int sail_u_build(__uint128_t *prefixes, uint8_t *pre_lens, uint8_t *pre_nhs, uint64_t cnt, int nthreads)
+{
+  struct sail_u_build *b;
+  struct sail_level *l;
+  uint32_t chunks;
+  int num_frags, f, k;
+  int err = 0;
+
+  b = (struct sail_u_build *) calloc (1, sizeof(struct sail_u_build));
+  if (!b)
+    return -1;
+  b->prefixes = prefixes;
+  b->pre_lens = pre_lens;
+  b->pre_nhs = pre_nhs;
+  b->cnt = cnt;
+
+  num_frags = partition_fib(prefixes, pre_lens, cnt, num_fragments(nthreads), b->frags);
+  if (num_frags < 0) {
+    free(b);
+    return -1;
+  }
+
+  run_tasks(nthreads, num_frags + 1, build_task, b);
+  if (b->err) {
+    puts("Failed to build SAIL-U fragments");
+    err = -1;
+    goto cleanup_frags;
+  }
+
+  //Prefix sum of the chunk counts of the fragments
+  for (k = 0; k < NUM_LEVELS; k++) {
+    chunks = 0;
+    for (f = 0; f < num_frags; f++) {
+      b->chunk_off[f][k] = chunks;
+      chunks += b->chunks[f][k];
+    }
+  }
+
+  err = _sail_u_init(&sail_u, NULL);
+  if (err)
+    goto cleanup_frags;
+  sail_u.def_nh = find_default_route(pre_lens, pre_nhs, cnt);
+
+  for (l = sail_u.level16.chield, k = 1; l; l = l->chield, k++) {
+    l->count = b->chunk_off[num_frags - 1][k] + b->chunks[num_frags - 1][k];
+    if (l->count > l->size / l->cnk_size) {
+      printf("Cannot insert a new chunk in level %d. Please increase the array size\n", l->level_num);
+      err = -1;
+    }
+  }
+  if (err) {
+    _sail_u_cleanup(&sail_u);
+    goto cleanup_frags;
+  }
+
+  sail_u.rib = b->rib;
+  run_tasks(nthreads, num_frags, merge_fragment, b);
+  for (l = &sail_u.level16; l; l = l->chield)
+    sail_level_sync(l);
+  free_partition(b->frags, num_frags);
+  free(b);
+  return 0;
+
+cleanup_frags:
+  rib_cleanup(&b->rib);
+  run_tasks(nthreads, num_frags, cleanup_fragment, b);
+  free_partition(b->frags, num_frags);
+  free(b);
+  return err;
+}
+
+//Makes the packed lookup image of the committed SAIL-U, see struct
+//sail_packed. It's read by sail_u_lookup_packed() until the next update.
+int sail_u_pack() {
+  sail_unpack(&sail_u.packed);
+  return sail_pack(&sail_u.packed, &sail_u.level16, sail_u.def_nh, 0);
+}
+
+//Writes the packed image to a file
+int sail_u_save(FILE *fp) {
+  return sail_packed_save(&sail_u.packed, 0, fp);
+}
+
+//Reads a packed image written by sail_u_save(), which is then read by
+//sail_u_lookup_packed() until the next update
+int sail_u_load(FILE *fp) {
+  return sail_packed_load(&sail_u.packed, 0, fp);
+}
+
+//Memory of the packed image in MB
+double calc_sail_u_packed_mem() {
+  return (double)sail_u.packed.size / (1024 * 1024);
+}
+
+//Resident memory of the lookup arrays of the levels in MB. The resident
+//memory of the update-only arrays is stored in ctrl.
+double calc_sail_u_resident(double *ctrl) {
+  double mem = 0;
+
+  *ctrl = 0;
+  for (struct sail_level *l = &sail_u.level16; l; l = l->chield)
+    mem += sail_level_resident(l, ctrl);
+  *ctrl /= 1024 * 1024;
+  return mem / (1024 * 1024);
+}
+
+uint8_t sail_u_lookup_packed(__uint128_t key) {
+  register struct sail_packed *p = &sail_u.packed;
+  register uint32_t idx, e;
+  register uint8_t nh = p->def_nh;
+  register int k;
+
+  /*extract 16 bits from MSB*/
+  idx = key >> 112;
+
+#pragma GCC unroll 16
+  for (k = 0; k < SAIL_LEVELS - 1; k++) {
+    e = p->E[k][idx];
+    if (e >> 24)
+      nh = e >> 24;
+    if (!(e & 0XFFFFFF))
+      return nh;
+    idx = ((e & 0XFFFFFF) - 1) * CNK_8 + ((key >> (104 - 8 * k)) & 0XFF);
+  }
+  if (p->N[idx] != 0)
+    nh = p->N[idx];
+  return nh;
+}
+
 uint8_t sail_u_lookup(__uint128_t key) {
   register uint32_t idx;
   register uint8_t nh = sail_u.def_nh;
@@ -386,6 +764,145 @@ finish:
   return nh;
 }
 
+//Same as sail_u_lookup() except that the key is the IPv6 address in network
+//byte order, e.g. the destination address in a packet header. As the chunk
+//size is 2^8, each level reads just one byte of the address.
+uint8_t sail_u_lookup_addr(const uint8_t *addr) {
+  register uint32_t idx;
+  register uint8_t nh = sail_u.def_nh;
+
+  /*extract 16 bits from MSB*/
+  idx = (addr[0] << 8) | addr[1];
+
+  /*Find corresponding next-hop in level 16*/
+  if (sail_u.level16.N[idx] != 0)
+    nh = sail_u.level16.N[idx];
+
+  /*Check if there is a longer prefix; if yes, extract bit 17~32
+   *  and calculate index to N32
+   */
+  if (sail_u.level16.C[idx] != 0) {
+    idx = (sail_u.level16.C[idx] - 1) * CNK_8 + addr[2];
+  } else {
+    goto finish;
+  }
+
+  if (sail_u.level24.N[idx] != 0)
+    nh = sail_u.level24.N[idx];
+    
+  if (sail_u.level24.C[idx] != 0) {
+    idx = (sail_u.level24.C[idx] - 1) * CNK_8 + addr[3];
+  } else {
+    goto finish;
+  }        
+
+  if (sail_u.level32.N[idx] != 0)
+    nh = sail_u.level32.N[idx];
+
+  if (sail_u.level32.C[idx] != 0) {
+    idx = (sail_u.level32.C[idx] - 1) * CNK_8 + addr[4];
+  } else {
+    goto finish;
+  }
+
+  if (sail_u.level40.N[idx] != 0)
+    nh = sail_u.level40.N[idx];
+
+  if (sail_u.level40.C[idx] != 0) {
+    idx = (sail_u.level40.C[idx] - 1) * CNK_8 + addr[5];
+  } else {
+    goto finish;
+  }
+
+  if (sail_u.level48.N[idx] != 0)
+    nh = sail_u.level48.N[idx];
+
+  if (sail_u.level48.C[idx] != 0) {
+    idx = (sail_u.level48.C[idx] - 1) * CNK_8 + addr[6];
+  } else {
+    goto finish;
+  }
+
+  if (sail_u.level56.N[idx] != 0)
+    nh = sail_u.level56.N[idx];
+
+  if (sail_u.level56.C[idx] != 0) {
+    idx = (sail_u.level56.C[idx] - 1) * CNK_8 + addr[7];
+  } else {
+    goto finish;
+  }
+
+  if (sail_u.level64.N[idx] != 0)
+    nh = sail_u.level64.N[idx];
+
+  if (sail_u.level64.C[idx] != 0)
+    idx = (sail_u.level64.C[idx] - 1) * CNK_8 + addr[8];
+  else
+    goto finish;
+
+  if (sail_u.level72.N[idx] != 0)
+    nh = sail_u.level72.N[idx];
+
+  if (sail_u.level72.C[idx] != 0)
+    idx = (sail_u.level72.C[idx] - 1) * CNK_8 + addr[9];
+  else
+    goto finish;
+
+  if (sail_u.level80.N[idx] != 0)
+    nh = sail_u.level80.N[idx];
+
+  if (sail_u.level80.C[idx] != 0)
+    idx = (sail_u.level80.C[idx] - 1) * CNK_8 + addr[10];
+  else
+    goto finish;
+
+  if (sail_u.level88.N[idx] != 0)
+    nh = sail_u.level88.N[idx];
+
+  if (sail_u.level88.C[idx] != 0)
+    idx = (sail_u.level88.C[idx] - 1) * CNK_8 + addr[11];
+  else
+    goto finish;
+
+  if (sail_u.level96.N[idx] != 0)
+    nh = sail_u.level96.N[idx];
+
+  if (sail_u.level96.C[idx] != 0)
+    idx = (sail_u.level96.C[idx] - 1) * CNK_8 + addr[12];
+  else
+    goto finish;
+
+  if (sail_u.level104.N[idx] != 0)
+    nh = sail_u.level104.N[idx];
+
+  if (sail_u.level104.C[idx] != 0)
+    idx = (sail_u.level104.C[idx] - 1) * CNK_8 + addr[13];
+  else
+    goto finish;
+
+  if (sail_u.level112.N[idx] != 0)
+    nh = sail_u.level112.N[idx];
+
+  if (sail_u.level112.C[idx] != 0)
+    idx = (sail_u.level112.C[idx] - 1) * CNK_8 + addr[14];
+  else
+    goto finish;
+
+  if (sail_u.level120.N[idx] != 0)
+    nh = sail_u.level120.N[idx];
+
+  if (sail_u.level120.C[idx] != 0)
+    idx = (sail_u.level120.C[idx] - 1) * CNK_8 + addr[15];
+  else
+    goto finish;
+
+  if (sail_u.level128.N[idx] != 0)
+    nh = sail_u.level128.N[idx];
+        
+finish:
+  return nh;
+}
+
 //This is same as FIB lookup, except it returns matched prefix length instead
 //of next-hop index
 uint8_t sail_u_matched_prefix_len(__uint128_t key) {
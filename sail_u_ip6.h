@@ -26,10 +26,20 @@
 #include <string.h>
 
 int sail_u_init();
+void sail_u_commit();
 int sail_u_cleanup();
 double calc_sail_u_mem();
 int sail_u_insert(__uint128_t ip, int prefix_len, int nexthop);
+int sail_u_delete(__uint128_t ip, int prefix_len);
+int sail_u_build(__uint128_t *prefixes, uint8_t *pre_lens, uint8_t *pre_nhs, uint64_t cnt, int nthreads);
 uint8_t sail_u_lookup(__uint128_t key);
+uint8_t sail_u_lookup_addr(const uint8_t *addr);
+int sail_u_pack();
+double calc_sail_u_packed_mem();
+int sail_u_save(FILE *fp);
+int sail_u_load(FILE *fp);
+double calc_sail_u_resident(double *ctrl);
+uint8_t sail_u_lookup_packed(__uint128_t key);
 uint8_t sail_u_matched_prefix_len(__uint128_t key) ;
 
 
@@ -16,13 +16,30 @@
  *
  */
 #include "stopwatch.h"
+#include <unistd.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#include <linux/perf_event.h>
 
-struct timespec clock_start, clock_end;
-uint64_t tick_start, tick_end;
-bool is_started = false;
+//The stopwatch is per thread so that each thread of a multi-threaded
+//benchmark can time its own lookups. The clock type and the TSC frequency are
+//shared.
+__thread struct timespec clock_start, clock_end;
+__thread uint64_t tick_start, tick_end;
+__thread bool is_started = false;
 enum clock_type type;
 float ticks_per_ns;
 
+//Hardware events counted by PERF. The first one is the group leader.
+enum {PERF_INSTRUCTIONS = 0, PERF_CACHE_MISSES, PERF_DTLB_MISSES, PERF_BRANCH_MISSES, NUM_PERF_EVENTS};
+//perf_event_open() counts the calling thread, so each thread opens its own group
+__thread bool perf_opened = false;
+__thread int perf_fd[NUM_PERF_EVENTS] = {-1, -1, -1, -1};
+__thread uint64_t perf_id[NUM_PERF_EVENTS];
+//Counter values of the last measurement
+__thread struct perf_counters perf_last;
+__thread bool perf_valid = false;
+
 static __inline__ uint64_t rdtsc()
 {
     unsigned int lo,hi;
@@ -61,11 +78,85 @@ static double diff (struct timespec start, struct timespec end)
   return (double)seconds * (double)1000000000 + (double)ns;
 }
 
+static int open_perf_event(uint32_t ev_type, uint64_t config, int group_fd)
+{
+  struct perf_event_attr attr;
+
+  memset(&attr, 0, sizeof(attr));
+  attr.size = sizeof(attr);
+  attr.type = ev_type;
+  attr.config = config;
+  attr.disabled = group_fd == -1;
+  attr.exclude_kernel = 1;
+  attr.exclude_hv = 1;
+  attr.read_format = PERF_FORMAT_GROUP | PERF_FORMAT_ID | PERF_FORMAT_TOTAL_TIME_ENABLED | PERF_FORMAT_TOTAL_TIME_RUNNING;
+  //Count this thread on any CPU
+  return syscall(__NR_perf_event_open, &attr, 0, -1, group_fd, 0);
+}
+
+//Opens the counter group of the calling thread. If the leader cannot be
+//opened during stopwatch_init(), PERF falls back to TSC. A missing member is
+//just reported as -1.
+static void perf_init(bool verbose)
+{
+  perf_opened = true;
+  perf_fd[PERF_INSTRUCTIONS] = open_perf_event(PERF_TYPE_HARDWARE, PERF_COUNT_HW_INSTRUCTIONS, -1);
+  if (perf_fd[PERF_INSTRUCTIONS] < 0) {
+    if (verbose) {
+      puts ("Hardware counters are not available. Falling back to TSC");
+      type = TSC;
+    }
+    return;
+  }
+  perf_fd[PERF_CACHE_MISSES] = open_perf_event(PERF_TYPE_HARDWARE, PERF_COUNT_HW_CACHE_MISSES, perf_fd[0]);
+  perf_fd[PERF_DTLB_MISSES] = open_perf_event(PERF_TYPE_HW_CACHE, PERF_COUNT_HW_CACHE_DTLB |
+                                              (PERF_COUNT_HW_CACHE_OP_READ << 8) |
+                                              (PERF_COUNT_HW_CACHE_RESULT_MISS << 16), perf_fd[0]);
+  perf_fd[PERF_BRANCH_MISSES] = open_perf_event(PERF_TYPE_HARDWARE, PERF_COUNT_HW_BRANCH_MISSES, perf_fd[0]);
+
+  for (int i = 0; i < NUM_PERF_EVENTS; i++) {
+    if (perf_fd[i] >= 0 && ioctl(perf_fd[i], PERF_EVENT_IOC_ID, &perf_id[i]) < 0) {
+      close(perf_fd[i]);
+      perf_fd[i] = -1;
+    }
+    if (perf_fd[i] < 0 && verbose)
+      printf ("Hardware counter %d is not available\n", i);
+  }
+}
+
+//Reads the group and scales the values if the counters were multiplexed
+static void perf_read()
+{
+  //nr, time_enabled, time_running and a {value, id} pair for each event
+  uint64_t buff[3 + 2 * NUM_PERF_EVENTS];
+  int64_t *val[NUM_PERF_EVENTS] = {&perf_last.instructions, &perf_last.cache_misses,
+                                   &perf_last.dtlb_misses, &perf_last.branch_misses};
+  double scale = 1;
+
+  perf_valid = false;
+  for (int i = 0; i < NUM_PERF_EVENTS; i++)
+    *val[i] = -1;
+  if (read(perf_fd[PERF_INSTRUCTIONS], buff, sizeof(buff)) <= 0)
+    return;
+  if (buff[2] && buff[2] < buff[1])
+    scale = (double)buff[1] / buff[2];
+
+  for (uint64_t k = 0; k < buff[0] && k < NUM_PERF_EVENTS; k++) {
+    for (int i = 0; i < NUM_PERF_EVENTS; i++) {
+      if (perf_fd[i] >= 0 && perf_id[i] == buff[4 + 2 * k])
+        *val[i] = buff[3 + 2 * k] * scale;
+    }
+  }
+  perf_valid = true;
+}
+
 void stopwatch_init(enum clock_type t)
 {
   type = t;
   ticks_per_ns = calc_cpu_frequency();
   printf ("CPU frequency is %f GHz\n", ticks_per_ns);
+  if (type == PERF)
+    perf_init(true);
 }
 
 int stopwatch_start()
@@ -76,11 +167,18 @@ int stopwatch_start()
 
   switch (type) {
     case CLOCK:
-      clock_gettime(CLOCK_PROCESS_CPUTIME_ID, &clock_start);
+      clock_gettime(CLOCK_THREAD_CPUTIME_ID, &clock_start);
       break;
     case TSC:
       tick_start = rdtsc();
       break;
+    case PERF:
+      if (!perf_opened)
+        perf_init(false);
+      ioctl(perf_fd[PERF_INSTRUCTIONS], PERF_EVENT_IOC_RESET, PERF_IOC_FLAG_GROUP);
+      ioctl(perf_fd[PERF_INSTRUCTIONS], PERF_EVENT_IOC_ENABLE, PERF_IOC_FLAG_GROUP);
+      tick_start = rdtsc();
+      break;
   }
 
   is_started = true;
@@ -96,7 +194,7 @@ int stopwatch_stop(double *delay, double *cpu_cycle)
 
   switch (type) {
     case CLOCK:
-      clock_gettime(CLOCK_PROCESS_CPUTIME_ID, &clock_end);
+      clock_gettime(CLOCK_THREAD_CPUTIME_ID, &clock_end);
       *delay = diff(clock_start, clock_end);
       //It does not report CPU cycle
       *cpu_cycle = 0;
@@ -107,8 +205,45 @@ int stopwatch_stop(double *delay, double *cpu_cycle)
       *delay = (tick_end - tick_start) / ticks_per_ns;
       *cpu_cycle = tick_end - tick_start;
       break;
+
+    case PERF:
+      tick_end = rdtsc();
+      ioctl(perf_fd[PERF_INSTRUCTIONS], PERF_EVENT_IOC_DISABLE, PERF_IOC_FLAG_GROUP);
+      *delay = (tick_end - tick_start) / ticks_per_ns;
+      *cpu_cycle = tick_end - tick_start;
+      perf_read();
+      break;
   }
 
   is_started = false;
   return 0;
 }
+
+//Returns the hardware counters of the last measurement. Returns -1 if the
+//clock type is not PERF or the counters could not be read.
+int stopwatch_read_perf(struct perf_counters *pc)
+{
+  if (type != PERF || !perf_valid)
+    return -1;
+  *pc = perf_last;
+  return 0;
+}
+
+//TSC ticks per ns, i.e. TSC frequency in GHz
+double stopwatch_tsc_ghz()
+{
+  return ticks_per_ns;
+}
+
+//Closes the counter group of the calling thread. A thread that used the
+//stopwatch calls it before exiting, otherwise its descriptors stay open.
+void stopwatch_thread_exit()
+{
+  for (int i = 0; i < NUM_PERF_EVENTS; i++) {
+    if (perf_fd[i] >= 0)
+      close(perf_fd[i]);
+    perf_fd[i] = -1;
+  }
+  perf_opened = false;
+  perf_valid = false;
+}
@@ -34,10 +34,45 @@
  *However TSC has smaller than 1ns resolution. This is why we use
  *TSC here.
  */
-enum clock_type {TSC = 0, CLOCK = 1};
+enum clock_type {TSC = 0, CLOCK = 1, PERF = 2};
+
+/*
+ *PERF measures the delay with TSC like above. In addition, it counts a group of
+ *hardware events with perf_event_open() between stopwatch_start() and
+ *stopwatch_stop(). A counter is -1 if the event is not available (e.g. in a VM
+ *or with a restrictive perf_event_paranoid).
+ */
+struct perf_counters {
+  int64_t instructions;
+  int64_t cache_misses;
+  int64_t dtlb_misses;
+  int64_t branch_misses;
+};
 
 void stopwatch_init(enum clock_type t);
 int stopwatch_start();
 int stopwatch_stop(double *delay, double *cpu_cycle);
+int stopwatch_read_perf(struct perf_counters *pc);
+double stopwatch_tsc_ghz();
+void stopwatch_thread_exit();
+
+/*
+ *Timestamps for timing a single lookup. lfence keeps the lookup from starting
+ *before the first rdtsc, and rdtscp waits for the lookup to finish before
+ *reading the TSC. The trailing lfence keeps later instructions out.
+ */
+static __inline__ uint64_t tsc_begin()
+{
+  unsigned int lo, hi;
+  __asm__ __volatile__ ("lfence\n\trdtsc" : "=a" (lo), "=d" (hi) :: "memory");
+  return ((uint64_t)hi << 32) | lo;
+}
+
+static __inline__ uint64_t tsc_end()
+{
+  unsigned int lo, hi;
+  __asm__ __volatile__ ("rdtscp\n\tlfence" : "=a" (lo), "=d" (hi) :: "rcx", "memory");
+  return ((uint64_t)hi << 32) | lo;
+}
 
 #endif /* STOPWATCH_H_ */
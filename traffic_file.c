@@ -0,0 +1,193 @@
+/*
+ *   Copyright (c) 2019-2021 MD Iftakharul Islam (Tamim) <tamim@csebuet.org>
+ *
+ *   This program is free software; you can redistribute it and/or modify
+ *   it under the terms of the GNU General Public License as published by
+ *   the Free Software Foundation; either version 3 of the License, or
+ *   (at your option) any later version.
+ *
+ *   This program is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *   GNU General Public License for more details.
+ *
+ *   You should have received a copy of the GNU General Public License
+ *   along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+#include "traffic_file.h"
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <arpa/inet.h>
+
+//Parses an IPv6 address in a line of text traffic. Returns 1 for an empty
+//line, -1 for an invalid address and 0 otherwise.
+static int parse_line(char *buff, __uint128_t *ip)
+{
+  struct in6_addr v6addr;
+  int i;
+
+  buff[strcspn(buff, "\r\n")] = 0;
+  if (!buff[0])
+    return 1;
+  if (inet_pton(AF_INET6, buff, &v6addr) != 1) {
+    printf ("Invalid IPv6 address %s \n", buff);
+    return -1;
+  }
+  *ip = 0;
+  for (i = 0; i < 16; i++)
+    *ip = (*ip << 8) | v6addr.s6_addr[i];
+  return 0;
+}
+
+//Text traffic has one address per line. The array grows as needed.
+static int read_text(FILE *fp, struct traffic_file *tf)
+{
+  uint64_t size = 1 << 16;
+  char buff[256];
+  __uint128_t ip, *ips;
+  int ret;
+
+  tf->ips = (__uint128_t *) malloc (size * sizeof(__uint128_t));
+  if (!tf->ips) {
+    puts("Failed to allocate memory for traffic");
+    return -1;
+  }
+  while (fgets(buff, sizeof(buff), fp)) {
+    ret = parse_line(buff, &ip);
+    if (ret < 0)
+      return -1;
+    if (ret)
+      continue;
+    if (tf->cnt == size) {
+      size *= 2;
+      ips = (__uint128_t *) realloc (tf->ips, size * sizeof(__uint128_t));
+      if (!ips) {
+        puts("Failed to allocate memory for traffic");
+        return -1;
+      }
+      tf->ips = ips;
+    }
+    tf->ips[tf->cnt++] = ip;
+  }
+  return 0;
+}
+
+//Maps a binary traffic file. The pages are populated up front so that page
+//faults don't show up in the lookup time.
+static int map_binary(int fd, struct traffic_file *tf)
+{
+  struct traffic_header *h;
+  struct stat st;
+
+  if (fstat(fd, &st) || st.st_size < (off_t)sizeof(struct traffic_header)) {
+    puts("Invalid traffic file");
+    return -1;
+  }
+  tf->map_len = st.st_size;
+  tf->map = mmap(NULL, tf->map_len, PROT_READ, MAP_PRIVATE | MAP_POPULATE, fd, 0);
+  if (tf->map == MAP_FAILED) {
+    tf->map = NULL;
+    puts("Failed to map the traffic file");
+    return -1;
+  }
+  h = (struct traffic_header *) tf->map;
+  if (h->version != TRAFFIC_VERSION || h->byte_order != TRAFFIC_BYTE_ORDER) {
+    puts("Unsupported version or byte order of traffic file");
+    return -1;
+  }
+  if (h->cnt > (tf->map_len - sizeof(*h)) / sizeof(__uint128_t)) {
+    puts("Traffic file is truncated");
+    return -1;
+  }
+  tf->ips = (__uint128_t *) (h + 1);
+  tf->cnt = h->cnt;
+  madvise(tf->map, tf->map_len, MADV_SEQUENTIAL);
+  return 0;
+}
+
+//Opens a binary traffic file or, if there is no header, a text one
+int traffic_file_open(const char *file, struct traffic_file *tf)
+{
+  char magic[sizeof(TRAFFIC_MAGIC)] = {0};
+  FILE *fp;
+  int ret;
+
+  memset(tf, 0, sizeof(*tf));
+  if ((fp = fopen(file, "r")) == NULL) {
+    puts("File not exists");
+    return -1;
+  }
+  if (fread(magic, 1, sizeof(magic), fp) == sizeof(magic) && !memcmp(magic, TRAFFIC_MAGIC, sizeof(magic))) {
+    ret = map_binary(fileno(fp), tf);
+  } else {
+    rewind(fp);
+    ret = read_text(fp, tf);
+  }
+  fclose(fp);
+  if (ret)
+    traffic_file_close(tf);
+  return ret;
+}
+
+void traffic_file_close(struct traffic_file *tf)
+{
+  if (tf->map)
+    munmap(tf->map, tf->map_len);
+  else
+    free(tf->ips);
+  memset(tf, 0, sizeof(*tf));
+}
+
+//Converts text traffic to the binary format. The addresses are written as
+//they are parsed and the count is filled in at the end.
+int traffic_file_convert(const char *text_file, const char *bin_file)
+{
+  struct traffic_header h;
+  char buff[256];
+  __uint128_t ip;
+  FILE *in, *out;
+  int ret = 0;
+
+  if ((in = fopen(text_file, "r")) == NULL) {
+    puts("File not exists");
+    return -1;
+  }
+  if ((out = fopen(bin_file, "w")) == NULL) {
+    puts("Failed to create the traffic file");
+    fclose(in);
+    return -1;
+  }
+
+  memset(&h, 0, sizeof(h));
+  memcpy(h.magic, TRAFFIC_MAGIC, sizeof(TRAFFIC_MAGIC));
+  h.version = TRAFFIC_VERSION;
+  h.byte_order = TRAFFIC_BYTE_ORDER;
+  fwrite(&h, sizeof(h), 1, out);
+  while (fgets(buff, sizeof(buff), in)) {
+    ret = parse_line(buff, &ip);
+    if (ret < 0)
+      break;
+    if (ret) {
+      ret = 0;
+      continue;
+    }
+    fwrite(&ip, sizeof(ip), 1, out);
+    h.cnt++;
+  }
+  if (!ret) {
+    rewind(out);
+    fwrite(&h, sizeof(h), 1, out);
+    printf ("Converted %llu addresses from %s to %s\n", (unsigned long long)h.cnt, text_file, bin_file);
+  }
+  if (ferror(out)) {
+    puts("Failed to write the traffic file");
+    ret = -1;
+  }
+  fclose(in);
+  fclose(out);
+  return ret;
+}
@@ -0,0 +1,58 @@
+/*
+ *   Copyright (c) 2019-2021 MD Iftakharul Islam (Tamim) <tamim@csebuet.org>
+ *
+ *   This program is free software; you can redistribute it and/or modify
+ *   it under the terms of the GNU General Public License as published by
+ *   the Free Software Foundation; either version 3 of the License, or
+ *   (at your option) any later version.
+ *
+ *   This program is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *   GNU General Public License for more details.
+ *
+ *   You should have received a copy of the GNU General Public License
+ *   along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+#ifndef TRAFFIC_FILE_H_
+#define TRAFFIC_FILE_H_
+
+#include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+
+/*
+ *Binary traffic file: a 32-byte header followed by the addresses as
+ *__uint128_t in host byte order. The loader maps the file and the lookups
+ *read the addresses straight from the page cache. The header is 32 bytes so
+ *that the addresses stay 16-byte aligned.
+ */
+#define TRAFFIC_MAGIC "IP6TRAF"
+#define TRAFFIC_VERSION 1
+//Written in host byte order. A file from a machine with different byte
+//order is rejected.
+#define TRAFFIC_BYTE_ORDER 0x01020304
+
+struct traffic_header {
+  char magic[8];
+  uint32_t version;
+  uint32_t byte_order;
+  //Number of addresses
+  uint64_t cnt;
+  uint64_t reserved;
+};
+
+struct traffic_file {
+  __uint128_t *ips;
+  uint64_t cnt;
+  //Mapping of a binary file, or NULL if the addresses are parsed from text
+  void *map;
+  size_t map_len;
+};
+
+int traffic_file_open(const char *file, struct traffic_file *tf);
+void traffic_file_close(struct traffic_file *tf);
+int traffic_file_convert(const char *text_file, const char *bin_file);
+
+#endif /* TRAFFIC_FILE_H_ */
@@ -0,0 +1,109 @@
+/*
+ *   Copyright (c) 2019-2021 MD Iftakharul Islam (Tamim) <tamim@csebuet.org>
+ *
+ *   This program is free software; you can redistribute it and/or modify
+ *   it under the terms of the GNU General Public License as published by
+ *   the Free Software Foundation; either version 3 of the License, or
+ *   (at your option) any later version.
+ *
+ *   This program is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *   GNU General Public License for more details.
+ *
+ *   You should have received a copy of the GNU General Public License
+ *   along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+#include "traffic_gen.h"
+#include <math.h>
+
+//xorshift64* from Vigna, "An experimental exploration of Marsaglia's xorshift
+//generators, scrambled". The state must be non-zero.
+static uint64_t xorshift64s(uint64_t *s)
+{
+  uint64_t x = *s;
+  x ^= x >> 12;
+  x ^= x << 25;
+  x ^= x >> 27;
+  *s = x;
+  return x * 0x2545F4914F6CDD1DULL;
+}
+
+//Uniform in [0, 1)
+static double rand_double(uint64_t *s)
+{
+  return (xorshift64s(s) >> 11) * (1.0 / (1ULL << 53));
+}
+
+//A random address under a random prefix of the FIB
+static __uint128_t rand_flow(__uint128_t *prefixes, uint8_t *pre_lens, uint64_t prefix_cnt, uint64_t *s)
+{
+  uint64_t ix = xorshift64s(s) % prefix_cnt;
+  __uint128_t suffix = ((__uint128_t)xorshift64s(s) << 64) | xorshift64s(s);
+
+  //Shifting a __uint128_t by 128 is undefined
+  if (pre_lens[ix] >= 128)
+    return prefixes[ix];
+  return prefixes[ix] | (suffix >> pre_lens[ix]);
+}
+
+//Rank of the flow for a uniform number u, i.e. the first rank whose
+//cumulative probability exceeds u
+static uint64_t zipf_rank(double *cdf, uint64_t n, double u)
+{
+  uint64_t lo = 0, hi = n - 1, mid;
+
+  while (lo < hi) {
+    mid = (lo + hi) / 2;
+    if (cdf[mid] > u)
+      hi = mid;
+    else
+      lo = mid + 1;
+  }
+  return lo;
+}
+
+int gen_zipf_traffic(__uint128_t *ips, uint64_t cnt, __uint128_t *prefixes, uint8_t *pre_lens,
+                     uint64_t prefix_cnt, struct traffic_conf *conf)
+{
+  uint64_t n = conf->working_set;
+  uint64_t s = conf->seed ? conf->seed : 1;
+  //Probability that a train goes on after a packet
+  double cont = conf->burst > 1 ? 1 - 1 / conf->burst : 0;
+  __uint128_t *flows, ip;
+  double *cdf, sum = 0;
+  uint64_t i, k;
+
+  if (!n || !prefix_cnt) {
+    puts("Working set and FIB must not be empty");
+    return -1;
+  }
+  flows = (__uint128_t *) malloc (n * sizeof(__uint128_t));
+  cdf = (double *) malloc (n * sizeof(double));
+  if (!flows || !cdf) {
+    puts("Failed to allocate memory for the working set");
+    free(flows);
+    free(cdf);
+    return -1;
+  }
+
+  for (k = 0; k < n; k++) {
+    flows[k] = rand_flow(prefixes, pre_lens, prefix_cnt, &s);
+    sum += 1 / pow(k + 1, conf->skew);
+    cdf[k] = sum;
+  }
+  for (k = 0; k < n; k++)
+    cdf[k] /= sum;
+
+  for (i = 0; i < cnt;) {
+    ip = flows[zipf_rank(cdf, n, rand_double(&s))];
+    ips[i++] = ip;
+    while (i < cnt && rand_double(&s) < cont)
+      ips[i++] = ip;
+  }
+
+  free(flows);
+  free(cdf);
+  return 0;
+}
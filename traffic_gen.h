@@ -0,0 +1,48 @@
+/*
+ *   Copyright (c) 2019-2021 MD Iftakharul Islam (Tamim) <tamim@csebuet.org>
+ *
+ *   This program is free software; you can redistribute it and/or modify
+ *   it under the terms of the GNU General Public License as published by
+ *   the Free Software Foundation; either version 3 of the License, or
+ *   (at your option) any later version.
+ *
+ *   This program is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *   GNU General Public License for more details.
+ *
+ *   You should have received a copy of the GNU General Public License
+ *   along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+#ifndef TRAFFIC_GEN_H_
+#define TRAFFIC_GEN_H_
+
+#include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+
+/*
+ *Synthetic traffic with skewed flow popularity. A working set of flows is
+ *drawn from the FIB, i.e. each flow is a random address under a random
+ *prefix. Flows are picked with Zipf distributed popularity: the flow of rank
+ *k is picked with probability proportional to 1/k^skew. So skew 0 is uniform
+ *over the working set and a larger skew concentrates the traffic on fewer
+ *flows. Each pick emits a train of packets of the same flow whose length is
+ *geometrically distributed with mean burst.
+ */
+struct traffic_conf {
+  //Zipf exponent
+  double skew;
+  //Number of distinct flows
+  uint64_t working_set;
+  //Mean packet train length, at least 1
+  double burst;
+  //Same seed generates the same traffic
+  uint64_t seed;
+};
+
+int gen_zipf_traffic(__uint128_t *ips, uint64_t cnt, __uint128_t *prefixes, uint8_t *pre_lens,
+                     uint64_t prefix_cnt, struct traffic_conf *conf);
+
+#endif /* TRAFFIC_GEN_H_ */